@@ -0,0 +1,233 @@
+#pragma once
+
+// Scans started from Lua that finish on the scan pool while the game keeps rendering. Only
+// needs the Lua API, so the tests can drive it with a plain frame loop. main.cpp supplies the
+// pattern scan itself, Log, GetPluginState, AbortWriteTransaction and LockPluginState.
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <vector>
+#include <lua.hpp>
+#include "scan_thread_pool.h"
+
+void Log(const std::string& msg);
+lua_State* GetPluginState(lua_State* L);
+void AbortWriteTransaction(lua_State* L);
+// Held while the pump runs a plugin's code, which hook callbacks may otherwise enter
+std::unique_lock<std::recursive_mutex> LockPluginState(lua_State* L);
+ScanThreadPool& GetScanThreadPool();
+
+// LuaJIT resumes with (co, nargs); the Lua 5.4 the tests build against adds from and nresults
+inline int ResumeCoroutine(lua_State* co, int nargs) {
+#if LUA_VERSION_NUM >= 504
+    int results;
+    return lua_resume(co, nullptr, nargs, &results);
+#else
+    return lua_resume(co, nargs);
+#endif
+}
+
+// A scan running on the scan pool. Inside a coroutine the caller yields and is resumed by
+// PumpAsyncScans once the scan is done; from the main chunk it gets a job handle to poll.
+struct AsyncScanJob {
+    std::function<bool(uintptr_t& result, std::atomic<bool>* cancel)> scan;
+    std::atomic<bool> done{ false };
+    std::atomic<bool> cancelled{ false };
+    bool found = false;       // Written by the scan before done is set
+    uintptr_t result = 0;
+    lua_State* owner = nullptr; // Main state holding coroutineRef
+    int coroutineRef = LUA_NOREF;
+    lua_Integer yieldToken = 0; // Handed to the coroutine's wait and checked when it is resumed
+};
+
+typedef std::shared_ptr<AsyncScanJob> AsyncScanJobPtr;
+
+// Coroutines waiting on a scan, resumed from the render thread
+inline std::vector<AsyncScanJobPtr> waitingScans;
+inline std::mutex waitingScansLock;
+inline lua_Integer nextYieldToken = 0;
+
+inline void StartAsyncScan(AsyncScanJobPtr job) {
+    GetScanThreadPool().Submit([job]() {
+        job->found = job->scan(job->result, &job->cancelled);
+        job->done = true;
+    });
+}
+
+// Called once per frame before OnFrame. Each finished scan resumes its coroutine with its
+// token and the address, or nil if nothing matched. A wait the coroutine gave up on, because
+// the plugin resumed it itself, was already dropped and is not resumed again.
+inline void PumpAsyncScans() {
+    std::vector<AsyncScanJobPtr> ready;
+    {
+        std::lock_guard<std::mutex> guard(waitingScansLock);
+        auto finished = std::stable_partition(waitingScans.begin(), waitingScans.end(),
+            [](const AsyncScanJobPtr& job) { return !job->done; });
+        ready.assign(finished, waitingScans.end());
+        waitingScans.erase(finished, waitingScans.end());
+    }
+
+    for (const auto& job : ready) {
+        lua_State* owner = job->owner;
+        auto gate = LockPluginState(owner);
+        lua_rawgeti(owner, LUA_REGISTRYINDEX, job->coroutineRef);
+        luaL_unref(owner, LUA_REGISTRYINDEX, job->coroutineRef);
+        lua_State* co = lua_tothread(owner, -1);
+
+        if (co && lua_status(co) == LUA_YIELD) {
+            lua_pushinteger(co, job->yieldToken);
+            if (job->found) {
+                lua_pushinteger(co, (lua_Integer)job->result);
+            }
+            else {
+                lua_pushnil(co);
+            }
+            int status = ResumeCoroutine(co, 2);
+            if (status != 0 && status != LUA_YIELD) {
+                const char* error = lua_tostring(co, -1);
+                Log("Error in coroutine resumed by async scan: " + std::string(error ? error : "unknown error"));
+                AbortWriteTransaction(owner);
+            }
+        }
+        lua_pop(owner, 1);
+    }
+}
+
+// Drops the waits of a plugin that is being closed; their scans are told to stop
+inline void CancelAsyncScans(lua_State* L) {
+    std::lock_guard<std::mutex> guard(waitingScansLock);
+    for (const auto& job : waitingScans) {
+        if (job->owner == L) job->cancelled = true;
+    }
+    waitingScans.erase(std::remove_if(waitingScans.begin(), waitingScans.end(),
+        [L](const AsyncScanJobPtr& job) { return job->owner == L; }), waitingScans.end());
+}
+
+// Starts job for the Lua caller. In a coroutine the wait is registered and its token returned
+// for the wrapper to yield on; elsewhere a ScanJob handle is returned.
+inline int BeginAsyncScan(lua_State* L, AsyncScanJobPtr job) {
+    bool isMainThread = lua_pushthread(L) == 1;
+    if (!isMainThread) {
+        job->owner = GetPluginState(L);
+        lua_xmove(L, job->owner, 1);
+        job->coroutineRef = luaL_ref(job->owner, LUA_REGISTRYINDEX);
+        {
+            std::lock_guard<std::mutex> guard(waitingScansLock);
+            job->yieldToken = ++nextYieldToken;
+            waitingScans.push_back(job);
+        }
+        StartAsyncScan(job);
+        lua_pushinteger(L, job->yieldToken);
+        return 1;
+    }
+    lua_pop(L, 1);
+
+    new (lua_newuserdata(L, sizeof(AsyncScanJobPtr))) AsyncScanJobPtr(job);
+    luaL_getmetatable(L, "ScanJob");
+    lua_setmetatable(L, -2);
+    StartAsyncScan(job);
+    return 1;
+}
+
+// Called by the wrapper when its coroutine was resumed by something other than the pump
+inline int lua_AbandonAsyncScan(lua_State* L) {
+    lua_Integer token = luaL_checkinteger(L, 1);
+    std::lock_guard<std::mutex> guard(waitingScansLock);
+    for (auto it = waitingScans.begin(); it != waitingScans.end(); ++it) {
+        if ((*it)->yieldToken != token) continue;
+        AsyncScanJobPtr job = *it;
+        job->cancelled = true;
+        waitingScans.erase(it);
+        luaL_unref(job->owner, LUA_REGISTRYINDEX, job->coroutineRef);
+        break;
+    }
+    return 0;
+}
+
+// The yield happens in Lua so the wait can check who resumed it. The pump passes the token
+// back; any other resume gives up the wait and returns nil, "interrupted".
+constexpr const char* asyncScanWrapper =
+    "local begin, abandon, yield = ...\n"
+    "return function(...)\n"
+    "    local token = begin(...)\n"
+    "    if type(token) ~= 'number' then return token end\n"
+    "    local resumedWith, address = yield()\n"
+    "    if resumedWith ~= token then\n"
+    "        abandon(token)\n"
+    "        return nil, 'interrupted'\n"
+    "    end\n"
+    "    return address\n"
+    "end\n";
+
+// Pushes the Lua-facing function for begin, a C function that ends in BeginAsyncScan
+inline void PushAsyncScanFunction(lua_State* L, lua_CFunction begin) {
+    luaL_loadstring(L, asyncScanWrapper);
+    lua_pushcfunction(L, begin);
+    lua_pushcfunction(L, lua_AbandonAsyncScan);
+    lua_getglobal(L, "coroutine");
+    lua_getfield(L, -1, "yield");
+    lua_remove(L, -2);
+    lua_call(L, 3, 1);
+}
+
+inline AsyncScanJobPtr& CheckScanJob(lua_State* L) {
+    return *(AsyncScanJobPtr*)luaL_checkudata(L, 1, "ScanJob");
+}
+
+inline int lua_ScanJob_Done(lua_State* L) {
+    lua_pushboolean(L, CheckScanJob(L)->done);
+    return 1;
+}
+
+// job:Result() -> address or nil once done; nil, "pending" while still running
+inline int lua_ScanJob_Result(lua_State* L) {
+    AsyncScanJobPtr& job = CheckScanJob(L);
+    if (!job->done) {
+        lua_pushnil(L);
+        lua_pushliteral(L, "pending");
+        return 2;
+    }
+    if (job->found && !job->cancelled) {
+        lua_pushinteger(L, (lua_Integer)job->result);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+inline int lua_ScanJob_Cancel(lua_State* L) {
+    CheckScanJob(L)->cancelled = true;
+    return 0;
+}
+
+// The pool task holds its own reference, so collecting the handle never frees a running job
+inline int lua_ScanJob_Gc(lua_State* L) {
+    AsyncScanJobPtr& job = CheckScanJob(L);
+    job->cancelled = true;
+    job.~AsyncScanJobPtr();
+    return 0;
+}
+
+inline void RegisterScanJob(lua_State* L) {
+    luaL_newmetatable(L, "ScanJob");
+
+    lua_pushcfunction(L, lua_ScanJob_Gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_ScanJob_Done);
+    lua_setfield(L, -2, "Done");
+    lua_pushcfunction(L, lua_ScanJob_Result);
+    lua_setfield(L, -2, "Result");
+    lua_pushcfunction(L, lua_ScanJob_Cancel);
+    lua_setfield(L, -2, "Cancel");
+    lua_setfield(L, -2, "__index");
+
+    lua_pop(L, 1);
+}
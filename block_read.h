@@ -0,0 +1,62 @@
+#pragma once
+
+// Block reads behind Memory.ReadBytes and Memory.ReadCString, kept free of Windows headers so
+// they also build on Linux.
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "page_protection.h"
+
+// Supplied by main.cpp, or by the test harness
+extern ProtectionCache protectionCache;
+
+constexpr size_t maxBlockRead = 64 * 1024 * 1024;
+
+// Scratch buffer reused by block reads so repeated calls don't reallocate
+inline thread_local std::vector<uint8_t> readScratch;
+
+// Validates the range against the protection cache and copies it directly, so probing a
+// null or stale pointer costs a map lookup instead of a ReadProcessMemory call
+inline bool ReadBlock(uintptr_t address, void* dest, size_t size) {
+    if (!protectionCache.IsReadable(address, size)) {
+        protectionCache.rejectedReads++;
+        return false;
+    }
+    if (GuardedCopy(dest, (const void*)address, size)) {
+        return true;
+    }
+    // Freed behind our back; forget it so the next read re-queries
+    protectionCache.Invalidate(address, size);
+    return false;
+}
+
+// Reads a NUL-terminated string of at most maxLen characters, one page-bounded chunk at a time.
+// Returns false only if the very first byte is unreadable.
+inline bool ReadCString(uintptr_t address, size_t maxLen, std::string& out) {
+    out.clear();
+    if (readScratch.size() < pageSize) {
+        readScratch.resize(pageSize);
+    }
+
+    while (out.size() < maxLen) {
+        size_t chunk = (size_t)(pageSize - (address & (pageSize - 1)));
+        if (chunk > maxLen - out.size()) {
+            chunk = maxLen - out.size();
+        }
+
+        if (!ReadBlock(address, readScratch.data(), chunk)) {
+            return !out.empty();
+        }
+
+        const uint8_t* end = (const uint8_t*)memchr(readScratch.data(), 0, chunk);
+        if (end) {
+            out.append((const char*)readScratch.data(), end - readScratch.data());
+            return true;
+        }
+
+        out.append((const char*)readScratch.data(), chunk);
+        address += chunk;
+    }
+    return true;
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+// Breakpoint conditions, kept free of Windows headers so the tests can compile and evaluate
+// them on Linux. main.cpp evaluates them in the exception handler, reading memory with
+// GuardedCopy.
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+#include <vector>
+
+// --- Breakpoint Conditions ---
+// A condition such as "ecx == 0x1234 and [esp+4] > 10" is compiled once into postfix ops
+// and evaluated on the hitting thread, so hits that don't match never reach Lua.
+// Values are 32-bit and compared unsigned; [x] reads a dword, byte [x] and word [x] less.
+// Numbers are decimal, or hex with a 0x prefix.
+enum class ConditionOpCode : uint8_t {
+    Constant, Register, Load, Add, Subtract, BitAnd,
+    Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual, And, Or
+};
+
+struct ConditionOp {
+    ConditionOpCode code;
+    uint32_t value;  // Constant, register index or load size
+};
+
+// Register operands index this order: the ProcessorRegisters fields, then EFLAGS
+const char* const conditionRegisterNames[] = { "eax", "ebx", "ecx", "edx", "esi", "edi", "ebp", "esp", "eip", "eflags" };
+constexpr size_t conditionRegisterCount = 10;
+constexpr size_t conditionStackDepth = 16;
+
+struct BreakpointCondition {
+    std::string source;
+    std::vector<ConditionOp> program;  // Empty always matches
+};
+
+class ConditionCompiler {
+public:
+    explicit ConditionCompiler(const std::string& text) : text(text) {}
+
+    bool Compile(std::vector<ConditionOp>& program, std::string& error) {
+        Next();
+        if (token.empty()) {
+            program.clear();
+            return true;
+        }
+        if (!ParseOr() || !Expect("")) {
+            error = this->error;
+            return false;
+        }
+        if (maxDepth > conditionStackDepth) {
+            error = "condition is too deeply nested";
+            return false;
+        }
+        program = std::move(ops);
+        return true;
+    }
+
+private:
+    const std::string& text;
+    size_t pos = 0;
+    std::string token;
+    std::vector<ConditionOp> ops;
+    size_t depth = 0, maxDepth = 0;
+    std::string error;
+
+    void Next() {
+        while (pos < text.size() && isspace((unsigned char)text[pos])) pos++;
+        size_t start = pos;
+        if (pos >= text.size()) {
+            token.clear();
+            return;
+        }
+        if (isalnum((unsigned char)text[pos]) || text[pos] == '_') {
+            while (pos < text.size() && (isalnum((unsigned char)text[pos]) || text[pos] == '_')) pos++;
+        }
+        else {
+            static const char* const pairs[] = { "==", "!=", "<=", ">=", "&&", "||" };
+            pos++;
+            for (const char* pair : pairs) {
+                if (text.compare(start, 2, pair) == 0) {
+                    pos = start + 2;
+                    break;
+                }
+            }
+        }
+        token = text.substr(start, pos - start);
+        std::transform(token.begin(), token.end(), token.begin(), ::tolower);
+    }
+
+    bool Fail(const std::string& message) {
+        if (error.empty()) error = message + (token.empty() ? " at end of condition" : " near '" + token + "'");
+        return false;
+    }
+
+    bool Expect(const char* expected) {
+        if (token != expected) return Fail(*expected ? std::string("expected '") + expected + "'" : "unexpected token");
+        Next();
+        return true;
+    }
+
+    void Emit(ConditionOpCode code, uint32_t value = 0) {
+        ops.push_back({ code, value });
+        // Operands push one value, loads replace one, everything else pops two and pushes one
+        if (code == ConditionOpCode::Constant || code == ConditionOpCode::Register) {
+            maxDepth = std::max(maxDepth, ++depth);
+        }
+        else if (code != ConditionOpCode::Load) {
+            depth--;
+        }
+    }
+
+    bool ParseOr() {
+        if (!ParseAnd()) return false;
+        while (token == "or" || token == "||") {
+            Next();
+            if (!ParseAnd()) return false;
+            Emit(ConditionOpCode::Or);
+        }
+        return true;
+    }
+
+    bool ParseAnd() {
+        if (!ParseComparison()) return false;
+        while (token == "and" || token == "&&") {
+            Next();
+            if (!ParseComparison()) return false;
+            Emit(ConditionOpCode::And);
+        }
+        return true;
+    }
+
+    bool ParseComparison() {
+        static const std::pair<const char*, ConditionOpCode> comparisons[] = {
+            { "==", ConditionOpCode::Equal }, { "!=", ConditionOpCode::NotEqual },
+            { "<", ConditionOpCode::Less }, { "<=", ConditionOpCode::LessEqual },
+            { ">", ConditionOpCode::Greater }, { ">=", ConditionOpCode::GreaterEqual },
+        };
+        if (!ParseSum()) return false;
+        for (const auto& comparison : comparisons) {
+            if (token == comparison.first) {
+                Next();
+                if (!ParseSum()) return false;
+                Emit(comparison.second);
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool ParseSum() {
+        if (!ParseOperand()) return false;
+        while (token == "+" || token == "-" || token == "&") {
+            ConditionOpCode code = token == "+" ? ConditionOpCode::Add :
+                token == "-" ? ConditionOpCode::Subtract : ConditionOpCode::BitAnd;
+            Next();
+            if (!ParseOperand()) return false;
+            Emit(code);
+        }
+        return true;
+    }
+
+    bool ParseOperand() {
+        if (token == "(") {
+            Next();
+            return ParseOr() && Expect(")");
+        }
+        uint32_t size = 4;
+        if (token == "byte" || token == "word" || token == "dword") {
+            size = token == "byte" ? 1 : token == "word" ? 2 : 4;
+            Next();
+            if (token != "[") return Fail("expected '['");
+        }
+        if (token == "[") {
+            Next();
+            if (!ParseSum() || !Expect("]")) return false;
+            Emit(ConditionOpCode::Load, size);
+            return true;
+        }
+        for (uint32_t i = 0; i < conditionRegisterCount; i++) {
+            if (token == conditionRegisterNames[i]) {
+                Next();
+                Emit(ConditionOpCode::Register, i);
+                return true;
+            }
+        }
+        if (!token.empty() && isdigit((unsigned char)token[0])) {
+            // Decimal unless written 0x..., so a leading zero doesn't make a number octal
+            bool hex = token.size() > 2 && token.compare(0, 2, "0x") == 0;
+            if (hex && token.find_first_not_of("0123456789abcdef", 2) != std::string::npos) return Fail("bad number");
+            char* end = nullptr;
+            unsigned long long value = strtoull(token.c_str() + (hex ? 2 : 0), &end, hex ? 16 : 10);
+            if (*end || value > 0xFFFFFFFFull) return Fail("bad number");
+            Next();
+            Emit(ConditionOpCode::Constant, (uint32_t)value);
+            return true;
+        }
+        return Fail("expected a register, number or memory operand");
+    }
+};
+
+// Read(address, dest, size) fetches memory; a failed read makes the condition false
+template<typename Read>
+bool EvaluateCondition(const BreakpointCondition& condition, const uint32_t* registers, Read read) {
+    if (condition.program.empty()) return true;
+    uint32_t stack[conditionStackDepth];
+    size_t top = 0;
+    for (const ConditionOp& op : condition.program) {
+        uint32_t b = 0;
+        switch (op.code) {
+        case ConditionOpCode::Constant: stack[top++] = op.value; continue;
+        case ConditionOpCode::Register: stack[top++] = registers[op.value]; continue;
+        case ConditionOpCode::Load:
+            if (!read((uintptr_t)stack[top - 1], &b, op.value)) return false;
+            stack[top - 1] = b;
+            continue;
+        default:
+            b = stack[--top];
+            break;
+        }
+        uint32_t& a = stack[top - 1];
+        switch (op.code) {
+        case ConditionOpCode::Add: a += b; break;
+        case ConditionOpCode::Subtract: a -= b; break;
+        case ConditionOpCode::BitAnd: a &= b; break;
+        case ConditionOpCode::Equal: a = a == b; break;
+        case ConditionOpCode::NotEqual: a = a != b; break;
+        case ConditionOpCode::Less: a = a < b; break;
+        case ConditionOpCode::LessEqual: a = a <= b; break;
+        case ConditionOpCode::Greater: a = a > b; break;
+        case ConditionOpCode::GreaterEqual: a = a >= b; break;
+        case ConditionOpCode::And: a = a && b; break;
+        case ConditionOpCode::Or: a = a || b; break;
+        default: break;
+        }
+    }
+    return stack[0] != 0;
+}
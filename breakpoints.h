@@ -0,0 +1,304 @@
+#pragma once
+
+// INT3 breakpoints: the stepping logic, the table the exception handler reads and the queue
+// deferred hits wait in, kept free of Windows headers so they also build on Linux. main.cpp
+// drives them from its vectored exception handler; the tests drive them from a SIGTRAP
+// handler.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// --- Breakpoint Dispatch ---
+// A hit puts the original byte back and sets the trap flag, so the original instruction
+// runs once and raises a single-step trap on the same thread, which writes INT3 again.
+// Table lookups, callbacks and code writes go through BreakpointHost so the stepping
+// logic does not depend on the Windows exception machinery.
+constexpr uint32_t trapFlag = 0x100;
+constexpr uint8_t int3Opcode = 0xCC;
+
+// The parts of the interrupted thread's state that dispatch reads and changes
+struct TrapFrame {
+    uintptr_t ip;       // Address of the INT3 on a breakpoint trap
+    uint32_t flags;
+    void* native;       // Platform context, for the host's callback
+};
+
+struct BreakpointHost {
+    virtual bool IsArmed(uintptr_t address, uint8_t& originalByte) = 0;
+    virtual void OnHit(uintptr_t address, TrapFrame& frame) = 0;
+    virtual bool WriteCode(uintptr_t address, uint8_t value) = 0;
+    // Writes INT3 back if address is still armed. The check and the write must not be split
+    // by a removal or disable, or the INT3 returns after the original byte was restored.
+    virtual void Rearm(uintptr_t address) = 0;
+};
+
+// Set while a breakpoint or hook callback runs; hits it causes don't call back again
+inline thread_local bool insideBreakpointCallback = false;
+// Breakpoint the current thread is stepping over, or 0
+inline thread_local uintptr_t rearmAddress = 0;
+
+// Returns false if address is not one of our armed breakpoints
+inline bool DispatchBreakpoint(BreakpointHost& host, uintptr_t address, TrapFrame& frame) {
+    uint8_t originalByte;
+    if (!host.IsArmed(address, originalByte)) return false;
+
+    host.WriteCode(address, originalByte);
+    if (!insideBreakpointCallback) {
+        insideBreakpointCallback = true;
+        host.OnHit(address, frame);
+        insideBreakpointCallback = false;
+    }
+    frame.flags |= trapFlag;
+    rearmAddress = address;
+    return true;
+}
+
+// Returns false if this thread was not stepping over one of our breakpoints
+inline bool DispatchSingleStep(BreakpointHost& host, TrapFrame& frame) {
+    if (!rearmAddress) return false;
+    uintptr_t address = rearmAddress;
+    rearmAddress = 0;
+    frame.flags &= ~trapFlag;
+    host.Rearm(address);
+    return true;
+}
+
+// Any other exception while this thread steps over a breakpoint was raised by the stepped
+// instruction, so no single-step trap follows. The breakpoint is rearmed now and the trap
+// flag dropped, since whatever handles the fault may resume the thread elsewhere.
+inline void DispatchFault(BreakpointHost& host, TrapFrame& frame) {
+    if (!rearmAddress) return;
+    uintptr_t address = rearmAddress;
+    rearmAddress = 0;
+    frame.flags &= ~trapFlag;
+    host.Rearm(address);
+}
+
+// --- Breakpoint Table ---
+// Read from the exception handler on game threads while plugins add and remove breakpoints.
+// A published table is never changed: writers copy it, edit the copy and swap the pointer,
+// so a lookup is one hashed probe without a lock. Replaced tables are freed once no lookup
+// is in flight.
+template<typename Info>
+class BreakpointTable {
+public:
+    BreakpointTable() : current(new Table(16)) {}
+
+    ~BreakpointTable() {
+        for (const Table* table : retired) delete table;
+        delete current.load();
+    }
+
+    // Calls visit(info) with the entry for address while the table is held; false if absent
+    template<typename Visit>
+    bool Lookup(uint32_t address, Visit visit) {
+        readers++;
+        const Table* table = current.load();
+        const Slot* slot = table->Find(address);
+        if (slot) visit(slot->info);
+        readers--;
+        return slot != nullptr;
+    }
+
+    bool Get(uint32_t address, Info& info) {
+        return Lookup(address, [&](const Info& found) { info = found; });
+    }
+
+    bool Contains(uint32_t address) {
+        return Lookup(address, [](const Info&) {});
+    }
+
+    void Set(uint32_t address, const Info& info) {
+        std::lock_guard<std::recursive_mutex> guard(writeLock);
+        const Table* table = current.load();
+        Table* next = Copy(*table, table->count + 1);
+        next->Insert(address, info);
+        Publish(next);
+    }
+
+    bool Erase(uint32_t address) {
+        std::lock_guard<std::recursive_mutex> guard(writeLock);
+        const Table* table = current.load();
+        if (!table->Find(address)) return false;
+        Table* next = new Table(table->slots.size());
+        for (const auto& slot : table->slots) {
+            if (slot.address && slot.address != address) next->Insert(slot.address, slot.info);
+        }
+        Publish(next);
+        removed[removedNext++ % removed.size()] = address;
+        return true;
+    }
+
+    // Runs change() holding the write lock, which Set and Erase may take again inside it.
+    // Code patches that go with an entry change are made in here, so a stepping thread's
+    // rearm sees either the old entry and byte or the new ones.
+    template<typename Change>
+    void Exclusive(Change change) {
+        std::lock_guard<std::recursive_mutex> guard(writeLock);
+        change();
+    }
+
+    // True for the last few erased addresses, so a hit that raced a removal can be told
+    // apart from an INT3 that was never ours
+    bool WasRemoved(uint32_t address) {
+        for (const auto& entry : removed) {
+            if (entry == address) return true;
+        }
+        return false;
+    }
+
+    // Every entry in address order
+    std::vector<std::pair<uint32_t, Info>> Snapshot() {
+        std::vector<std::pair<uint32_t, Info>> entries;
+        std::lock_guard<std::recursive_mutex> guard(writeLock);
+        for (const auto& slot : current.load()->slots) {
+            if (slot.address) entries.push_back({ slot.address, slot.info });
+        }
+        std::sort(entries.begin(), entries.end(),
+            [](const std::pair<uint32_t, Info>& a, const std::pair<uint32_t, Info>& b) { return a.first < b.first; });
+        return entries;
+    }
+
+    void Clear() {
+        std::lock_guard<std::recursive_mutex> guard(writeLock);
+        Publish(new Table(16));
+    }
+
+private:
+    // Address 0 marks an empty slot; nothing can be set there
+    struct Slot {
+        uint32_t address = 0;
+        Info info = {};
+    };
+
+    struct Table {
+        std::vector<Slot> slots;  // Power of two, kept at most half full
+        size_t count = 0;
+
+        explicit Table(size_t capacity) : slots(capacity) {}
+
+        size_t Home(uint32_t address) const {
+            // Fibonacci hashing spreads the low bits that code addresses share
+            return (size_t)((address * 2654435769u) >> 7) & (slots.size() - 1);
+        }
+
+        const Slot* Find(uint32_t address) const {
+            for (size_t i = Home(address); ; i = (i + 1) & (slots.size() - 1)) {
+                if (slots[i].address == address) return &slots[i];
+                if (!slots[i].address) return nullptr;
+            }
+        }
+
+        void Insert(uint32_t address, const Info& info) {
+            size_t i = Home(address);
+            while (slots[i].address && slots[i].address != address) i = (i + 1) & (slots.size() - 1);
+            if (!slots[i].address) count++;
+            slots[i].address = address;
+            slots[i].info = info;
+        }
+    };
+
+    std::atomic<const Table*> current;
+    std::atomic<uint32_t> readers{ 0 };
+    std::recursive_mutex writeLock;
+    std::vector<const Table*> retired;
+    std::array<std::atomic<uint32_t>, 16> removed = {};
+    size_t removedNext = 0;
+
+    static Table* Copy(const Table& table, size_t minCount) {
+        size_t capacity = table.slots.size();
+        while (capacity < minCount * 2) capacity *= 2;
+        Table* next = new Table(capacity);
+        for (const auto& slot : table.slots) {
+            if (slot.address) next->Insert(slot.address, slot.info);
+        }
+        return next;
+    }
+
+    // A lookup that could still see a replaced table counted itself in readers before it
+    // loaded the pointer, so once readers is seen at zero the retired tables are unreachable.
+    // If lookups keep overlapping they are left for the next write.
+    void Publish(const Table* next) {
+        retired.push_back(current.exchange(next));
+        for (int spin = 0; spin < 64; spin++) {
+            if (readers == 0) {
+                for (const Table* table : retired) delete table;
+                retired.clear();
+                return;
+            }
+            std::this_thread::yield();
+        }
+    }
+};
+
+// --- Breakpoint Hit Queue ---
+// Hits of deferred breakpoints, pushed by the exception handler on any number of game threads
+// and popped by the render thread alone. A bounded ring of sequenced cells: pushing never
+// blocks or allocates, and a full queue drops the hit and counts it.
+template<typename Hit, size_t Capacity>
+class BreakpointHitQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+public:
+    BreakpointHitQueue() {
+        for (size_t i = 0; i < Capacity; i++) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    // Lock-free; false if the queue was full
+    bool Push(const Hit& hit) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells[position & (Capacity - 1)];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            intptr_t lag = (intptr_t)sequence - (intptr_t)position;
+            if (lag == 0) {
+                // The cell is free for this position; claim the position
+                if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    cell.hit = hit;
+                    cell.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (lag < 0) {
+                // Still holds a hit from one lap ago
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Consumer thread only; false if nothing is ready
+    bool Pop(Hit& hit) {
+        Cell& cell = cells[head & (Capacity - 1)];
+        if (cell.sequence.load(std::memory_order_acquire) != head + 1) return false;
+        hit = cell.hit;
+        cell.sequence.store(head + Capacity, std::memory_order_release);
+        head++;
+        return true;
+    }
+
+    // Every claimed position is a pushed hit
+    uint64_t Pushed() const { return tail.load(std::memory_order_relaxed); }
+    uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+    size_t Pending() const { return tail.load(std::memory_order_relaxed) - head; }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;  // position + 1 once written, position + capacity once read
+        Hit hit;
+    };
+
+    std::array<Cell, Capacity> cells;
+    alignas(64) std::atomic<size_t> tail{ 0 };
+    alignas(64) size_t head = 0;
+    std::atomic<uint64_t> dropped{ 0 };
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+// Byte patterns and the SSE2 scan over a buffer. Live memory is scanned by main.cpp, which
+// wraps ScanPattern in SEH; this part only needs a buffer, so it also builds on Linux.
+#include <cctype>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include <emmintrin.h>
+
+// Patterns are hex bytes separated by spaces, with ? or ?? for a wildcard: "53 42 ?? 4E"
+struct BytePattern {
+    std::vector<uint8_t> bytes;
+    std::vector<uint8_t> mask;  // 0xFF for bytes that must match, 0 for wildcards
+    size_t anchor = 0;          // Index of the byte the scan looks for first
+};
+
+// Rough frequency of byte values in x86 code and game data; higher means a worse anchor
+inline int ByteCommonness(uint8_t value) {
+    switch (value) {
+    case 0x00: return 10;
+    case 0xFF: return 8;
+    case 0xCC: case 0x8B: return 6;
+    case 0x89: case 0x90: case 0x01: return 5;
+    case 0x04: case 0x08: case 0x0F: case 0x24: case 0x44: case 0x45: case 0x83: case 0xE8: return 3;
+    default: return 0;
+    }
+}
+
+inline bool ParsePattern(const char* text, BytePattern& pattern) {
+    pattern = BytePattern();
+    const char* p = text;
+    while (*p) {
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        if (*p == '?') {
+            p += (p[1] == '?') ? 2 : 1;
+            pattern.bytes.push_back(0);
+            pattern.mask.push_back(0);
+            continue;
+        }
+        if (!isxdigit((unsigned char)p[0]) || !isxdigit((unsigned char)p[1])) {
+            return false;
+        }
+        char hex[3] = { p[0], p[1], 0 };
+        pattern.bytes.push_back((uint8_t)strtoul(hex, nullptr, 16));
+        pattern.mask.push_back(0xFF);
+        p += 2;
+    }
+
+    int best = INT_MAX;
+    for (size_t i = 0; i < pattern.bytes.size(); i++) {
+        if (pattern.mask[i] && ByteCommonness(pattern.bytes[i]) < best) {
+            best = ByteCommonness(pattern.bytes[i]);
+            pattern.anchor = i;
+        }
+    }
+    // An all-wildcard pattern would match everywhere, which is never what a script means
+    return best != INT_MAX;
+}
+
+inline bool MatchPatternAt(const uint8_t* data, const BytePattern& pattern) {
+    size_t size = pattern.bytes.size();
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i diff = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(data + i)),
+            _mm_loadu_si128((const __m128i*)(pattern.bytes.data() + i)));
+        diff = _mm_and_si128(diff, _mm_loadu_si128((const __m128i*)(pattern.mask.data() + i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF) {
+            return false;
+        }
+    }
+    for (; i < size; i++) {
+        if ((data[i] ^ pattern.bytes[i]) & pattern.mask[i]) return false;
+    }
+    return true;
+}
+
+// Offset of the first (or, backward, the last) match fully inside data, or SIZE_MAX.
+// Candidates come from a 16-byte compare against the anchor byte, then get a masked verify.
+inline size_t ScanPattern(const uint8_t* data, size_t size, const BytePattern& pattern, bool backward) {
+    size_t length = pattern.bytes.size();
+    if (length == 0 || size < length) return SIZE_MAX;
+
+    size_t positions = size - length + 1;
+    const uint8_t* anchorData = data + pattern.anchor;
+    uint8_t anchorByte = pattern.bytes[pattern.anchor];
+    __m128i needle = _mm_set1_epi8((char)anchorByte);
+
+    auto blockBits = [&](size_t i) {
+        return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(anchorData + i)), needle));
+    };
+
+    if (!backward) {
+        size_t i = 0;
+        for (; i + 16 <= positions; i += 16) {
+            unsigned bits = blockBits(i);
+            for (unsigned bit = 0; bits; bit++, bits >>= 1) {
+                if ((bits & 1) && MatchPatternAt(data + i + bit, pattern)) return i + bit;
+            }
+        }
+        for (; i < positions; i++) {
+            if (anchorData[i] == anchorByte && MatchPatternAt(data + i, pattern)) return i;
+        }
+        return SIZE_MAX;
+    }
+
+    size_t i = positions;
+    for (; i >= 16; i -= 16) {
+        unsigned bits = blockBits(i - 16);
+        for (int bit = 15; bits && bit >= 0; bit--) {
+            if (((bits >> bit) & 1) && MatchPatternAt(data + i - 16 + bit, pattern)) return i - 16 + bit;
+        }
+    }
+    while (i > 0) {
+        i--;
+        if (anchorData[i] == anchorByte && MatchPatternAt(data + i, pattern)) return i;
+    }
+    return SIZE_MAX;
+}
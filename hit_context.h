@@ -0,0 +1,215 @@
+#pragma once
+
+// Breakpoint and hook callbacks get their hit's registers as a HitContext userdata. Fields
+// are read from the interrupted thread's saved state when accessed and written straight
+// back into it, so changes take effect when the thread resumes. Each plugin reuses one
+// userdata, detached once the callback returns, so a hit allocates nothing.
+// Kept free of Windows headers: main.cpp points a frame at a CONTEXT or a hook's saved
+// registers, the tests at a signal's ucontext.
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <lua.hpp>
+#include "block_read.h"
+#include "breakpoint_condition.h"
+
+// Supplied by main.cpp, or by the test harness
+void Log(const std::string& msg);
+void AbortWriteTransaction(lua_State* L);
+
+struct HitFrame {
+    uint32_t* registers[conditionRegisterCount] = {};  // In conditionRegisterNames order
+    uint32_t readOnly = 0;      // Bit per register whose writes can't reach the thread
+    uint8_t* fxsave = nullptr;  // FXSAVE image holding XMM0-7, if the source saved one
+    uint32_t address = 0;
+    uint32_t threadId = 0;
+    int64_t time = 0;           // steady_clock ticks
+};
+
+constexpr size_t fxsaveXmmOffset = 160;
+constexpr uint32_t allRegistersReadOnly = (1u << conditionRegisterCount) - 1;  // A queued copy
+constexpr int espRegister = 7;
+constexpr int eipRegister = 8;
+constexpr int eflagsRegister = 9;
+
+struct HitContextRef {
+    HitFrame* frame;  // Null outside the callback
+};
+
+inline HitFrame* CheckHitFrame(lua_State* L) {
+    HitContextRef* ref = (HitContextRef*)luaL_checkudata(L, 1, "HitContext");
+    if (!ref->frame) luaL_error(L, "hit context used after its callback returned");
+    return ref->frame;
+}
+
+inline int FindRegister(const char* name) {
+    for (size_t i = 0; i < conditionRegisterCount; i++) {
+        if (strcmp(name, conditionRegisterNames[i]) == 0) return (int)i;
+    }
+    return -1;
+}
+
+// "xmm0" to "xmm7" give 0 to 7, anything else -1
+inline int FindXmmRegister(const char* name) {
+    return strncmp(name, "xmm", 3) == 0 && name[3] >= '0' && name[3] <= '7' && !name[4] ? name[3] - '0' : -1;
+}
+
+inline float* XmmLanes(lua_State* L, HitFrame* frame, int index) {
+    if (!frame->fxsave) luaL_error(L, "XMM registers were not saved for this hit");
+    return (float*)(frame->fxsave + fxsaveXmmOffset + index * 16);
+}
+
+// Registers and xmm0-7 (low lane) by name, plus address, thread and time
+inline int lua_HitContext_Index(lua_State* L) {
+    HitFrame* frame = CheckHitFrame(L);
+    const char* key = luaL_checkstring(L, 2);
+    int index = FindRegister(key);
+    if (index >= 0) {
+        lua_pushinteger(L, *frame->registers[index]);
+        return 1;
+    }
+    index = FindXmmRegister(key);
+    if (index >= 0) {
+        lua_pushnumber(L, XmmLanes(L, frame, index)[0]);
+        return 1;
+    }
+    if (strcmp(key, "address") == 0) {
+        lua_pushinteger(L, frame->address);
+    }
+    else if (strcmp(key, "thread") == 0) {
+        lua_pushinteger(L, frame->threadId);
+    }
+    else if (strcmp(key, "time") == 0) {
+        lua_pushnumber(L, std::chrono::duration<double>(std::chrono::steady_clock::duration(frame->time)).count());
+    }
+    else {
+        lua_getmetatable(L, 1);
+        lua_getfield(L, -1, "methods");
+        lua_pushvalue(L, 2);
+        lua_rawget(L, -2);
+    }
+    return 1;
+}
+
+inline int lua_HitContext_NewIndex(lua_State* L) {
+    HitFrame* frame = CheckHitFrame(L);
+    const char* key = luaL_checkstring(L, 2);
+    int index = FindRegister(key);
+    if (index >= 0) {
+        if (frame->readOnly & (1u << index)) return luaL_error(L, "%s can't be changed for this hit", key);
+        *frame->registers[index] = (uint32_t)luaL_checkinteger(L, 3);
+        return 0;
+    }
+    index = FindXmmRegister(key);
+    if (index < 0) return luaL_error(L, "unknown register '%s'", key);
+    if (frame->readOnly == allRegistersReadOnly) return luaL_error(L, "%s can't be changed for this hit", key);
+    XmmLanes(L, frame, index)[0] = (float)luaL_checknumber(L, 3);
+    return 0;
+}
+
+// ctx:GetXmm(n) returns the four single-precision lanes of XMMn
+inline int lua_HitContext_GetXmm(lua_State* L) {
+    HitFrame* frame = CheckHitFrame(L);
+    int index = (int)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, index >= 0 && index < 8, 2, "XMM register 0-7 expected");
+    const float* lanes = XmmLanes(L, frame, index);
+    for (int i = 0; i < 4; i++) lua_pushnumber(L, lanes[i]);
+    return 4;
+}
+
+// ctx:SetXmm(n, a, b, c, d) sets the lanes given; nil leaves a lane as it is
+inline int lua_HitContext_SetXmm(lua_State* L) {
+    HitFrame* frame = CheckHitFrame(L);
+    int index = (int)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, index >= 0 && index < 8, 2, "XMM register 0-7 expected");
+    if (frame->readOnly == allRegistersReadOnly) return luaL_error(L, "xmm%d can't be changed for this hit", index);
+    float* lanes = XmmLanes(L, frame, index);
+    for (int i = 0; i < 4; i++) {
+        if (!lua_isnoneornil(L, 3 + i)) lanes[i] = (float)luaL_checknumber(L, 3 + i);
+    }
+    return 0;
+}
+
+// ctx:ReadStack(offset, [size]) reads the value at esp + offset, or nil if unreadable
+inline int lua_HitContext_ReadStack(lua_State* L) {
+    HitFrame* frame = CheckHitFrame(L);
+    lua_Integer offset = luaL_checkinteger(L, 2);
+    lua_Integer size = luaL_optinteger(L, 3, 4);
+    luaL_argcheck(L, size == 1 || size == 2 || size == 4, 3, "size must be 1, 2 or 4");
+    uint32_t value = 0;
+    uintptr_t esp = *frame->registers[espRegister];
+    if (ReadBlock(esp + (uintptr_t)offset, &value, (size_t)size)) {
+        lua_pushinteger(L, value);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+inline void RegisterHitContext(lua_State* L) {
+    luaL_newmetatable(L, "HitContext");
+
+    lua_pushcfunction(L, lua_HitContext_Index);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushcfunction(L, lua_HitContext_NewIndex);
+    lua_setfield(L, -2, "__newindex");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_HitContext_GetXmm);
+    lua_setfield(L, -2, "GetXmm");
+    lua_pushcfunction(L, lua_HitContext_SetXmm);
+    lua_setfield(L, -2, "SetXmm");
+    lua_pushcfunction(L, lua_HitContext_ReadStack);
+    lua_setfield(L, -2, "ReadStack");
+    lua_setfield(L, -2, "methods");
+
+    lua_pop(L, 1);
+}
+
+// Pushes the plugin's hit context bound to frame and returns the frame it was bound to
+// before, for UnbindHitContext once the callback returns
+inline HitFrame* BindHitContext(lua_State* L, HitFrame* frame) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "HitContextObject");
+    if (!lua_isuserdata(L, -1)) {
+        lua_pop(L, 1);
+        HitContextRef* created = (HitContextRef*)lua_newuserdata(L, sizeof(HitContextRef));
+        created->frame = nullptr;
+        luaL_getmetatable(L, "HitContext");
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, "HitContextObject");
+    }
+    HitContextRef* ref = (HitContextRef*)lua_touserdata(L, -1);
+    HitFrame* previous = ref->frame;
+    ref->frame = frame;
+    return previous;
+}
+
+inline void UnbindHitContext(lua_State* L, HitFrame* previous) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "HitContextObject");
+    if (HitContextRef* ref = (HitContextRef*)lua_touserdata(L, -1)) ref->frame = previous;
+    lua_pop(L, 1);
+}
+
+// The frame of the callback running in this plugin, or null
+inline HitFrame* CurrentHitFrame(lua_State* L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "HitContextObject");
+    HitContextRef* ref = (HitContextRef*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return ref ? ref->frame : nullptr;
+}
+
+// Calls the function on top of the stack as callback(address, ctx)
+inline void CallHitCallback(lua_State* L, HitFrame& frame, const char* what) {
+    lua_pushinteger(L, (lua_Integer)frame.address);
+    HitFrame* previous = BindHitContext(L, &frame);
+    if (lua_pcall(L, 2, 0, 0) != 0) {
+        Log(std::string("Error in ") + what + " callback: " + lua_tostring(L, -1));
+        lua_pop(L, 1);
+        AbortWriteTransaction(L);
+    }
+    UnbindHitContext(L, previous);
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+// The machine code a detour hook enters through. Only needs the C fixed-width types so the
+// tests can build it freestanding for i386 and run the stub for real.
+#include <stddef.h>
+#include <stdint.h>
+
+// Registers as a hook stub leaves them on the stack: pushad below pushfd
+struct HookContext {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;  // esp is 4 below the hooked code's
+    uint32_t eflags;
+};
+
+constexpr size_t hookStubSize = 45;
+// The jump MinHook writes over the hooked code; nothing else may patch these bytes
+constexpr uint32_t hookPatchSize = 5;
+
+// Writes the stub for hook into out (hookStubSize bytes), which will run from stubAddress.
+// ebp keeps the register block while esp is aligned for fxsave:
+//   pushfd; cld; pushad; mov ebp, esp; and esp, -16; sub esp, 512; fxsave [esp];
+//   push esp; push ebp; push hook; call handler; fxrstor [esp+12]; mov esp, ebp;
+//   popad; popfd; jmp [resumeSlot]
+inline size_t EmitHookStub(uint8_t* out, uintptr_t stubAddress, uintptr_t hook, uintptr_t handler, uintptr_t resumeSlot) {
+    static const uint8_t prologue[] = {
+        0x9C, 0xFC, 0x60, 0x8B, 0xEC, 0x83, 0xE4, 0xF0,
+        0x81, 0xEC, 0x00, 0x02, 0x00, 0x00, 0x0F, 0xAE, 0x04, 0x24,
+        0x54, 0x55,
+    };
+    static const uint8_t epilogue[] = { 0x0F, 0xAE, 0x4C, 0x24, 0x0C, 0x8B, 0xE5, 0x61, 0x9D };
+    size_t n = 0;
+    auto emit = [&](const uint8_t* bytes, size_t size) {
+        for (size_t i = 0; i < size; i++) out[n++] = bytes[i];
+    };
+    auto emit32 = [&](uint32_t value) {
+        for (int i = 0; i < 4; i++) out[n++] = (uint8_t)(value >> (i * 8));
+    };
+    emit(prologue, sizeof(prologue));
+    out[n++] = 0x68; emit32((uint32_t)hook);
+    out[n++] = 0xE8; emit32((uint32_t)(handler - (stubAddress + n + 4)));
+    emit(epilogue, sizeof(epilogue));
+    out[n++] = 0xFF; out[n++] = 0x25; emit32((uint32_t)resumeSlot);
+    return n;
+}
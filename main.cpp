@@ -1,5 +1,6 @@
 ﻿// F1 2012 LUA Loader
 #include <Windows.h>
+#include <TlHelp32.h>
 #include <d3d11.h>
 #include <dxgi.h>
 #include <thread>
@@ -7,6 +8,8 @@
 #include <vector>
 #include <map>
 #include <unordered_map>
+#include <algorithm>
+#include <array>
 #include <wrl/client.h>
 #include <fstream>
 #include <sstream>
@@ -18,7 +21,35 @@
 #include <chrono>
 #include <iomanip>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <new>
+#include <memory>
+#include <type_traits>
+#include <emmintrin.h>
 #include <excpt.h>
+#include "page_protection.h"
+#include "block_read.h"
+#include "memory_view.h"
+#include "pointer_chain.h"
+#include "struct_layout.h"
+#include "hit_context.h"
+#include "scan_thread_pool.h"
+#include "async_scan.h"
+#include "byte_pattern.h"
+#include "multi_pattern.h"
+#include "track_database.h"
+#include "breakpoints.h"
+#include "breakpoint_condition.h"
+#include "hook_stub.h"
+#include "pe_image.h"
+#include "signature_cache.h"
+#include "plugin_arena.h"
+#include "pointer_index.h"
+#include "snapshot_diff.h"
+#include "value_scan.h"
 
 // Handle filesystem based on compiler support
 #if defined(_MSC_VER) && _MSC_VER >= 1914
@@ -73,11 +104,16 @@ struct ProcessorRegisters {
     DWORD eip;  // Added instruction pointer for debugging
 };
 
+struct BreakpointState;
+
 struct BreakpointInfo {
     BYTE originalByte;
     std::string callbackName;
     bool active;
     lua_State* L; // Lua state that owns this breakpoint
+    bool deferred = false; // Hits are queued and delivered at frame time
+    std::shared_ptr<BreakpointState> state; // Condition, sampling and counters
+    std::shared_ptr<PluginGate> gate; // Entered by callbacks that run on the hitting thread
 };
 
 struct HookConfig {
@@ -119,8 +155,6 @@ std::unordered_map<std::string, Plugin> loadedPlugins;
 std::thread monitorThread;
 int currentWidth = 0;
 int currentHeight = 0;
-std::map<DWORD, BreakpointInfo> breakpointInfo;
-bool insideBreakpointHandler = false;
 PVOID vehHandle = nullptr;
 int lua_ProtectMemory(lua_State* L);
 
@@ -142,6 +176,13 @@ string ExecuteLuaScript(const string& scriptPath, lua_State* L);
 int GetVirtualKeyFromName(const string& keyName);
 void SetupLuaKeyboardAPI(lua_State* L);
 void RefreshCurrentPluginStatus();
+lua_State* GetPluginState(lua_State* L);
+void AbortWriteTransaction(lua_State* L);
+bool IsHooked(DWORD address);
+bool IsPluginLive(lua_State* L);
+struct PluginGate;
+void RemovePluginHooks(lua_State* L);
+void RemovePluginBreakpoints(lua_State* L);
 
 // --- Logging ---
 ofstream logFile;
@@ -247,9 +288,48 @@ int GetVirtualKeyFromName(const string& keyName) {
     return 0;
 }
 
+// --- Plugin Gates ---
+// A Lua state may only run on one thread at a time, but hook and breakpoint callbacks come
+// in on game threads. Every entry into a plugin's state holds its gate: the render and
+// monitor threads wait for it, game threads only try it and skip the hit if the plugin is
+// busy. ReleasePluginState waits for inFlight to drain before it closes the state.
+struct PluginGate {
+    std::recursive_mutex lock;
+    std::atomic<int> inFlight{ 0 };
+};
+
+std::unordered_map<lua_State*, std::shared_ptr<PluginGate>> pluginGates;
+std::mutex pluginGatesMutex;
+
+std::shared_ptr<PluginGate> GetPluginGate(lua_State* L) {
+    std::lock_guard<std::mutex> lock(pluginGatesMutex);
+    auto& gate = pluginGates[L];
+    if (!gate) gate = std::make_shared<PluginGate>();
+    return gate;
+}
+
+std::unique_lock<std::recursive_mutex> LockPluginState(lua_State* L) {
+    return std::unique_lock<std::recursive_mutex>(GetPluginGate(L)->lock);
+}
+
+// For callbacks on game threads. Counted in inFlight before trying, so a caller that then
+// finds its hook or breakpoint still in place can't have its state closed under it.
+bool TryEnterPlugin(PluginGate& gate) {
+    gate.inFlight++;
+    if (gate.lock.try_lock()) return true;
+    gate.inFlight--;
+    return false;
+}
+
+void LeavePlugin(PluginGate& gate) {
+    gate.lock.unlock();
+    gate.inFlight--;
+}
+
 // --- Lua Script Execution ---
 string ExecuteLuaScript(const string& scriptPath, lua_State* L) {
     if (!L) return "Lua engine not initialized";
+    auto gate = LockPluginState(L);
 
     int top = lua_gettop(L);
 
@@ -268,6 +348,7 @@ string ExecuteLuaScript(const string& scriptPath, lua_State* L) {
         executionResult = "Error: " + string(lua_tostring(L, -1));
         lua_pop(L, 1);
         Log("Failed to execute Lua: " + scriptPath + " - " + executionResult);
+        AbortWriteTransaction(L);
     }
     else {
         // Check for SCRIPT_RESULT
@@ -326,19 +407,147 @@ int lua_IsKeyPressed(lua_State* L) {
     return 1;
 }
 
+// --- Page Protection Cache ---
+// Copies under SEH so a stale cache entry can't crash the game. Must not hold C++ objects.
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    __try {
+        memcpy(dst, src, size);
+        return true;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+bool GuardedFill(void* dst, BYTE value, size_t size) {
+    __try {
+        memset(dst, value, size);
+        return true;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+bool IsWritableProtect(DWORD protect) {
+    if (protect & (PAGE_GUARD | PAGE_NOACCESS)) return false;
+    return (protect & (PAGE_READWRITE | PAGE_WRITECOPY | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)) != 0;
+}
+
+bool IsReadableProtect(DWORD protect) {
+    if (protect == 0 || (protect & (PAGE_GUARD | PAGE_NOACCESS))) return false;
+    return (protect & PAGE_EXECUTE) == 0;
+}
+
+// Protections as VirtualQuery reports them; reserved and free memory count as protection 0
+struct VirtualQueryRegionSource : RegionSource {
+    bool Query(uintptr_t address, uintptr_t& start, uintptr_t& end, uint32_t& protect) override {
+        MEMORY_BASIC_INFORMATION mbi;
+        if (!VirtualQuery((LPCVOID)address, &mbi, sizeof(mbi))) return false;
+        start = (uintptr_t)mbi.BaseAddress;
+        end = start + mbi.RegionSize;
+        protect = mbi.State == MEM_COMMIT ? mbi.Protect : 0;
+        return true;
+    }
+
+    bool IsReadable(uint32_t protect) const override { return IsReadableProtect(protect); }
+    bool IsWritable(uint32_t protect) const override { return IsWritableProtect(protect); }
+    uint64_t Now() const override { return GetTickCount64(); }
+};
+
+VirtualQueryRegionSource virtualQueryRegionSource;
+ProtectionCache protectionCache(virtualQueryRegionSource);
+
+// Writes size bytes at address, skipping VirtualProtect when the page is already writable
+bool PatchMemory(uintptr_t address, const void* src, size_t size) {
+    if (protectionCache.IsWritable(address, size)) {
+        if (GuardedCopy((void*)address, src, size)) {
+            protectionCache.savedSyscalls += 2;
+            return true;
+        }
+        protectionCache.Invalidate(address, size);
+    }
+
+    DWORD oldProtect;
+    VirtualProtect((LPVOID)address, size, PAGE_EXECUTE_READWRITE, &oldProtect);
+    SIZE_T bytesWritten;
+    bool result = WriteProcessMemory(GetCurrentProcess(), (LPVOID)address, src, size, &bytesWritten);
+    VirtualProtect((LPVOID)address, size, oldProtect, &oldProtect);
+    return result;
+}
+
+// Memory.GetProtectionStats() -> table with cache counters, totals and last frame
+int lua_GetProtectionStats(lua_State* L) {
+    lua_newtable(L);
+
+    lua_pushstring(L, "hits"); lua_pushnumber(L, protectionCache.hits); lua_settable(L, -3);
+    lua_pushstring(L, "misses"); lua_pushnumber(L, protectionCache.misses); lua_settable(L, -3);
+    lua_pushstring(L, "savedSyscalls"); lua_pushnumber(L, protectionCache.savedSyscalls); lua_settable(L, -3);
+    lua_pushstring(L, "rejectedReads"); lua_pushnumber(L, protectionCache.rejectedReads); lua_settable(L, -3);
+    lua_pushstring(L, "frameHits"); lua_pushnumber(L, protectionCache.frameHits); lua_settable(L, -3);
+    lua_pushstring(L, "frameMisses"); lua_pushnumber(L, protectionCache.frameMisses); lua_settable(L, -3);
+    lua_pushstring(L, "frameSavedSyscalls"); lua_pushnumber(L, protectionCache.frameSaved); lua_settable(L, -3);
+    lua_pushstring(L, "regions"); lua_pushnumber(L, (lua_Number)protectionCache.Size()); lua_settable(L, -3);
+    lua_pushstring(L, "negativeRegions"); lua_pushnumber(L, (lua_Number)protectionCache.NegativeEntries()); lua_settable(L, -3);
+
+    return 1;
+}
+
+// --- Block Reads ---
+// ReadBlock and ReadCString are in block_read.h
+
+// Memory.ReadBytes(address, size) -> string with the raw bytes, or nil
+int lua_ReadBytes(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t size = (size_t)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, size <= maxBlockRead, 2, "size too large");
+
+    if (size == 0) {
+        lua_pushliteral(L, "");
+        return 1;
+    }
+
+    if (readScratch.size() < size) {
+        readScratch.resize(size);
+    }
+
+    if (ReadBlock(address, readScratch.data(), size)) {
+        lua_pushlstring(L, (const char*)readScratch.data(), size);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// Memory.ReadCString(address, [maxLen = 256]) -> string up to the first NUL, or nil
+int lua_ReadCString(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t maxLen = (size_t)luaL_optinteger(L, 2, 256);
+    luaL_argcheck(L, maxLen <= maxBlockRead, 2, "length too large");
+
+    string result;
+    if (ReadCString(address, maxLen, result)) {
+        lua_pushlstring(L, result.data(), result.size());
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// Memory.ReadMemory(address, size) - size is 1, 2, 4 or 8
 int lua_ReadMemory(lua_State* L) {
     DWORD64 address = (DWORD64)luaL_checkinteger(L, 1);
     size_t size = luaL_checkinteger(L, 2);
-    vector<BYTE> buffer(size);
-    SIZE_T bytesRead;
+    DWORD64 value = 0;
 
-    if (ReadProcessMemory(GetCurrentProcess(), (LPCVOID)address, buffer.data(), size, &bytesRead)) {
+    if ((size == 1 || size == 2 || size == 4 || size == 8) && ReadBlock((uintptr_t)address, &value, size)) {
         switch (size) {
-        case 1: lua_pushinteger(L, buffer[0]); break;
-        case 2: lua_pushinteger(L, *(WORD*)buffer.data()); break;
-        case 4: lua_pushinteger(L, *(DWORD*)buffer.data()); break;
-        case 8: lua_pushinteger(L, *(DWORD64*)buffer.data()); break;
-        default: lua_pushnil(L); break;
+        case 1: lua_pushinteger(L, (BYTE)value); break;
+        case 2: lua_pushinteger(L, (WORD)value); break;
+        case 4: lua_pushinteger(L, (DWORD)value); break;
+        case 8: lua_pushinteger(L, value); break;
         }
         return 1;
     }
@@ -346,56 +555,1822 @@ int lua_ReadMemory(lua_State* L) {
     return 1;
 }
 
-int lua_WriteMemory(lua_State* L) {
-    DWORD64 address = (DWORD64)luaL_checkinteger(L, 1);
-    DWORD64 value = (DWORD64)luaL_checkinteger(L, 2);
-    size_t size = luaL_checkinteger(L, 3);
-    DWORD oldProtect;
+// --- Module Cache ---
+string ToLower(string text) {
+    for (char& c : text) c = (char)tolower((unsigned char)c);
+    return text;
+}
 
-    VirtualProtect((LPVOID)address, size, PAGE_EXECUTE_READWRITE, &oldProtect);
-    SIZE_T bytesWritten;
-    bool result = WriteProcessMemory(GetCurrentProcess(), (LPVOID)address, &value, size, &bytesWritten);
-    VirtualProtect((LPVOID)address, size, oldProtect, &oldProtect);
+// Link timestamp from the headers of a loaded image, read under SEH in case it was unloaded
+bool ReadImageTimeDateStamp(uintptr_t base, DWORD& stamp) {
+    // The headers of a loaded module always fit in its first page
+    BYTE headers[pageSize];
+    PeHeaders parsed;
+    if (!GuardedCopy(headers, (const void*)base, pageSize) || !ReadPeHeaders(headers, pageSize, parsed)) return false;
+    stamp = parsed.file.timeDateStamp;
+    return true;
+}
 
-    lua_pushboolean(L, result);
+// Bumped by the loader whenever a DLL is loaded or unloaded. The callback runs under the
+// loader lock, so it does nothing else.
+std::atomic<uint32_t> moduleListGeneration{ 0 };
+
+typedef VOID(CALLBACK* LdrDllNotificationFunction)(ULONG reason, const void* data, PVOID context);
+typedef LONG(NTAPI* LdrRegisterDllNotificationFunction)(ULONG flags, LdrDllNotificationFunction callback,
+    PVOID context, PVOID* cookie);
+
+VOID CALLBACK OnDllNotification(ULONG, const void*, PVOID) {
+    moduleListGeneration++;
+}
+
+// Loaded modules by lowercase name. Filled from a Toolhelp snapshot on first use; a name that
+// is not found is looked up with GetModuleHandle, so the list is only touched when it changes.
+// Cached entries are checked against GetModuleHandle and the image timestamp only after the
+// loader reported a load or unload, and replaced when the module went away or came back
+// somewhere else. Without loader notifications every lookup checks its entry.
+class ModuleCache {
+public:
+    ModuleInfo* Find(const string& moduleName) {
+        string key = ToLower(moduleName);
+        if (!enumerated) Enumerate();
+
+        uint32_t generation = moduleListGeneration;
+        if (!notified || generation != checkedGeneration) {
+            checkedGeneration = generation;
+            for (auto it = modules.begin(); it != modules.end();) {
+                it = IsStillLoaded(it->first, it->second) ? std::next(it) : modules.erase(it);
+            }
+        }
+        auto it = modules.find(key);
+        if (it != modules.end()) return &it->second;
+
+        HMODULE handle = GetModuleHandleA(moduleName.c_str());
+        if (!handle) return nullptr;
+        // Loaded since the snapshot, or asked for without its extension
+        ModuleInfo* module = Add((uintptr_t)handle);
+        if (module && module->name != key) {
+            modules[key] = *module;
+            module = &modules[key];
+        }
+        return module;
+    }
+
+    const SectionInfo* FindSection(ModuleInfo& module, const string& sectionName) {
+        for (const auto& section : module.sections) {
+            if (section.name == sectionName) return &section;
+        }
+        return nullptr;
+    }
+
+    bool FindExport(ModuleInfo& module, const string& exportName, uintptr_t& address) {
+        if (!module.exportsParsed) {
+            // Parsed from a copy so pages that vanish or were never readable can't fault the
+            // parser; they read as zeros
+            vector<BYTE> image(module.size);
+            for (size_t offset = 0; offset < module.size; offset += pageSize) {
+                GuardedCopy(image.data() + offset, (const void*)(module.base + offset),
+                    std::min<size_t>(pageSize, module.size - offset));
+            }
+            ParsePeExports(image.data(), image.size(), true, module);
+        }
+        auto it = module.exports.find(exportName);
+        if (it == module.exports.end()) return false;
+        address = it->second;
+        return true;
+    }
+
+    std::mutex lock;
+
+private:
+    std::unordered_map<string, ModuleInfo> modules;
+    bool enumerated = false;
+    bool notified = false;          // Loader notifications registered
+    uint32_t checkedGeneration = 0;
+
+    bool IsStillLoaded(const string& key, const ModuleInfo& module) {
+        HMODULE handle = GetModuleHandleA(key.c_str());
+        DWORD stamp;
+        return handle && (uintptr_t)handle == module.base && ReadImageTimeDateStamp(module.base, stamp) &&
+            stamp == module.timeDateStamp;
+    }
+
+    void Enumerate() {
+        enumerated = true;
+        auto registerNotification = (LdrRegisterDllNotificationFunction)GetProcAddress(
+            GetModuleHandleA("ntdll.dll"), "LdrRegisterDllNotification");
+        PVOID cookie;
+        notified = registerNotification && registerNotification(0, OnDllNotification, nullptr, &cookie) >= 0;
+        // Read before the snapshot, so anything loaded while it is taken gets checked on the
+        // first lookup
+        checkedGeneration = moduleListGeneration;
+        HANDLE snapshot = CreateToolhelp32Snapshot(TH32CS_SNAPMODULE, GetCurrentProcessId());
+        if (snapshot == INVALID_HANDLE_VALUE) return;
+
+        MODULEENTRY32 entry;
+        entry.dwSize = sizeof(entry);
+        for (BOOL more = Module32First(snapshot, &entry); more; more = Module32Next(snapshot, &entry)) {
+            Add((uintptr_t)entry.modBaseAddr);
+        }
+        CloseHandle(snapshot);
+    }
+
+    ModuleInfo* Add(uintptr_t base) {
+        char path[MAX_PATH];
+        if (!GetModuleFileNameA((HMODULE)base, path, MAX_PATH)) return nullptr;
+
+        ModuleInfo module;
+        module.base = base;
+        string fileName = path;
+        module.name = ToLower(fileName.substr(fileName.find_last_of("\\/") + 1));
+        // The headers of a loaded module always fit in its first page
+        BYTE headers[pageSize];
+        if (!GuardedCopy(headers, (const void*)base, pageSize) || !ParsePeSections(headers, pageSize, module)) {
+            return nullptr;
+        }
+
+        ModuleInfo& stored = modules[module.name];
+        stored = std::move(module);
+        return &stored;
+    }
+};
+
+ModuleCache moduleCache;
+
+int lua_GetModuleBase(lua_State* L) {
+    const char* moduleName = luaL_checkstring(L, 1);
+    std::lock_guard<std::mutex> guard(moduleCache.lock);
+    ModuleInfo* module = moduleCache.Find(moduleName);
+    if (module) {
+        lua_pushinteger(L, (lua_Integer)module->base);
+    }
+    else {
+        lua_pushnil(L);
+    }
     return 1;
 }
 
-int lua_AllocateMemory(lua_State* L) {
-    size_t size = luaL_checkinteger(L, 1);
-    void* memory = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_EXECUTE_READWRITE);
-    if (memory) {
-        lua_pushinteger(L, (lua_Integer)memory);
+// Memory.GetSection(module, name) -> start, size, characteristics, or nil
+int lua_GetSection(lua_State* L) {
+    const char* moduleName = luaL_checkstring(L, 1);
+    const char* sectionName = luaL_checkstring(L, 2);
+    std::lock_guard<std::mutex> guard(moduleCache.lock);
+    ModuleInfo* module = moduleCache.Find(moduleName);
+    const SectionInfo* section = module ? moduleCache.FindSection(*module, sectionName) : nullptr;
+    if (!section) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_pushinteger(L, (lua_Integer)section->start);
+    lua_pushinteger(L, (lua_Integer)section->size);
+    lua_pushnumber(L, section->characteristics);
+    return 3;
+}
+
+// Memory.GetExport(module, name) -> address, or nil
+int lua_GetExport(lua_State* L) {
+    const char* moduleName = luaL_checkstring(L, 1);
+    const char* exportName = luaL_checkstring(L, 2);
+    std::lock_guard<std::mutex> guard(moduleCache.lock);
+    ModuleInfo* module = moduleCache.Find(moduleName);
+    uintptr_t address;
+    if (module && moduleCache.FindExport(*module, exportName, address)) {
+        lua_pushinteger(L, (lua_Integer)address);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// --- Scan Thread Pool ---
+// Large scans are split into chunks and run on these workers. Each worker owns a deque and
+// takes from its back; idle workers and the submitting thread steal from the front of others.
+ScanStats scanStats;
+
+// Sized to the machine, leaving one core for the game's render thread. Never destroyed.
+ScanThreadPool& GetScanThreadPool() {
+    static ScanThreadPool* pool = new ScanThreadPool(
+        std::thread::hardware_concurrency() > 2 ? std::thread::hardware_concurrency() - 1 : 1);
+    return *pool;
+}
+
+// --- Pattern Scanning ---
+// Scans live memory under SEH so a region freed mid-scan can't crash the game
+bool GuardedScanPattern(const BYTE* data, size_t size, const BytePattern* pattern, bool backward, size_t* offset) {
+    __try {
+        *offset = ScanPattern(data, size, *pattern, backward);
+        return true;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+// Splits [start, end) into maximal readable runs using the protection cache
+vector<AddressRange> ReadableRuns(uintptr_t start, uintptr_t end) {
+    vector<AddressRange> runs;
+    uintptr_t address = start;
+    while (address < end) {
+        ProtectionRegion region;
+        if (!protectionCache.GetProtection(address, region) || region.end <= address) break;
+        uintptr_t regionEnd = region.end < end ? region.end : end;
+        if (IsReadableProtect(region.protect)) {
+            if (!runs.empty() && runs.back().end == address) {
+                runs.back().end = regionEnd;
+            }
+            else {
+                runs.push_back({ address, regionEnd });
+            }
+        }
+        address = regionEnd;
+    }
+    return runs;
+}
+
+void RecordScan(size_t bytes, std::chrono::steady_clock::time_point started) {
+    scanStats.jobs++;
+    scanStats.bytes += bytes;
+    scanStats.microseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started).count();
+}
+
+// Pool version of FindPatternInRange. Chunks past a chunk that already matched are skipped,
+// since they can no longer hold the first (or, backward, the last) match.
+bool FindPatternParallel(const vector<AddressRange>& runs, const BytePattern& pattern, bool backward, uintptr_t& result,
+    std::atomic<bool>* cancel) {
+    vector<ScanChunk> chunks = SplitScanChunks(runs, pattern.bytes.size() - 1);
+    vector<uintptr_t> found(chunks.size(), 0);
+    vector<char> faulted(chunks.size(), 0);
+    std::atomic<size_t> best{ backward ? 0 : SIZE_MAX };
+    std::atomic<bool> anyFound{ false };
+
+    GetScanThreadPool().Run(chunks.size(), [&](size_t i) {
+        if (anyFound && (backward ? i < best : i > best)) return;
+        const ScanChunk& chunk = chunks[i];
+        size_t offset;
+        if (!GuardedScanPattern((const BYTE*)chunk.start, chunk.end - chunk.start, &pattern, backward, &offset)) {
+            faulted[i] = 1;
+            return;
+        }
+        if (offset == SIZE_MAX) return;
+        found[i] = chunk.start + offset;
+        size_t current = best;
+        while ((backward ? i > current : i < current) && !best.compare_exchange_weak(current, i)) {}
+        anyFound = true;
+    }, cancel);
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (faulted[i]) protectionCache.Invalidate(chunks[i].start, chunks[i].end - chunks[i].start);
+    }
+    if (!anyFound) return false;
+    result = found[best];
+    return true;
+}
+
+// Searches the readable parts of [start, start + length) for the first (or last) match.
+// Setting *cancel from another thread makes the search give up early.
+bool FindPatternInRange(uintptr_t start, size_t length, const BytePattern& pattern, bool backward, uintptr_t& result,
+    std::atomic<bool>* cancel = nullptr) {
+    auto started = std::chrono::steady_clock::now();
+    uintptr_t end = start + length < start ? UINTPTR_MAX : start + length;
+    vector<AddressRange> runs = ReadableRuns(start, end);
+    size_t total = TotalRunBytes(runs);
+
+    if (total >= parallelScanThreshold) {
+        bool found = FindPatternParallel(runs, pattern, backward, result, cancel);
+        RecordScan(total, started);
+        return found;
+    }
+
+    if (backward) {
+        std::reverse(runs.begin(), runs.end());
+    }
+
+    bool found = false;
+    for (const auto& run : runs) {
+        if (cancel && *cancel) break;
+        size_t offset;
+        if (!GuardedScanPattern((const BYTE*)run.start, run.end - run.start, &pattern, backward, &offset)) {
+            protectionCache.Invalidate(run.start, run.end - run.start);
+            continue;
+        }
+        if (offset != SIZE_MAX) {
+            result = run.start + offset;
+            found = true;
+            break;
+        }
+    }
+    RecordScan(total, started);
+    return found;
+}
+
+// Memory.FindPattern(start, length, pattern, [backward = false]) -> address, or nil.
+// Only matches that lie completely inside [start, start + length) are reported.
+int lua_FindPattern(lua_State* L) {
+    uintptr_t start = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t length = (size_t)luaL_checkinteger(L, 2);
+    const char* text = luaL_checkstring(L, 3);
+    bool backward = lua_toboolean(L, 4) != 0;
+
+    BytePattern pattern;
+    luaL_argcheck(L, ParsePattern(text, pattern), 3, "invalid pattern");
+
+    uintptr_t result;
+    if (FindPatternInRange(start, length, pattern, backward, result)) {
+        lua_pushinteger(L, (lua_Integer)result);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+bool GuardedScanMultiPattern(const BYTE* data, size_t size, const MultiPattern* multi,
+    vector<PatternHit>* hits, size_t maxHits) {
+    __try {
+        ScanMultiPattern(data, size, (uintptr_t)data, *multi, *hits, maxHits);
+        return true;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+// Every match of every pattern in the readable parts of [start, start + length), in address order
+vector<PatternHit> FindAllInRange(uintptr_t start, size_t length, const MultiPattern& multi, size_t maxHits) {
+    if (maxHits == 0) return {};
+    auto started = std::chrono::steady_clock::now();
+    uintptr_t end = start + length < start ? UINTPTR_MAX : start + length;
+    vector<AddressRange> runs = ReadableRuns(start, end);
+    size_t total = TotalRunBytes(runs);
+
+    size_t longest = 0;
+    for (const auto& pattern : multi.patterns) {
+        if (pattern.bytes.size() > longest) longest = pattern.bytes.size();
+    }
+    vector<ScanChunk> chunks = total >= parallelScanThreshold ? SplitScanChunks(runs, longest - 1) : vector<ScanChunk>();
+    if (chunks.empty()) {
+        for (const auto& run : runs) {
+            chunks.push_back({ run.start, run.end, run.end });
+        }
+    }
+
+    vector<vector<PatternHit>> chunkHits(chunks.size());
+    vector<char> faulted(chunks.size(), 0);
+    auto scanChunk = [&](size_t i) {
+        const ScanChunk& chunk = chunks[i];
+        vector<PatternHit>& found = chunkHits[i];
+        if (!GuardedScanMultiPattern((const BYTE*)chunk.start, chunk.end - chunk.start, &multi, &found, maxHits)) {
+            faulted[i] = 1;
+        }
+        TrimChunkHits(chunk, found);
+    };
+
+    if (total >= parallelScanThreshold) {
+        GetScanThreadPool().Run(chunks.size(), scanChunk);
     }
     else {
+        for (size_t i = 0; i < chunks.size(); i++) scanChunk(i);
+    }
+
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (faulted[i]) protectionCache.Invalidate(chunks[i].start, chunks[i].end - chunks[i].start);
+    }
+    vector<PatternHit> hits = MergeChunkHits(chunkHits, maxHits);
+    RecordScan(total, started);
+    return hits;
+}
+
+// Memory.FindAll(start, length, {patterns...}, [maxHits = 4096]) -> addresses, pattern indices
+// Both results are arrays in address order; indices refer to the patterns table.
+int lua_FindAll(lua_State* L) {
+    uintptr_t start = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t length = (size_t)luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+    lua_Integer maxHits = luaL_optinteger(L, 4, 4096);
+    luaL_argcheck(L, maxHits > 0, 4, "maxHits must be positive");
+
+    MultiPattern multi;
+    for (int i = 1; ; i++) {
+        lua_rawgeti(L, 3, i);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        const char* text = lua_tostring(L, -1);
+        BytePattern pattern;
+        if (!text || !ParsePattern(text, pattern)) {
+            return luaL_error(L, "invalid pattern %d", i);
+        }
+        multi.patterns.push_back(std::move(pattern));
+        lua_pop(L, 1);
+    }
+    luaL_argcheck(L, !multi.patterns.empty(), 3, "no patterns");
+    BuildMultiPattern(multi);
+
+    vector<PatternHit> hits = FindAllInRange(start, length, multi, (size_t)maxHits);
+
+    lua_createtable(L, (int)hits.size(), 0);
+    lua_createtable(L, (int)hits.size(), 0);
+    for (size_t i = 0; i < hits.size(); i++) {
+        lua_pushinteger(L, (lua_Integer)hits[i].address);
+        lua_rawseti(L, -3, (int)i + 1);
+        lua_pushinteger(L, hits[i].pattern + 1);
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+    return 2;
+}
+
+// Memory.GetScanStats() -> table with pool size, totals and average throughput
+int lua_GetScanStats(lua_State* L) {
+    uint64_t bytes = scanStats.bytes, microseconds = scanStats.microseconds;
+
+    lua_newtable(L);
+    lua_pushstring(L, "threads"); lua_pushnumber(L, (lua_Number)GetScanThreadPool().ThreadCount()); lua_settable(L, -3);
+    lua_pushstring(L, "jobs"); lua_pushnumber(L, (lua_Number)scanStats.jobs); lua_settable(L, -3);
+    lua_pushstring(L, "chunks"); lua_pushnumber(L, (lua_Number)scanStats.chunks); lua_settable(L, -3);
+    lua_pushstring(L, "steals"); lua_pushnumber(L, (lua_Number)scanStats.steals); lua_settable(L, -3);
+    lua_pushstring(L, "bytes"); lua_pushnumber(L, (lua_Number)bytes); lua_settable(L, -3);
+    lua_pushstring(L, "seconds"); lua_pushnumber(L, microseconds / 1e6); lua_settable(L, -3);
+    lua_pushstring(L, "gbPerSecond"); lua_pushnumber(L, microseconds ? bytes / (microseconds * 1e3) : 0.0); lua_settable(L, -3);
+    return 1;
+}
+
+// --- Signature Cache ---
+// Pattern hits inside modules are remembered across launches in this file, keyed by the
+// module's fingerprint. A cached hit is re-checked against live bytes before it is trusted.
+const char* signatureCacheFile = "dinput8_sigcache.txt";
+
+SignatureCache signatureCache(signatureCacheFile);
+
+// Memory.FindPatternCached(module, pattern, [section = ".text"]) -> address, fromCache; or nil
+int lua_FindPatternCached(lua_State* L) {
+    const char* moduleName = luaL_checkstring(L, 1);
+    const char* text = luaL_checkstring(L, 2);
+    const char* sectionName = luaL_optstring(L, 3, ".text");
+
+    BytePattern pattern;
+    luaL_argcheck(L, ParsePattern(text, pattern), 2, "invalid pattern");
+
+    uintptr_t base, sectionStart;
+    size_t sectionSize;
+    string moduleKey;
+    {
+        std::lock_guard<std::mutex> guard(moduleCache.lock);
+        ModuleInfo* module = moduleCache.Find(moduleName);
+        const SectionInfo* section = module ? moduleCache.FindSection(*module, sectionName) : nullptr;
+        if (!section) {
+            lua_pushnil(L);
+            return 1;
+        }
+        base = module->base;
+        sectionStart = section->start;
+        sectionSize = section->size;
+        moduleKey = module->name;
+    }
+
+    char path[MAX_PATH];
+    ModuleFingerprint fingerprint;
+    bool fingerprinted = GetModuleFileNameA((HMODULE)base, path, MAX_PATH) &&
+        signatureCache.GetFingerprint(path, fingerprint);
+    string key = moduleKey + "\t" + sectionName + "\t" + text;
+
+    uintptr_t rva;
+    if (fingerprinted && signatureCache.Lookup(key, fingerprint, rva)) {
+        uintptr_t address = base + rva;
+        vector<BYTE> bytes(pattern.bytes.size());
+        if (address >= sectionStart && address + bytes.size() <= sectionStart + sectionSize &&
+            ReadBlock(address, bytes.data(), bytes.size()) && MatchPatternAt(bytes.data(), pattern)) {
+            lua_pushinteger(L, (lua_Integer)address);
+            lua_pushboolean(L, true);
+            return 2;
+        }
+        Log("Signature cache entry no longer matches, rescanning: " + string(text));
+    }
+
+    uintptr_t address;
+    if (!FindPatternInRange(sectionStart, sectionSize, pattern, false, address)) {
         lua_pushnil(L);
+        return 1;
+    }
+    if (fingerprinted) {
+        signatureCache.Store(key, { fingerprint, address - base });
+    }
+    lua_pushinteger(L, (lua_Integer)address);
+    lua_pushboolean(L, false);
+    return 2;
+}
+
+// --- Asynchronous Scans ---
+// Memory.FindPatternAsync(start, length, pattern, [backward = false])
+// In a coroutine: yields and later returns the address, or nil. The loader resumes the
+// coroutine; resuming it from elsewhere while it waits gives up the wait and returns
+// nil, "interrupted". Elsewhere: returns a job with Done(), Result() and Cancel().
+int lua_FindPatternAsync(lua_State* L) {
+    uintptr_t start = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t length = (size_t)luaL_checkinteger(L, 2);
+    const char* text = luaL_checkstring(L, 3);
+
+    BytePattern pattern;
+    luaL_argcheck(L, ParsePattern(text, pattern), 3, "invalid pattern");
+    bool backward = lua_toboolean(L, 4) != 0;
+
+    AsyncScanJobPtr job = std::make_shared<AsyncScanJob>();
+    job->scan = [start, length, pattern, backward](uintptr_t& result, std::atomic<bool>* cancel) {
+        return FindPatternInRange(start, length, pattern, backward, result, cancel);
+    };
+    return BeginAsyncScan(L, job);
+}
+
+// --- Pointer Cross-References ---
+// Committed regions of the whole address space in address order, adjacent ones merged.
+// One VirtualQuery walk is cheaper here than filling the protection cache page by page.
+vector<AddressRange> CommittedRegions(bool writableOnly) {
+    vector<AddressRange> regions;
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    uintptr_t address = (uintptr_t)info.lpMinimumApplicationAddress;
+    uintptr_t limit = (uintptr_t)info.lpMaximumApplicationAddress;
+
+    MEMORY_BASIC_INFORMATION mbi;
+    while (address < limit && VirtualQuery((LPCVOID)address, &mbi, sizeof(mbi))) {
+        uintptr_t start = (uintptr_t)mbi.BaseAddress;
+        uintptr_t end = start + mbi.RegionSize;
+        if (end <= address) break;
+        DWORD protect = mbi.State == MEM_COMMIT ? mbi.Protect : 0;
+        if (writableOnly ? IsWritableProtect(protect) : IsReadableProtect(protect)) {
+            if (!regions.empty() && regions.back().end == start) {
+                regions.back().end = end;
+            }
+            else {
+                regions.push_back({ start, end });
+            }
+        }
+        address = end;
+    }
+    return regions;
+}
+
+bool GuardedCollectPointers(const uintptr_t* data, size_t count, const vector<AddressRange>* mapped,
+    vector<PointerRef>* refs) {
+    __try {
+        CollectPointers(data, count, *mapped, *refs);
+        return true;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+void BuildPointerIndex(PointerIndex& index) {
+    auto started = std::chrono::steady_clock::now();
+    vector<AddressRange> mapped = CommittedRegions(false);
+
+    vector<AddressRange> runs;
+    for (const auto& source : index.sources) {
+        vector<AddressRange> readable = ReadableRuns(source.start, source.end);
+        runs.insert(runs.end(), readable.begin(), readable.end());
+    }
+    size_t total = TotalRunBytes(runs);
+    bool parallel = total >= parallelScanThreshold;
+
+    vector<AddressRange> faulted;
+    BuildPointerRefs(runs, mapped, parallel, index.refs, faulted);
+    for (const auto& range : faulted) protectionCache.Invalidate(range.start, range.end - range.start);
+
+    index.bytes = total;
+    index.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    RecordScan(total, started);
+}
+
+// Memory.PointerIndex(start, length) or Memory.PointerIndex(module) -> index object.
+// With a module name, all of its writable sections are indexed.
+int lua_CreatePointerIndex(lua_State* L) {
+    vector<AddressRange> sources;
+    if (lua_type(L, 1) == LUA_TSTRING) {
+        const char* moduleName = lua_tostring(L, 1);
+        std::lock_guard<std::mutex> guard(moduleCache.lock);
+        ModuleInfo* module = moduleCache.Find(moduleName);
+        if (!module) {
+            lua_pushnil(L);
+            return 1;
+        }
+        for (const auto& section : module->sections) {
+            if (section.characteristics & IMAGE_SCN_MEM_WRITE) {
+                sources.push_back({ section.start, section.start + section.size });
+            }
+        }
+    }
+    else {
+        uintptr_t start = (uintptr_t)luaL_checkinteger(L, 1);
+        size_t length = (size_t)luaL_checkinteger(L, 2);
+        sources.push_back({ start, start + length < start ? UINTPTR_MAX : start + length });
     }
+
+    PointerIndex* index = new (lua_newuserdata(L, sizeof(PointerIndex))) PointerIndex();
+    luaL_getmetatable(L, "PointerIndex");
+    lua_setmetatable(L, -2);
+
+    index->sources = std::move(sources);
+    BuildPointerIndex(*index);
     return 1;
 }
 
-// Frees memory previously allocated with AllocateMemory
-int lua_FreeMemory(lua_State* L) {
-    void* memory = (void*)luaL_checkinteger(L, 1);
-    BOOL result = VirtualFree(memory, 0, MEM_RELEASE);
-    lua_pushboolean(L, result);
-    return 1;
-}
+// index:Find(address, [size = 1], [maxRefs = 4096]) -> array of addresses holding a pointer
+// into [address, address + size), and true if the list was truncated
+int lua_PointerIndex_Find(lua_State* L) {
+    PointerIndex* index = (PointerIndex*)luaL_checkudata(L, 1, "PointerIndex");
+    uintptr_t low = (uintptr_t)luaL_checkinteger(L, 2);
+    size_t size = (size_t)luaL_optinteger(L, 3, 1);
+    size_t maxRefs = (size_t)luaL_optinteger(L, 4, 4096);
+    uintptr_t high = low + size < low ? UINTPTR_MAX : low + size;
+
+    auto it = std::lower_bound(index->refs.begin(), index->refs.end(), low,
+        [](const PointerRef& ref, uintptr_t value) { return ref.target < value; });
+
+    lua_newtable(L);
+    int count = 0;
+    for (; it != index->refs.end() && it->target < high && (size_t)count < maxRefs; ++it) {
+        lua_pushinteger(L, (lua_Integer)it->source);
+        lua_rawseti(L, -2, ++count);
+    }
+    lua_pushboolean(L, it != index->refs.end() && it->target < high);
+    return 2;
+}
+
+// index:Rebuild() re-reads the same ranges, e.g. after the game loaded new data
+int lua_PointerIndex_Rebuild(lua_State* L) {
+    PointerIndex* index = (PointerIndex*)luaL_checkudata(L, 1, "PointerIndex");
+    BuildPointerIndex(*index);
+    return 0;
+}
+
+// index:Stats() -> table with the number of pointers, bytes indexed and build time
+int lua_PointerIndex_Stats(lua_State* L) {
+    PointerIndex* index = (PointerIndex*)luaL_checkudata(L, 1, "PointerIndex");
+    lua_newtable(L);
+    lua_pushstring(L, "refs"); lua_pushnumber(L, (lua_Number)index->refs.size()); lua_settable(L, -3);
+    lua_pushstring(L, "bytes"); lua_pushnumber(L, (lua_Number)index->bytes); lua_settable(L, -3);
+    lua_pushstring(L, "seconds"); lua_pushnumber(L, index->seconds); lua_settable(L, -3);
+    return 1;
+}
+
+int lua_PointerIndex_Gc(lua_State* L) {
+    PointerIndex* index = (PointerIndex*)luaL_checkudata(L, 1, "PointerIndex");
+    index->~PointerIndex();
+    return 0;
+}
+
+void RegisterPointerIndex(lua_State* L) {
+    luaL_newmetatable(L, "PointerIndex");
+
+    lua_pushcfunction(L, lua_PointerIndex_Gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_PointerIndex_Find);
+    lua_setfield(L, -2, "Find");
+    lua_pushcfunction(L, lua_PointerIndex_Rebuild);
+    lua_setfield(L, -2, "Rebuild");
+    lua_pushcfunction(L, lua_PointerIndex_Stats);
+    lua_setfield(L, -2, "Stats");
+    lua_setfield(L, -2, "__index");
+
+    lua_pop(L, 1);
+}
+
+// --- String Extraction ---
+// Runs of printable ASCII (0x20-0x7E) and of the same characters as UTF-16LE, found with
+// a 16-byte classification per step and gathered into a dictionary of string -> addresses
+constexpr size_t maxStringLength = 1024; // Longer runs are data, not text, and are dropped
+
+struct FoundString {
+    uintptr_t address;
+    size_t textOffset;  // Into the chunk's text pool
+    size_t length;
+    bool wide;
+};
+
+struct StringDictionary {
+    vector<string> strings;                 // Unique strings in sorted order, for prefix lookups
+    vector<vector<uintptr_t>> addresses;    // Per string, ASCII occurrences in address order
+    vector<vector<uintptr_t>> wideAddresses;
+    std::unordered_map<string, size_t> exact;
+    std::unordered_map<string, vector<size_t>> folded; // Lowercase -> indices of its case variants
+    size_t occurrences = 0;
+};
+
+bool IsPrintableChar(BYTE c) {
+    return c >= 0x20 && c <= 0x7E;
+}
+
+// Bit i is set when p[i] is printable; signed compares also reject bytes of 0x80 and up
+unsigned PrintableMask(const BYTE* p) {
+    __m128i v = _mm_loadu_si128((const __m128i*)p);
+    __m128i printable = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(v, _mm_set1_epi8(0x7F)));
+    return (unsigned)_mm_movemask_epi8(printable);
+}
+
+unsigned ZeroMask(const BYTE* p) {
+    return (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), _mm_setzero_si128()));
+}
+
+// Finds the strings that start in data[0, owned); the bytes up to size let the last ones finish.
+// With continues set, data[-2] and data[-1] are readable and a run already open there is skipped.
+// UTF-16 characters must start on an even address.
+void ExtractStrings(const BYTE* data, size_t owned, size_t size, uintptr_t address, bool continues, size_t minLen,
+    vector<FoundString>& found, string& text) {
+    size_t asciiStart = SIZE_MAX, wideStart = SIZE_MAX;
+    bool skipAscii = continues && IsPrintableChar(data[-1]);
+    size_t parity = address & 1; // Offsets i with (i & 1) == parity are even addresses
+    // A character that straddles or ends at data[0] means the run at parity is a continuation
+    bool skipWide = continues && (parity ? IsPrintableChar(data[-1]) && data[0] == 0 :
+        IsPrintableChar(data[-2]) && data[-1] == 0);
+
+    auto closeAscii = [&](size_t end) {
+        size_t length = end - asciiStart;
+        if (asciiStart < owned && !(skipAscii && asciiStart == 0) && length >= minLen && length <= maxStringLength) {
+            found.push_back({ address + asciiStart, text.size(), length, false });
+            text.append((const char*)data + asciiStart, length);
+        }
+        asciiStart = SIZE_MAX;
+    };
+    auto closeWide = [&](size_t end) {
+        size_t length = (end - wideStart) / 2;
+        if (wideStart < owned && !(skipWide && wideStart == parity) && length >= minLen && length <= maxStringLength) {
+            found.push_back({ address + wideStart, text.size(), length, true });
+            for (size_t j = 0; j < length; j++) text.push_back((char)data[wideStart + j * 2]);
+        }
+        wideStart = SIZE_MAX;
+    };
+    auto visitAscii = [&](size_t i, bool printable) {
+        if (printable && asciiStart == SIZE_MAX) asciiStart = i;
+        else if (!printable && asciiStart != SIZE_MAX) closeAscii(i);
+    };
+    auto visitWide = [&](size_t i, bool printable) {
+        if (printable && wideStart == SIZE_MAX) wideStart = i;
+        else if (!printable && wideStart != SIZE_MAX) closeWide(i);
+    };
+
+    unsigned parityMask = parity ? 0xAAAA : 0x5555;
+    size_t i = 0;
+    for (; i + 17 <= size; i += 16) {
+        unsigned printable = PrintableMask(data + i);
+        unsigned zero = ZeroMask(data + i) | (data[i + 16] == 0 ? 0x10000 : 0);
+        unsigned wide = printable & (zero >> 1) & parityMask;
+
+        bool asciiQuiet = (printable == 0xFFFF && asciiStart != SIZE_MAX) || (printable == 0 && asciiStart == SIZE_MAX);
+        bool wideQuiet = (wide == parityMask && wideStart != SIZE_MAX) || (wide == 0 && wideStart == SIZE_MAX);
+        if (asciiQuiet && wideQuiet) continue;
+
+        for (unsigned bit = 0; bit < 16; bit++) {
+            if (!asciiQuiet) visitAscii(i + bit, (printable >> bit) & 1);
+            if (!wideQuiet && (bit & 1) == parity) visitWide(i + bit, (wide >> bit) & 1);
+        }
+    }
+    for (; i < size; i++) {
+        visitAscii(i, IsPrintableChar(data[i]));
+        if ((i & 1) == parity) visitWide(i, i + 1 < size && IsPrintableChar(data[i]) && data[i + 1] == 0);
+    }
+    if (asciiStart != SIZE_MAX) closeAscii(size);
+    if (wideStart != SIZE_MAX) closeWide(size);
+}
+
+bool GuardedExtractStrings(const BYTE* data, size_t owned, size_t size, bool continues, size_t minLen,
+    vector<FoundString>* found, string* text) {
+    __try {
+        ExtractStrings(data, owned, size, (uintptr_t)data, continues, minLen, *found, *text);
+        return true;
+    }
+    __except (EXCEPTION_EXECUTE_HANDLER) {
+        return false;
+    }
+}
+
+void BuildStringDictionary(uintptr_t start, size_t length, size_t minLen, StringDictionary& dictionary) {
+    auto started = std::chrono::steady_clock::now();
+    uintptr_t end = start + length < start ? UINTPTR_MAX : start + length;
+    vector<AddressRange> runs = ReadableRuns(start, end);
+    size_t total = TotalRunBytes(runs);
+    bool parallel = total >= parallelScanThreshold;
+
+    vector<ScanChunk> chunks = parallel ? SplitScanChunks(runs, 2 * maxStringLength + 2) : vector<ScanChunk>();
+    if (!parallel) {
+        for (const auto& run : runs) chunks.push_back({ run.start, run.end, run.end });
+    }
+
+    vector<vector<FoundString>> chunkStrings(chunks.size());
+    vector<string> chunkText(chunks.size());
+    vector<char> faulted(chunks.size(), 0);
+    auto extract = [&](size_t i) {
+        const ScanChunk& chunk = chunks[i];
+        // Runs are never adjacent, so a chunk continues a run exactly when it starts where the last one ended
+        bool continues = i > 0 && chunks[i - 1].ownedEnd == chunk.start;
+        if (!GuardedExtractStrings((const BYTE*)chunk.start, chunk.ownedEnd - chunk.start, chunk.end - chunk.start,
+            continues, minLen, &chunkStrings[i], &chunkText[i])) {
+            faulted[i] = 1;
+        }
+    };
+
+    if (parallel) {
+        GetScanThreadPool().Run(chunks.size(), extract);
+    }
+    else {
+        for (size_t i = 0; i < chunks.size(); i++) extract(i);
+    }
+
+    // Unique strings first in the order met, then sorted with their address lists carried along
+    vector<string> strings;
+    vector<vector<uintptr_t>> addresses, wideAddresses;
+    std::unordered_map<string, size_t> seen;
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (faulted[i]) protectionCache.Invalidate(chunks[i].start, chunks[i].end - chunks[i].start);
+        for (const auto& found : chunkStrings[i]) {
+            string value = chunkText[i].substr(found.textOffset, found.length);
+            auto inserted = seen.emplace(value, strings.size());
+            if (inserted.second) {
+                strings.push_back(std::move(value));
+                addresses.emplace_back();
+                wideAddresses.emplace_back();
+            }
+            (found.wide ? wideAddresses : addresses)[inserted.first->second].push_back(found.address);
+            dictionary.occurrences++;
+        }
+    }
+
+    vector<size_t> order(strings.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return strings[a] < strings[b]; });
+
+    for (size_t index : order) {
+        size_t slot = dictionary.strings.size();
+        dictionary.exact[strings[index]] = slot;
+        dictionary.folded[ToLower(strings[index])].push_back(slot);
+        dictionary.strings.push_back(std::move(strings[index]));
+        dictionary.addresses.push_back(std::move(addresses[index]));
+        dictionary.wideAddresses.push_back(std::move(wideAddresses[index]));
+    }
+    RecordScan(total, started);
+}
+
+// Memory.Strings(start, length, [minLen = 4]) -> dictionary of the strings in the readable parts of the range
+int lua_CreateStringDictionary(lua_State* L) {
+    uintptr_t start = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t length = (size_t)luaL_checkinteger(L, 2);
+    size_t minLen = (size_t)luaL_optinteger(L, 3, 4);
+    luaL_argcheck(L, minLen >= 1 && minLen <= maxStringLength, 3, "invalid minimum length");
+
+    StringDictionary* dictionary = new (lua_newuserdata(L, sizeof(StringDictionary))) StringDictionary();
+    luaL_getmetatable(L, "StringDictionary");
+    lua_setmetatable(L, -2);
+
+    BuildStringDictionary(start, length, minLen, *dictionary);
+    return 1;
+}
+
+void PushAddressArray(lua_State* L, const vector<uintptr_t>& addresses) {
+    lua_createtable(L, (int)addresses.size(), 0);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        lua_pushinteger(L, (lua_Integer)addresses[i]);
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+}
+
+// dict:Find(text, [ignoreCase = false]) -> array of ASCII addresses, array of UTF-16 addresses; or nil
+int lua_StringDictionary_Find(lua_State* L) {
+    StringDictionary* dictionary = (StringDictionary*)luaL_checkudata(L, 1, "StringDictionary");
+    string text = luaL_checkstring(L, 2);
+    bool ignoreCase = lua_toboolean(L, 3) != 0;
+
+    if (!ignoreCase) {
+        auto it = dictionary->exact.find(text);
+        if (it == dictionary->exact.end()) {
+            lua_pushnil(L);
+            return 1;
+        }
+        PushAddressArray(L, dictionary->addresses[it->second]);
+        PushAddressArray(L, dictionary->wideAddresses[it->second]);
+        return 2;
+    }
+
+    auto it = dictionary->folded.find(ToLower(text));
+    if (it == dictionary->folded.end()) {
+        lua_pushnil(L);
+        return 1;
+    }
+    vector<uintptr_t> addresses, wideAddresses;
+    for (size_t index : it->second) {
+        addresses.insert(addresses.end(), dictionary->addresses[index].begin(), dictionary->addresses[index].end());
+        wideAddresses.insert(wideAddresses.end(), dictionary->wideAddresses[index].begin(), dictionary->wideAddresses[index].end());
+    }
+    std::sort(addresses.begin(), addresses.end());
+    std::sort(wideAddresses.begin(), wideAddresses.end());
+    PushAddressArray(L, addresses);
+    PushAddressArray(L, wideAddresses);
+    return 2;
+}
+
+// dict:FindPrefix(prefix, [maxResults = 256]) -> sorted array of the strings starting with prefix
+int lua_StringDictionary_FindPrefix(lua_State* L) {
+    StringDictionary* dictionary = (StringDictionary*)luaL_checkudata(L, 1, "StringDictionary");
+    size_t prefixLength;
+    const char* prefix = luaL_checklstring(L, 2, &prefixLength);
+    size_t maxResults = (size_t)luaL_optinteger(L, 3, 256);
+
+    auto it = std::lower_bound(dictionary->strings.begin(), dictionary->strings.end(), string(prefix, prefixLength));
+    lua_newtable(L);
+    int count = 0;
+    for (; it != dictionary->strings.end() && (size_t)count < maxResults &&
+        it->compare(0, prefixLength, prefix, prefixLength) == 0; ++it) {
+        lua_pushlstring(L, it->data(), it->size());
+        lua_rawseti(L, -2, ++count);
+    }
+    return 1;
+}
+
+// dict:Count() -> unique strings, total occurrences
+int lua_StringDictionary_Count(lua_State* L) {
+    StringDictionary* dictionary = (StringDictionary*)luaL_checkudata(L, 1, "StringDictionary");
+    lua_pushinteger(L, (lua_Integer)dictionary->strings.size());
+    lua_pushinteger(L, (lua_Integer)dictionary->occurrences);
+    return 2;
+}
+
+int lua_StringDictionary_Gc(lua_State* L) {
+    StringDictionary* dictionary = (StringDictionary*)luaL_checkudata(L, 1, "StringDictionary");
+    dictionary->~StringDictionary();
+    return 0;
+}
+
+void RegisterStringDictionary(lua_State* L) {
+    luaL_newmetatable(L, "StringDictionary");
+
+    lua_pushcfunction(L, lua_StringDictionary_Gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_StringDictionary_Find);
+    lua_setfield(L, -2, "Find");
+    lua_pushcfunction(L, lua_StringDictionary_FindPrefix);
+    lua_setfield(L, -2, "FindPrefix");
+    lua_pushcfunction(L, lua_StringDictionary_Count);
+    lua_setfield(L, -2, "Count");
+    lua_setfield(L, -2, "__index");
+
+    lua_pop(L, 1);
+}
+
+// --- Value Scanning ---
+// The scan itself is in value_scan.h; this is its Lua interface
+bool ParseScanCondition(lua_State* L, bool first, ScanCondition& condition) {
+    string mode = luaL_checkstring(L, 2);
+    if (mode == "exact") condition.compare = ScanCompare::Exact;
+    else if (mode == "range") condition.compare = ScanCompare::Range;
+    else if (mode == "unknown" && first) condition.compare = ScanCompare::Unknown;
+    else if (mode == "changed" && !first) condition.compare = ScanCompare::Changed;
+    else if (mode == "unchanged" && !first) condition.compare = ScanCompare::Unchanged;
+    else if (mode == "increased" && !first) condition.compare = ScanCompare::Increased;
+    else if (mode == "decreased" && !first) condition.compare = ScanCompare::Decreased;
+    else return false;
+
+    if (condition.compare == ScanCompare::Exact || condition.compare == ScanCompare::Range) {
+        condition.low = luaL_checknumber(L, 3);
+        condition.high = condition.compare == ScanCompare::Range ? luaL_checknumber(L, 4) : condition.low;
+    }
+    return true;
+}
+
+// Memory.ValueScan(type, [start, length]) -> scan object; type is "i32", "f32" or "f64".
+// Without a range the first scan covers all committed writable memory.
+int lua_CreateValueScan(lua_State* L) {
+    string typeName = luaL_checkstring(L, 1);
+    ScanValueType type;
+    if (typeName == "i32") type = ScanValueType::I32;
+    else if (typeName == "f32") type = ScanValueType::F32;
+    else if (typeName == "f64") type = ScanValueType::F64;
+    else return luaL_argerror(L, 1, "unknown value type");
+
+    ValueScan* scan = new (lua_newuserdata(L, sizeof(ValueScan))) ValueScan();
+    luaL_getmetatable(L, "ValueScan");
+    lua_setmetatable(L, -2);
+
+    scan->type = type;
+    if (!lua_isnoneornil(L, 2)) {
+        uintptr_t start = (uintptr_t)luaL_checkinteger(L, 2);
+        size_t length = (size_t)luaL_checkinteger(L, 3);
+        scan->ranges.push_back({ start, start + length < start ? UINTPTR_MAX : start + length });
+    }
+    return 1;
+}
+
+// scan:First(mode, [a], [b]) -> candidate count. mode: "exact" a, "range" a..b, or "unknown".
+// nil, error if the scan was refused or ran out of memory; First has to be called again.
+int lua_ValueScan_First(lua_State* L) {
+    ValueScan* scan = (ValueScan*)luaL_checkudata(L, 1, "ValueScan");
+    ScanCondition condition;
+    luaL_argcheck(L, ParseScanCondition(L, true, condition), 2, "unknown first scan mode");
+    string error;
+    if (!RunValueScan(*scan, condition, true, error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    lua_pushinteger(L, (lua_Integer)CountCandidates(*scan));
+    return 1;
+}
+
+// scan:Next(mode, [a], [b]) -> candidate count. mode: "exact", "range", "changed",
+// "unchanged", "increased" or "decreased", compared against the value at the last scan
+int lua_ValueScan_Next(lua_State* L) {
+    ValueScan* scan = (ValueScan*)luaL_checkudata(L, 1, "ValueScan");
+    luaL_argcheck(L, scan->started, 1, "First must be called before Next");
+    ScanCondition condition;
+    luaL_argcheck(L, ParseScanCondition(L, false, condition), 2, "unknown next scan mode");
+    string error;
+    if (!RunValueScan(*scan, condition, false, error)) {
+        lua_pushnil(L);
+        lua_pushstring(L, error.c_str());
+        return 2;
+    }
+    lua_pushinteger(L, (lua_Integer)CountCandidates(*scan));
+    return 1;
+}
+
+int lua_ValueScan_Count(lua_State* L) {
+    ValueScan* scan = (ValueScan*)luaL_checkudata(L, 1, "ValueScan");
+    lua_pushinteger(L, (lua_Integer)CountCandidates(*scan));
+    return 1;
+}
+
+// scan:Results([maxResults = 1024]) -> array of addresses, array of values at the last scan
+int lua_ValueScan_Results(lua_State* L) {
+    ValueScan* scan = (ValueScan*)luaL_checkudata(L, 1, "ValueScan");
+    size_t maxResults = (size_t)luaL_optinteger(L, 2, 1024);
+    size_t valueSize = ScanValueSize(scan->type);
+
+    lua_newtable(L);
+    lua_newtable(L);
+    int count = 0;
+    for (const auto& block : scan->blocks) {
+        if ((size_t)count >= maxResults) break;
+        ForEachCandidate(block, [&](size_t slot, size_t n) {
+            if ((size_t)count >= maxResults) return;
+            const BYTE* stored = block.values.data() + n * valueSize;
+            lua_pushinteger(L, (lua_Integer)(block.base + slot * scanSlotStride));
+            lua_rawseti(L, -3, ++count);
+            if (scan->type == ScanValueType::I32) {
+                int32_t value;
+                memcpy(&value, stored, sizeof(value));
+                lua_pushinteger(L, value);
+            }
+            else if (scan->type == ScanValueType::F32) {
+                float value;
+                memcpy(&value, stored, sizeof(value));
+                lua_pushnumber(L, value);
+            }
+            else {
+                double value;
+                memcpy(&value, stored, sizeof(value));
+                lua_pushnumber(L, value);
+            }
+            lua_rawseti(L, -2, count);
+        });
+    }
+    return 2;
+}
+
+// scan:Stats() -> table with candidates, blocks, bytes held and the last scan's duration
+int lua_ValueScan_Stats(lua_State* L) {
+    ValueScan* scan = (ValueScan*)luaL_checkudata(L, 1, "ValueScan");
+    size_t bytes = 0, dense = 0;
+    for (const auto& block : scan->blocks) {
+        bytes += block.bits.capacity() * sizeof(uint32_t) + block.deltas.capacity() + block.values.capacity();
+        if (block.dense) dense++;
+    }
+
+    lua_newtable(L);
+    lua_pushstring(L, "candidates"); lua_pushnumber(L, (lua_Number)CountCandidates(*scan)); lua_settable(L, -3);
+    lua_pushstring(L, "blocks"); lua_pushnumber(L, (lua_Number)scan->blocks.size()); lua_settable(L, -3);
+    lua_pushstring(L, "denseBlocks"); lua_pushnumber(L, (lua_Number)dense); lua_settable(L, -3);
+    lua_pushstring(L, "bytes"); lua_pushnumber(L, (lua_Number)bytes); lua_settable(L, -3);
+    lua_pushstring(L, "seconds"); lua_pushnumber(L, scan->seconds); lua_settable(L, -3);
+    return 1;
+}
+
+int lua_ValueScan_Gc(lua_State* L) {
+    ValueScan* scan = (ValueScan*)luaL_checkudata(L, 1, "ValueScan");
+    scan->~ValueScan();
+    return 0;
+}
+
+void RegisterValueScan(lua_State* L) {
+    luaL_newmetatable(L, "ValueScan");
+
+    lua_pushcfunction(L, lua_ValueScan_Gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_ValueScan_First);
+    lua_setfield(L, -2, "First");
+    lua_pushcfunction(L, lua_ValueScan_Next);
+    lua_setfield(L, -2, "Next");
+    lua_pushcfunction(L, lua_ValueScan_Count);
+    lua_setfield(L, -2, "Count");
+    lua_pushcfunction(L, lua_ValueScan_Results);
+    lua_setfield(L, -2, "Results");
+    lua_pushcfunction(L, lua_ValueScan_Stats);
+    lua_setfield(L, -2, "Stats");
+    lua_setfield(L, -2, "__index");
+
+    lua_pop(L, 1);
+}
+
+// --- Track Database ---
+// database.bin is loaded onto the heap with an SBDN signature in front. Each track record
+// follows an ITMS tag and holds its name at +0x20. The index is built once per session and
+// shared by every plugin.
+struct TrackDatabase {
+    uintptr_t sbdn = 0;
+    vector<TrackRecord> tracks;                  // In record order
+    std::unordered_map<string, size_t> byName;   // Lowercase name -> first track with it
+    std::mutex lock;
+};
+
+TrackDatabase trackDatabase;
+
+// Finds the SBDN signature at or before anchor and indexes the records after it
+bool IndexTrackDatabase(uintptr_t anchor, TrackDatabase& database) {
+    BytePattern sbdn;
+    ParsePattern("53 42 44 4E", sbdn);
+    uintptr_t searchStart = anchor > trackSearchBack ? anchor - trackSearchBack : 0;
+    uintptr_t found;
+    if (!FindPatternInRange(searchStart, anchor - searchStart + 1, sbdn, true, found)) {
+        return false;
+    }
+
+    // The database is one allocation, so only the readable run starting at SBDN matters
+    size_t span = trackDatabaseSpan + 4 + trackNameOffset + trackNameLength;
+    vector<AddressRange> runs = ReadableRuns(found, found + span);
+    if (runs.empty() || runs[0].start != found) return false;
+    vector<BYTE> image(runs[0].end - found);
+    if (!GuardedCopy(image.data(), (const void*)found, image.size())) {
+        protectionCache.Invalidate(found, image.size());
+        return false;
+    }
+
+    database.sbdn = found;
+    database.tracks.clear();
+    database.byName.clear();
+    ParseTrackDatabase(image.data(), image.size(), found, database.tracks);
+    for (size_t i = 0; i < database.tracks.size(); i++) {
+        database.byName.emplace(ToLower(database.tracks[i].name), i);
+    }
+    Log("Track database indexed at 0x" + std::to_string(found) + ": " + std::to_string(database.tracks.size()) + " tracks");
+    return true;
+}
+
+// True if the cached index still describes the live database around anchor
+bool IsTrackDatabaseCurrent(const TrackDatabase& database, uintptr_t anchor) {
+    if (!database.sbdn || database.tracks.empty() || anchor < database.sbdn ||
+        anchor > database.sbdn + trackSearchBack) {
+        return false;
+    }
+    BYTE tag[4];
+    string name;
+    const TrackRecord& first = database.tracks.front();
+    return ReadBlock(database.sbdn, tag, sizeof(tag)) && memcmp(tag, "SBDN", 4) == 0 &&
+        ReadCString(first.address + trackNameOffset, trackNameLength, name) && name == first.name;
+}
+
+void PushTrack(lua_State* L, const TrackRecord& track) {
+    lua_createtable(L, 0, 2);
+    lua_pushlstring(L, track.name.data(), track.name.size());
+    lua_setfield(L, -2, "name");
+    lua_pushinteger(L, (lua_Integer)track.address);
+    lua_setfield(L, -2, "address");
+}
+
+// Game.IndexDatabase(anchorAddress, [force = false]) -> SBDN address, track count; or nil.
+// anchorAddress is any address inside the database, e.g. a track pointer from the season array.
+// A later call reuses the index while the database is still in place, unless force is set.
+int lua_IndexDatabase(lua_State* L) {
+    uintptr_t anchor = (uintptr_t)luaL_checkinteger(L, 1);
+    bool force = lua_toboolean(L, 2) != 0;
+
+    std::lock_guard<std::mutex> guard(trackDatabase.lock);
+    if (force || !IsTrackDatabaseCurrent(trackDatabase, anchor)) {
+        if (!IndexTrackDatabase(anchor, trackDatabase)) {
+            trackDatabase.sbdn = 0;
+            trackDatabase.tracks.clear();
+            trackDatabase.byName.clear();
+            lua_pushnil(L);
+            return 1;
+        }
+    }
+    lua_pushinteger(L, (lua_Integer)trackDatabase.sbdn);
+    lua_pushinteger(L, (lua_Integer)trackDatabase.tracks.size());
+    return 2;
+}
+
+// Game.GetTracks() -> array of {name=, address=} in record order
+int lua_GetTracks(lua_State* L) {
+    std::lock_guard<std::mutex> guard(trackDatabase.lock);
+    lua_createtable(L, (int)trackDatabase.tracks.size(), 0);
+    for (size_t i = 0; i < trackDatabase.tracks.size(); i++) {
+        PushTrack(L, trackDatabase.tracks[i]);
+        lua_rawseti(L, -2, (int)i + 1);
+    }
+    return 1;
+}
+
+// Game.FindTrack(name) -> address, name as stored; or nil. The name is matched ignoring case.
+int lua_FindTrack(lua_State* L) {
+    string name = ToLower(luaL_checkstring(L, 1));
+    std::lock_guard<std::mutex> guard(trackDatabase.lock);
+    auto it = trackDatabase.byName.find(name);
+    if (it == trackDatabase.byName.end()) {
+        lua_pushnil(L);
+        return 1;
+    }
+    const TrackRecord& track = trackDatabase.tracks[it->second];
+    lua_pushinteger(L, (lua_Integer)track.address);
+    lua_pushlstring(L, track.name.data(), track.name.size());
+    return 2;
+}
+
+// Game.FindTracks(text) -> array of {name=, address=} whose names contain text, ignoring case
+int lua_FindTracks(lua_State* L) {
+    string text = ToLower(luaL_checkstring(L, 1));
+    std::lock_guard<std::mutex> guard(trackDatabase.lock);
+    lua_newtable(L);
+    int count = 0;
+    for (const auto& track : trackDatabase.tracks) {
+        if (ToLower(track.name).find(text) != string::npos) {
+            PushTrack(L, track);
+            lua_rawseti(L, -2, ++count);
+        }
+    }
+    return 1;
+}
+
+// --- Typed Memory Views ---
+// The views are in memory_view.h
+
+// --- Pointer Chains ---
+// The chains are in pointer_chain.h
+
+// --- Snapshots and Diff ---
+// DiffBytes and DiffFloats are in snapshot_diff.h
+struct MemorySnapshot {
+    uintptr_t address;
+    vector<BYTE> data;
+};
+
+// Memory.Snapshot(address, size) -> snapshot object, or nil if the range is unreadable
+int lua_CreateSnapshot(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t size = (size_t)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, size > 0 && size <= maxBlockRead, 2, "invalid size");
+
+    MemorySnapshot* snapshot = new (lua_newuserdata(L, sizeof(MemorySnapshot))) MemorySnapshot();
+    luaL_getmetatable(L, "MemorySnapshot");
+    lua_setmetatable(L, -2);
+
+    snapshot->address = address;
+    snapshot->data.resize(size);
+    if (!ReadBlock(address, snapshot->data.data(), size)) {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// snapshot:Update() re-captures the same range into the existing buffer
+int lua_Snapshot_Update(lua_State* L) {
+    MemorySnapshot* snapshot = (MemorySnapshot*)luaL_checkudata(L, 1, "MemorySnapshot");
+    lua_pushboolean(L, ReadBlock(snapshot->address, snapshot->data.data(), snapshot->data.size()));
+    return 1;
+}
+
+int lua_Snapshot_Address(lua_State* L) {
+    MemorySnapshot* snapshot = (MemorySnapshot*)luaL_checkudata(L, 1, "MemorySnapshot");
+    lua_pushinteger(L, (lua_Integer)snapshot->address);
+    return 1;
+}
+
+int lua_Snapshot_Size(lua_State* L) {
+    MemorySnapshot* snapshot = (MemorySnapshot*)luaL_checkudata(L, 1, "MemorySnapshot");
+    lua_pushinteger(L, (lua_Integer)snapshot->data.size());
+    return 1;
+}
+
+int lua_Snapshot_Gc(lua_State* L) {
+    MemorySnapshot* snapshot = (MemorySnapshot*)luaL_checkudata(L, 1, "MemorySnapshot");
+    snapshot->~MemorySnapshot();
+    return 0;
+}
+
+// Memory.Diff(before, after, [mode = "changed"], [maxRanges = 4096])
+// mode: "changed", "unchanged", "increased" or "decreased" (the last two compare floats)
+// Returns an array of {address, size} ranges and true if the list was truncated.
+int lua_DiffSnapshots(lua_State* L) {
+    MemorySnapshot* before = (MemorySnapshot*)luaL_checkudata(L, 1, "MemorySnapshot");
+    MemorySnapshot* after = (MemorySnapshot*)luaL_checkudata(L, 2, "MemorySnapshot");
+    string mode = luaL_optstring(L, 3, "changed");
+    size_t maxRanges = (size_t)luaL_optinteger(L, 4, 4096);
+
+    luaL_argcheck(L, before->address == after->address && before->data.size() == after->data.size(),
+        2, "snapshots must cover the same range");
+
+    lua_newtable(L);
+    int count = 0;
+    bool truncated = false;
+
+    auto emit = [&](size_t offset, size_t length) {
+        if ((size_t)count >= maxRanges) {
+            truncated = true;
+            return;
+        }
+        lua_newtable(L);
+        lua_pushinteger(L, (lua_Integer)(before->address + offset));
+        lua_setfield(L, -2, "address");
+        lua_pushinteger(L, (lua_Integer)length);
+        lua_setfield(L, -2, "size");
+        lua_rawseti(L, -2, ++count);
+    };
+
+    const BYTE* a = before->data.data();
+    const BYTE* b = after->data.data();
+    size_t size = before->data.size();
+
+    if (mode == "changed" || mode == "unchanged") {
+        DiffBytes(a, b, size, mode == "unchanged", emit);
+    }
+    else if (mode == "increased" || mode == "decreased") {
+        DiffFloats(before->address, a, b, size, mode == "decreased", emit);
+    }
+    else {
+        return luaL_argerror(L, 3, "unknown diff mode");
+    }
+
+    lua_pushboolean(L, truncated);
+    return 2;
+}
+
+void RegisterMemorySnapshot(lua_State* L) {
+    luaL_newmetatable(L, "MemorySnapshot");
+
+    lua_pushcfunction(L, lua_Snapshot_Gc);
+    lua_setfield(L, -2, "__gc");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_Snapshot_Update);
+    lua_setfield(L, -2, "Update");
+    lua_pushcfunction(L, lua_Snapshot_Address);
+    lua_setfield(L, -2, "Address");
+    lua_pushcfunction(L, lua_Snapshot_Size);
+    lua_setfield(L, -2, "Size");
+    lua_setfield(L, -2, "__index");
+
+    lua_pop(L, 1);
+}
+
+// --- Write Transactions ---
+// An oldProtect of 0 means the page was already writable and was left untouched
+struct VirtualProtectProtector : PageProtector {
+    bool Unprotect(uintptr_t page, size_t size, uint32_t& oldProtect) override {
+        if (protectionCache.IsWritable(page, size)) {
+            protectionCache.savedSyscalls += 2;
+            oldProtect = 0;
+            return true;
+        }
+
+        DWORD old = 0;
+        if (!VirtualProtect((LPVOID)page, size, PAGE_EXECUTE_READWRITE, &old)) {
+            return false;
+        }
+        oldProtect = old;
+        return true;
+    }
+
+    void Restore(uintptr_t page, size_t size, uint32_t oldProtect) override {
+        if (oldProtect == 0) return;
+
+        DWORD old;
+        VirtualProtect((LPVOID)page, size, oldProtect, &old);
+        if (oldProtect & (PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY)) {
+            FlushInstructionCache(GetCurrentProcess(), (LPCVOID)page, size);
+        }
+    }
+
+    void OnFault(uintptr_t address, size_t size) override {
+        protectionCache.Invalidate(address, size);
+    }
+};
+
+struct WriteTransaction {
+    int depth = 0;
+    WriteBatch batch;
+};
+
+VirtualProtectProtector virtualProtectProtector;
+// Hook and breakpoint callbacks of different plugins run on game threads at once, so the map
+// itself is locked. An entry is only used by its own plugin, under that plugin's gate, and
+// nodes don't move when others are added or erased.
+std::unordered_map<lua_State*, WriteTransaction> writeTransactions;
+std::mutex writeTransactionsMutex;
+
+// Returns the plugin's main Lua state even when called from a coroutine
+lua_State* GetPluginState(lua_State* L) {
+    lua_getfield(L, LUA_REGISTRYINDEX, "PluginState");
+    lua_State* owner = (lua_State*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return owner ? owner : L;
+}
+
+// Returns the open transaction of the calling plugin, or nullptr
+WriteTransaction* GetWriteTransaction(lua_State* L) {
+    lua_State* owner = GetPluginState(L);
+    std::lock_guard<std::mutex> lock(writeTransactionsMutex);
+    auto it = writeTransactions.find(owner);
+    if (it == writeTransactions.end() || it->second.depth == 0) {
+        return nullptr;
+    }
+    return &it->second;
+}
+
+// Drops the open transaction of a plugin whose Lua code just failed. Without this a missing
+// Commit would leave every later write of the plugin queued and never applied.
+void AbortWriteTransaction(lua_State* L) {
+    lua_State* owner = GetPluginState(L);
+    size_t discarded;
+    {
+        std::lock_guard<std::mutex> lock(writeTransactionsMutex);
+        auto it = writeTransactions.find(owner);
+        if (it == writeTransactions.end()) return;
+        discarded = it->second.batch.writes.size();
+        writeTransactions.erase(it);
+    }
+    Log("Discarding " + std::to_string(discarded) + " uncommitted writes after a Lua error");
+}
+
+// Queues the batch if a transaction is open, otherwise applies it right away
+bool SubmitWrites(lua_State* L, WriteBatch& batch) {
+    WriteTransaction* transaction = GetWriteTransaction(L);
+    if (!transaction) {
+        return batch.Apply(virtualProtectProtector);
+    }
+
+    for (const auto& w : batch.writes) {
+        if (w.fill) {
+            transaction->batch.AddFill(w.address, w.fillValue, w.size);
+        }
+        else {
+            transaction->batch.Add(w.address, batch.data.data() + w.dataOffset, w.size);
+        }
+    }
+    return true;
+}
+
+// Memory.BeginWrite() - queue following writes until Memory.Commit()
+int lua_BeginWrite(lua_State* L) {
+    lua_State* owner = GetPluginState(L);
+    std::lock_guard<std::mutex> lock(writeTransactionsMutex);
+    writeTransactions[owner].depth++;
+    return 0;
+}
+
+// Memory.Commit() -> true if every queued write was applied
+int lua_CommitWrite(lua_State* L) {
+    WriteTransaction* transaction = GetWriteTransaction(L);
+    if (!transaction) {
+        return luaL_error(L, "Memory.Commit called without Memory.BeginWrite");
+    }
+
+    bool result = true;
+    if (--transaction->depth == 0) {
+        result = transaction->batch.Apply(virtualProtectProtector);
+        lua_State* owner = GetPluginState(L);
+        std::lock_guard<std::mutex> lock(writeTransactionsMutex);
+        writeTransactions.erase(owner);
+    }
+
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Memory.Fill(address, value, size)
+int lua_FillMemory(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    BYTE value = (BYTE)luaL_checkinteger(L, 2);
+    size_t size = (size_t)luaL_checkinteger(L, 3);
+
+    WriteBatch batch;
+    batch.AddFill(address, value, size);
+    lua_pushboolean(L, SubmitWrites(L, batch));
+    return 1;
+}
+
+// Memory.WriteBytes(address, bytes) - bytes is a Lua string such as one from Memory.ReadBytes
+int lua_WriteBytes(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t size;
+    const char* bytes = luaL_checklstring(L, 2, &size);
+
+    WriteBatch batch;
+    batch.Add(address, bytes, size);
+    lua_pushboolean(L, SubmitWrites(L, batch));
+    return 1;
+}
+
+// --- Struct Layouts ---
+// The layouts are in struct_layout.h
+
+// --- Plugin Memory Arena ---
+struct VirtualAllocChunkSource : ChunkSource {
+    void* Reserve(size_t size, bool executable) override {
+        void* memory = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE,
+            executable ? PAGE_EXECUTE_READWRITE : PAGE_READWRITE);
+        if (memory) protectionCache.Invalidate((uintptr_t)memory, size);
+        return memory;
+    }
+    void Release(void* memory, size_t size) override {
+        VirtualFree(memory, 0, MEM_RELEASE);
+        protectionCache.Invalidate((uintptr_t)memory, size);
+    }
+};
+
+VirtualAllocChunkSource virtualAllocChunkSource;
+
+// Each plugin owns its allocations so reloading it gives the memory back
+// Plugins are reloaded from the folder monitor thread, so the map is shared with the render thread
+std::unordered_map<lua_State*, std::unique_ptr<PluginArena>> pluginArenas;
+std::mutex pluginArenasMutex;
+
+PluginArena& GetPluginArena(lua_State* L) {
+    auto& arena = pluginArenas[GetPluginState(L)];
+    if (!arena) arena = std::make_unique<PluginArena>(virtualAllocChunkSource);
+    return *arena;
+}
+
+// The plugin's arena if it has allocated anything; call with pluginArenasMutex held
+PluginArena* FindPluginArena(lua_State* L) {
+    auto it = pluginArenas.find(GetPluginState(L));
+    return it != pluginArenas.end() ? it->second.get() : nullptr;
+}
+
+// Allocations made with owned = false, by base. They outlive the plugin that made them, so
+// any plugin may free them, for instance the same plugin after a reload.
+std::map<uintptr_t, size_t> unownedAllocations;
+
+// Closes a plugin's Lua state and drops everything the loader tracks for it
+void ReleasePluginState(lua_State* L) {
+    if (!L) return;
+    {
+        std::lock_guard<std::mutex> lock(writeTransactionsMutex);
+        writeTransactions.erase(L);
+    }
+    CancelAsyncScans(L);
+    RemovePluginHooks(L);
+    RemovePluginBreakpoints(L);
+    // Callbacks that got in before their hook or breakpoint went away finish first
+    std::shared_ptr<PluginGate> gate = GetPluginGate(L);
+    while (gate->inFlight > 0) Sleep(1);
+    lua_close(L);
+    {
+        std::lock_guard<std::mutex> lock(pluginGatesMutex);
+        pluginGates.erase(L);
+    }
+    // After lua_close so __gc handlers still see live memory
+    std::lock_guard<std::mutex> lock(pluginArenasMutex);
+    pluginArenas.erase(L);
+}
+
+int lua_WriteMemory(lua_State* L) {
+    DWORD64 address = (DWORD64)luaL_checkinteger(L, 1);
+    DWORD64 value = (DWORD64)luaL_checkinteger(L, 2);
+    size_t size = luaL_checkinteger(L, 3);
+    luaL_argcheck(L, size <= sizeof(value), 3, "size too large");
+
+    if (WriteTransaction* transaction = GetWriteTransaction(L)) {
+        transaction->batch.Add((uintptr_t)address, &value, size);
+        lua_pushboolean(L, true);
+        return 1;
+    }
+
+    bool result = PatchMemory((uintptr_t)address, &value, size);
+
+    lua_pushboolean(L, result);
+    return 1;
+}
+
+// Memory.AllocateMemory(size, executable = true, options)
+// Executable memory gets whole pages. With options.owned = false the pages come straight from
+// VirtualAlloc and outlive the plugin, for memory the game keeps pointers into.
+int lua_AllocateMemory(lua_State* L) {
+    size_t size = luaL_checkinteger(L, 1);
+    bool executable = lua_isnoneornil(L, 2) ? true : lua_toboolean(L, 2) != 0;
+    bool owned = true;
+    if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "owned");
+        owned = lua_isnil(L, -1) || lua_toboolean(L, -1);
+        lua_pop(L, 1);
+    }
+
+    void* memory = nullptr;
+    if (owned) {
+        std::lock_guard<std::mutex> lock(pluginArenasMutex);
+        memory = GetPluginArena(L).Allocate(size, executable, executable);
+    }
+    else {
+        size = std::max<size_t>(size, 1);
+        memory = virtualAllocChunkSource.Reserve(size, executable);
+        if (memory) {
+            std::lock_guard<std::mutex> lock(pluginArenasMutex);
+            unownedAllocations[(uintptr_t)memory] = size;
+        }
+    }
+    if (memory) {
+        lua_pushinteger(L, (lua_Integer)memory);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// Frees memory previously allocated with AllocateMemory. Anything else, including memory of
+// the game's own, is refused.
+int lua_FreeMemory(lua_State* L) {
+    uintptr_t memory = (uintptr_t)luaL_checkinteger(L, 1);
+    std::unique_lock<std::mutex> lock(pluginArenasMutex);
+    PluginArena* arena = FindPluginArena(L);
+    if (arena && arena->Free(memory)) {
+        lua_pushboolean(L, true);
+        return 1;
+    }
+    auto unowned = unownedAllocations.find(memory);
+    if (unowned == unownedAllocations.end()) {
+        lock.unlock();
+        Log("FreeMemory refused for 0x" + std::to_string(memory) + ": it was not allocated with AllocateMemory");
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    size_t size = unowned->second;
+    unownedAllocations.erase(unowned);
+    lock.unlock();
+    virtualAllocChunkSource.Release((void*)memory, size);
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+// Memory.GetAllocatorStats() - footprint of the calling plugin's arena
+int lua_GetAllocatorStats(lua_State* L) {
+    std::unique_lock<std::mutex> lock(pluginArenasMutex);
+    PluginArena* arena = FindPluginArena(L);
+    ArenaStats stats = arena ? arena->Stats() : ArenaStats();
+    lock.unlock();
+    double fragmentation = stats.reservedBytes ? 1.0 - (double)stats.liveBytes / stats.reservedBytes : 0.0;
+
+    lua_newtable(L);
+    lua_pushstring(L, "liveBytes"); lua_pushnumber(L, (lua_Number)stats.liveBytes); lua_settable(L, -3);
+    lua_pushstring(L, "blockBytes"); lua_pushnumber(L, (lua_Number)stats.blockBytes); lua_settable(L, -3);
+    lua_pushstring(L, "reservedBytes"); lua_pushnumber(L, (lua_Number)stats.reservedBytes); lua_settable(L, -3);
+    lua_pushstring(L, "allocations"); lua_pushnumber(L, (lua_Number)stats.allocations); lua_settable(L, -3);
+    lua_pushstring(L, "chunks"); lua_pushnumber(L, (lua_Number)stats.chunks); lua_settable(L, -3);
+    lua_pushstring(L, "fragmentation"); lua_pushnumber(L, fragmentation); lua_settable(L, -3);
+    return 1;
+}
+
+// Filtering and counters of one breakpoint. Table entries are copied on every change, so
+// they share this by pointer and the counters survive enabling and disabling.
+struct BreakpointState {
+    BreakpointCondition condition;
+    uint64_t every = 1;    // Call back on every Nth matching hit
+    uint64_t limit = 0;    // Disable after this many callbacks; 0 for no limit
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> matches{ 0 };
+    std::atomic<uint64_t> calls{ 0 };
+    std::atomic<int64_t> ticks{ 0 };  // Clock ticks spent handling hits
+    // Set by the hit that makes the last call. The exception handler can't change the table,
+    // so this disables the breakpoint until EnableBreakpoint clears it.
+    std::atomic<bool> disabled{ false };
+
+    enum Verdict { Skip, Call, CallLast };
+
+    Verdict Admit(const ProcessorRegisters& registers, DWORD eflags) {
+        hits++;
+        static_assert(sizeof(ProcessorRegisters) == (conditionRegisterCount - 1) * sizeof(DWORD), "register order");
+        uint32_t values[conditionRegisterCount];
+        memcpy(values, &registers, sizeof(registers));
+        values[conditionRegisterCount - 1] = eflags;
+        // Runs in the exception handler, so memory operands skip the protection cache, which
+        // locks and allocates on a miss; a bad address just faults inside the guarded copy
+        if (!EvaluateCondition(condition, values, [](uintptr_t address, void* dest, size_t size) {
+            return GuardedCopy(dest, (const void*)address, size);
+        })) {
+            return Skip;
+        }
+        if (++matches % every != 0) return Skip;
+        uint64_t call = ++calls;
+        if (!limit || call < limit) return Call;
+        return call == limit ? CallLast : Skip;
+    }
+};
+
+BreakpointTable<BreakpointInfo> breakpointTable;
+
+// --- Hit Context ---
+// The hit context is in hit_context.h
+
+// --- Breakpoint Hit Queue ---
+// Deferred breakpoints don't enter Lua on the game thread: the handler records the hit in
+// breakpointHits and the render thread hands the hits to the plugins once per frame.
+struct BreakpointHit {
+    DWORD address;
+    DWORD threadId;
+    ProcessorRegisters registers;
+    DWORD eflags;
+    int64_t time;  // Clock ticks
+};
+
+constexpr size_t hitQueueCapacity = 4096;  // Power of two
 
-int lua_GetModuleBase(lua_State* L) {
-    const char* moduleName = luaL_checkstring(L, 1);
-    HMODULE hModule = GetModuleHandleA(moduleName);
-    if (hModule) {
-        lua_pushinteger(L, (lua_Integer)hModule);
-    }
-    else {
-        lua_pushnil(L);
+BreakpointHitQueue<BreakpointHit, hitQueueCapacity> breakpointHits;
+
+// Breakpoints disabled by their call limit. The exception handler can't log, so it queues
+// them here and the render thread writes the log lines.
+struct SpentBreakpoint {
+    DWORD address;
+    uint64_t limit;
+};
+
+BreakpointHitQueue<SpentBreakpoint, 64> spentBreakpoints;
+uint64_t breakpointHitsDelivered = 0;
+
+// Called once per frame before OnFrame. Each queued hit calls its breakpoint's callback with
+// the address and a read-only hit context of the copied registers, thread and time. At most
+// one queue's worth is drained so a hot breakpoint can't keep the frame from finishing.
+// Hits of breakpoints removed or disabled since, or of plugins being replaced, are dropped.
+void PumpBreakpointHits() {
+    SpentBreakpoint spent;
+    while (spentBreakpoints.Pop(spent)) {
+        Log("Breakpoint at 0x" + std::to_string(spent.address) + " disabled after " + std::to_string(spent.limit) + " calls");
+    }
+
+    BreakpointHit hit;
+    for (size_t n = 0; n < hitQueueCapacity && breakpointHits.Pop(hit); n++) {
+        BreakpointInfo info;
+        if (!breakpointTable.Get(hit.address, info) || !info.active || !IsPluginLive(info.L)) continue;
+
+        lua_State* L = info.L;
+        auto gate = LockPluginState(L);
+        lua_getglobal(L, info.callbackName.c_str());
+        if (!lua_isfunction(L, -1)) {
+            lua_pop(L, 1);
+            continue;
+        }
+        HitFrame frame;
+        uint32_t* registers = (uint32_t*)&hit.registers;
+        for (size_t i = 0; i < eflagsRegister; i++) frame.registers[i] = &registers[i];
+        frame.registers[eflagsRegister] = (uint32_t*)&hit.eflags;
+        frame.readOnly = allRegistersReadOnly;
+        frame.address = hit.address;
+        frame.threadId = hit.threadId;
+        frame.time = hit.time;
+        Clock::time_point started = Clock::now();
+        CallHitCallback(L, frame, "breakpoint");
+        info.state->ticks += (Clock::now() - started).count();
+        breakpointHitsDelivered++;
     }
+}
+
+int lua_GetHitQueueStats(lua_State* L) {
+    lua_newtable(L);
+    lua_pushnumber(L, (lua_Number)breakpointHits.Pushed());
+    lua_setfield(L, -2, "queued");
+    lua_pushnumber(L, (lua_Number)breakpointHitsDelivered);
+    lua_setfield(L, -2, "delivered");
+    lua_pushnumber(L, (lua_Number)breakpointHits.Dropped());
+    lua_setfield(L, -2, "dropped");
+    lua_pushinteger(L, (lua_Integer)breakpointHits.Pending());
+    lua_setfield(L, -2, "pending");
+    lua_pushinteger(L, (lua_Integer)hitQueueCapacity);
+    lua_setfield(L, -2, "capacity");
     return 1;
 }
 
+// Registers of the hit whose callback is running, or those captured by the last frame
 int lua_GetRegisters(lua_State* L) {
     lua_newtable(L);
 
+    if (HitFrame* frame = CurrentHitFrame(L)) {
+        for (size_t i = 0; i < conditionRegisterCount; i++) {
+            lua_pushinteger(L, *frame->registers[i]);
+            lua_setfield(L, -2, conditionRegisterNames[i]);
+        }
+        return 1;
+    }
+
     lua_pushstring(L, "eax"); lua_pushinteger(L, currentRegisters.eax); lua_settable(L, -3);
     lua_pushstring(L, "ebx"); lua_pushinteger(L, currentRegisters.ebx); lua_settable(L, -3);
     lua_pushstring(L, "ecx"); lua_pushinteger(L, currentRegisters.ecx); lua_settable(L, -3);
@@ -417,32 +2392,65 @@ int lua_SetBreakpoint(lua_State* L) {
         callbackName = lua_tostring(L, 2);
     }
 
-    if (map_contains(breakpointInfo, address)) {
+    // Options: deferred, condition, every, limit
+    auto state = std::make_shared<BreakpointState>();
+    bool deferred = false;
+    if (lua_istable(L, 3)) {
+        lua_getfield(L, 3, "deferred");
+        deferred = lua_toboolean(L, -1) != 0;
+        lua_pop(L, 1);
+
+        lua_getfield(L, 3, "condition");
+        if (lua_isstring(L, -1)) {
+            state->condition.source = lua_tostring(L, -1);
+            std::string error;
+            if (!ConditionCompiler(state->condition.source).Compile(state->condition.program, error)) {
+                return luaL_argerror(L, 3, ("bad condition: " + error).c_str());
+            }
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, 3, "every");
+        state->every = lua_isnumber(L, -1) ? (uint64_t)std::max<lua_Integer>(1, lua_tointeger(L, -1)) : 1;
+        lua_pop(L, 1);
+
+        lua_getfield(L, 3, "limit");
+        state->limit = lua_isnumber(L, -1) ? (uint64_t)std::max<lua_Integer>(0, lua_tointeger(L, -1)) : 0;
+        lua_pop(L, 1);
+    }
+
+    if (breakpointTable.Contains(address)) {
         Log("Breakpoint already exists at 0x" + std::to_string(address));
         lua_pushboolean(L, true);
         return 1;
     }
 
+    if (IsHooked(address)) {
+        Log("Cannot set breakpoint at 0x" + std::to_string(address) + ": a hook's jump covers it");
+        lua_pushboolean(L, false);
+        return 1;
+    }
+
     BYTE origByte;
-    DWORD oldProtect;
     BOOL success = FALSE;
 
-    VirtualProtect(reinterpret_cast<LPVOID>(address), 1, PAGE_EXECUTE_READWRITE, &oldProtect);
-
-    if (ReadProcessMemory(GetCurrentProcess(), reinterpret_cast<LPCVOID>(address),
-        &origByte, 1, nullptr)) {
-        BYTE int3 = 0xCC;
-        if (WriteProcessMemory(GetCurrentProcess(), reinterpret_cast<LPVOID>(address),
-            &int3, 1, nullptr)) {
-            success = TRUE;
-            BreakpointInfo info = { origByte, callbackName, true, L };
-            breakpointInfo[address] = info;
-            Log("Breakpoint set at 0x" + std::to_string(address) + " callback: " + callbackName);
-        }
+    if (ReadBlock(address, &origByte, 1)) {
+        // Published before the INT3 goes in, so a thread can never hit an unknown breakpoint
+        lua_State* owner = GetPluginState(L);
+        BreakpointInfo info = { origByte, callbackName, true, owner, deferred, state, GetPluginGate(owner) };
+        breakpointTable.Exclusive([&] {
+            breakpointTable.Set(address, info);
+            BYTE int3 = 0xCC;
+            if (PatchMemory(address, &int3, 1)) {
+                success = TRUE;
+            }
+            else {
+                breakpointTable.Erase(address);
+            }
+        });
+        if (success) Log("Breakpoint set at 0x" + std::to_string(address) + " callback: " + callbackName);
     }
 
-    VirtualProtect(reinterpret_cast<LPVOID>(address), 1, oldProtect, &oldProtect);
-
     lua_pushboolean(L, success);
     return 1;
 }
@@ -450,66 +2458,76 @@ int lua_SetBreakpoint(lua_State* L) {
 int lua_RemoveBreakpoint(lua_State* L) {
     DWORD address = static_cast<DWORD>(luaL_checkinteger(L, 1));
 
-    if (!map_contains(breakpointInfo, address)) {
-        lua_pushboolean(L, false);
-        return 1;
-    }
-
-    BYTE origByte = breakpointInfo[address].originalByte;
-    DWORD oldProtect;
     BOOL success = FALSE;
 
-    VirtualProtect(reinterpret_cast<LPVOID>(address), 1, PAGE_EXECUTE_READWRITE, &oldProtect);
-
-    if (WriteProcessMemory(GetCurrentProcess(), reinterpret_cast<LPVOID>(address),
-        &origByte, 1, nullptr)) {
-        success = TRUE;
-        Log("Breakpoint removed from 0x" + std::to_string(address));
-        breakpointInfo.erase(address);
-    }
-
-    VirtualProtect(reinterpret_cast<LPVOID>(address), 1, oldProtect, &oldProtect);
+    // The original byte goes back before the entry is dropped, for the same reason, and
+    // under the table lock so a thread stepping over it can't write the INT3 back
+    breakpointTable.Exclusive([&] {
+        BreakpointInfo info;
+        if (breakpointTable.Get(address, info) && PatchMemory(address, &info.originalByte, 1)) {
+            breakpointTable.Erase(address);
+            success = TRUE;
+        }
+    });
+    if (success) Log("Breakpoint removed from 0x" + std::to_string(address));
 
     lua_pushboolean(L, success);
     return 1;
 }
 
+// Unpatches and drops every breakpoint set by a plugin that is being closed, so neither the
+// handler nor the hit queue hands a hit to its state afterwards
+void RemovePluginBreakpoints(lua_State* L) {
+    breakpointTable.Exclusive([&] {
+        for (auto& pair : breakpointTable.Snapshot()) {
+            if (pair.second.L != L) continue;
+            PatchMemory(pair.first, &pair.second.originalByte, 1);
+            breakpointTable.Erase(pair.first);
+        }
+    });
+}
+
 int lua_EnableBreakpoint(lua_State* L) {
     DWORD address = static_cast<DWORD>(luaL_checkinteger(L, 1));
     bool enable = lua_toboolean(L, 2);
 
-    if (!map_contains(breakpointInfo, address)) {
-        lua_pushboolean(L, false);
-        return 1;
-    }
-
     BOOL success = FALSE;
-    DWORD oldProtect;
 
-    VirtualProtect(reinterpret_cast<LPVOID>(address), 1, PAGE_EXECUTE_READWRITE, &oldProtect);
+    // Under the table lock, like RemoveBreakpoint
+    breakpointTable.Exclusive([&] {
+        BreakpointInfo info;
+        if (!breakpointTable.Get(address, info)) return;
 
-    if (enable && !breakpointInfo[address].active) {
-        BYTE int3 = 0xCC;
-        if (WriteProcessMemory(GetCurrentProcess(), reinterpret_cast<LPVOID>(address),
-            &int3, 1, nullptr)) {
-            breakpointInfo[address].active = true;
-            success = TRUE;
-            Log("Breakpoint enabled at 0x" + std::to_string(address));
+        // One that reached its call limit starts a new run of calls
+        if (enable && (!info.active || info.state->disabled)) {
+            if (info.state->disabled) {
+                info.state->calls = 0;
+                info.state->disabled = false;
+            }
+            info.active = true;
+            breakpointTable.Set(address, info);
+            BYTE int3 = 0xCC;
+            if (PatchMemory(address, &int3, 1)) {
+                success = TRUE;
+                Log("Breakpoint enabled at 0x" + std::to_string(address));
+            }
+            else {
+                info.active = false;
+                breakpointTable.Set(address, info);
+            }
         }
-    }
-    else if (!enable && breakpointInfo[address].active) {
-        if (WriteProcessMemory(GetCurrentProcess(), reinterpret_cast<LPVOID>(address),
-            &breakpointInfo[address].originalByte, 1, nullptr)) {
-            breakpointInfo[address].active = false;
+        else if (!enable && info.active) {
+            if (PatchMemory(address, &info.originalByte, 1)) {
+                info.active = false;
+                breakpointTable.Set(address, info);
+                success = TRUE;
+                Log("Breakpoint disabled at 0x" + std::to_string(address));
+            }
+        }
+        else {
             success = TRUE;
-            Log("Breakpoint disabled at 0x" + std::to_string(address));
         }
-    }
-    else {
-        success = TRUE;
-    }
-
-    VirtualProtect(reinterpret_cast<LPVOID>(address), 1, oldProtect, &oldProtect);
+    });
 
     lua_pushboolean(L, success);
     return 1;
@@ -519,7 +2537,7 @@ int lua_ListBreakpoints(lua_State* L) {
     lua_newtable(L);
     int index = 1;
 
-    for (const auto& pair : breakpointInfo) {
+    for (const auto& pair : breakpointTable.Snapshot()) {
         DWORD address = pair.first;
         const BreakpointInfo& info = pair.second;
 
@@ -531,13 +2549,35 @@ int lua_ListBreakpoints(lua_State* L) {
         lua_settable(L, -3);
 
         lua_pushstring(L, "active");
-        lua_pushboolean(L, info.active);
+        lua_pushboolean(L, info.active && !info.state->disabled);
         lua_settable(L, -3);
 
         lua_pushstring(L, "callback");
         lua_pushstring(L, info.callbackName.c_str());
         lua_settable(L, -3);
 
+        lua_pushstring(L, "deferred");
+        lua_pushboolean(L, info.deferred);
+        lua_settable(L, -3);
+
+        const BreakpointState& state = *info.state;
+        if (!state.condition.source.empty()) {
+            lua_pushstring(L, state.condition.source.c_str());
+            lua_setfield(L, -2, "condition");
+        }
+        lua_pushnumber(L, (lua_Number)state.every);
+        lua_setfield(L, -2, "every");
+        lua_pushnumber(L, (lua_Number)state.limit);
+        lua_setfield(L, -2, "limit");
+        lua_pushnumber(L, (lua_Number)state.hits.load());
+        lua_setfield(L, -2, "hits");
+        lua_pushnumber(L, (lua_Number)state.matches.load());
+        lua_setfield(L, -2, "matches");
+        lua_pushnumber(L, (lua_Number)state.calls.load());
+        lua_setfield(L, -2, "calls");
+        lua_pushnumber(L, std::chrono::duration<double>(Clock::duration(state.ticks.load())).count());
+        lua_setfield(L, -2, "seconds");
+
         lua_settable(L, -3);
     }
 
@@ -549,19 +2589,291 @@ int lua_ProtectMemory(lua_State* L) {
     DWORD64 address = (DWORD64)luaL_checkinteger(L, 1);
     size_t size = luaL_checkinteger(L, 2);
     DWORD newProtect = luaL_checkinteger(L, 3);
-    DWORD oldProtect;
+    DWORD oldProtect = 0;
+
+    // A small arena block shares its page with other allocations of the plugin
+    std::unique_lock<std::mutex> lock(pluginArenasMutex);
+    auto arena = pluginArenas.find(GetPluginState(L));
+    if (size && arena != pluginArenas.end() && arena->second->SharesPage((uintptr_t)address, size)) {
+        lock.unlock();
+        Log("ProtectMemory refused for 0x" + std::to_string(address) + ": the range shares a page with other allocations");
+        lua_pushboolean(L, false);
+        lua_pushinteger(L, 0);
+        return 2;
+    }
+    lock.unlock();
 
     BOOL result = VirtualProtect((LPVOID)address, size, newProtect, &oldProtect);
+    protectionCache.Invalidate((uintptr_t)address, size);
 
     lua_pushboolean(L, result);
     lua_pushinteger(L, oldProtect);
     return 2;
 }
 
+// --- Detour Hooks ---
+// A hook sends execution at address through a small stub instead of an INT3. The stub saves
+// the registers, flags and FPU/SSE state on the stack, calls DispatchHook with them and jumps
+// to a MinHook trampoline that runs the relocated instructions, so a hit never leaves user mode.
+
+struct DetourHook {
+    DWORD address = 0;
+    BYTE* stub = nullptr;
+    void* trampoline = nullptr;  // Read by the stub through its jmp [trampoline]
+    std::atomic<bool> active{ false };
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> skipped{ 0 };  // Hits dropped because the plugin was busy
+    std::mutex lock;             // Guards the fields below against SetHook reusing the hook
+    lua_State* L = nullptr;
+    std::shared_ptr<PluginGate> gate;
+    std::string callbackName;    // Global looked up on each hit when callbackRef is unset
+    int callbackRef = LUA_NOREF;
+};
+
+// Hooks are never freed while the DLL is loaded: a thread can still be inside a removed
+// hook's stub or trampoline, so removing one only disables it and SetHook reuses it
+std::map<DWORD, std::unique_ptr<DetourHook>> detourHooks;
+std::mutex detourHooksMutex;
+PluginArena hookStubArena(virtualAllocChunkSource);
+// Callback references of disabled hooks. The owning plugin may be running on another thread
+// when a hook is disabled, so they are released by the render thread under its gate.
+std::vector<std::pair<lua_State*, int>> staleHookRefs;
+
+// True if address lies in the bytes an active hook's jump overwrites
+bool IsHooked(DWORD address) {
+    std::lock_guard<std::mutex> lock(detourHooksMutex);
+    auto it = detourHooks.upper_bound(address);
+    while (it != detourHooks.begin()) {
+        --it;
+        if (it->first + hookPatchSize <= address) break;
+        if (it->second->active) return true;
+    }
+    return false;
+}
+
+void __cdecl DispatchHook(DetourHook* hook, HookContext* context, BYTE* fxsave) {
+    hook->hits++;
+    if (insideBreakpointCallback || !hook->active) return;
+
+    std::shared_ptr<PluginGate> gate;
+    {
+        std::lock_guard<std::mutex> guard(hook->lock);
+        gate = hook->gate;
+    }
+    if (!gate) return;
+    if (!TryEnterPlugin(*gate)) {
+        hook->skipped++;
+        return;
+    }
+    // Inside the gate the callback can't be released, and once counted in inFlight the
+    // state isn't closed; both only hold if the hook is still ours
+    lua_State* L = nullptr;
+    int callbackRef = LUA_NOREF;
+    std::string callbackName;
+    {
+        std::lock_guard<std::mutex> guard(hook->lock);
+        if (hook->active && hook->gate == gate) {
+            L = hook->L;
+            callbackRef = hook->callbackRef;
+            if (callbackRef == LUA_NOREF) callbackName = hook->callbackName;
+        }
+    }
+    if (!L) {
+        LeavePlugin(*gate);
+        return;
+    }
+    insideBreakpointCallback = true;
+
+    if (callbackRef != LUA_NOREF) {
+        lua_rawgeti(L, LUA_REGISTRYINDEX, callbackRef);
+    }
+    else {
+        lua_getglobal(L, callbackName.c_str());
+    }
+    if (lua_isfunction(L, -1)) {
+        // popad skips the saved esp, and eip is wherever the trampoline goes
+        uint32_t esp = context->esp + 4;
+        uint32_t eip = hook->address;
+        HitFrame frame;
+        uint32_t* slots[conditionRegisterCount] = { (uint32_t*)&context->eax, (uint32_t*)&context->ebx,
+            (uint32_t*)&context->ecx, (uint32_t*)&context->edx, (uint32_t*)&context->esi, (uint32_t*)&context->edi,
+            (uint32_t*)&context->ebp, &esp, &eip, (uint32_t*)&context->eflags };
+        std::copy(slots, slots + conditionRegisterCount, frame.registers);
+        frame.readOnly = (1u << espRegister) | (1u << eipRegister);
+        frame.fxsave = fxsave;
+        frame.address = hook->address;
+        frame.threadId = GetCurrentThreadId();
+        frame.time = Clock::now().time_since_epoch().count();
+        CallHitCallback(L, frame, "hook");
+    }
+    else {
+        lua_pop(L, 1);
+        Log("Hook callback function not found: " + callbackName);
+    }
+
+    insideBreakpointCallback = false;
+    LeavePlugin(*gate);
+}
+
+// Drops the callback and sends the hooked code straight through again; call with
+// detourHooksMutex held
+void DisableHook(DetourHook& hook) {
+    if (!hook.active) return;
+    MH_DisableHook((LPVOID)hook.address);
+    std::lock_guard<std::mutex> guard(hook.lock);
+    hook.active = false;
+    if (hook.callbackRef != LUA_NOREF) staleHookRefs.push_back({ hook.L, hook.callbackRef });
+    hook.callbackRef = LUA_NOREF;
+}
+
+// Render thread, once per frame
+void ReleaseStaleHookRefs() {
+    std::vector<std::pair<lua_State*, int>> stale;
+    {
+        std::lock_guard<std::mutex> lock(detourHooksMutex);
+        stale.swap(staleHookRefs);
+    }
+    for (const auto& ref : stale) {
+        auto gate = LockPluginState(ref.first);
+        luaL_unref(ref.first, LUA_REGISTRYINDEX, ref.second);
+    }
+}
+
+// Called before a plugin's state is closed. Its references go with the state.
+void RemovePluginHooks(lua_State* L) {
+    std::lock_guard<std::mutex> lock(detourHooksMutex);
+    for (auto& pair : detourHooks) {
+        if (pair.second->L == L) DisableHook(*pair.second);
+    }
+    staleHookRefs.erase(std::remove_if(staleHookRefs.begin(), staleHookRefs.end(),
+        [L](const std::pair<lua_State*, int>& ref) { return ref.first == L; }), staleHookRefs.end());
+}
+
+int lua_SetHook(lua_State* L) {
+    DWORD address = static_cast<DWORD>(luaL_checkinteger(L, 1));
+    luaL_argcheck(L, lua_isfunction(L, 2) || lua_isstring(L, 2), 2, "function or global name expected");
+    lua_State* owner = GetPluginState(L);
+
+    // The jump covers hookPatchSize bytes, and an INT3 or another jump inside them would be
+    // overwritten or cut in half
+    for (DWORD offset = 0; offset < hookPatchSize; offset++) {
+        if (breakpointTable.Contains(address + offset)) {
+            Log("Cannot hook 0x" + std::to_string(address) + ": a breakpoint is set at 0x" + std::to_string(address + offset));
+            lua_pushboolean(L, false);
+            return 1;
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(detourHooksMutex);
+    for (auto it = detourHooks.lower_bound(address - (hookPatchSize - 1));
+         it != detourHooks.end() && it->first < address + hookPatchSize; ++it) {
+        if (it->first != address && it->second->active) {
+            Log("Cannot hook 0x" + std::to_string(address) + ": it overlaps the hook at 0x" + std::to_string(it->first));
+            lua_pushboolean(L, false);
+            return 1;
+        }
+    }
+    auto& hook = detourHooks[address];
+    if (!hook) {
+        MH_STATUS status = MH_Initialize();
+        if (status != MH_OK && status != MH_ERROR_ALREADY_INITIALIZED) {
+            detourHooks.erase(address);
+            lua_pushboolean(L, false);
+            return 1;
+        }
+
+        auto created = std::make_unique<DetourHook>();
+        created->address = address;
+        created->stub = (BYTE*)hookStubArena.Allocate(hookStubSize, true);
+        // MinHook relocates the instructions the jump overwrites into the trampoline
+        if (!created->stub ||
+            MH_CreateHook((LPVOID)address, created->stub, &created->trampoline) != MH_OK) {
+            if (created->stub) hookStubArena.Free((uintptr_t)created->stub);
+            detourHooks.erase(address);
+            Log("Cannot hook 0x" + std::to_string(address) + ": instructions could not be relocated");
+            lua_pushboolean(L, false);
+            return 1;
+        }
+        EmitHookStub(created->stub, (uintptr_t)created->stub, (uintptr_t)created.get(),
+            (uintptr_t)&DispatchHook, (uintptr_t)&created->trampoline);
+        FlushInstructionCache(GetCurrentProcess(), created->stub, hookStubSize);
+        hook = std::move(created);
+    }
+
+    DisableHook(*hook);
+    {
+        std::lock_guard<std::mutex> guard(hook->lock);
+        hook->L = owner;
+        hook->gate = GetPluginGate(owner);
+        if (lua_isfunction(L, 2)) {
+            lua_pushvalue(L, 2);
+            lua_xmove(L, owner, 1);
+            hook->callbackRef = luaL_ref(owner, LUA_REGISTRYINDEX);
+            hook->callbackName = "<function>";
+        }
+        else {
+            hook->callbackName = lua_tostring(L, 2);
+        }
+        hook->active = true;
+    }
+
+    bool success = MH_EnableHook((LPVOID)address) == MH_OK;
+    if (success) {
+        Log("Hook set at 0x" + std::to_string(address) + " callback: " + hook->callbackName);
+    }
+    else {
+        DisableHook(*hook);
+    }
+    lua_pushboolean(L, success);
+    return 1;
+}
+
+int lua_RemoveHook(lua_State* L) {
+    DWORD address = static_cast<DWORD>(luaL_checkinteger(L, 1));
+
+    std::lock_guard<std::mutex> lock(detourHooksMutex);
+    auto it = detourHooks.find(address);
+    if (it == detourHooks.end() || !it->second->active) {
+        lua_pushboolean(L, false);
+        return 1;
+    }
+    DisableHook(*it->second);
+    Log("Hook removed from 0x" + std::to_string(address));
+    lua_pushboolean(L, true);
+    return 1;
+}
+
+int lua_ListHooks(lua_State* L) {
+    lua_newtable(L);
+    int index = 1;
+
+    std::lock_guard<std::mutex> lock(detourHooksMutex);
+    for (const auto& pair : detourHooks) {
+        const DetourHook& hook = *pair.second;
+        if (!hook.active) continue;
+
+        lua_newtable(L);
+        lua_pushinteger(L, (lua_Integer)hook.address);
+        lua_setfield(L, -2, "address");
+        lua_pushstring(L, hook.callbackName.c_str());
+        lua_setfield(L, -2, "callback");
+        lua_pushnumber(L, (lua_Number)hook.hits.load());
+        lua_setfield(L, -2, "hits");
+        lua_pushnumber(L, (lua_Number)hook.skipped.load());
+        lua_setfield(L, -2, "skipped");
+        lua_rawseti(L, -2, index++);
+    }
+    return 1;
+}
+
 // --- Lua API Setup ---
 void SetupLuaKeyboardAPI(lua_State* L) {
     if (!L) return;
 
+    // Remember the owning state so API calls made from coroutines can find their plugin
+    lua_pushlightuserdata(L, L);
+    lua_setfield(L, LUA_REGISTRYINDEX, "PluginState");
+
     // Keyboard API
     lua_newtable(L);
 
@@ -613,20 +2925,113 @@ void SetupLuaKeyboardAPI(lua_State* L) {
     lua_setglobal(L, "Keys");
 
     // Memory API
+    RegisterMemoryView(L);
+    RegisterHitContext(L);
+    RegisterPointerChain(L);
+    RegisterMemorySnapshot(L);
+    RegisterMemoryStruct(L);
+    RegisterScanJob(L);
+    RegisterPointerIndex(L);
+    RegisterStringDictionary(L);
+    RegisterValueScan(L);
     lua_newtable(L);
 
     lua_pushstring(L, "ReadMemory");
     lua_pushcfunction(L, lua_ReadMemory);
     lua_settable(L, -3);
 
+    lua_pushstring(L, "ReadBytes");
+    lua_pushcfunction(L, lua_ReadBytes);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "ReadCString");
+    lua_pushcfunction(L, lua_ReadCString);
+    lua_settable(L, -3);
+
     lua_pushstring(L, "WriteMemory");
     lua_pushcfunction(L, lua_WriteMemory);
     lua_settable(L, -3);
 
+    lua_pushstring(L, "View");
+    lua_pushcfunction(L, lua_CreateView);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "Chain");
+    lua_pushcfunction(L, lua_CreateChain);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "Snapshot");
+    lua_pushcfunction(L, lua_CreateSnapshot);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "Diff");
+    lua_pushcfunction(L, lua_DiffSnapshots);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "DefineStruct");
+    lua_pushcfunction(L, lua_DefineStruct);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "WriteBytes");
+    lua_pushcfunction(L, lua_WriteBytes);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "Fill");
+    lua_pushcfunction(L, lua_FillMemory);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "BeginWrite");
+    lua_pushcfunction(L, lua_BeginWrite);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "Commit");
+    lua_pushcfunction(L, lua_CommitWrite);
+    lua_settable(L, -3);
+
     lua_pushstring(L, "GetModuleBase");
     lua_pushcfunction(L, lua_GetModuleBase);
     lua_settable(L, -3);
 
+    lua_pushstring(L, "GetSection");
+    lua_pushcfunction(L, lua_GetSection);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "GetExport");
+    lua_pushcfunction(L, lua_GetExport);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "FindPattern");
+    lua_pushcfunction(L, lua_FindPattern);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "FindAll");
+    lua_pushcfunction(L, lua_FindAll);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "FindPatternCached");
+    lua_pushcfunction(L, lua_FindPatternCached);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "FindPatternAsync");
+    PushAsyncScanFunction(L, lua_FindPatternAsync);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "PointerIndex");
+    lua_pushcfunction(L, lua_CreatePointerIndex);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "Strings");
+    lua_pushcfunction(L, lua_CreateStringDictionary);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "ValueScan");
+    lua_pushcfunction(L, lua_CreateValueScan);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "GetScanStats");
+    lua_pushcfunction(L, lua_GetScanStats);
+    lua_settable(L, -3);
+
     lua_pushstring(L, "AllocateMemory");
     lua_pushcfunction(L, lua_AllocateMemory);
     lua_settable(L, -3);
@@ -636,12 +3041,41 @@ void SetupLuaKeyboardAPI(lua_State* L) {
     lua_pushcfunction(L, lua_FreeMemory);
     lua_settable(L, -3);
 
+    lua_pushstring(L, "GetAllocatorStats");
+    lua_pushcfunction(L, lua_GetAllocatorStats);
+    lua_settable(L, -3);
+
     lua_pushstring(L, "ProtectMemory");
     lua_pushcfunction(L, lua_ProtectMemory);
     lua_settable(L, -3);
 
+    lua_pushstring(L, "GetProtectionStats");
+    lua_pushcfunction(L, lua_GetProtectionStats);
+    lua_settable(L, -3);
+
     lua_setglobal(L, "Memory");
 
+    // Game API, backed by indexes shared between plugins
+    lua_newtable(L);
+
+    lua_pushstring(L, "IndexDatabase");
+    lua_pushcfunction(L, lua_IndexDatabase);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "GetTracks");
+    lua_pushcfunction(L, lua_GetTracks);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "FindTrack");
+    lua_pushcfunction(L, lua_FindTrack);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "FindTracks");
+    lua_pushcfunction(L, lua_FindTracks);
+    lua_settable(L, -3);
+
+    lua_setglobal(L, "Game");
+
     // Registers API
     lua_newtable(L);
 
@@ -674,6 +3108,22 @@ void SetupLuaKeyboardAPI(lua_State* L) {
     lua_pushcfunction(L, lua_ListBreakpoints);
     lua_settable(L, -3);
 
+    lua_pushstring(L, "SetHook");
+    lua_pushcfunction(L, lua_SetHook);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "RemoveHook");
+    lua_pushcfunction(L, lua_RemoveHook);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "ListHooks");
+    lua_pushcfunction(L, lua_ListHooks);
+    lua_settable(L, -3);
+
+    lua_pushstring(L, "GetHitQueueStats");
+    lua_pushcfunction(L, lua_GetHitQueueStats);
+    lua_settable(L, -3);
+
     // Set the Debug table globally
     lua_setglobal(L, "Debug");
 
@@ -688,6 +3138,46 @@ void RebuildPluginsVector() {
     }
 }
 
+// The folder monitor replaces plugins on its own thread while the render thread may still be
+// running the old state from the plugins vector. Replaced states are parked here and closed
+// by the render thread once the vector no longer holds them.
+std::vector<lua_State*> retiredPluginStates;
+std::mutex retiredPluginStatesMutex;
+
+void RetirePluginState(lua_State* L) {
+    if (!L) return;
+    std::lock_guard<std::mutex> lock(retiredPluginStatesMutex);
+    retiredPluginStates.push_back(L);
+}
+
+// Render thread, before any plugin code runs for the frame
+void CloseRetiredPluginStates() {
+    std::vector<lua_State*> closing;
+    {
+        std::lock_guard<std::mutex> lock(retiredPluginStatesMutex);
+        for (auto it = retiredPluginStates.begin(); it != retiredPluginStates.end();) {
+            bool inUse = std::any_of(plugins.begin(), plugins.end(),
+                [&](const Plugin& plugin) { return plugin.L == *it; });
+            if (inUse) {
+                ++it;
+                continue;
+            }
+            closing.push_back(*it);
+            it = retiredPluginStates.erase(it);
+        }
+    }
+    for (lua_State* L : closing) ReleasePluginState(L);
+}
+
+// Render thread. True if L is a loaded plugin's state that isn't waiting to be closed.
+bool IsPluginLive(lua_State* L) {
+    if (!L) return false;
+    bool loaded = std::any_of(plugins.begin(), plugins.end(), [&](const Plugin& plugin) { return plugin.L == L; });
+    if (!loaded) return false;
+    std::lock_guard<std::mutex> lock(retiredPluginStatesMutex);
+    return std::find(retiredPluginStates.begin(), retiredPluginStates.end(), L) == retiredPluginStates.end();
+}
+
 void LoadPluginsWithoutExecution() {
     std::unordered_map<std::string, Plugin> newPlugins;
 
@@ -812,7 +3302,7 @@ void UpdateSinglePlugin(const std::string& baseName) {
         if (map_contains(loadedPlugins, baseName)) {
             Log("Plugin removed: " + baseName);
             if (loadedPlugins[baseName].L) {
-                lua_close(loadedPlugins[baseName].L);
+                RetirePluginState(loadedPlugins[baseName].L);
             }
             loadedPlugins.erase(baseName);
             lastPluginState.erase(baseName);
@@ -831,7 +3321,7 @@ void UpdateSinglePlugin(const std::string& baseName) {
 
     // (Re)create Lua state for this plugin
     if (plugin.L) {
-        lua_close(plugin.L);
+        RetirePluginState(plugin.L);
     }
     plugin.L = luaL_newstate();
     if (plugin.L) {
@@ -854,10 +3344,14 @@ void UpdateSinglePlugin(const std::string& baseName) {
     }
 
     if (!isChanged) {
+        RetirePluginState(plugin.L);
         return;
     }
 
     bool isNew = !map_contains(loadedPlugins, baseName);
+    if (!isNew && loadedPlugins[baseName].L) {
+        RetirePluginState(loadedPlugins[baseName].L);
+    }
 
     try {
         Log("Executing updated plugin: " + plugin.name);
@@ -926,83 +3420,152 @@ void MonitorDirectoryChanges(const std::string& directory) {
 }
 
 // --- Exception Handler for Breakpoints ---
-LONG CALLBACK BreakpointExceptionHandler(EXCEPTION_POINTERS* ExceptionInfo) {
-    if (ExceptionInfo->ExceptionRecord->ExceptionCode == EXCEPTION_BREAKPOINT) {
-        // Get the exception address (where INT3 was triggered)
-        DWORD exceptionAddress = (DWORD)ExceptionInfo->ExceptionRecord->ExceptionAddress;
-
-        // Check if this is our breakpoint
-        if (map_contains(breakpointInfo, exceptionAddress) &&
-            breakpointInfo[exceptionAddress].active && !insideBreakpointHandler) {
-
-            insideBreakpointHandler = true; // Prevent recursion
-
-            // Temporarily restore the original byte
-            BYTE origByte = breakpointInfo[exceptionAddress].originalByte;
-            DWORD oldProtect;
-            VirtualProtect((LPVOID)exceptionAddress, 1, PAGE_EXECUTE_READWRITE, &oldProtect);
-            WriteProcessMemory(GetCurrentProcess(), (LPVOID)exceptionAddress, &origByte, 1, nullptr);
-            VirtualProtect((LPVOID)exceptionAddress, 1, oldProtect, &oldProtect);
-
-            // Save current registers from exception context
-            currentRegisters.eax = ExceptionInfo->ContextRecord->Eax;
-            currentRegisters.ebx = ExceptionInfo->ContextRecord->Ebx;
-            currentRegisters.ecx = ExceptionInfo->ContextRecord->Ecx;
-            currentRegisters.edx = ExceptionInfo->ContextRecord->Edx;
-            currentRegisters.esi = ExceptionInfo->ContextRecord->Esi;
-            currentRegisters.edi = ExceptionInfo->ContextRecord->Edi;
-            currentRegisters.ebp = ExceptionInfo->ContextRecord->Ebp;
-            currentRegisters.esp = ExceptionInfo->ContextRecord->Esp;
-            currentRegisters.eip = exceptionAddress;
-
-            Log("Breakpoint hit at 0x" + std::to_string(exceptionAddress));
-
-            // Call Lua callback using the plugin's Lua state
-            lua_State* cbState = breakpointInfo[exceptionAddress].L;
-            if (cbState) {
-                std::string callbackName = breakpointInfo[exceptionAddress].callbackName;
-                lua_getglobal(cbState, callbackName.c_str());
-                if (lua_isfunction(cbState, -1)) {
-                    lua_pushinteger(cbState, exceptionAddress);
-                    if (lua_pcall(cbState, 1, 0, 0) != 0) {
-                        std::string error = lua_tostring(cbState, -1);
-                        Log("Error in breakpoint callback: " + error);
-                        lua_pop(cbState, 1);
-                    }
-                }
-                else {
-                    lua_pop(cbState, 1); // Pop non-function
-                    Log("Breakpoint callback function not found: " + callbackName);
+struct VehBreakpointHost : BreakpointHost {
+    bool IsArmed(uintptr_t address, BYTE& originalByte) override {
+        bool active = false;
+        breakpointTable.Lookup((DWORD)address, [&](const BreakpointInfo& info) {
+            active = info.active && !info.state->disabled;
+            originalByte = info.originalByte;
+        });
+        return active;
+    }
+
+    void OnHit(uintptr_t address, TrapFrame& frame) override {
+        // Only the filtering state is copied on every hit; the rest once a hit gets through
+        std::shared_ptr<BreakpointState> state;
+        if (!breakpointTable.Lookup((DWORD)address, [&](const BreakpointInfo& info) { state = info.state; })) return;
+        Clock::time_point started = Clock::now();
+
+        CONTEXT* context = (CONTEXT*)frame.native;
+        ProcessorRegisters registers;
+        registers.eax = context->Eax;
+        registers.ebx = context->Ebx;
+        registers.ecx = context->Ecx;
+        registers.edx = context->Edx;
+        registers.esi = context->Esi;
+        registers.edi = context->Edi;
+        registers.ebp = context->Ebp;
+        registers.esp = context->Esp;
+        registers.eip = (DWORD)address;
+
+        BreakpointState::Verdict verdict = state->Admit(registers, frame.flags);
+        if (verdict != BreakpointState::Skip) {
+            Deliver(address, registers, frame);
+        }
+        if (verdict == BreakpointState::CallLast) {
+            // The original byte is already back and the single step won't rearm a disabled entry
+            state->disabled = true;
+            spentBreakpoints.Push({ (DWORD)address, state->limit });
+        }
+        state->ticks += (Clock::now() - started).count();
+    }
+
+    void Deliver(uintptr_t address, const ProcessorRegisters& registers, TrapFrame& frame) {
+        // A deferred hit must not allocate, so the callback name is only copied by whoever
+        // calls back: PumpBreakpointHits, or the synchronous path below once it has the gate
+        bool deferred = false;
+        lua_State* cbState = nullptr;
+        std::shared_ptr<PluginGate> gate;
+        if (!breakpointTable.Lookup((DWORD)address, [&](const BreakpointInfo& info) {
+            deferred = info.deferred;
+            cbState = info.L;
+            if (!deferred) gate = info.gate;
+        })) {
+            return;
+        }
+
+        if (deferred) {
+            BreakpointHit hit = { (DWORD)address, GetCurrentThreadId(), registers, frame.flags,
+                Clock::now().time_since_epoch().count() };
+            breakpointHits.Push(hit);
+            return;
+        }
+
+        // The callback runs on this thread, so only while the plugin isn't running elsewhere.
+        // Once counted in inFlight, an entry that is still there keeps the state open.
+        if (!cbState || !gate || !TryEnterPlugin(*gate)) return;
+        bool ours = false;
+        std::string callbackName;
+        breakpointTable.Lookup((DWORD)address, [&](const BreakpointInfo& current) {
+            ours = current.L == cbState;
+            if (ours) callbackName = current.callbackName;
+        });
+        if (ours) {
+            Log("Breakpoint hit at 0x" + std::to_string(address));
+            lua_getglobal(cbState, callbackName.c_str());
+            if (lua_isfunction(cbState, -1)) {
+                // Writes land in the exception's CONTEXT, which the thread resumes with;
+                // EFLAGS goes through the frame because dispatch sets the trap flag after us
+                CONTEXT* context = (CONTEXT*)frame.native;
+                HitFrame hitFrame;
+                uint32_t* slots[conditionRegisterCount] = { (uint32_t*)&context->Eax, (uint32_t*)&context->Ebx,
+                    (uint32_t*)&context->Ecx, (uint32_t*)&context->Edx, (uint32_t*)&context->Esi, (uint32_t*)&context->Edi,
+                    (uint32_t*)&context->Ebp, (uint32_t*)&context->Esp, (uint32_t*)&context->Eip, &frame.flags };
+                std::copy(slots, slots + conditionRegisterCount, hitFrame.registers);
+                if ((context->ContextFlags & CONTEXT_EXTENDED_REGISTERS) == CONTEXT_EXTENDED_REGISTERS) {
+                    hitFrame.fxsave = context->ExtendedRegisters;
                 }
+                hitFrame.address = (DWORD)address;
+                hitFrame.threadId = GetCurrentThreadId();
+                hitFrame.time = Clock::now().time_since_epoch().count();
+                CallHitCallback(cbState, hitFrame, "breakpoint");
+            }
+            else {
+                lua_pop(cbState, 1); // Pop non-function
+                Log("Breakpoint callback function not found: " + callbackName);
             }
+        }
+        LeavePlugin(*gate);
+    }
 
-            // Create a copy of the address for the thread
-            DWORD addressCopy = exceptionAddress;
-
-            // Create a thread to reset the breakpoint after the original instruction is executed
-            std::thread([addressCopy]() {
-                // Give time for the original instruction to execute
-                Sleep(1);
-
-                if (!stopMonitoring && map_contains(breakpointInfo, addressCopy)) {
-                    // Put INT3 back
-                    BYTE int3 = 0xCC;
-                    DWORD oldProtect;
-                    VirtualProtect((LPVOID)addressCopy, 1, PAGE_EXECUTE_READWRITE, &oldProtect);
-                    WriteProcessMemory(GetCurrentProcess(), (LPVOID)addressCopy, &int3, 1, nullptr);
-                    VirtualProtect((LPVOID)addressCopy, 1, oldProtect, &oldProtect);
-                }
+    bool WriteCode(uintptr_t address, BYTE value) override {
+        // Shutting down: let stepping threads finish but don't arm anything again
+        if (stopMonitoring && value == int3Opcode) return false;
+        return PatchMemory(address, &value, 1);
+    }
+
+    void Rearm(uintptr_t address) override {
+        // RemoveBreakpoint and EnableBreakpoint patch under the same lock
+        breakpointTable.Exclusive([&] {
+            BYTE originalByte;
+            if (IsArmed(address, originalByte)) WriteCode(address, int3Opcode);
+        });
+    }
+};
 
-                insideBreakpointHandler = false;
-                }).detach();
+VehBreakpointHost vehBreakpointHost;
 
-            // Continue execution with the original instruction
+LONG CALLBACK BreakpointExceptionHandler(EXCEPTION_POINTERS* ExceptionInfo) {
+    DWORD code = ExceptionInfo->ExceptionRecord->ExceptionCode;
+    CONTEXT* context = ExceptionInfo->ContextRecord;
+    // Eip already points back at the INT3, so continuing runs the restored instruction
+    TrapFrame frame = { (uintptr_t)ExceptionInfo->ExceptionRecord->ExceptionAddress, context->EFlags, context };
+    if (code != EXCEPTION_BREAKPOINT && code != EXCEPTION_SINGLE_STEP) {
+        // The instruction we were stepping over faulted; the game's own handlers deal with it
+        if (rearmAddress) {
+            DispatchFault(vehBreakpointHost, frame);
+            context->EFlags = frame.flags;
+        }
+        return EXCEPTION_CONTINUE_SEARCH;
+    }
+
+    bool handled = code == EXCEPTION_BREAKPOINT ?
+        DispatchBreakpoint(vehBreakpointHost, frame.ip, frame) :
+        DispatchSingleStep(vehBreakpointHost, frame);
+    if (!handled) {
+        // Disabled or removed between the INT3 firing and the lookup: the original byte is
+        // back, so just rerun it
+        BYTE current;
+        if (code == EXCEPTION_BREAKPOINT && frame.ip == context->Eip && ReadBlock(frame.ip, &current, 1) &&
+            current != int3Opcode &&
+            (breakpointTable.Contains((DWORD)frame.ip) || breakpointTable.WasRemoved((DWORD)frame.ip))) {
             return EXCEPTION_CONTINUE_EXECUTION;
         }
+        // Hardware breakpoints and breakpoints that aren't ours
+        return EXCEPTION_CONTINUE_SEARCH;
     }
-
-    // For other exceptions or breakpoints that aren't ours
-    return EXCEPTION_CONTINUE_SEARCH;
+    context->EFlags = frame.flags;
+    return EXCEPTION_CONTINUE_EXECUTION;
 }
 
 // --- Window Processing ---
@@ -1119,6 +3682,7 @@ void CallPluginOnFrame() {
     auto& plugin = plugins[currentPlugin];
     lua_State* state = plugin.L;
     if (!state) return;
+    auto gate = LockPluginState(state);
 
     int top = lua_gettop(state);
     lua_getglobal(state, "OnFrame");
@@ -1127,6 +3691,7 @@ void CallPluginOnFrame() {
         if (lua_pcall(state, 0, 1, 0) != 0) {
             std::string error = lua_tostring(state, -1);
             Log("Error in OnFrame: " + error);
+            AbortWriteTransaction(state);
         }
         else {
             if (lua_isboolean(state, -1) && lua_toboolean(state, -1)) {
@@ -1163,6 +3728,8 @@ PresentFn oPresent = nullptr;
 HRESULT __stdcall hkPresent(IDXGISwapChain* pSwap, UINT SyncInterval, UINT Flags) {
     static bool firstRun = true;
 
+    protectionCache.EndFrame();
+
     if (!initialized) {
         if (SUCCEEDED(pSwap->GetDevice(__uuidof(ID3D11Device), reinterpret_cast<void**>(device.GetAddressOf())))) {
             device->GetImmediateContext(context.GetAddressOf());
@@ -1256,6 +3823,9 @@ HRESULT __stdcall hkPresent(IDXGISwapChain* pSwap, UINT SyncInterval, UINT Flags
         Log("Overlay hidden (" + config.closeKey + ")");
     }
 
+    CloseRetiredPluginStates();
+    ReleaseStaleHookRefs();
+
     if (initialized && isActive) {
         if (overlayVisible) {
             // Make sure the current plugin status is set
@@ -1265,6 +3835,8 @@ HRESULT __stdcall hkPresent(IDXGISwapChain* pSwap, UINT SyncInterval, UINT Flags
             }
         }
 
+        PumpAsyncScans();
+        PumpBreakpointHits();
         CallPluginOnFrame();
     }
 
@@ -1383,24 +3955,25 @@ BOOL WINAPI DllMain(HINSTANCE hinstDLL, DWORD fdwReason, LPVOID) {
         }
 
         // Remove all breakpoints on exit
-        for (auto& pair : breakpointInfo) {
-            DWORD address = pair.first;
-            BreakpointInfo& info = pair.second;
+        breakpointTable.Exclusive([] {
+            for (auto& pair : breakpointTable.Snapshot()) {
+                DWORD address = pair.first;
+                BreakpointInfo& info = pair.second;
 
-            DWORD oldProtect;
-            VirtualProtect((LPVOID)address, 1, PAGE_EXECUTE_READWRITE, &oldProtect);
-            WriteProcessMemory(GetCurrentProcess(), (LPVOID)address, &info.originalByte, 1, nullptr);
-            VirtualProtect((LPVOID)address, 1, oldProtect, &oldProtect);
-        }
-        breakpointInfo.clear();
+                PatchMemory(address, &info.originalByte, 1);
+            }
+            breakpointTable.Clear();
+        });
 
         // Close all plugin Lua states
         for (auto& p : loadedPlugins) {
             if (p.second.L) {
-                lua_close(p.second.L);
+                ReleasePluginState(p.second.L);
                 p.second.L = nullptr;
             }
         }
+        for (lua_State* L : retiredPluginStates) ReleasePluginState(L);
+        retiredPluginStates.clear();
 
         if (mainRenderTargetView) {
             mainRenderTargetView.Reset();
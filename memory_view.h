@@ -0,0 +1,217 @@
+#pragma once
+
+// Typed views behind Memory.View: zero-based arrays of numbers over raw memory. Only needs the
+// Lua API and the protection cache, so the tests can time them against Memory.ReadMemory.
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <lua.hpp>
+#include "page_protection.h"
+
+// Supplied by main.cpp, or by the test harness
+extern ProtectionCache protectionCache;
+
+enum class ViewType { U8, I8, U16, I16, U32, I32, F32, F64 };
+
+struct MemoryView {
+    uintptr_t address;
+    size_t count;
+    size_t stride;
+    ViewType type;
+    bool writable = true;
+};
+
+inline bool ParseViewType(const std::string& name, ViewType& type, size_t& size) {
+    static const std::unordered_map<std::string, std::pair<ViewType, size_t>> typeMap = {
+        {"u8", {ViewType::U8, 1}}, {"byte", {ViewType::U8, 1}},
+        {"i8", {ViewType::I8, 1}},
+        {"u16", {ViewType::U16, 2}}, {"word", {ViewType::U16, 2}},
+        {"i16", {ViewType::I16, 2}},
+        {"u32", {ViewType::U32, 4}}, {"dword", {ViewType::U32, 4}},
+        {"i32", {ViewType::I32, 4}}, {"int", {ViewType::I32, 4}},
+        {"f32", {ViewType::F32, 4}}, {"float", {ViewType::F32, 4}},
+        {"f64", {ViewType::F64, 8}}, {"double", {ViewType::F64, 8}}
+    };
+
+    auto it = typeMap.find(name);
+    if (it == typeMap.end()) return false;
+    type = it->second.first;
+    size = it->second.second;
+    return true;
+}
+
+// Direct load of one element; no buffers or syscalls involved
+inline void PushViewElement(lua_State* L, const MemoryView* view, size_t index) {
+    const void* src = (const void*)(view->address + index * view->stride);
+    switch (view->type) {
+    case ViewType::U8: { uint8_t v; memcpy(&v, src, 1); lua_pushinteger(L, v); break; }
+    case ViewType::I8: { int8_t v; memcpy(&v, src, 1); lua_pushinteger(L, v); break; }
+    case ViewType::U16: { uint16_t v; memcpy(&v, src, 2); lua_pushinteger(L, v); break; }
+    case ViewType::I16: { int16_t v; memcpy(&v, src, 2); lua_pushinteger(L, v); break; }
+    case ViewType::U32: { uint32_t v; memcpy(&v, src, 4); lua_pushnumber(L, (lua_Number)v); break; }
+    case ViewType::I32: { int32_t v; memcpy(&v, src, 4); lua_pushinteger(L, v); break; }
+    case ViewType::F32: { float v; memcpy(&v, src, 4); lua_pushnumber(L, v); break; }
+    case ViewType::F64: { double v; memcpy(&v, src, 8); lua_pushnumber(L, v); break; }
+    }
+}
+
+inline void StoreViewElement(lua_State* L, const MemoryView* view, size_t index, int valueIndex) {
+    void* dst = (void*)(view->address + index * view->stride);
+    lua_Number n = luaL_checknumber(L, valueIndex);
+    switch (view->type) {
+    case ViewType::U8: case ViewType::I8: { uint8_t v = (uint8_t)(int64_t)n; memcpy(dst, &v, 1); break; }
+    case ViewType::U16: case ViewType::I16: { uint16_t v = (uint16_t)(int64_t)n; memcpy(dst, &v, 2); break; }
+    case ViewType::U32: case ViewType::I32: { uint32_t v = (uint32_t)(int64_t)n; memcpy(dst, &v, 4); break; }
+    case ViewType::F32: { float v = (float)n; memcpy(dst, &v, 4); break; }
+    case ViewType::F64: { double v = n; memcpy(dst, &v, 8); break; }
+    }
+}
+
+inline size_t CheckViewIndex(lua_State* L, const MemoryView* view, int arg) {
+    lua_Integer index = luaL_checkinteger(L, arg);
+    luaL_argcheck(L, index >= 0 && (size_t)index < view->count, arg, "index out of range");
+    return (size_t)index;
+}
+
+// Points the view at address if its whole range is readable there. This is the only check:
+// elements are loaded and stored directly, so memory freed after it still faults like a
+// stale pointer would. Views into memory that may go away should be rebased before use.
+inline bool MoveView(MemoryView* view, uintptr_t address) {
+    size_t bytes = view->count * view->stride;
+    if (!protectionCache.IsReadable(address, bytes)) {
+        protectionCache.rejectedReads++;
+        return false;
+    }
+    view->address = address;
+    view->writable = protectionCache.IsWritable(address, bytes);
+    return true;
+}
+
+// Memory.View(address, type, [count = 1]) -> zero-based typed view over raw memory, or nil
+// if the range is unreadable
+inline int lua_CreateView(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    const char* typeName = luaL_checkstring(L, 2);
+    lua_Integer count = luaL_optinteger(L, 3, 1);
+    luaL_argcheck(L, count > 0, 3, "count must be positive");
+
+    ViewType type;
+    size_t size;
+    if (!ParseViewType(typeName, type, size)) {
+        return luaL_argerror(L, 2, "unknown view type");
+    }
+    luaL_argcheck(L, (size_t)count <= (UINTPTR_MAX - address) / size, 3, "view too large");
+
+    MemoryView checked = { 0, (size_t)count, size, type };
+    if (!MoveView(&checked, address)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    MemoryView* view = (MemoryView*)lua_newuserdata(L, sizeof(MemoryView));
+    *view = checked;
+    luaL_getmetatable(L, "MemoryView");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+// Element access runs once per element, so its functions hold the metatable as an upvalue and
+// compare against that instead of having luaL_checkudata look it up by name every time
+inline MemoryView* CheckView(lua_State* L) {
+    MemoryView* view = (MemoryView*)lua_touserdata(L, 1);
+    if (view && lua_getmetatable(L, 1)) {
+        bool matches = lua_rawequal(L, -1, lua_upvalueindex(1)) != 0;
+        lua_pop(L, 1);
+        if (matches) return view;
+    }
+    return (MemoryView*)luaL_checkudata(L, 1, "MemoryView");
+}
+
+inline int lua_View_Index(lua_State* L) {
+    MemoryView* view = CheckView(L);
+    if (lua_type(L, 2) == LUA_TNUMBER) {
+        PushViewElement(L, view, CheckViewIndex(L, view, 2));
+        return 1;
+    }
+
+    // Fall back to the method table for string keys
+    lua_getfield(L, lua_upvalueindex(1), "methods");
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+}
+
+inline int lua_View_NewIndex(lua_State* L) {
+    MemoryView* view = CheckView(L);
+    if (!view->writable) {
+        return luaL_error(L, "view is over read-only memory");
+    }
+    StoreViewElement(L, view, CheckViewIndex(L, view, 2), 3);
+    return 0;
+}
+
+inline int lua_View_Len(lua_State* L) {
+    MemoryView* view = (MemoryView*)luaL_checkudata(L, 1, "MemoryView");
+    lua_pushinteger(L, (lua_Integer)view->count);
+    return 1;
+}
+
+inline int lua_View_Get(lua_State* L) {
+    return lua_View_Index(L);
+}
+
+inline int lua_View_Set(lua_State* L) {
+    lua_View_NewIndex(L);
+    return 0;
+}
+
+inline int lua_View_Address(lua_State* L) {
+    MemoryView* view = (MemoryView*)luaL_checkudata(L, 1, "MemoryView");
+    lua_pushinteger(L, (lua_Integer)view->address);
+    return 1;
+}
+
+// view:Rebase(address) re-points an existing view without allocating a new one. Returns nil
+// and leaves the view where it was if the new range is unreadable.
+inline int lua_View_Rebase(lua_State* L) {
+    MemoryView* view = (MemoryView*)luaL_checkudata(L, 1, "MemoryView");
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 2);
+    luaL_argcheck(L, view->count * view->stride <= UINTPTR_MAX - address, 2, "view too large");
+    if (!MoveView(view, address)) {
+        lua_pushnil(L);
+        return 1;
+    }
+    lua_settop(L, 1);
+    return 1;
+}
+
+inline void RegisterMemoryView(lua_State* L) {
+    luaL_newmetatable(L, "MemoryView");
+
+    lua_pushvalue(L, -1);
+    lua_pushcclosure(L, lua_View_Index, 1);
+    lua_setfield(L, -2, "__index");
+
+    lua_pushvalue(L, -1);
+    lua_pushcclosure(L, lua_View_NewIndex, 1);
+    lua_setfield(L, -2, "__newindex");
+
+    lua_pushcfunction(L, lua_View_Len);
+    lua_setfield(L, -2, "__len");
+
+    lua_newtable(L);
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, lua_View_Get, 1);
+    lua_setfield(L, -2, "Get");
+    lua_pushvalue(L, -2);
+    lua_pushcclosure(L, lua_View_Set, 1);
+    lua_setfield(L, -2, "Set");
+    lua_pushcfunction(L, lua_View_Address);
+    lua_setfield(L, -2, "Address");
+    lua_pushcfunction(L, lua_View_Rebase);
+    lua_setfield(L, -2, "Rebase");
+    lua_setfield(L, -2, "methods");
+
+    lua_pop(L, 1);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+// Several byte patterns found in one pass over a buffer, kept free of Windows headers so it
+// also builds on Linux. main.cpp runs the scan over live memory under SEH, one pool chunk at
+// a time, and puts the chunks' hits together with MergeChunkHits.
+#include <algorithm>
+#include <array>
+#include <vector>
+#include "byte_pattern.h"
+#include "scan_thread_pool.h"
+
+// An Aho-Corasick automaton over the longest literal run of each pattern finds candidates,
+// and the full masked pattern is verified around them
+struct MultiPattern {
+    std::vector<BytePattern> patterns;
+    std::vector<size_t> keyOffsets;          // Start of each pattern's literal key
+    std::vector<size_t> keyLengths;
+    std::vector<std::array<int, 256>> next;  // Complete transition table, state 0 is the root
+    std::vector<std::vector<int>> outputs;   // Patterns whose key ends in each state
+    std::vector<uint8_t> startBytes;         // Bytes that leave the root state
+};
+
+// Up to this many start bytes, runs of other bytes are skipped 16 at a time in the root state
+constexpr size_t multiPatternSkipBytes = 4;
+
+struct PatternHit {
+    uintptr_t address;
+    int pattern;
+};
+
+inline void BuildMultiPattern(MultiPattern& multi) {
+    multi.next.assign(1, {});
+    multi.next[0].fill(-1);
+    multi.outputs.assign(1, {});
+    multi.keyOffsets.clear();
+    multi.keyLengths.clear();
+    multi.startBytes.clear();
+
+    for (size_t p = 0; p < multi.patterns.size(); p++) {
+        const BytePattern& pattern = multi.patterns[p];
+        size_t bestOffset = 0, bestLength = 0;
+        for (size_t i = 0; i < pattern.bytes.size(); ) {
+            if (!pattern.mask[i]) {
+                i++;
+                continue;
+            }
+            size_t j = i;
+            while (j < pattern.bytes.size() && pattern.mask[j]) j++;
+            if (j - i > bestLength) {
+                bestOffset = i;
+                bestLength = j - i;
+            }
+            i = j;
+        }
+        multi.keyOffsets.push_back(bestOffset);
+        multi.keyLengths.push_back(bestLength);
+
+        int state = 0;
+        for (size_t i = bestOffset; i < bestOffset + bestLength; i++) {
+            uint8_t b = pattern.bytes[i];
+            if (multi.next[state][b] < 0) {
+                multi.next[state][b] = (int)multi.next.size();
+                multi.next.emplace_back();
+                multi.next.back().fill(-1);
+                multi.outputs.emplace_back();
+            }
+            state = multi.next[state][b];
+        }
+        multi.outputs[state].push_back((int)p);
+    }
+
+    // Breadth-first fill of failure transitions turns the trie into a DFA
+    std::vector<int> fail(multi.next.size(), 0);
+    std::vector<int> queue;
+    for (int b = 0; b < 256; b++) {
+        int child = multi.next[0][b];
+        if (child < 0) {
+            multi.next[0][b] = 0;
+        }
+        else {
+            queue.push_back(child);
+            multi.startBytes.push_back((uint8_t)b);
+        }
+    }
+    for (size_t head = 0; head < queue.size(); head++) {
+        int state = queue[head];
+        const std::vector<int>& inherited = multi.outputs[fail[state]];
+        multi.outputs[state].insert(multi.outputs[state].end(), inherited.begin(), inherited.end());
+        for (int b = 0; b < 256; b++) {
+            int child = multi.next[state][b];
+            if (child < 0) {
+                multi.next[state][b] = multi.next[fail[state]][b];
+            }
+            else {
+                fail[child] = multi.next[fail[state]][b];
+                queue.push_back(child);
+            }
+        }
+    }
+}
+
+// One linear pass over data. Hits come out of the automaton in the order their keys end, so
+// once hits holds maxHits entries the pass goes on just far enough to catch longer patterns
+// that start earlier, then keeps the first maxHits by address.
+inline void ScanMultiPattern(const uint8_t* data, size_t size, uintptr_t address, const MultiPattern& multi,
+    std::vector<PatternHit>& hits, size_t maxHits) {
+    size_t longest = 0;
+    for (const auto& pattern : multi.patterns) longest = std::max(longest, pattern.bytes.size());
+
+    bool skip = multi.startBytes.size() <= multiPatternSkipBytes;
+    __m128i needles[multiPatternSkipBytes];
+    for (size_t k = 0; skip && k < multi.startBytes.size(); k++) needles[k] = _mm_set1_epi8((char)multi.startBytes[k]);
+
+    int state = 0;
+    size_t stopAt = size;
+    for (size_t i = 0; i < stopAt; i++) {
+        if (state == 0 && skip) {
+            for (; i + 16 <= stopAt; i += 16) {
+                __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+                __m128i any = _mm_setzero_si128();
+                for (size_t k = 0; k < multi.startBytes.size(); k++) any = _mm_or_si128(any, _mm_cmpeq_epi8(block, needles[k]));
+                unsigned bits = (unsigned)_mm_movemask_epi8(any);
+                if (bits) {
+                    for (; !(bits & 1); bits >>= 1) i++;
+                    break;
+                }
+            }
+            if (i >= stopAt) break;
+        }
+        state = multi.next[state][data[i]];
+        for (int p : multi.outputs[state]) {
+            size_t keyEnd = multi.keyOffsets[p] + multi.keyLengths[p];
+            size_t length = multi.patterns[p].bytes.size();
+            if (i + 1 < keyEnd) continue;
+            size_t start = i + 1 - keyEnd;
+            if (start + length > size || !MatchPatternAt(data + start, multi.patterns[p])) continue;
+
+            hits.push_back({ address + start, p });
+            if (hits.size() >= maxHits && stopAt == size) stopAt = std::min(size, i + longest);
+        }
+    }
+    std::stable_sort(hits.begin(), hits.end(),
+        [](const PatternHit& a, const PatternHit& b) { return a.address < b.address; });
+    if (hits.size() > maxHits) hits.resize(maxHits);
+}
+
+// Hits starting in the chunk's overlap belong to the next chunk. The rest are sorted again in
+// case the scan faulted before it got to sort them.
+inline void TrimChunkHits(const ScanChunk& chunk, std::vector<PatternHit>& hits) {
+    hits.erase(std::remove_if(hits.begin(), hits.end(),
+        [&](const PatternHit& hit) { return hit.address >= chunk.ownedEnd; }), hits.end());
+    std::stable_sort(hits.begin(), hits.end(),
+        [](const PatternHit& a, const PatternHit& b) { return a.address < b.address; });
+}
+
+// The trimmed hits of consecutive chunks, in address order and at most maxHits of them
+inline std::vector<PatternHit> MergeChunkHits(const std::vector<std::vector<PatternHit>>& chunkHits, size_t maxHits) {
+    std::vector<PatternHit> hits;
+    for (size_t i = 0; i < chunkHits.size() && hits.size() < maxHits; i++) {
+        size_t take = chunkHits[i].size();
+        if (take > maxHits - hits.size()) take = maxHits - hits.size();
+        hits.insert(hits.end(), chunkHits[i].begin(), chunkHits[i].begin() + take);
+    }
+    return hits;
+}
@@ -0,0 +1,382 @@
+#pragma once
+
+// Page protection cache and write batching, kept free of Windows headers so they also build
+// on Linux. main.cpp supplies the VirtualQuery/VirtualProtect backends and the SEH-guarded
+// copies; the /proc/self/maps and mprotect backends below are what the tests run against.
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#ifndef _WIN32
+#include <csetjmp>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/mman.h>
+#endif
+
+constexpr uintptr_t pageSize = 0x1000;
+
+// Copy and fill that return false instead of faulting on a bad address
+bool GuardedCopy(void* dst, const void* src, size_t size);
+bool GuardedFill(void* dst, uint8_t value, size_t size);
+
+// Unmapped ranges are only trusted briefly since the game may allocate there at any time
+constexpr uint64_t negativeEntryTtl = 250;
+// Past this many negative entries the expired ones are swept, and if that is not enough all
+// of them are dropped, so probing many bad addresses can't grow the cache without bound
+constexpr size_t maxNegativeEntries = 4096;
+
+struct ProtectionRegion {
+    uintptr_t end;
+    uint32_t protect; // 0 for reserved, free or unmapped memory
+    uint64_t expires; // 0 for entries that stay valid until invalidated
+};
+
+// Where the cache learns protections from, so it does not depend on VirtualQuery
+struct RegionSource {
+    virtual ~RegionSource() = default;
+    // Fills the region holding address. On false the page is remembered as unmapped.
+    virtual bool Query(uintptr_t address, uintptr_t& start, uintptr_t& end, uint32_t& protect) = 0;
+    virtual bool IsReadable(uint32_t protect) const = 0;
+    virtual bool IsWritable(uint32_t protect) const = 0;
+    virtual uint64_t Now() const = 0; // Milliseconds
+};
+
+// Interval map of region protections. Our own ProtectMemory, AllocateMemory and FreeMemory
+// calls invalidate the ranges they touch.
+class ProtectionCache {
+public:
+    std::atomic<uint32_t> hits{ 0 };
+    std::atomic<uint32_t> misses{ 0 };
+    std::atomic<uint32_t> savedSyscalls{ 0 };
+    std::atomic<uint32_t> rejectedReads{ 0 };
+    uint32_t frameHits = 0, frameMisses = 0, frameSaved = 0;
+
+    explicit ProtectionCache(RegionSource& source) : source(source) {}
+
+    // Protection of the page holding address, querying the source only on a miss
+    bool GetProtection(uintptr_t address, ProtectionRegion& out) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto it = regions.upper_bound(address);
+            if (it != regions.begin()) {
+                --it;
+                if (address < it->second.end &&
+                    (!it->second.expires || source.Now() < it->second.expires)) {
+                    hits++;
+                    out = it->second;
+                    return true;
+                }
+            }
+        }
+
+        misses++;
+        uintptr_t start, end;
+        uint32_t protect;
+        if (source.Query(address, start, end, protect)) {
+            out.end = end;
+            out.protect = protect;
+        }
+        else {
+            // Outside the user address space; remember the page as unmapped
+            start = address & ~(pageSize - 1);
+            out.end = start + pageSize;
+            out.protect = 0;
+        }
+        uint64_t now = source.Now();
+        out.expires = source.IsReadable(out.protect) ? 0 : now + negativeEntryTtl;
+
+        std::lock_guard<std::mutex> guard(lock);
+        EraseRange(start, out.end);
+        regions[start] = out;
+        if (out.expires && ++negativeEntries > maxNegativeEntries) {
+            DropNegativeEntries(now);
+        }
+        return true;
+    }
+
+    bool IsWritable(uintptr_t address, size_t size) {
+        uintptr_t end = address + size;
+        if (end < address) return false;
+        while (address < end) {
+            ProtectionRegion region;
+            if (!GetProtection(address, region) || !source.IsWritable(region.protect)) {
+                return false;
+            }
+            address = region.end;
+        }
+        return true;
+    }
+
+    bool IsReadable(uintptr_t address, size_t size) {
+        uintptr_t end = address + size;
+        if (end < address) return false;
+        while (address < end) {
+            ProtectionRegion region;
+            if (!GetProtection(address, region) || !source.IsReadable(region.protect)) {
+                return false;
+            }
+            address = region.end;
+        }
+        return true;
+    }
+
+    void Invalidate(uintptr_t address, size_t size) {
+        std::lock_guard<std::mutex> guard(lock);
+        EraseRange(address, address + (size ? size : 1));
+    }
+
+    size_t Size() {
+        std::lock_guard<std::mutex> guard(lock);
+        return regions.size();
+    }
+
+    size_t NegativeEntries() {
+        std::lock_guard<std::mutex> guard(lock);
+        return negativeEntries;
+    }
+
+    // Called once per Present so the Lua side can see per-frame numbers
+    void EndFrame() {
+        uint32_t h = hits, m = misses, s = savedSyscalls;
+        frameHits = h - lastHits;
+        frameMisses = m - lastMisses;
+        frameSaved = s - lastSaved;
+        lastHits = h;
+        lastMisses = m;
+        lastSaved = s;
+    }
+
+private:
+    RegionSource& source;
+    std::map<uintptr_t, ProtectionRegion> regions; // Keyed by region start
+    std::mutex lock;
+    size_t negativeEntries = 0;
+    uint32_t lastHits = 0, lastMisses = 0, lastSaved = 0;
+
+    std::map<uintptr_t, ProtectionRegion>::iterator Erase(std::map<uintptr_t, ProtectionRegion>::iterator it) {
+        if (it->second.expires) negativeEntries--;
+        return regions.erase(it);
+    }
+
+    void EraseRange(uintptr_t start, uintptr_t end) {
+        auto it = regions.upper_bound(start);
+        if (it != regions.begin()) {
+            auto prev = std::prev(it);
+            if (prev->second.end > start) it = prev;
+        }
+        while (it != regions.end() && it->first < end) {
+            it = Erase(it);
+        }
+    }
+
+    // Expired entries first; if they are all still live, every negative entry goes
+    void DropNegativeEntries(uint64_t now) {
+        for (int pass = 0; pass < 2 && negativeEntries > maxNegativeEntries / 2; pass++) {
+            for (auto it = regions.begin(); it != regions.end();) {
+                it = it->second.expires && (pass || now >= it->second.expires) ? Erase(it) : std::next(it);
+            }
+        }
+    }
+};
+
+// Page protection goes through this interface so the batching below does not depend on VirtualProtect
+struct PageProtector {
+    virtual ~PageProtector() = default;
+    virtual bool Unprotect(uintptr_t page, size_t size, uint32_t& oldProtect) = 0;
+    virtual void Restore(uintptr_t page, size_t size, uint32_t oldProtect) = 0;
+    virtual void OnFault(uintptr_t /*address*/, size_t /*size*/) {}
+};
+
+struct PendingWrite {
+    uintptr_t address;
+    size_t size;
+    size_t dataOffset; // Offset into WriteBatch::data, unused for fills
+    bool fill;
+    uint8_t fillValue;
+};
+
+// Collects writes and applies them with one unprotect/restore per touched page
+struct WriteBatch {
+    std::vector<PendingWrite> writes;
+    std::vector<uint8_t> data;
+
+    bool Empty() const { return writes.empty(); }
+
+    void Add(uintptr_t address, const void* src, size_t size) {
+        if (size == 0) return;
+        writes.push_back({ address, size, data.size(), false, 0 });
+        data.insert(data.end(), (const uint8_t*)src, (const uint8_t*)src + size);
+    }
+
+    void AddFill(uintptr_t address, uint8_t value, size_t size) {
+        if (size == 0) return;
+        writes.push_back({ address, size, 0, true, value });
+    }
+
+    void Clear() {
+        writes.clear();
+        data.clear();
+    }
+
+    bool Apply(PageProtector& protector) {
+        std::vector<uintptr_t> pages;
+        for (const auto& w : writes) {
+            uintptr_t first = w.address & ~(pageSize - 1);
+            uintptr_t last = (w.address + w.size - 1) & ~(pageSize - 1);
+            for (uintptr_t page = first; page <= last; page += pageSize) {
+                pages.push_back(page);
+            }
+        }
+        std::sort(pages.begin(), pages.end());
+        pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+        std::vector<uint32_t> oldProtect(pages.size());
+        std::vector<bool> unlocked(pages.size());
+        bool success = true;
+        for (size_t i = 0; i < pages.size(); ++i) {
+            unlocked[i] = protector.Unprotect(pages[i], pageSize, oldProtect[i]);
+            success = success && unlocked[i];
+        }
+
+        auto isUnlocked = [&](uintptr_t address, size_t size) {
+            uintptr_t first = address & ~(pageSize - 1);
+            uintptr_t last = (address + size - 1) & ~(pageSize - 1);
+            auto it = std::lower_bound(pages.begin(), pages.end(), first);
+            for (uintptr_t page = first; page <= last; page += pageSize, ++it) {
+                if (!unlocked[it - pages.begin()]) return false;
+            }
+            return true;
+        };
+
+        // Writes are applied in the order they were recorded
+        for (const auto& w : writes) {
+            if (!isUnlocked(w.address, w.size)) {
+                continue;
+            }
+            bool written = w.fill
+                ? GuardedFill((void*)w.address, w.fillValue, w.size)
+                : GuardedCopy((void*)w.address, data.data() + w.dataOffset, w.size);
+            if (!written) {
+                protector.OnFault(w.address, w.size);
+                success = false;
+            }
+        }
+
+        for (size_t i = 0; i < pages.size(); ++i) {
+            if (unlocked[i]) {
+                protector.Restore(pages[i], pageSize, oldProtect[i]);
+            }
+        }
+        return success;
+    }
+};
+
+#ifndef _WIN32
+// Region source reading /proc/self/maps, the counterpart of the VirtualQuery source. Gaps
+// between mappings are reported as unmapped regions.
+struct ProcMapsRegionSource : RegionSource {
+    bool Query(uintptr_t address, uintptr_t& start, uintptr_t& end, uint32_t& protect) override {
+        FILE* maps = fopen("/proc/self/maps", "r");
+        if (!maps) return false;
+        char line[512];
+        uintptr_t gapStart = 0;
+        bool found = false;
+        while (!found && fgets(line, sizeof(line), maps)) {
+            unsigned long long first, last;
+            char perms[5] = {};
+            if (sscanf(line, "%llx-%llx %4s", &first, &last, perms) != 3) continue;
+            if (address < first) {
+                start = gapStart;
+                end = (uintptr_t)first;
+                protect = 0;
+                found = true;
+            }
+            else if (address < last) {
+                start = (uintptr_t)first;
+                end = (uintptr_t)last;
+                protect = (perms[0] == 'r' ? PROT_READ : 0) | (perms[1] == 'w' ? PROT_WRITE : 0) |
+                    (perms[2] == 'x' ? PROT_EXEC : 0);
+                found = true;
+            }
+            gapStart = (uintptr_t)last;
+        }
+        fclose(maps);
+        return found;
+    }
+
+    bool IsReadable(uint32_t protect) const override { return (protect & PROT_READ) != 0; }
+    bool IsWritable(uint32_t protect) const override { return (protect & PROT_WRITE) != 0; }
+
+    uint64_t Now() const override {
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+    }
+};
+
+// The POSIX counterpart of VirtualProtectProtector. An oldProtect of 0 means the page was
+// already writable; otherwise it holds the previous PROT_ bits plus mprotectChanged.
+struct MprotectProtector : PageProtector {
+    static constexpr uint32_t mprotectChanged = 0x100;
+    uint32_t unprotectCalls = 0;
+    ProcMapsRegionSource maps;
+
+    bool Unprotect(uintptr_t page, size_t size, uint32_t& oldProtect) override {
+        uintptr_t start, end;
+        uint32_t protect = 0;
+        if (!maps.Query(page, start, end, protect) || !protect) return false;
+        if (protect & PROT_WRITE) {
+            oldProtect = 0;
+            return true;
+        }
+        unprotectCalls++;
+        if (mprotect((void*)page, size, (int)(protect | PROT_READ | PROT_WRITE)) != 0) return false;
+        oldProtect = protect | mprotectChanged;
+        return true;
+    }
+
+    void Restore(uintptr_t page, size_t size, uint32_t oldProtect) override {
+        if (oldProtect == 0) return;
+        mprotect((void*)page, size, (int)(oldProtect & ~mprotectChanged));
+    }
+};
+
+// A copy that jumps back out of SIGSEGV the way the loader's copy leaves __except, for
+// harnesses whose timings shouldn't include a syscall per read. Faults outside a copy still
+// kill the process.
+inline thread_local sigjmp_buf* signalCopyJump = nullptr;
+
+inline void SignalCopyFault(int signal) {
+    if (signalCopyJump) siglongjmp(*signalCopyJump, 1);
+    std::signal(signal, SIG_DFL);
+}
+
+inline bool SignalGuardedCopy(void* dst, const void* src, size_t size) {
+    static const bool installed = [] {
+        struct sigaction action = {};
+        action.sa_handler = SignalCopyFault;
+        action.sa_flags = SA_NODEFER;
+        sigaction(SIGSEGV, &action, nullptr);
+        sigaction(SIGBUS, &action, nullptr);
+        return true;
+    }();
+    (void)installed;
+
+    sigjmp_buf jump;
+    if (sigsetjmp(jump, 0)) {
+        signalCopyJump = nullptr;
+        return false;
+    }
+    signalCopyJump = &jump;
+    memcpy(dst, src, size);
+    signalCopyJump = nullptr;
+    return true;
+}
+#endif
@@ -0,0 +1,202 @@
+#pragma once
+
+// PE image parsing for the module cache and the signature cache, kept free of Windows headers
+// so it also builds on Linux. Images are parsed either as the loader mapped them or as laid
+// out on disk. Only 32-bit (PE32) images are accepted, like the game's.
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SectionInfo {
+    std::string name;
+    uintptr_t start;       // Mapped address of the section
+    size_t size;           // Virtual size
+    uint32_t rawOffset;    // File offset, for images parsed from disk
+    uint32_t rawSize;
+    uint32_t characteristics;
+};
+
+struct ModuleInfo {
+    std::string name;      // Lowercase file name
+    uintptr_t base = 0;
+    size_t size = 0;
+    uint32_t timeDateStamp = 0;
+    std::vector<SectionInfo> sections;
+    std::unordered_map<std::string, uintptr_t> exports;
+    bool exportsParsed = false;
+};
+
+// The on-disk layouts of the headers the parser reads, field for field as in winnt.h
+struct PeFileHeader {
+    uint16_t machine, numberOfSections;
+    uint32_t timeDateStamp, pointerToSymbolTable, numberOfSymbols;
+    uint16_t sizeOfOptionalHeader, characteristics;
+};
+
+struct PeDataDirectory {
+    uint32_t virtualAddress, size;
+};
+
+struct PeOptionalHeader32 {
+    uint16_t magic;
+    uint8_t majorLinkerVersion, minorLinkerVersion;
+    uint32_t sizeOfCode, sizeOfInitializedData, sizeOfUninitializedData;
+    uint32_t addressOfEntryPoint, baseOfCode, baseOfData, imageBase;
+    uint32_t sectionAlignment, fileAlignment;
+    uint16_t majorOperatingSystemVersion, minorOperatingSystemVersion;
+    uint16_t majorImageVersion, minorImageVersion, majorSubsystemVersion, minorSubsystemVersion;
+    uint32_t win32VersionValue, sizeOfImage, sizeOfHeaders, checkSum;
+    uint16_t subsystem, dllCharacteristics;
+    uint32_t sizeOfStackReserve, sizeOfStackCommit, sizeOfHeapReserve, sizeOfHeapCommit;
+    uint32_t loaderFlags, numberOfRvaAndSizes;
+    PeDataDirectory dataDirectory[16];
+};
+
+struct PeSectionHeader {
+    char name[8];
+    uint32_t virtualSize, virtualAddress, sizeOfRawData, pointerToRawData;
+    uint32_t pointerToRelocations, pointerToLinenumbers;
+    uint16_t numberOfRelocations, numberOfLinenumbers;
+    uint32_t characteristics;
+};
+
+struct PeExportDirectory {
+    uint32_t characteristics, timeDateStamp;
+    uint16_t majorVersion, minorVersion;
+    uint32_t name, base, numberOfFunctions, numberOfNames;
+    uint32_t addressOfFunctions, addressOfNames, addressOfNameOrdinals;
+};
+
+static_assert(sizeof(PeFileHeader) == 20 && sizeof(PeOptionalHeader32) == 224 && sizeof(PeSectionHeader) == 40 &&
+    sizeof(PeExportDirectory) == 40, "PE header layout");
+
+constexpr uint16_t peDosSignature = 0x5A4D;        // "MZ"
+constexpr uint32_t peNtSignature = 0x00004550;     // "PE\0\0"
+constexpr uint16_t pe32Magic = 0x10B;
+constexpr size_t peExportDirectoryIndex = 0;
+constexpr uint32_t peSectionWritable = 0x80000000;  // IMAGE_SCN_MEM_WRITE
+
+struct PeHeaders {
+    PeFileHeader file;
+    PeOptionalHeader32 optional;
+    size_t sectionsOffset;  // First section header
+};
+
+// Copies a header out of the buffer, so nothing depends on its alignment; false if it doesn't fit
+template<typename T>
+bool ReadPeStruct(const uint8_t* image, size_t size, size_t offset, T& out) {
+    if (offset > size || size - offset < sizeof(T)) return false;
+    memcpy(&out, image + offset, sizeof(T));
+    return true;
+}
+
+inline bool ReadPeHeaders(const uint8_t* image, size_t size, PeHeaders& headers) {
+    uint16_t dosMagic;
+    int32_t ntOffset;
+    uint32_t signature;
+    if (!ReadPeStruct(image, size, 0, dosMagic) || dosMagic != peDosSignature ||
+        !ReadPeStruct(image, size, 0x3C, ntOffset) || ntOffset < 0 ||
+        !ReadPeStruct(image, size, ntOffset, signature) || signature != peNtSignature ||
+        !ReadPeStruct(image, size, ntOffset + 4, headers.file) ||
+        !ReadPeStruct(image, size, ntOffset + 4 + sizeof(PeFileHeader), headers.optional) ||
+        headers.optional.magic != pe32Magic) {
+        return false;
+    }
+    headers.sectionsOffset = ntOffset + 4 + sizeof(PeFileHeader) + headers.file.sizeOfOptionalHeader;
+    return true;
+}
+
+// Translates an RVA to an offset into the image buffer; identity for mapped images
+inline bool RvaToOffset(const ModuleInfo& module, uint32_t rva, bool mapped, size_t& offset) {
+    if (mapped) {
+        offset = rva;
+        return true;
+    }
+    for (const auto& section : module.sections) {
+        uint32_t sectionRva = (uint32_t)(section.start - module.base);
+        if (rva >= sectionRva && rva - sectionRva < section.rawSize) {
+            offset = section.rawOffset + (rva - sectionRva);
+            return true;
+        }
+    }
+    return false;
+}
+
+// Reads the section table of a PE image held in memory either as mapped by the loader
+// or as laid out on disk. module.base must be set; section starts are relative to it.
+inline bool ParsePeSections(const uint8_t* image, size_t size, ModuleInfo& module) {
+    PeHeaders headers;
+    if (!ReadPeHeaders(image, size, headers)) return false;
+
+    size_t count = headers.file.numberOfSections;
+    if (headers.sectionsOffset > size || (size - headers.sectionsOffset) / sizeof(PeSectionHeader) < count) {
+        return false;
+    }
+
+    module.size = headers.optional.sizeOfImage;
+    module.timeDateStamp = headers.file.timeDateStamp;
+    module.sections.clear();
+    for (size_t i = 0; i < count; i++) {
+        PeSectionHeader header;
+        ReadPeStruct(image, size, headers.sectionsOffset + i * sizeof(PeSectionHeader), header);
+        SectionInfo section;
+        section.name.assign(header.name, strnlen(header.name, sizeof(header.name)));
+        section.start = module.base + header.virtualAddress;
+        section.size = header.virtualSize ? header.virtualSize : header.sizeOfRawData;
+        section.rawOffset = header.pointerToRawData;
+        section.rawSize = header.sizeOfRawData;
+        section.characteristics = header.characteristics;
+        module.sections.push_back(section);
+    }
+    return true;
+}
+
+// Fills module.exports by name. Forwarded exports have no code in this module and are skipped.
+// For an image laid out on disk the sections must have been parsed first.
+inline bool ParsePeExports(const uint8_t* image, size_t size, bool mapped, ModuleInfo& module) {
+    module.exportsParsed = true;
+    PeHeaders headers;
+    if (!ReadPeHeaders(image, size, headers) || headers.optional.numberOfRvaAndSizes <= peExportDirectoryIndex) {
+        return false;
+    }
+
+    const PeDataDirectory& directory = headers.optional.dataDirectory[peExportDirectoryIndex];
+    size_t offset;
+    PeExportDirectory exports;
+    if (!directory.virtualAddress || !RvaToOffset(module, directory.virtualAddress, mapped, offset) ||
+        !ReadPeStruct(image, size, offset, exports)) {
+        return false;
+    }
+
+    size_t functionsOffset, namesOffset, ordinalsOffset;
+    if (!RvaToOffset(module, exports.addressOfFunctions, mapped, functionsOffset) ||
+        !RvaToOffset(module, exports.addressOfNames, mapped, namesOffset) ||
+        !RvaToOffset(module, exports.addressOfNameOrdinals, mapped, ordinalsOffset) ||
+        functionsOffset > size || (size - functionsOffset) / sizeof(uint32_t) < exports.numberOfFunctions ||
+        namesOffset > size || (size - namesOffset) / sizeof(uint32_t) < exports.numberOfNames ||
+        ordinalsOffset > size || (size - ordinalsOffset) / sizeof(uint16_t) < exports.numberOfNames) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < exports.numberOfNames; i++) {
+        uint16_t ordinal = 0;
+        uint32_t nameRva = 0, rva = 0;
+        ReadPeStruct(image, size, ordinalsOffset + i * sizeof(uint16_t), ordinal);
+        ReadPeStruct(image, size, namesOffset + i * sizeof(uint32_t), nameRva);
+        size_t nameOffset;
+        if (ordinal >= exports.numberOfFunctions || !RvaToOffset(module, nameRva, mapped, nameOffset) ||
+            nameOffset >= size) {
+            continue;
+        }
+        ReadPeStruct(image, size, functionsOffset + ordinal * sizeof(uint32_t), rva);
+        if (rva >= directory.virtualAddress && rva - directory.virtualAddress < directory.size) {
+            continue;
+        }
+        const char* name = (const char*)image + nameOffset;
+        module.exports[std::string(name, strnlen(name, size - nameOffset))] = module.base + rva;
+    }
+    return true;
+}
@@ -0,0 +1,219 @@
+#pragma once
+
+// Per-plugin memory arena, kept free of Windows headers so it also builds on Linux. main.cpp
+// supplies the VirtualAlloc chunk source; the mmap source below is what the tests run against.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+#include "page_protection.h"
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// Chunks come from this interface so the arena itself does not depend on VirtualAlloc
+struct ChunkSource {
+    virtual ~ChunkSource() = default;
+    virtual void* Reserve(size_t size, bool executable) = 0;
+    virtual void Release(void* memory, size_t size) = 0;
+};
+
+// Blocks are powers of two from 16 bytes to 32 KB; anything larger gets its own chunk
+constexpr size_t arenaChunkSize = 0x10000;
+constexpr size_t arenaMinBlock = 16;
+constexpr size_t arenaClassCount = 12;
+
+// One chunk holds blocks of a single size class
+struct ArenaChunk {
+    uintptr_t base = 0;
+    size_t size = 0;
+    size_t blockSize = 0;      // 0 for a dedicated large allocation
+    bool executable = false;
+    std::vector<uint32_t> freeBlocks;
+    std::vector<bool> used;
+    std::vector<size_t> requested;
+};
+
+struct ArenaStats {
+    size_t liveBytes = 0;      // bytes requested by live allocations
+    size_t blockBytes = 0;     // bytes handed out after rounding to a size class
+    size_t reservedBytes = 0;  // bytes held in chunks
+    size_t allocations = 0;
+    size_t chunks = 0;
+};
+
+class PluginArena {
+public:
+    explicit PluginArena(ChunkSource& source) : source(source) {}
+    PluginArena(const PluginArena&) = delete;
+    PluginArena& operator=(const PluginArena&) = delete;
+    ~PluginArena() { ReleaseAll(); }
+
+    // pageGranular blocks start on a page and never share one, so changing their protection
+    // leaves other allocations alone
+    void* Allocate(size_t size, bool executable, bool pageGranular = false) {
+        if (size == 0) size = 1;
+        size_t sizeClass = ClassFor(pageGranular ? (size + pageSize - 1) & ~(pageSize - 1) : size);
+        if (sizeClass == arenaClassCount) {
+            size_t chunkSize = (size + pageSize - 1) & ~(pageSize - 1);
+            ArenaChunk* chunk = NewChunk(chunkSize, 0, executable);
+            if (!chunk) return nullptr;
+            chunk->used[0] = true;
+            chunk->requested[0] = size;
+            stats.liveBytes += size;
+            stats.blockBytes += chunkSize;
+            stats.allocations++;
+            return (void*)chunk->base;
+        }
+
+        size_t blockSize = arenaMinBlock << sizeClass;
+        ArenaChunk* chunk = nullptr;
+        for (uintptr_t base : pools[executable][sizeClass]) {
+            ArenaChunk& candidate = chunks[base];
+            if (!candidate.freeBlocks.empty()) {
+                chunk = &candidate;
+                break;
+            }
+        }
+        if (!chunk) {
+            chunk = NewChunk(arenaChunkSize, blockSize, executable);
+            if (!chunk) return nullptr;
+            pools[executable][sizeClass].push_back(chunk->base);
+        }
+
+        uint32_t index = chunk->freeBlocks.back();
+        chunk->freeBlocks.pop_back();
+        chunk->used[index] = true;
+        chunk->requested[index] = size;
+        stats.liveBytes += size;
+        stats.blockBytes += blockSize;
+        stats.allocations++;
+
+        void* block = (void*)(chunk->base + index * blockSize);
+        memset(block, 0, blockSize);
+        return block;
+    }
+
+    // Returns false if the address is not the start of a live block from this arena
+    bool Free(uintptr_t address) {
+        auto it = chunks.upper_bound(address);
+        if (it == chunks.begin()) return false;
+        --it;
+        ArenaChunk& chunk = it->second;
+        if (address >= chunk.base + chunk.size) return false;
+
+        size_t blockSize = chunk.blockSize ? chunk.blockSize : chunk.size;
+        size_t offset = address - chunk.base;
+        if (offset % blockSize != 0) return false;
+        uint32_t index = (uint32_t)(offset / blockSize);
+        if (!chunk.used[index]) return false;
+
+        chunk.used[index] = false;
+        stats.liveBytes -= chunk.requested[index];
+        stats.blockBytes -= blockSize;
+        stats.allocations--;
+        chunk.requested[index] = 0;
+        chunk.freeBlocks.push_back(index);
+
+        // Hand fully free chunks back so a long session does not keep its peak footprint
+        if (chunk.freeBlocks.size() == chunk.used.size()) {
+            if (chunk.blockSize) {
+                auto& pool = pools[chunk.executable][ClassFor(chunk.blockSize)];
+                pool.erase(std::find(pool.begin(), pool.end(), chunk.base));
+            }
+            DropChunk(it);
+        }
+        return true;
+    }
+
+    void ReleaseAll() {
+        while (!chunks.empty()) DropChunk(chunks.begin());
+        for (auto& byType : pools)
+            for (auto& pool : byType) pool.clear();
+        stats = ArenaStats();
+    }
+
+    // True if [address, address + size) touches a chunk of sub-page blocks
+    bool SharesPage(uintptr_t address, size_t size) const {
+        auto it = chunks.upper_bound(address + size - 1);
+        while (it != chunks.begin()) {
+            --it;
+            const ArenaChunk& chunk = it->second;
+            if (chunk.base + chunk.size <= address) break;
+            if (chunk.blockSize && chunk.blockSize < pageSize) return true;
+        }
+        return false;
+    }
+
+    const ArenaStats& Stats() const { return stats; }
+
+private:
+    static size_t ClassFor(size_t size) {
+        size_t sizeClass = 0;
+        while (sizeClass < arenaClassCount && (arenaMinBlock << sizeClass) < size) sizeClass++;
+        return sizeClass;
+    }
+
+    ArenaChunk* NewChunk(size_t size, size_t blockSize, bool executable) {
+        void* memory = source.Reserve(size, executable);
+        if (!memory) return nullptr;
+
+        ArenaChunk& chunk = chunks[(uintptr_t)memory];
+        chunk.base = (uintptr_t)memory;
+        chunk.size = size;
+        chunk.blockSize = blockSize;
+        chunk.executable = executable;
+        size_t blockCount = blockSize ? size / blockSize : 1;
+        chunk.used.assign(blockCount, false);
+        chunk.requested.assign(blockCount, 0);
+        // Reverse order so blocks are handed out from the bottom of the chunk
+        for (size_t i = blockCount; i > 0; i--) chunk.freeBlocks.push_back((uint32_t)(i - 1));
+        if (!blockSize) chunk.freeBlocks.clear();
+
+        stats.reservedBytes += size;
+        stats.chunks++;
+        return &chunk;
+    }
+
+    void DropChunk(std::map<uintptr_t, ArenaChunk>::iterator it) {
+        ArenaChunk& chunk = it->second;
+        for (size_t i = 0; i < chunk.used.size(); i++) {
+            if (!chunk.used[i]) continue;
+            stats.liveBytes -= chunk.requested[i];
+            stats.blockBytes -= chunk.blockSize ? chunk.blockSize : chunk.size;
+            stats.allocations--;
+        }
+        source.Release((void*)chunk.base, chunk.size);
+        stats.reservedBytes -= chunk.size;
+        stats.chunks--;
+        chunks.erase(it);
+    }
+
+    ChunkSource& source;
+    std::map<uintptr_t, ArenaChunk> chunks;
+    std::vector<uintptr_t> pools[2][arenaClassCount];
+    ArenaStats stats;
+};
+
+#ifndef _WIN32
+// The POSIX counterpart of VirtualAllocChunkSource
+struct MmapChunkSource : ChunkSource {
+    size_t reserved = 0, released = 0;
+
+    void* Reserve(size_t size, bool executable) override {
+        int protect = PROT_READ | PROT_WRITE | (executable ? PROT_EXEC : 0);
+        void* memory = mmap(nullptr, size, protect, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) return nullptr;
+        reserved++;
+        return memory;
+    }
+
+    void Release(void* memory, size_t size) override {
+        munmap(memory, size);
+        released++;
+    }
+};
+#endif
@@ -25,58 +25,15 @@
     -- Clear log file at startup
     writeLog("Starting new session", true)
 
-    -- Optimized signature search function (from the second script with improvements)
-    local function findSignature(startAddress, signature, direction, maxBytes)
-        direction = direction or 1  -- 1 = down, -1 = up
-        maxBytes = maxBytes or 500000  -- Optimal search range
-
-        local signatureLength = #signature
-        local currentAddress = startAddress
-        local bytesChecked = 0
-        local endAddress = startAddress + (direction * maxBytes)
-
-        writeLog("Searching for '" .. signature .. "' from 0x" ..
-                 string.format("%X", startAddress) .. " direction: " ..
-                 (direction == 1 and "down" or "up") .. ", max " .. maxBytes .. " bytes")
-
-        while (direction == 1 and currentAddress < endAddress) or
-              (direction == -1 and currentAddress > endAddress) do
-
-            local match = true
-            for i = 1, signatureLength do
-                local checkAddr
-                if direction == 1 then
-                    checkAddr = currentAddress + (i - 1)
-                else
-                    checkAddr = currentAddress - signatureLength + i
-                end
-
-                local byteValue = Memory.ReadMemory(checkAddr, 1)
-                if byteValue ~= string.byte(signature, i) then
-                    match = false
-                    break
-                end
-            end
-
-            if match then
-                local resultAddress
-                if direction == -1 then
-                    resultAddress = currentAddress - signatureLength + 1
-                else
-                    resultAddress = currentAddress
-                end
-
-                writeLog("Found signature at 0x" .. string.format("%X", resultAddress) ..
-                         " after checking " .. bytesChecked .. " bytes")
-                return resultAddress
-            end
-
-            currentAddress = currentAddress + direction
-            bytesChecked = bytesChecked + 1
-        end
-
-        writeLog("Signature not found in " .. bytesChecked .. " bytes")
-        return nil
+    -- Pointer chain base + 0xDDB23C -> +0x74 (long season, isShort = 0), compiled once
+    local seasonChain = nil
+    local function getSeasonStruct()
+        if not seasonChain then
+            local base = Memory.GetModuleBase("F1_2012.exe")
+            if not base then return nil end
+            seasonChain = Memory.Chain(base + 0xDDB23C, {0*4 + 0x74, 0})
+        end
+        return seasonChain:Resolve()
     end
 
     -- Find the track array for the long season
@@ -88,15 +45,12 @@
             return false
         end
 
-        local ptrAddr = base + 0xDDB23C
-        local BASE1 = Memory.ReadMemory(ptrAddr, 4)
-        if not BASE1 or BASE1 == 0 then
+        local OFFSET1 = getSeasonStruct()
+        if not OFFSET1 then
             SCRIPT_RESULT = "Waiting for game initialization..."
             return false
         end
 
-        -- For long season (isShort = 0)
-        local OFFSET1 = Memory.ReadMemory(BASE1 + 0*4 + 0x74, 4)
         originalArray.start = Memory.ReadMemory(OFFSET1 + 0x58, 4)
         originalArray.end_ = Memory.ReadMemory(OFFSET1 + 0x5C, 4)
 
@@ -118,18 +72,12 @@
             originalArray.secondPtr = secondArrayPtr
 
             -- Read and store the first 32 bytes (header) from the second array
-            originalArray.header = {}
-            for i = 0, 31 do
-                originalArray.header[i] = Memory.ReadMemory(secondArrayPtr + i, 1)
-            end
+            originalArray.header = Memory.ReadBytes(secondArrayPtr, 32)
 
             -- Read and store the last 32 bytes (footer) + 4 bytes for FF FF FF FF
-            originalArray.footer = {}
             -- First, locate the footer (should be after 20 * 8 bytes of entries)
             local footerStart = secondArrayPtr + 32 + (originalArray.count * 8)
-            for i = 0, 35 do  -- 32 bytes footer + 4 bytes for FF FF FF FF
-                originalArray.footer[i] = Memory.ReadMemory(footerStart + i, 1)
-            end
+            originalArray.footer = Memory.ReadBytes(footerStart, 36)
         else
             writeLog("Warning: Could not find second array pointer at OFFSET1+630h")
         end
@@ -158,8 +106,9 @@
 
         writeLog("First track pointer: 0x" .. string.format("%X", firstTrackAddress))
 
-        -- Find SBDN signature (start of database.bin) by searching UP from track address
-        local sbdnAddress = findSignature(firstTrackAddress, "SBDN", -1, 500000)
+        -- The loader finds SBDN (start of database.bin) before the track and indexes
+        -- every ITMS record after it; the index is shared with other plugins
+        local sbdnAddress, trackCount = Game.IndexDatabase(firstTrackAddress)
         if not sbdnAddress then
             writeLog("Error: Failed to find SBDN signature (database.bin)")
             return false
@@ -167,47 +116,10 @@
 
         writeLog("Database.bin found at address: 0x" .. string.format("%X", sbdnAddress))
 
-        -- Find all tracks by ITMS signature (searching DOWN from SBDN)
-        local trackCount = 0
-        local currentAddress = sbdnAddress
-        local maxAddress = sbdnAddress + 5000000  -- Search limit
-
-        while currentAddress and currentAddress < maxAddress do
-            currentAddress = findSignature(currentAddress + 4, "ITMS", 1, 500000)
-
-            if currentAddress then
-                trackCount = trackCount + 1
-
-                -- Track address is right after ITMS
-                local trackAddress = currentAddress + 4
-
-                -- Get track name (at offset +0x20)
-                local nameAddress = trackAddress + 0x20
-                local trackName = ""
-                local emptyTrack = true
-
-                for i = 0, 30 do  -- Name length limit
-                    local char = Memory.ReadMemory(nameAddress + i, 1)
-                    if char == 0 then break end
-                    trackName = trackName .. string.char(char)
-                    emptyTrack = false
-                end
-
-                -- Stop searching if we find a track with empty name
-                if emptyTrack then
-                    writeLog("Found track with empty name, stopping search")
-                    break
-                end
-
-                -- Save track information
-                trackDatabase[trackCount] = {
-                    address = trackAddress,
-                    name = trackName
-                }
-
-                writeLog(trackCount .. ". \"" .. trackName .. "\" found at address: 0x" ..
-                        string.format("%X", trackAddress))
-            end
+        trackDatabase = Game.GetTracks()
+        for i, track in ipairs(trackDatabase) do
+            writeLog(i .. ". \"" .. track.name .. "\" found at address: 0x" ..
+                    string.format("%X", track.address))
         end
 
         writeLog("Total tracks found: " .. trackCount)
@@ -311,8 +223,9 @@
 
         -- Allocate memory for our array (8 bytes per race)
         -- Use maxPosition to ensure enough space for all entries
+        -- The game keeps pointing at this array, so it must not be freed when the plugin reloads
         local arraySize = maxPosition * 8
-        local arrayAddress = Memory.AllocateMemory(arraySize)
+        local arrayAddress = Memory.AllocateMemory(arraySize, false, { owned = false })
 
         if not arrayAddress or arrayAddress == 0 then
             writeLog("Error: Failed to allocate memory for custom array")
@@ -323,31 +236,26 @@
                 string.format("%X", arrayAddress) .. ", size=" .. arraySize .. " bytes")
 
         -- Initialize memory to zeros
-        for i = 0, arraySize - 1 do
-            Memory.WriteMemory(arrayAddress + i, 0, 1)
-        end
+        Memory.Fill(arrayAddress, 0, arraySize)
 
         -- Fill the array with data
         for position, info in pairs(customCalendar) do
             local entryAddress = arrayAddress + (position - 1) * 8
 
             -- Find the corresponding track in our database
-            local trackAddress = nil
+            local wanted = info.name:lower()
+            local trackAddress = Game.FindTrack(info.name)
             local bestMatchName = ""
             local bestMatchAddr = 0
 
-            -- First try exact match
-            for _, track in pairs(trackDatabase) do
-                if track.name:lower() == info.name:lower() then
-                    trackAddress = track.address
-                    break
-                end
-
-                -- Keep track of partial matches
-                if track.name:lower():find(info.name:lower(), 1, true) or
-                   info.name:lower():find(track.name:lower(), 1, true) then
-                    bestMatchName = track.name
-                    bestMatchAddr = track.address
+            -- Only fall back to a scan for partial matches when the exact lookup failed
+            if not trackAddress then
+                for _, track in pairs(trackDatabase) do
+                    local name = track.name:lower()
+                    if name:find(wanted, 1, true) or wanted:find(name, 1, true) then
+                        bestMatchName = track.name
+                        bestMatchAddr = track.address
+                    end
                 end
             end
 
@@ -393,15 +301,9 @@
 
 	-- Function to modify second array (objective manager)
 	local function createCustomStructure()
-		local base = Memory.GetModuleBase("F1_2012.exe")
-		if not base then return false end
-
-		local ptrAddr = base + 0xDDB23C
-		local BASE1 = Memory.ReadMemory(ptrAddr, 4)
-		if not BASE1 or BASE1 == 0 then return false end
-
 		-- For long season (isShort = 0)
-		local OFFSET1 = Memory.ReadMemory(BASE1 + 0*4 + 0x74, 4)
+		local OFFSET1 = getSeasonStruct()
+		if not OFFSET1 then return false end
 
 		-- Получаем адрес существующей структуры
 		local existingStructAddr = Memory.ReadMemory(OFFSET1 + 0x630, 4)
@@ -419,17 +321,23 @@
 		local foundSecondFFFF = false
 		local secondFFFFPos = 0
 
-		for i = 0, maxSearchBytes, 1 do
-			local b1 = Memory.ReadMemory(currentPos + i, 1)
-			local b2 = Memory.ReadMemory(currentPos + i + 1, 1)
-			local b3 = Memory.ReadMemory(currentPos + i + 2, 1)
-			local b4 = Memory.ReadMemory(currentPos + i + 3, 1)
-
-			if b1 == 0xFF and b2 == 0xFF and b3 == 0xFF and b4 == 0xFF then
-					foundFirstFFFF = true
-					secondFFFFPos = currentPos + i
-					writeLog("Found first FFFF at offset: " .. i)
-			end
+		-- Читаем диапазон постранично: нечитаемая страница не скрывает маркеры на остальных
+		local windowSize = maxSearchBytes + 4
+		local pieces = {}
+		local offset = 0
+		while offset < windowSize do
+			local address = currentPos + offset
+			local pieceSize = math.min(0x1000 - address % 0x1000, windowSize - offset)
+			pieces[#pieces + 1] = Memory.ReadBytes(address, pieceSize) or string.rep("\0", pieceSize)
+			offset = offset + pieceSize
+		end
+		local block = table.concat(pieces)
+		local i = block:find("\255\255\255\255", 1, true)
+		while i do
+			foundFirstFFFF = true
+			secondFFFFPos = currentPos + i - 1
+			writeLog("Found first FFFF at offset: " .. (i - 1))
+			i = block:find("\255\255\255\255", i + 1, true)
 		end
 
 		if not foundFirstFFFF then
@@ -478,16 +386,11 @@
 			-- Вычисляем смещение, где должен быть новый маркер конца
 			local newMarkerPos = entriesStart + (maxPosition * 8)
 
-			-- Заполняем 16 байт нулями перед новым маркером конца
-			for i = 0, 15 do
-				Memory.WriteMemory(newMarkerPos + i, 0, 1)
-			end
-
-			-- Устанавливаем новый маркер конца
-			Memory.WriteMemory(newMarkerPos + 16, 0xFF, 1)
-			Memory.WriteMemory(newMarkerPos + 17, 0xFF, 1)
-			Memory.WriteMemory(newMarkerPos + 18, 0xFF, 1)
-			Memory.WriteMemory(newMarkerPos + 19, 0xFF, 1)
+			-- Заполняем 16 байт нулями перед новым маркером конца и ставим маркер
+			Memory.BeginWrite()
+			Memory.Fill(newMarkerPos, 0, 16)
+			Memory.WriteBytes(newMarkerPos + 16, "\255\255\255\255")
+			Memory.Commit()
 
 			writeLog("Removed " .. (racesInStruct - maxPosition) .. " entries. New FF FF FF FF marker at offset " ..
 					(newMarkerPos - existingStructAddr + 16))
@@ -495,27 +398,19 @@
 			-- Календарь больше - добавляем новые записи
 			writeLog("Calendar is larger than existing structure. Adding " .. (maxPosition - racesInStruct) .. " entries.")
 
+			Memory.BeginWrite()
+
 			-- Заполняем нулями новые записи
-			for i = racesInStruct, maxPosition - 1 do
-				local entryAddr = entriesStart + (i * 8)
-				for j = 0, 7 do
-					Memory.WriteMemory(entryAddr + j, 0, 1)
-				end
-			end
+			Memory.Fill(entriesStart + (racesInStruct * 8), 0, (maxPosition - racesInStruct) * 8)
 
 			-- Вычисляем смещение, где должен быть новый маркер конца
 			local newMarkerPos = entriesStart + (maxPosition * 8)
 
-			-- Заполняем 16 байт нулями перед новым маркером конца
-			for i = 0, 15 do
-				Memory.WriteMemory(newMarkerPos + i, 0, 1)
-			end
+			-- Заполняем 16 байт нулями перед новым маркером конца и ставим маркер
+			Memory.Fill(newMarkerPos, 0, 16)
+			Memory.WriteBytes(newMarkerPos + 16, "\255\255\255\255")
 
-			-- Устанавливаем новый маркер конца
-			Memory.WriteMemory(newMarkerPos + 16, 0xFF, 1)
-			Memory.WriteMemory(newMarkerPos + 17, 0xFF, 1)
-			Memory.WriteMemory(newMarkerPos + 18, 0xFF, 1)
-			Memory.WriteMemory(newMarkerPos + 19, 0xFF, 1)
+			Memory.Commit()
 
 			writeLog("Added " .. (maxPosition - racesInStruct) .. " entries. New FF FF FF FF marker at offset " ..
 					(newMarkerPos - existingStructAddr + 16))
@@ -529,12 +424,9 @@
         local base = Memory.GetModuleBase("F1_2012.exe")
         if not base then return false end
 
-        local ptrAddr = base + 0xDDB23C
-        local BASE1 = Memory.ReadMemory(ptrAddr, 4)
-        if not BASE1 or BASE1 == 0 then return false end
-
         -- For long season (isShort = 0)
-        local OFFSET1 = Memory.ReadMemory(BASE1 + 0*4 + 0x74, 4)
+        local OFFSET1 = getSeasonStruct()
+        if not OFFSET1 then return false end
 		local OFFSET2 = Memory.ReadMemory(OFFSET1 + 0x13C, 4)
 
         -- Save original pointers (for debugging and possible restoration)
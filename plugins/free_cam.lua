@@ -74,25 +74,22 @@ local cfg = {
     mouseSens = tonumber(controls.MouseSensitivity) or 0.005
 }
 
--- Memory helpers
-local function readFloat(addr)
-    return ffi.cast('float*', addr)[0]
-end
-local function writeFloat(addr, val)
-    ffi.cast('float*', addr)[0] = val
-end
-
 local base = Memory.GetModuleBase('F1_2012.exe')
+local camChain = Memory.Chain(base + 0xE374CC, {0})
 local CamStructure
 
+-- The game keeps a second copy of the camera block 0x70 bytes further on
+local camLayout = Memory.DefineStruct('Camera', {
+    {name='up',      offset=0x630, type='f32', count=3, mirrors={0x6A0}},
+    {name='right',   offset=0x640, type='f32', count=3, mirrors={0x6B0}},
+    {name='forward', offset=0x650, type='f32', count=3, mirrors={0x6C0}},
+    {name='pos',     offset=0x660, type='f32', count=3, mirrors={0x6D0}},
+    {name='fov',     offset=0x670, type='f32', mirrors={0x6E0}}
+})
+
 local function findCamStructure()
-    local ptr = Memory.ReadMemory(base + 0xE374CC, 4)
-    if ptr and ptr ~= 0 then
-        CamStructure = ptr
-        return true
-    end
-    CamStructure = nil
-    return false
+    CamStructure = camChain:Resolve()
+    return CamStructure ~= nil
 end
 
 local renderOffsets = {0x26C0B7,0x26C0C5,0x26C0D3,0x26C0E1,0x26C0F0,0x26C100,0x26C110,0x26C120,0x26C130,0x26C140,0x26C150,0x26C15D}
@@ -102,24 +99,25 @@ local savedBytes = {}
 local active = false
 
 local function patch(addrs)
+    Memory.BeginWrite()
     for i,off in ipairs(addrs) do
         local addr = base + off
         local size = patchSize[i]
-        local bytes = {}
-        for j=0,size-1 do
-            bytes[j+1] = Memory.ReadMemory(addr+j,1)
-            Memory.WriteMemory(addr+j,0x90,1)
+        local bytes = Memory.ReadBytes(addr, size)
+        if bytes then
+            Memory.Fill(addr, 0x90, size)
+            savedBytes[addr] = bytes
         end
-        savedBytes[addr] = {size=size,data=bytes}
     end
+    Memory.Commit()
 end
 
 local function restore()
-    for addr,info in pairs(savedBytes) do
-        for i=0,info.size-1 do
-            Memory.WriteMemory(addr+i, info.data[i+1],1)
-        end
+    Memory.BeginWrite()
+    for addr,bytes in pairs(savedBytes) do
+        Memory.WriteBytes(addr, bytes)
     end
+    Memory.Commit()
     savedBytes = {}
 end
 
@@ -171,39 +169,20 @@ local function updateOrientation()
     end
 end
 
-local function readOrientation()
-    orient.up     = { readFloat(CamStructure+0x630), readFloat(CamStructure+0x634), readFloat(CamStructure+0x638) }
-    orient.right  = { readFloat(CamStructure+0x640), readFloat(CamStructure+0x644), readFloat(CamStructure+0x648) }
-    orient.forward= { readFloat(CamStructure+0x650), readFloat(CamStructure+0x654), readFloat(CamStructure+0x658) }
+local function readCamera()
+    local cam = camLayout:Read(CamStructure)
+    if not cam then return false end
+    orient.up, orient.right, orient.forward = cam.up, cam.right, cam.forward
+    pos = cam.pos
+    fov = cam.fov
+    return true
 end
 
-local function readPosition()
-    pos = { readFloat(CamStructure+0x660), readFloat(CamStructure+0x664), readFloat(CamStructure+0x668) }
-end
-local function writeOrientation()
-    local vals = {
-        orient.up[1], orient.up[2], orient.up[3],
-        orient.right[1], orient.right[2], orient.right[3],
-        orient.forward[1], orient.forward[2], orient.forward[3]
-    }
-    local o1 = {0x630,0x634,0x638,0x640,0x644,0x648,0x650,0x654,0x658}
-    local o2 = {0x6A0,0x6A4,0x6A8,0x6B0,0x6B4,0x6B8,0x6C0,0x6C4,0x6C8}
-    for i=1,9 do
-        writeFloat(CamStructure+o1[i], vals[i])
-        writeFloat(CamStructure+o2[i], vals[i])
-    end
-end
-local function writePosition()
-    local offs1 = {0x660,0x664,0x668}
-    local offs2 = {0x6D0,0x6D4,0x6D8}
-    for i=1,3 do
-        writeFloat(CamStructure+offs1[i], pos[i])
-        writeFloat(CamStructure+offs2[i], pos[i])
-    end
-end
-local function writeFov()
-    writeFloat(CamStructure+0x670, fov)
-    writeFloat(CamStructure+0x6E0, fov)
+local function writeCamera()
+    camLayout:Write(CamStructure, {
+        up = orient.up, right = orient.right, forward = orient.forward,
+        pos = pos, fov = fov
+    })
 end
 
 local screenCenter = {x=0, y=0}
@@ -235,9 +214,7 @@ local function enable()
     end
     patch(renderOffsets)
     patch(camOffsets)
-    readOrientation()
-    readPosition()
-    fov = readFloat(CamStructure+0x670)
+    readCamera()
     local p,y,r = toEuler()
     pitch = math.rad(p)
     yaw = math.rad(y)
@@ -292,9 +269,7 @@ function OnFrame()
     end
 
     if not active then
-        readOrientation()
-        readPosition()
-        fov = readFloat(CamStructure+0x670)
+        readCamera()
         local p,y,r = toEuler()
         pitch = math.rad(p)
         yaw = math.rad(y)
@@ -384,17 +359,13 @@ function OnFrame()
 
     updateOrientation()
 
-    writeOrientation()
-    writePosition()
-    writeFov()
+    writeCamera()
     SCRIPT_RESULT = status('ENABLED')
     return true
 end
 
 if findCamStructure() then
-    readOrientation()
-    readPosition()
-    fov = readFloat(CamStructure+0x670)
+    readCamera()
     local p,y,r = toEuler()
     pitch = math.rad(p)
     yaw = math.rad(y)
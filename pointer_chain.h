@@ -0,0 +1,140 @@
+#pragma once
+
+// Pointer chains behind Memory.Chain. Only needs the Lua API and GuardedCopy, so the tests can
+// time them against the same walk written in Lua.
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <lua.hpp>
+#include "page_protection.h"
+
+// Memory.Chain(base, {o1, ..., on}): address = base; for each offset address = [address] + offset.
+// The first hop reads the root pointer at base, so a cached chain revalidates with one load.
+struct PointerChain {
+    uintptr_t base;
+    bool cached;
+    bool valid;
+    uint32_t root;       // Value of [base] when the cache was filled
+    uintptr_t resolved;  // Final address for that root
+    size_t offsetCount;
+    intptr_t offsets[1]; // Allocated inline with the userdata
+};
+
+inline bool LoadPointer(uintptr_t address, uint32_t& value) {
+    return GuardedCopy(&value, (const void*)address, sizeof(value));
+}
+
+inline bool ResolveChain(PointerChain* chain, uintptr_t& result) {
+    uint32_t root;
+    if (!LoadPointer(chain->base, root) || root == 0) {
+        chain->valid = false;
+        return false;
+    }
+
+    if (chain->cached && chain->valid && chain->root == root) {
+        result = chain->resolved;
+        return true;
+    }
+
+    uintptr_t address = (uintptr_t)root + chain->offsets[0];
+    for (size_t i = 1; i < chain->offsetCount; ++i) {
+        uint32_t next;
+        if (!LoadPointer(address, next) || next == 0) {
+            chain->valid = false;
+            return false;
+        }
+        address = (uintptr_t)next + chain->offsets[i];
+    }
+
+    chain->root = root;
+    chain->resolved = address;
+    chain->valid = true;
+    result = address;
+    return true;
+}
+
+// Memory.Chain(base, {offsets...}, [cache = false])
+inline int lua_CreateChain(lua_State* L) {
+    uintptr_t base = (uintptr_t)luaL_checkinteger(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+    bool cached = lua_toboolean(L, 3) != 0;
+
+    std::vector<intptr_t> offsets;
+    for (int i = 1; ; ++i) {
+        lua_rawgeti(L, 2, i);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        offsets.push_back((intptr_t)luaL_checkinteger(L, -1));
+        lua_pop(L, 1);
+    }
+    if (offsets.empty()) {
+        offsets.push_back(0);
+    }
+
+    size_t bytes = sizeof(PointerChain) + (offsets.size() - 1) * sizeof(intptr_t);
+    PointerChain* chain = (PointerChain*)lua_newuserdata(L, bytes);
+    chain->base = base;
+    chain->cached = cached;
+    chain->valid = false;
+    chain->root = 0;
+    chain->resolved = 0;
+    chain->offsetCount = offsets.size();
+    memcpy(chain->offsets, offsets.data(), offsets.size() * sizeof(intptr_t));
+
+    luaL_getmetatable(L, "PointerChain");
+    lua_setmetatable(L, -2);
+    return 1;
+}
+
+// chain:Resolve() -> final address, or nil on any null or unreadable hop
+inline int lua_Chain_Resolve(lua_State* L) {
+    PointerChain* chain = (PointerChain*)luaL_checkudata(L, 1, "PointerChain");
+    uintptr_t address;
+    if (ResolveChain(chain, address)) {
+        lua_pushinteger(L, (lua_Integer)address);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// chain:Read([size = 4]) -> value stored at the resolved address, or nil
+inline int lua_Chain_Read(lua_State* L) {
+    PointerChain* chain = (PointerChain*)luaL_checkudata(L, 1, "PointerChain");
+    size_t size = (size_t)luaL_optinteger(L, 2, 4);
+    luaL_argcheck(L, size == 1 || size == 2 || size == 4, 2, "size must be 1, 2 or 4");
+
+    uintptr_t address;
+    uint32_t value = 0;
+    if (ResolveChain(chain, address) && GuardedCopy(&value, (const void*)address, size)) {
+        lua_pushnumber(L, (lua_Number)value);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+inline int lua_Chain_Invalidate(lua_State* L) {
+    PointerChain* chain = (PointerChain*)luaL_checkudata(L, 1, "PointerChain");
+    chain->valid = false;
+    return 0;
+}
+
+inline void RegisterPointerChain(lua_State* L) {
+    luaL_newmetatable(L, "PointerChain");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_Chain_Resolve);
+    lua_setfield(L, -2, "Resolve");
+    lua_pushcfunction(L, lua_Chain_Read);
+    lua_setfield(L, -2, "Read");
+    lua_pushcfunction(L, lua_Chain_Invalidate);
+    lua_setfield(L, -2, "Invalidate");
+    lua_setfield(L, -2, "__index");
+
+    lua_pop(L, 1);
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+// The pointer index behind Memory.PointerIndex, kept free of Windows headers so it also builds
+// on Linux. main.cpp finds the readable runs and the committed regions, and reads memory
+// under SEH; this part collects and sorts what it reads.
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <iterator>
+#include <vector>
+#include "scan_thread_pool.h"
+
+// Every aligned value in the indexed ranges that points into committed memory, sorted by
+// target so "who points into [lo, hi)" is one binary search
+struct PointerRef {
+    uintptr_t target;
+    uintptr_t source;
+};
+
+struct PointerIndex {
+    std::vector<AddressRange> sources;  // Ranges that were indexed, kept for Rebuild
+    std::vector<PointerRef> refs;       // Ordered by target, then source
+    size_t bytes = 0;
+    double seconds = 0;
+};
+
+// Supplied by main.cpp, or by the test harness. CollectPointers under SEH.
+ScanThreadPool& GetScanThreadPool();
+bool GuardedCollectPointers(const uintptr_t* data, size_t count, const std::vector<AddressRange>* mapped,
+    std::vector<PointerRef>* refs);
+
+// Appends every value in data[0, count) that lands inside one of the mapped ranges.
+// Pointers cluster, so the range of the previous hit is tried before searching.
+inline void CollectPointers(const uintptr_t* data, size_t count, const std::vector<AddressRange>& mapped,
+    std::vector<PointerRef>& refs) {
+    if (mapped.empty()) return;
+    uintptr_t low = mapped.front().start, high = mapped.back().end;
+    size_t last = 0;
+    for (size_t i = 0; i < count; i++) {
+        uintptr_t value = data[i];
+        if (value < low || value >= high) continue;
+        if (value < mapped[last].start || value >= mapped[last].end) {
+            auto it = std::upper_bound(mapped.begin(), mapped.end(), value,
+                [](uintptr_t v, const AddressRange& range) { return v < range.start; });
+            if (it == mapped.begin() || value >= std::prev(it)->end) continue;
+            last = (size_t)(std::prev(it) - mapped.begin());
+        }
+        refs.push_back({ value, (uintptr_t)(data + i) });
+    }
+}
+
+// Stable LSD radix sort on target, one byte per pass. refs[bounds[p], bounds[p + 1]) is a
+// segment that counts and scatters on its own, so the passes can run on the scan pool.
+// Sources come in address order, so equal targets stay ordered by source.
+inline void RadixSortRefs(std::vector<PointerRef>& refs, const std::vector<size_t>& bounds, bool parallel) {
+    size_t parts = bounds.size() - 1;
+    std::vector<PointerRef> scratch(refs.size());
+    std::vector<std::array<size_t, 256>> offsets(parts);
+
+    auto run = [&](std::function<void(size_t)> task) {
+        if (parallel) {
+            GetScanThreadPool().Run(parts, task);
+        }
+        else {
+            for (size_t p = 0; p < parts; p++) task(p);
+        }
+    };
+
+    for (unsigned shift = 0; shift < sizeof(uintptr_t) * 8; shift += 8) {
+        run([&](size_t p) {
+            offsets[p].fill(0);
+            for (size_t i = bounds[p]; i < bounds[p + 1]; i++) {
+                offsets[p][(refs[i].target >> shift) & 0xFF]++;
+            }
+        });
+
+        // Turn the counts into each segment's first slot per digit
+        size_t next = 0;
+        bool skip = false;
+        for (size_t digit = 0; digit < 256 && !skip; digit++) {
+            size_t digitStart = next;
+            for (size_t p = 0; p < parts; p++) {
+                size_t count = offsets[p][digit];
+                offsets[p][digit] = next;
+                next += count;
+            }
+            // Every key has the same byte here, so this pass would not move anything
+            skip = next - digitStart == refs.size();
+        }
+        if (skip) continue;
+
+        run([&](size_t p) {
+            std::array<size_t, 256>& slot = offsets[p];
+            for (size_t i = bounds[p]; i < bounds[p + 1]; i++) {
+                scratch[slot[(refs[i].target >> shift) & 0xFF]++] = refs[i];
+            }
+        });
+        refs.swap(scratch);
+    }
+}
+
+// Collects the refs of every aligned word in runs and sorts them by target. Chunks that fault
+// are left out and reported in faulted.
+inline void BuildPointerRefs(const std::vector<AddressRange>& runs, const std::vector<AddressRange>& mapped, bool parallel,
+    std::vector<PointerRef>& refs, std::vector<AddressRange>& faulted) {
+    std::vector<ScanChunk> chunks = SplitScanChunks(runs, 0);
+    std::vector<std::vector<PointerRef>> chunkRefs(chunks.size());
+    std::vector<char> chunkFaulted(chunks.size(), 0);
+    auto collect = [&](size_t i) {
+        const ScanChunk& chunk = chunks[i];
+        uintptr_t first = (chunk.start + sizeof(uintptr_t) - 1) & ~(uintptr_t)(sizeof(uintptr_t) - 1);
+        if (first >= chunk.ownedEnd) return;
+        size_t count = (chunk.ownedEnd - first) / sizeof(uintptr_t);
+        if (!GuardedCollectPointers((const uintptr_t*)first, count, &mapped, &chunkRefs[i])) {
+            chunkFaulted[i] = 1;
+        }
+    };
+
+    if (parallel) {
+        GetScanThreadPool().Run(chunks.size(), collect);
+    }
+    else {
+        for (size_t i = 0; i < chunks.size(); i++) collect(i);
+    }
+
+    // Chunks are in address order, so concatenating keeps sources sorted within each target
+    std::vector<size_t> bounds(1, 0);
+    size_t count = 0;
+    for (const auto& found : chunkRefs) count += found.size();
+    refs.clear();
+    refs.reserve(count);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        if (chunkFaulted[i]) faulted.push_back({ chunks[i].start, chunks[i].end });
+        refs.insert(refs.end(), chunkRefs[i].begin(), chunkRefs[i].end());
+        std::vector<PointerRef>().swap(chunkRefs[i]);
+        bounds.push_back(refs.size());
+    }
+    RadixSortRefs(refs, bounds, parallel);
+}
@@ -0,0 +1,223 @@
+#pragma once
+
+// Work-stealing pool for chunked scans, kept free of Windows headers so it also builds on
+// Linux. main.cpp defines scanStats and the process-wide pool. Ranges are split into the
+// pool's chunks here too.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct ScanBatch {
+    std::function<void(size_t)> task;
+    std::atomic<size_t> remaining{ 0 };
+    std::atomic<bool> cancelled{ false };
+    bool detached = false;     // Submitted without a waiter; the worker that runs it frees it
+    std::mutex doneLock;
+    std::condition_variable done;
+};
+
+struct ScanTask {
+    ScanBatch* batch;
+    size_t index;
+};
+
+struct ScanStats {
+    std::atomic<uint64_t> jobs{ 0 };
+    std::atomic<uint64_t> chunks{ 0 };
+    std::atomic<uint64_t> steals{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+    std::atomic<uint64_t> microseconds{ 0 };
+};
+
+extern ScanStats scanStats;
+
+class ScanThreadPool {
+public:
+    explicit ScanThreadPool(size_t threads) : queues(threads) {
+        for (size_t i = 0; i < threads; i++) {
+            // Detached on purpose: joining from DllMain during unload would deadlock on the loader lock
+            std::thread(&ScanThreadPool::WorkerLoop, this, i).detach();
+        }
+    }
+
+    size_t ThreadCount() const { return queues.size(); }
+
+    // Runs task(0) .. task(count - 1) across the pool and returns once all have finished.
+    // The calling thread works on the batch too, so nested or concurrent callers can't starve.
+    // It only takes tasks of its own batch, so a render thread scan never picks up a
+    // submitted long-running one.
+    void Run(size_t count, std::function<void(size_t)> task, std::atomic<bool>* cancel = nullptr) {
+        if (count == 0) return;
+        ScanBatch batch;
+        batch.task = std::move(task);
+        batch.remaining = count;
+        Enqueue(&batch, count);
+
+        while (batch.remaining > 0) {
+            if (cancel && *cancel) batch.cancelled = true;
+            ScanTask stolen;
+            if (StealFrom(&batch, stolen)) {
+                Execute(stolen);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(batch.doneLock);
+            batch.done.wait_for(guard, std::chrono::milliseconds(5), [&] { return batch.remaining == 0; });
+        }
+        // The last worker decrements under this lock; wait for it to let go before the batch dies
+        std::lock_guard<std::mutex> guard(batch.doneLock);
+    }
+
+    // Queues task for a worker and returns at once, for scans started from the render thread.
+    // A scan the task runs with Run is still split across the pool.
+    void Submit(std::function<void()> task) {
+        ScanBatch* batch = new ScanBatch;
+        batch->task = [task](size_t) { task(); };
+        batch->remaining = 1;
+        batch->detached = true;
+        Enqueue(batch, 1);
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<ScanTask> tasks;
+    };
+
+    std::vector<WorkerQueue> queues;
+    std::atomic<size_t> nextQueue{ 0 };
+    std::mutex sleepLock;
+    std::condition_variable wake;
+    size_t pending = 0;
+
+    void Enqueue(ScanBatch* batch, size_t count) {
+        {
+            std::lock_guard<std::mutex> guard(sleepLock);
+            pending += count;
+        }
+        size_t first = nextQueue.fetch_add(count);
+        for (size_t i = 0; i < count; i++) {
+            WorkerQueue& queue = queues[(first + i) % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.tasks.push_back({ batch, i });
+        }
+        wake.notify_all();
+    }
+
+    bool PopLocal(size_t self, ScanTask& task) {
+        WorkerQueue& queue = queues[self];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) return false;
+        task = queue.tasks.back();
+        queue.tasks.pop_back();
+        Taken();
+        return true;
+    }
+
+    bool Steal(size_t self, ScanTask& task) {
+        for (size_t i = 0; i < queues.size(); i++) {
+            if (i == self) continue;
+            WorkerQueue& queue = queues[i];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            if (queue.tasks.empty()) continue;
+            task = queue.tasks.front();
+            queue.tasks.pop_front();
+            Taken();
+            scanStats.steals++;
+            return true;
+        }
+        return false;
+    }
+
+    // Takes a task of batch from any queue, for the thread waiting on that batch
+    bool StealFrom(const ScanBatch* batch, ScanTask& task) {
+        for (WorkerQueue& queue : queues) {
+            std::lock_guard<std::mutex> guard(queue.lock);
+            auto it = std::find_if(queue.tasks.begin(), queue.tasks.end(),
+                [batch](const ScanTask& queued) { return queued.batch == batch; });
+            if (it == queue.tasks.end()) continue;
+            task = *it;
+            queue.tasks.erase(it);
+            Taken();
+            scanStats.steals++;
+            return true;
+        }
+        return false;
+    }
+
+    void Taken() {
+        std::lock_guard<std::mutex> guard(sleepLock);
+        pending--;
+    }
+
+    void Execute(const ScanTask& task) {
+        ScanBatch* batch = task.batch;
+        if (!batch->cancelled) {
+            batch->task(task.index);
+            scanStats.chunks++;
+        }
+        if (batch->detached) {
+            delete batch;
+            return;
+        }
+        // Lock so the submitter can't miss the wakeup and destroy the batch under us
+        std::lock_guard<std::mutex> guard(batch->doneLock);
+        if (--batch->remaining == 0) {
+            batch->done.notify_all();
+        }
+    }
+
+    void WorkerLoop(size_t self) {
+        while (true) {
+            ScanTask task;
+            if (PopLocal(self, task) || Steal(self, task)) {
+                Execute(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> guard(sleepLock);
+            wake.wait(guard, [&] { return pending > 0; });
+        }
+    }
+};
+
+struct AddressRange {
+    uintptr_t start;
+    uintptr_t end;
+};
+
+// Ranges below this size are scanned on the calling thread; above it they go to the pool
+constexpr size_t parallelScanThreshold = 4 * 1024 * 1024;
+constexpr size_t scanChunkSize = 1024 * 1024;
+
+// A piece of a readable run. Matches must start before ownedEnd; the bytes up to end
+// overlap the next chunk so a match straddling the boundary is still seen whole.
+struct ScanChunk {
+    uintptr_t start;
+    uintptr_t ownedEnd;
+    uintptr_t end;
+};
+
+inline std::vector<ScanChunk> SplitScanChunks(const std::vector<AddressRange>& runs, size_t overlap) {
+    std::vector<ScanChunk> chunks;
+    for (const auto& run : runs) {
+        for (uintptr_t chunkStart = run.start; chunkStart < run.end; ) {
+            uintptr_t ownedEnd = run.end - chunkStart > scanChunkSize ? chunkStart + scanChunkSize : run.end;
+            uintptr_t end = run.end - ownedEnd > overlap ? ownedEnd + overlap : run.end;
+            chunks.push_back({ chunkStart, ownedEnd, end });
+            chunkStart = ownedEnd;
+        }
+    }
+    return chunks;
+}
+
+inline size_t TotalRunBytes(const std::vector<AddressRange>& runs) {
+    size_t total = 0;
+    for (const auto& run : runs) total += run.end - run.start;
+    return total;
+}
@@ -0,0 +1,158 @@
+#pragma once
+
+// The signature cache file and module fingerprints, kept free of Windows headers so they also
+// build on Linux. Each line of the file is "module, section, fingerprint, rva, pattern",
+// tab-separated, with the numbers in hex.
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "pe_image.h"
+
+struct ModuleFingerprint {
+    uint32_t timeDateStamp = 0;
+    uint32_t imageSize = 0;
+    uint64_t textHash = 0;
+
+    bool operator==(const ModuleFingerprint& other) const {
+        return timeDateStamp == other.timeDateStamp && imageSize == other.imageSize && textHash == other.textHash;
+    }
+};
+
+struct SignatureCacheEntry {
+    ModuleFingerprint fingerprint;
+    uintptr_t rva;
+};
+
+inline uint64_t HashBytes(const uint8_t* data, size_t size) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    for (size_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Fingerprints the image as laid out on disk, so our own patches and breakpoints in the
+// loaded .text don't change it. Returns false if the file can't be parsed.
+inline bool ComputeFingerprint(const std::vector<uint8_t>& file, ModuleFingerprint& fingerprint) {
+    ModuleInfo parsed;
+    if (!ParsePeSections(file.data(), file.size(), parsed)) return false;
+
+    fingerprint.timeDateStamp = parsed.timeDateStamp;
+    fingerprint.imageSize = (uint32_t)parsed.size;
+    fingerprint.textHash = 0;
+    for (const auto& section : parsed.sections) {
+        if (section.name == ".text" && (size_t)section.rawOffset + section.rawSize <= file.size()) {
+            fingerprint.textHash = HashBytes(file.data() + section.rawOffset, section.rawSize);
+        }
+    }
+    return true;
+}
+
+inline std::string FormatCacheLine(const std::string& key, const SignatureCacheEntry& entry) {
+    // key is "module\tsection\tpattern"; the pattern goes last since it contains spaces
+    size_t split = key.find('\t', key.find('\t') + 1);
+    char fields[80];
+    snprintf(fields, sizeof(fields), "%08lX\t%08lX\t%016llX\t%08lX",
+        (unsigned long)entry.fingerprint.timeDateStamp, (unsigned long)entry.fingerprint.imageSize,
+        (unsigned long long)entry.fingerprint.textHash, (unsigned long)entry.rva);
+    return key.substr(0, split) + "\t" + fields + key.substr(split);
+}
+
+// One to digits hex digits and nothing else. strtoull alone would read an empty field as 0
+// and wrap a negative one.
+inline bool ParseHexField(const std::string& field, size_t digits, uint64_t& value) {
+    if (field.empty() || field.size() > digits) return false;
+    for (char c : field) {
+        if (!isxdigit((unsigned char)c)) return false;
+    }
+    value = strtoull(field.c_str(), nullptr, 16);
+    return true;
+}
+
+inline bool ParseCacheLine(const std::string& line, std::string& key, SignatureCacheEntry& entry) {
+    std::vector<std::string> fields;
+    std::stringstream stream(line);
+    std::string field;
+    while (std::getline(stream, field, '\t')) fields.push_back(field);
+    if (fields.size() != 7 || fields[0].empty() || fields[1].empty() || fields[6].empty()) return false;
+
+    uint64_t timeDateStamp, imageSize, textHash, rva;
+    if (!ParseHexField(fields[2], 8, timeDateStamp) || !ParseHexField(fields[3], 8, imageSize) ||
+        !ParseHexField(fields[4], 16, textHash) || !ParseHexField(fields[5], 8, rva)) {
+        return false;
+    }
+    entry.fingerprint.timeDateStamp = (uint32_t)timeDateStamp;
+    entry.fingerprint.imageSize = (uint32_t)imageSize;
+    entry.fingerprint.textHash = textHash;
+    entry.rva = (uintptr_t)rva;
+
+    key = fields[0] + "\t" + fields[1] + "\t" + fields[6];
+    return true;
+}
+
+class SignatureCache {
+public:
+    explicit SignatureCache(const std::string& path) : path(path) {}
+
+    bool Lookup(const std::string& key, const ModuleFingerprint& fingerprint, uintptr_t& rva) {
+        std::lock_guard<std::mutex> guard(lock);
+        Load();
+        auto it = entries.find(key);
+        if (it == entries.end() || !(it->second.fingerprint == fingerprint)) return false;
+        rva = it->second.rva;
+        return true;
+    }
+
+    void Store(const std::string& key, const SignatureCacheEntry& entry) {
+        std::lock_guard<std::mutex> guard(lock);
+        Load();
+        entries[key] = entry;
+
+        std::ofstream file(path, std::ios::out | std::ios::trunc);
+        for (const auto& pair : entries) {
+            file << FormatCacheLine(pair.first, pair.second) << "\n";
+        }
+    }
+
+    // Fingerprints are computed once per module file for the session
+    bool GetFingerprint(const std::string& modulePath, ModuleFingerprint& fingerprint) {
+        std::lock_guard<std::mutex> guard(lock);
+        auto it = fingerprints.find(modulePath);
+        if (it == fingerprints.end()) {
+            std::ifstream file(modulePath, std::ios::binary);
+            std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            ModuleFingerprint computed;
+            if (data.empty() || !ComputeFingerprint(data, computed)) return false;
+            it = fingerprints.emplace(modulePath, computed).first;
+        }
+        fingerprint = it->second;
+        return true;
+    }
+
+private:
+    std::string path;
+    std::mutex lock;
+    std::map<std::string, SignatureCacheEntry> entries;
+    std::unordered_map<std::string, ModuleFingerprint> fingerprints;
+    bool loaded = false;
+
+    void Load() {
+        if (loaded) return;
+        loaded = true;
+        std::ifstream file(path);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::string key;
+            SignatureCacheEntry entry;
+            if (ParseCacheLine(line, key, entry)) entries[key] = entry;
+        }
+    }
+};
@@ -0,0 +1,85 @@
+#pragma once
+
+// The comparisons behind Memory.Diff, kept free of Windows headers so they also build on
+// Linux. Offsets passed to emit are relative to the start of the snapshots.
+#include <cstdint>
+#include <cstring>
+#include <emmintrin.h>
+
+// Calls emit(offset, length) for every run of bytes that differ (or match, if wantEqual).
+// Blocks of 16 bytes that can't start or end a run are skipped with one SSE2 compare.
+template<typename Emit>
+void DiffBytes(const uint8_t* a, const uint8_t* b, size_t size, bool wantEqual, Emit emit) {
+    size_t runStart = SIZE_MAX;
+    size_t i = 0;
+
+    auto visit = [&](size_t offset, bool match) {
+        if (match && runStart == SIZE_MAX) {
+            runStart = offset;
+        }
+        else if (!match && runStart != SIZE_MAX) {
+            emit(runStart, offset - runStart);
+            runStart = SIZE_MAX;
+        }
+    };
+
+    for (; i + 16 <= size; i += 16) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        unsigned equal = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb));
+        unsigned match = wantEqual ? equal : (~equal & 0xFFFF);
+
+        if ((match == 0xFFFF && runStart != SIZE_MAX) || (match == 0 && runStart == SIZE_MAX)) {
+            continue;
+        }
+        for (unsigned bit = 0; bit < 16; ++bit) {
+            visit(i + bit, (match >> bit) & 1);
+        }
+    }
+    for (; i < size; ++i) {
+        visit(i, (a[i] == b[i]) == wantEqual);
+    }
+    if (runStart != SIZE_MAX) {
+        emit(runStart, size - runStart);
+    }
+}
+
+// Same as DiffBytes for 4-byte aligned floats where b > a (or b < a when decreased is set)
+template<typename Emit>
+void DiffFloats(uintptr_t address, const uint8_t* a, const uint8_t* b, size_t size, bool decreased, Emit emit) {
+    size_t first = (size_t)((4 - (address & 3)) & 3);
+    size_t runStart = SIZE_MAX;
+    size_t i = first;
+
+    auto visit = [&](size_t offset, bool match) {
+        if (match && runStart == SIZE_MAX) {
+            runStart = offset;
+        }
+        else if (!match && runStart != SIZE_MAX) {
+            emit(runStart, offset - runStart);
+            runStart = SIZE_MAX;
+        }
+    };
+
+    for (; i + 16 <= size; i += 16) {
+        __m128 va = _mm_loadu_ps((const float*)(a + i));
+        __m128 vb = _mm_loadu_ps((const float*)(b + i));
+        unsigned match = (unsigned)_mm_movemask_ps(decreased ? _mm_cmplt_ps(vb, va) : _mm_cmpgt_ps(vb, va));
+
+        if ((match == 0xF && runStart != SIZE_MAX) || (match == 0 && runStart == SIZE_MAX)) {
+            continue;
+        }
+        for (unsigned lane = 0; lane < 4; ++lane) {
+            visit(i + lane * 4, (match >> lane) & 1);
+        }
+    }
+    for (; i + 4 <= size; i += 4) {
+        float fa, fb;
+        memcpy(&fa, a + i, 4);
+        memcpy(&fb, b + i, 4);
+        visit(i, decreased ? fb < fa : fb > fa);
+    }
+    if (runStart != SIZE_MAX) {
+        emit(runStart, i - runStart);
+    }
+}
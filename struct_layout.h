@@ -0,0 +1,284 @@
+#pragma once
+
+// Struct layouts behind Memory.DefineStruct: a field list read and written with as few copies
+// as possible. Needs the Lua API, the views' element helpers and block reads; main.cpp
+// supplies SubmitWrites, which queues the writes when a transaction is open.
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <string>
+#include <vector>
+#include <lua.hpp>
+#include "block_read.h"
+#include "memory_view.h"
+#include "page_protection.h"
+
+bool SubmitWrites(lua_State* L, WriteBatch& batch);
+
+// Gaps up to this size are read through so neighbouring fields come in with one copy
+constexpr size_t structReadGap = 32;
+
+struct StructField {
+    std::string name;
+    size_t offset;
+    size_t count;
+    size_t elementSize;
+    ViewType type;
+    std::vector<size_t> mirrors; // Extra offsets that receive the same value on write
+};
+
+struct StructSpan {
+    size_t offset;
+    size_t size;
+};
+
+// A field list compiled into the spans that Read and Write copy in one go
+struct StructLayout {
+    std::string name;
+    std::vector<StructField> fields;
+    std::vector<StructSpan> readSpans;
+    std::vector<StructSpan> writeSpans;
+    size_t begin = 0;
+    size_t end = 0;
+    std::vector<uint8_t> buffer; // Covers [begin, end) of the struct
+    // Reused by every Write so writing a struct each frame doesn't allocate
+    std::vector<StructSpan> partialSpans;
+    WriteBatch batch;
+};
+
+// Sorts spans and joins those separated by at most maxGap bytes
+inline std::vector<StructSpan> MergeSpans(std::vector<StructSpan> spans, size_t maxGap) {
+    std::sort(spans.begin(), spans.end(), [](const StructSpan& a, const StructSpan& b) { return a.offset < b.offset; });
+    std::vector<StructSpan> merged;
+    for (const auto& span : spans) {
+        if (!merged.empty() && span.offset <= merged.back().offset + merged.back().size + maxGap) {
+            size_t end = span.offset + span.size;
+            if (end > merged.back().offset + merged.back().size) {
+                merged.back().size = end - merged.back().offset;
+            }
+        }
+        else {
+            merged.push_back(span);
+        }
+    }
+    return merged;
+}
+
+inline void AddFieldWriteSpans(const StructField& field, std::vector<StructSpan>& spans) {
+    size_t size = field.count * field.elementSize;
+    spans.push_back({ field.offset, size });
+    for (size_t mirror : field.mirrors) {
+        spans.push_back({ mirror, size });
+    }
+}
+
+// Views over the layout buffer so the typed view element helpers can be reused
+inline MemoryView FieldBufferView(StructLayout* layout, const StructField& field, size_t offset) {
+    return { (uintptr_t)layout->buffer.data() + (offset - layout->begin), field.count, field.elementSize, field.type };
+}
+
+// Memory.DefineStruct(name, { {name=, offset=, type=, [count=1], [mirrors={...}]}, ... })
+inline int lua_DefineStruct(lua_State* L) {
+    const char* structName = luaL_checkstring(L, 1);
+    luaL_checktype(L, 2, LUA_TTABLE);
+
+    StructLayout* layout = new (lua_newuserdata(L, sizeof(StructLayout))) StructLayout();
+    luaL_getmetatable(L, "MemoryStruct");
+    lua_setmetatable(L, -2);
+    layout->name = structName;
+
+    std::vector<StructSpan> readSpans, writeSpans;
+    for (int i = 1; ; i++) {
+        lua_rawgeti(L, 2, i);
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            break;
+        }
+        if (!lua_istable(L, -1)) {
+            return luaL_error(L, "field %d is not a table", i);
+        }
+
+        StructField field;
+        lua_getfield(L, -1, "name");
+        if (!lua_isstring(L, -1)) return luaL_error(L, "field %d has no name", i);
+        field.name = lua_tostring(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, -1, "offset");
+        if (!lua_isnumber(L, -1) || lua_tointeger(L, -1) < 0) return luaL_error(L, "field '%s' has no valid offset", field.name.c_str());
+        field.offset = (size_t)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+
+        lua_getfield(L, -1, "type");
+        const char* typeName = lua_tostring(L, -1);
+        if (!typeName || !ParseViewType(typeName, field.type, field.elementSize)) {
+            return luaL_error(L, "field '%s' has an unknown type", field.name.c_str());
+        }
+        lua_pop(L, 1);
+
+        lua_getfield(L, -1, "count");
+        lua_Integer count = lua_isnil(L, -1) ? 1 : lua_tointeger(L, -1);
+        if (count < 1) return luaL_error(L, "field '%s' has an invalid count", field.name.c_str());
+        field.count = (size_t)count;
+        lua_pop(L, 1);
+
+        lua_getfield(L, -1, "mirrors");
+        if (lua_istable(L, -1)) {
+            for (int m = 1; ; m++) {
+                lua_rawgeti(L, -1, m);
+                if (lua_isnil(L, -1)) {
+                    lua_pop(L, 1);
+                    break;
+                }
+                field.mirrors.push_back((size_t)lua_tointeger(L, -1));
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 2);
+
+        readSpans.push_back({ field.offset, field.count * field.elementSize });
+        AddFieldWriteSpans(field, writeSpans);
+        layout->fields.push_back(std::move(field));
+    }
+    luaL_argcheck(L, !layout->fields.empty(), 2, "no fields");
+
+    layout->readSpans = MergeSpans(readSpans, structReadGap);
+    layout->writeSpans = MergeSpans(writeSpans, 0);
+    layout->begin = SIZE_MAX;
+    for (const auto& span : layout->writeSpans) {
+        if (span.offset < layout->begin) layout->begin = span.offset;
+        if (span.offset + span.size > layout->end) layout->end = span.offset + span.size;
+    }
+    layout->buffer.resize(layout->end - layout->begin);
+    return 1;
+}
+
+// layout:Read(address, [into]) -> table of field values, or nil if unreadable.
+// Arrays come back as tables; passing the previous result as into reuses them.
+inline int lua_Struct_Read(lua_State* L) {
+    StructLayout* layout = (StructLayout*)luaL_checkudata(L, 1, "MemoryStruct");
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 2);
+
+    for (const auto& span : layout->readSpans) {
+        if (!ReadBlock(address + span.offset, layout->buffer.data() + (span.offset - layout->begin), span.size)) {
+            lua_pushnil(L);
+            return 1;
+        }
+    }
+
+    if (lua_istable(L, 3)) {
+        lua_pushvalue(L, 3);
+    }
+    else {
+        lua_createtable(L, 0, (int)layout->fields.size());
+    }
+
+    for (const auto& field : layout->fields) {
+        MemoryView view = FieldBufferView(layout, field, field.offset);
+        if (field.count == 1) {
+            PushViewElement(L, &view, 0);
+        }
+        else {
+            lua_getfield(L, -1, field.name.c_str());
+            if (!lua_istable(L, -1)) {
+                lua_pop(L, 1);
+                lua_createtable(L, (int)field.count, 0);
+            }
+            for (size_t i = 0; i < field.count; i++) {
+                PushViewElement(L, &view, i);
+                lua_rawseti(L, -2, (int)i + 1);
+            }
+        }
+        lua_setfield(L, -2, field.name.c_str());
+    }
+    return 1;
+}
+
+// layout:Write(address, values) - fields missing from values are left untouched
+inline int lua_Struct_Write(lua_State* L) {
+    StructLayout* layout = (StructLayout*)luaL_checkudata(L, 1, "MemoryStruct");
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 2);
+    luaL_checktype(L, 3, LUA_TTABLE);
+
+    layout->partialSpans.clear();
+    bool partial = false;
+    for (const auto& field : layout->fields) {
+        lua_getfield(L, 3, field.name.c_str());
+        if (lua_isnil(L, -1)) {
+            lua_pop(L, 1);
+            partial = true;
+            continue;
+        }
+
+        MemoryView view = FieldBufferView(layout, field, field.offset);
+        if (field.count == 1) {
+            StoreViewElement(L, &view, 0, lua_gettop(L));
+        }
+        else {
+            luaL_checktype(L, -1, LUA_TTABLE);
+            for (size_t i = 0; i < field.count; i++) {
+                lua_rawgeti(L, -1, (int)i + 1);
+                StoreViewElement(L, &view, i, lua_gettop(L));
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+
+        size_t size = field.count * field.elementSize;
+        for (size_t mirror : field.mirrors) {
+            memcpy(layout->buffer.data() + (mirror - layout->begin), (const void*)view.address, size);
+        }
+        AddFieldWriteSpans(field, layout->partialSpans);
+    }
+
+    std::vector<StructSpan> partialMerged;
+    if (partial) {
+        partialMerged = MergeSpans(layout->partialSpans, 0);
+    }
+    const std::vector<StructSpan>& spans = partial ? partialMerged : layout->writeSpans;
+    layout->batch.Clear();
+    for (const auto& span : spans) {
+        layout->batch.Add(address + span.offset, layout->buffer.data() + (span.offset - layout->begin), span.size);
+    }
+    lua_pushboolean(L, SubmitWrites(L, layout->batch));
+    return 1;
+}
+
+// layout:Size() -> bytes from offset 0 to the end of the last field or mirror
+inline int lua_Struct_Size(lua_State* L) {
+    StructLayout* layout = (StructLayout*)luaL_checkudata(L, 1, "MemoryStruct");
+    lua_pushinteger(L, (lua_Integer)layout->end);
+    return 1;
+}
+
+inline int lua_Struct_ToString(lua_State* L) {
+    StructLayout* layout = (StructLayout*)luaL_checkudata(L, 1, "MemoryStruct");
+    lua_pushfstring(L, "struct %s (%d fields)", layout->name.c_str(), (int)layout->fields.size());
+    return 1;
+}
+
+inline int lua_Struct_Gc(lua_State* L) {
+    StructLayout* layout = (StructLayout*)luaL_checkudata(L, 1, "MemoryStruct");
+    layout->~StructLayout();
+    return 0;
+}
+
+inline void RegisterMemoryStruct(lua_State* L) {
+    luaL_newmetatable(L, "MemoryStruct");
+
+    lua_pushcfunction(L, lua_Struct_Gc);
+    lua_setfield(L, -2, "__gc");
+    lua_pushcfunction(L, lua_Struct_ToString);
+    lua_setfield(L, -2, "__tostring");
+
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_Struct_Read);
+    lua_setfield(L, -2, "Read");
+    lua_pushcfunction(L, lua_Struct_Write);
+    lua_setfield(L, -2, "Write");
+    lua_pushcfunction(L, lua_Struct_Size);
+    lua_setfield(L, -2, "Size");
+    lua_setfield(L, -2, "__index");
+
+    lua_pop(L, 1);
+}
@@ -0,0 +1,146 @@
+// Async scans driven by a frame loop: coroutines are resumed with their results once their
+// scan finishes, a coroutine resumed by the plugin itself gives up its wait and is never
+// resumed by the pump, and main chunk jobs are polled.
+#include "async_scan.h"
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+ScanStats scanStats;
+static int aborts = 0;
+static int failures = 0;
+
+void Log(const std::string& msg) {
+    printf("log: %s\n", msg.c_str());
+}
+
+lua_State* GetPluginState(lua_State* L) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State* main = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    return main;
+}
+
+void AbortWriteTransaction(lua_State*) {
+    aborts++;
+}
+
+std::unique_lock<std::recursive_mutex> LockPluginState(lua_State*) {
+    static std::recursive_mutex lock;
+    return std::unique_lock<std::recursive_mutex>(lock);
+}
+
+ScanThreadPool& GetScanThreadPool() {
+    static ScanThreadPool* pool = new ScanThreadPool(2);
+    return *pool;
+}
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Memory.FindPatternAsync(id): a scan that takes id * 5 ms and finds 0x1000 * id; 0 finds nothing
+static int lua_TestScan(lua_State* L) {
+    lua_Integer id = luaL_checkinteger(L, 1);
+    AsyncScanJobPtr job = std::make_shared<AsyncScanJob>();
+    job->scan = [id](uintptr_t& result, std::atomic<bool>* cancel) {
+        for (int i = 0; i < id * 5 && !*cancel; i++) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        result = (uintptr_t)(0x1000 * id);
+        return id != 0;
+    };
+    return BeginAsyncScan(L, job);
+}
+
+static const char* script = R"(
+results = {}
+local waiter = coroutine.create(function()
+    results[#results + 1] = Memory.FindPatternAsync(2)
+    results[#results + 1] = Memory.FindPatternAsync(1)
+    results[#results + 1] = Memory.FindPatternAsync(0) or "none"
+    finished = true
+end)
+assert(coroutine.resume(waiter))
+
+-- Resumed by the plugin while waiting: the wait is dropped and the coroutine then yields for
+-- its own reasons, where the pump must leave it alone
+interrupted = coroutine.create(function()
+    local address, reason = Memory.FindPatternAsync(1)
+    interruptedWith = { address, reason }
+    local value = coroutine.yield("own")
+    ownResume = value
+end)
+assert(coroutine.resume(interrupted))
+assert(coroutine.resume(interrupted, "not the token"))
+
+job = Memory.FindPatternAsync(3)
+pending = select(2, job:Result())
+)";
+
+static bool Global(lua_State* L, const char* name) {
+    lua_getglobal(L, name);
+    bool set = !lua_isnil(L, -1);
+    lua_pop(L, 1);
+    return set;
+}
+
+int main() {
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    RegisterScanJob(L);
+    lua_newtable(L);
+    PushAsyncScanFunction(L, lua_TestScan);
+    lua_setfield(L, -2, "FindPatternAsync");
+    lua_setglobal(L, "Memory");
+
+    if (luaL_dostring(L, script) != 0) {
+        printf("script error: %s\n", lua_tostring(L, -1));
+        return 1;
+    }
+    lua_getglobal(L, "pending");
+    Check(lua_isstring(L, -1) && std::string(lua_tostring(L, -1)) == "pending", "job pending right after start");
+    lua_pop(L, 1);
+
+    // The frame loop: pump, then let the frame take its time
+    using Clock = std::chrono::steady_clock;
+    double slowestPump = 0;
+    int frames = 0;
+    for (; frames < 500 && !(Global(L, "finished") && waitingScans.empty()); frames++) {
+        Clock::time_point start = Clock::now();
+        PumpAsyncScans();
+        slowestPump = std::max(slowestPump, std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    printf("%d frames, slowest pump %.3f ms\n", frames, slowestPump);
+    Check(Global(L, "finished"), "waiting coroutine ran to the end");
+    Check(slowestPump < 5.0, "pump does not wait for scans");
+
+    int ok = luaL_dostring(L, R"(
+        assert(results[1] == 0x2000, "first result")
+        assert(results[2] == 0x1000, "second result")
+        assert(results[3] == "none", "no match")
+        assert(interruptedWith[1] == nil and interruptedWith[2] == "interrupted", "interrupted wait")
+        assert(ownResume == nil, "pump resumed a foreign yield")
+        while not job:Done() do end
+        assert(job:Result() == 0x3000, "job result")
+    )");
+    if (ok != 0) {
+        printf("FAIL: %s\n", lua_tostring(L, -1));
+        failures++;
+    }
+    Check(aborts == 0, "no aborted transactions");
+
+    // A scan still running when its plugin closes is cancelled and never resumed
+    luaL_dostring(L, "closing = coroutine.create(function() Memory.FindPatternAsync(50) resumedAfterClose = true end) coroutine.resume(closing)");
+    CancelAsyncScans(L);
+    Check(waitingScans.empty(), "waits of a closed plugin dropped");
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    PumpAsyncScans();
+    Check(!Global(L, "resumedAfterClose"), "cancelled wait not resumed");
+
+    lua_close(L);
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
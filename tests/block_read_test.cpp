@@ -0,0 +1,132 @@
+// Block reads against mappings of this process: strings crossing a page boundary and the
+// boundary between two mappings, a string ending on the last byte before an inaccessible page
+// and one running into it, the maxLen cap, unreadable and freed addresses.
+#include "block_read.h"
+#include <cstdio>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+ProcMapsRegionSource regionSource;
+ProtectionCache protectionCache(regionSource);
+
+// Reads through the kernel, so memory unmapped behind the cache fails instead of faulting
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    iovec local = { dst, size }, remote = { const_cast<void*>(src), size };
+    return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == (ssize_t)size;
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static uint8_t* Map(size_t pages) {
+    return (uint8_t*)mmap(nullptr, pages * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+}
+
+// The next mapping may reuse the addresses, so the cache must not remember these
+static void Unmap(uint8_t* pages, size_t count) {
+    munmap(pages, count * pageSize);
+    protectionCache.Invalidate((uintptr_t)pages, count * pageSize);
+}
+
+static bool Reads(uintptr_t address, size_t maxLen, const std::string& expected) {
+    std::string out = "stale";
+    return ReadCString(address, maxLen, out) && out == expected;
+}
+
+static void TestStrings() {
+    // Three writable pages followed by an inaccessible one
+    uint8_t* pages = Map(4);
+    mprotect(pages + 3 * pageSize, pageSize, PROT_NONE);
+    uintptr_t base = (uintptr_t)pages;
+
+    const std::string crossing = "crosses the first page boundary";
+    memcpy(pages + pageSize - 10, crossing.c_str(), crossing.size() + 1);
+    Check(Reads(base + pageSize - 10, 256, crossing), "string across a page boundary");
+    Check(Reads(base + pageSize - 10, 10, crossing.substr(0, 10)), "cap at the page boundary");
+    Check(Reads(base + pageSize - 10, 11, crossing.substr(0, 11)), "cap one past the page boundary");
+    Check(Reads(base + pageSize - 10, crossing.size(), crossing), "cap at the string's length");
+    Check(Reads(base + pageSize - 10, 0, ""), "zero cap reads nothing");
+
+    // Longer than a page, starting mid-page
+    std::string spanning(6000, 'L');
+    memcpy(pages + 0x123, spanning.c_str(), spanning.size() + 1);
+    Check(Reads(base + 0x123, 8192, spanning), "string over three pages");
+    Check(Reads(base + 0x123, 4097, spanning.substr(0, 4097)), "cap over two pages");
+    Check(Reads(base + 0x123, 256, spanning.substr(0, 256)), "default cap");
+
+    // Terminated on the very last readable byte
+    uint8_t* last = pages + 3 * pageSize - 1;
+    memset(last - 99, 'a', 99);
+    *last = 0;
+    Check(Reads((uintptr_t)last - 99, 256, std::string(99, 'a')), "string ending just before an inaccessible page");
+    Check(Reads((uintptr_t)last, 256, ""), "empty string on the last readable byte");
+
+    // Unterminated: whatever was readable is returned
+    *last = 'a';
+    Check(Reads((uintptr_t)last - 99, 256, std::string(100, 'a')), "string cut off by an inaccessible page");
+    Check(Reads((uintptr_t)last - 99, 50, std::string(50, 'a')), "cap before the inaccessible page");
+
+    uint64_t rejected = protectionCache.rejectedReads;
+    std::string out = "stale";
+    Check(!ReadCString(base + 3 * pageSize, 256, out) && out.empty(), "string on an inaccessible page");
+    Check(!ReadCString(0, 256, out) && !ReadCString(16, 256, out), "null pointers");
+    Check(protectionCache.rejectedReads == rejected + 3, "rejected by the cache, not by a fault");
+    Unmap(pages, 4);
+}
+
+static void TestMappings() {
+    // A writable mapping followed directly by a read-only one
+    uint8_t* pages = Map(2);
+    const std::string crossing = "crosses into a read-only mapping";
+    memcpy(pages + pageSize - 12, crossing.c_str(), crossing.size() + 1);
+    mprotect(pages + pageSize, pageSize, PROT_READ);
+    Check(Reads((uintptr_t)pages + pageSize - 12, 256, crossing), "string across two mappings");
+
+    uint8_t block[64];
+    Check(ReadBlock((uintptr_t)pages + pageSize - 12, block, sizeof(block)) && !memcmp(block, crossing.c_str(), crossing.size()),
+        "block across two mappings");
+    Unmap(pages, 2);
+}
+
+static void TestBlocks() {
+    uint8_t* pages = Map(2);
+    mprotect(pages + pageSize, pageSize, PROT_NONE);
+    memset(pages, 0x5A, pageSize);
+
+    uint8_t block[32];
+    memset(block, 0, sizeof(block));
+    Check(ReadBlock((uintptr_t)pages + pageSize - 32, block, 32) && block[0] == 0x5A && block[31] == 0x5A,
+        "block ending on the last readable byte");
+    Check(!ReadBlock((uintptr_t)pages + pageSize - 31, block, 32), "block running into an inaccessible page");
+    Check(!ReadBlock(0, block, 4), "null block");
+
+    // Freed after the cache saw it readable: the copy fails, and the next read is rejected
+    // by the cache without trying again
+    Check(ReadBlock((uintptr_t)pages, block, 32), "block read before freeing");
+    munmap(pages, 2 * pageSize);
+    Check(!ReadBlock((uintptr_t)pages, block, 32), "freed block");
+    uint64_t rejected = protectionCache.rejectedReads;
+    std::string out;
+    Check(!ReadCString((uintptr_t)pages, 256, out) && protectionCache.rejectedReads == rejected + 1,
+        "freed range forgotten by the cache");
+}
+
+int main() {
+    TestStrings();
+    TestMappings();
+    TestBlocks();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
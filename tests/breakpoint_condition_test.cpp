@@ -0,0 +1,120 @@
+// Breakpoint conditions: what compiles, what each condition evaluates to against fixed
+// registers and memory, numbers decimal unless written 0x..., and evaluation cost per hit.
+#include "breakpoint_condition.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// In conditionRegisterNames order: eax ebx ecx edx esi edi ebp esp eip eflags
+static uint32_t registers[conditionRegisterCount] = { 1, 2, 0x1234, 4, 5, 6, 40, 8, 0x401000, 0x246 };
+// Addresses are offsets into this; anything past it can't be read
+static uint8_t memory[64];
+
+static bool Read(uintptr_t address, void* dest, size_t size) {
+    if (address + size > sizeof(memory)) return false;
+    memcpy(dest, memory + address, size);
+    return true;
+}
+
+static bool Compile(const char* text, BreakpointCondition& condition) {
+    condition.source = text;
+    std::string error;
+    return ConditionCompiler(condition.source).Compile(condition.program, error);
+}
+
+static void Matches(const char* text, bool expected) {
+    BreakpointCondition condition;
+    if (!Compile(text, condition)) {
+        printf("FAIL: %s doesn't compile\n", text);
+        failures++;
+        return;
+    }
+    if (EvaluateCondition(condition, registers, Read) != expected) {
+        printf("FAIL: %s should be %s\n", text, expected ? "true" : "false");
+        failures++;
+    }
+}
+
+static void Rejected(const char* text) {
+    BreakpointCondition condition;
+    if (Compile(text, condition)) {
+        printf("FAIL: %s should not compile\n", text);
+        failures++;
+    }
+}
+
+static void TestConditions() {
+    uint32_t value = 11;
+    memcpy(memory + 12, &value, 4);
+    memory[20] = 0x80;
+    memory[21] = 0x01;
+
+    Matches("", true);
+    Matches("ecx == 0x1234", true);
+    Matches("ECX != 0x1234", false);
+    Matches("[esp+4] > 10", true);
+    Matches("[esp+4] > 11", false);
+    Matches("[esp + 4] >= 11 and ecx == 4660", true);
+    Matches("eax == 2 or ebx == 2", true);
+    Matches("eax == 2 || ebx == 3", false);
+    Matches("byte [ebp-20] == 0x80", true);
+    Matches("word [ebp-20] == 0x180", true);
+    Matches("[ebp+100] == 0", false);  // Unreadable memory never matches
+    Matches("eflags & 0x40", true);
+    Matches("(eax == 1 or eax == 9) and edx < 5", true);
+    Matches("eax - 2 > 5", true);  // Unsigned, so it wraps
+    Matches("eip == 0x401000 && ([esp+4] == 11)", true);
+    Matches("((((((((((((((((eax+1)+1)+1)+1)+1)+1)+1)+1)+1)+1)+1)+1)+1)+1)+1)+1) > 0", true);
+
+    // A leading zero is still decimal
+    Matches("[esp+4] == 011", true);
+    Matches("ebp == 040", true);
+    Matches("08 == 8", true);
+    Matches("0X1234 == ecx", true);
+    Matches("0xffffffff == 4294967295", true);
+
+    Rejected("ecx ==");
+    Rejected("foo == 1");
+    Rejected("[esp+4");
+    Rejected("eax == 1 == 1");
+    Rejected("byte eax");
+    Rejected("0x1FFFFFFFF == 1");
+    Rejected("4294967296 == 0");
+    Rejected("0x == 0");
+    Rejected("0x0x10 == 16");
+    Rejected("12ab == 1");
+    Rejected("1+(2+(3+(4+(5+(6+(7+(8+(9+(10+(11+(12+(13+(14+(15+(16+17)))))))))))))))");
+}
+
+static void Benchmark() {
+    BreakpointCondition condition;
+    Check(Compile("ecx == 0x1234 and [esp+4] > 10", condition), "benchmark condition compiles");
+    uint32_t values[conditionRegisterCount];
+    memcpy(values, registers, sizeof(values));
+    const int count = 20000000;
+    int matched = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        values[2] = 0x1234 + (i & 1);
+        matched += EvaluateCondition(condition, values, Read);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+    printf("condition: %.1f ns per hit, %zu ops\n", ns, condition.program.size());
+    Check(matched == count / 2, "every other hit matches");
+}
+
+int main() {
+    TestConditions();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,348 @@
+// Breakpoint stepping driven by SIGTRAP on x86-64 Linux, the stand-in for the vectored
+// exception handler: every call through an INT3 hits and still runs the original code, a
+// removal racing stepping threads never leaves a stray INT3 behind, a faulting stepped
+// instruction doesn't leave the thread stepping, a Lua callback changing registers through
+// its HitContext changes them for the thread, and hits per second.
+#include "breakpoints.h"
+#include "hit_context.h"
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+ProcMapsRegionSource regionSource;
+ProtectionCache protectionCache(regionSource);
+
+// Through the kernel, since SIGSEGV belongs to the fault test below
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    iovec local = { dst, size }, remote = { const_cast<void*>(src), size };
+    return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == (ssize_t)size;
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+static std::vector<std::string> logged;
+static int abortedTransactions = 0;
+
+void Log(const std::string& msg) {
+    logged.push_back(msg);
+}
+
+void AbortWriteTransaction(lua_State*) {
+    abortedTransactions++;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// What VehBreakpointHost::Deliver does with a CONTEXT, done with the signal's ucontext: the
+// low halves of the 64-bit registers stand in for the game's 32-bit ones
+static void CallBreakpoint(lua_State* L, uintptr_t address, TrapFrame& frame) {
+    ucontext_t* context = (ucontext_t*)frame.native;
+    greg_t* registers = context->uc_mcontext.gregs;
+    const int order[] = { REG_RAX, REG_RBX, REG_RCX, REG_RDX, REG_RSI, REG_RDI, REG_RBP, REG_RSP, REG_RIP };
+    HitFrame hitFrame;
+    for (int i = 0; i < eflagsRegister; i++) hitFrame.registers[i] = (uint32_t*)&registers[order[i]];
+    hitFrame.registers[eflagsRegister] = &frame.flags;
+    hitFrame.fxsave = (uint8_t*)context->uc_mcontext.fpregs;
+    hitFrame.address = (uint32_t)address;
+    lua_getglobal(L, "OnBreakpoint");
+    CallHitCallback(L, hitFrame, "breakpoint");
+}
+
+struct TestBreakpoint {
+    uint8_t originalByte;
+    bool active;
+};
+
+// The same table and locking as VehBreakpointHost, writing straight into the RWX page
+struct TestHost : BreakpointHost {
+    BreakpointTable<TestBreakpoint> table;
+    std::atomic<uint64_t> hits{ 0 };
+    lua_State* callbacks = nullptr;  // When set, each hit calls its OnBreakpoint(address, ctx)
+
+    bool IsArmed(uintptr_t address, uint8_t& originalByte) override {
+        bool active = false;
+        table.Lookup((uint32_t)address, [&](const TestBreakpoint& info) {
+            active = info.active;
+            originalByte = info.originalByte;
+        });
+        return active;
+    }
+
+    void OnHit(uintptr_t address, TrapFrame& frame) override {
+        hits++;
+        if (callbacks) CallBreakpoint(callbacks, address, frame);
+    }
+
+    bool WriteCode(uintptr_t address, uint8_t value) override {
+        __atomic_store_n((uint8_t*)address, value, __ATOMIC_SEQ_CST);
+        return true;
+    }
+
+    void Rearm(uintptr_t address) override {
+        table.Exclusive([&] {
+            uint8_t originalByte;
+            if (IsArmed(address, originalByte)) WriteCode(address, int3Opcode);
+        });
+    }
+
+    // Takes the original byte rather than reading it, so a stray INT3 fails the test
+    // instead of becoming a breakpoint's original byte
+    void Set(uintptr_t address, uint8_t originalByte) {
+        table.Exclusive([&] {
+            table.Set((uint32_t)address, { originalByte, true });
+            WriteCode(address, int3Opcode);
+        });
+    }
+
+    void Remove(uintptr_t address) {
+        table.Exclusive([&] {
+            TestBreakpoint info;
+            if (table.Get((uint32_t)address, info)) {
+                WriteCode(address, info.originalByte);
+                table.Erase((uint32_t)address);
+            }
+        });
+    }
+};
+
+static TestHost host;
+static std::atomic<int> strayTraps{ 0 };
+static uint8_t* code = nullptr;
+static uint8_t addByte = 0;  // The byte the breakpoint in addThree covers
+
+static void SetFlags(greg_t* registers, uint32_t flags) {
+    registers[REG_EFL] = (registers[REG_EFL] & ~0xFFFFFFFFll) | flags;
+}
+
+static void OnTrap(int, siginfo_t* info, void* native) {
+    greg_t* registers = ((ucontext_t*)native)->uc_mcontext.gregs;
+    TrapFrame frame = { (uintptr_t)registers[REG_RIP], (uint32_t)registers[REG_EFL], native };
+    // The counterpart of EXCEPTION_SINGLE_STEP. A stepping thread can still meet an INT3
+    // first, when another thread rearmed the breakpoint in the meantime.
+    if (info->si_code == TRAP_TRACE) {
+        if (DispatchSingleStep(host, frame)) {
+            SetFlags(registers, frame.flags);
+        }
+        else {
+            strayTraps++;
+        }
+        return;
+    }
+    // Linux reports an INT3 with rip past it; Windows points at it
+    frame.ip--;
+    if (DispatchBreakpoint(host, frame.ip, frame)) {
+        registers[REG_RIP] = frame.ip;
+        SetFlags(registers, frame.flags);
+        return;
+    }
+    // Removed between the INT3 firing and the lookup: the original byte is already back
+    if (*(uint8_t*)frame.ip != int3Opcode &&
+        (host.table.Contains((uint32_t)frame.ip) || host.table.WasRemoved((uint32_t)frame.ip))) {
+        registers[REG_RIP] = frame.ip;
+        return;
+    }
+    strayTraps++;
+    *(uint8_t*)frame.ip = addByte;
+    registers[REG_RIP] = frame.ip;
+}
+
+static bool faultKeptTrapFlag = false;
+
+// The exception handler's turn, then the game's own, which like an __except block resumes
+// past the faulting 2-byte load with flags of its own and returns 0xBAD
+static void OnFault(int, siginfo_t*, void* native) {
+    greg_t* registers = ((ucontext_t*)native)->uc_mcontext.gregs;
+    TrapFrame frame = { (uintptr_t)registers[REG_RIP], (uint32_t)registers[REG_EFL], native };
+    DispatchFault(host, frame);
+    faultKeptTrapFlag = (frame.flags & trapFlag) != 0;
+    SetFlags(registers, frame.flags & ~trapFlag);
+    registers[REG_RIP] += 2;
+    registers[REG_RAX] = 0xBAD;
+}
+
+typedef int (*AddThree)(int);
+typedef int (*Load)(const int*);
+typedef float (*AddFloats)(float, float);
+
+static void TestHits(AddThree addThree, uintptr_t address) {
+    host.Set(address, addByte);
+    bool right = true;
+    for (int i = 0; i < 1000; i++) right = right && addThree(i) == i + 3;
+    Check(right, "original instruction still runs");
+    Check(host.hits == 1000, "every call hits");
+    Check(code[3] == int3Opcode && rearmAddress == 0, "INT3 written back after the step");
+    host.Remove(address);
+}
+
+// A removal racing threads that step over the breakpoint must leave the original byte
+static void TestRemoveRace(AddThree addThree, uintptr_t address) {
+    std::atomic<bool> stop{ false };
+    std::atomic<int> wrong{ 0 };
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 4; t++) {
+        callers.emplace_back([&] {
+            for (int i = 0; !stop; i++) {
+                if (addThree(i) != i + 3) wrong++;
+            }
+        });
+    }
+    int leftArmed = 0;
+    for (int round = 0; round < 2000; round++) {
+        host.Set(address, addByte);
+        std::this_thread::yield();
+        host.Remove(address);
+        if (code[3] != addByte) leftArmed++;
+    }
+    stop = true;
+    for (auto& caller : callers) caller.join();
+    Check(wrong == 0, "racing callers get the right results");
+    Check(leftArmed == 0 && code[3] == addByte, "no INT3 left behind by a removal");
+}
+
+static void TestFaultingStep(Load load, uintptr_t address) {
+    host.Set(address, code[0x10]);
+    int value = 7;
+    Check(load(&value) == 7, "load through the breakpoint");
+    Check(load(nullptr) == 0xBAD, "faulting stepped instruction reaches the fault handler");
+    Check(rearmAddress == 0 && !faultKeptTrapFlag, "fault ends the step");
+    Check(code[0x10] == int3Opcode, "fault rearms the breakpoint");
+    Check(load(&value) == 7, "breakpoint still works after the fault");
+    host.Remove(address);
+}
+
+static bool Run(lua_State* L, const char* code) {
+    if (luaL_dostring(L, code) == LUA_OK) return true;
+    printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return false;
+}
+
+static void CheckLua(lua_State* L, const char* code, const char* what) {
+    bool ok = luaL_dostring(L, code) == LUA_OK && lua_toboolean(L, -1);
+    if (!ok && lua_type(L, -1) == LUA_TSTRING) printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_settop(L, 0);
+    Check(ok, what);
+}
+
+static void TestHitContext(AddThree addThree, uintptr_t address, AddFloats addFloats, uintptr_t floatAddress) {
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    RegisterHitContext(L);
+    lua_pushinteger(L, (lua_Integer)address);
+    lua_setglobal(L, "breakpoint");
+    host.callbacks = L;
+
+    // At the breakpoint eax already holds the argument plus one
+    Run(L, R"(
+        function OnBreakpoint(address, ctx)
+            seen = { address = address, ctxAddress = ctx.address, eax = ctx.eax, edi = ctx.edi,
+                registers = ctx.eax ~= nil and ctx.esp ~= nil and ctx.eflags ~= nil }
+            ctx.eax = ctx.eax + 100
+            saved = ctx
+        end
+    )");
+    host.Set(address, addByte);
+    int result = addThree(5);
+    Check(result == 108, "eax changed through the context reaches the thread");
+    CheckLua(L, "return seen.eax == 6 and seen.edi == 5 and seen.registers", "registers read through the context");
+    CheckLua(L, "return seen.address == breakpoint and seen.ctxAddress == breakpoint", "hit address");
+    CheckLua(L, R"(
+        local read, readError = pcall(function() return saved.eax end)
+        local written = pcall(function() saved.eax = 1 end)
+        local method = pcall(function() return saved:GetXmm(0) end)
+        return not read and readError:find("after its callback returned") ~= nil and not written and not method
+    )", "context unusable after the callback returned");
+
+    // A failing callback is logged and the thread carries on
+    Run(L, "function OnBreakpoint() error('plugin bug') end");
+    logged.clear();
+    result = addThree(5);
+    host.Remove(address);
+    Check(result == 8, "thread resumes after a failing callback");
+    Check(logged.size() == 1 && logged[0].find("plugin bug") != std::string::npos && abortedTransactions == 1,
+        "callback error logged and its transaction dropped");
+
+    // addss xmm0, xmm1 with xmm1 replaced at the breakpoint
+    Run(L, R"(
+        function OnBreakpoint(address, ctx)
+            seenXmm0 = ctx.xmm0
+            local a, b, c, d = ctx:GetXmm(1)
+            seenXmm1 = a
+            ctx:SetXmm(1, 10)
+        end
+    )");
+    host.Set(floatAddress, code[0x20]);
+    float sum = addFloats(1.5f, 2.0f);
+    host.Remove(floatAddress);
+    Check(sum == 11.5f, "xmm1 changed through the context reaches the thread");
+    CheckLua(L, "return seenXmm0 == 1.5 and seenXmm1 == 2", "xmm registers read through the context");
+
+    host.callbacks = nullptr;
+    lua_close(L);
+}
+
+static void Benchmark(AddThree addThree, uintptr_t address) {
+    const int calls = 200000;
+    host.hits = 0;
+    host.Set(address, addByte);
+    auto start = std::chrono::steady_clock::now();
+    int sum = 0;
+    for (int i = 0; i < calls; i++) sum += addThree(i) & 1;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    host.Remove(address);
+    printf("%llu hits in %.3f s: %.0f hits/s, %.2f us per hit (%d)\n", (unsigned long long)host.hits.load(),
+        seconds, host.hits / seconds, seconds * 1e6 / calls, sum);
+}
+
+int main() {
+    // The table keys are 32-bit addresses like the game's
+    code = (uint8_t*)mmap(nullptr, 4096, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (code == MAP_FAILED) {
+        printf("FAIL: no executable page below 4 GB\n");
+        return 1;
+    }
+    // lea eax, [rdi+1]; add eax, 2; ret
+    static const uint8_t addThreeCode[] = { 0x8D, 0x47, 0x01, 0x83, 0xC0, 0x02, 0xC3 };
+    // mov eax, [rdi]; ret
+    static const uint8_t loadCode[] = { 0x8B, 0x07, 0xC3 };
+    // addss xmm0, xmm1; ret
+    static const uint8_t addFloatsCode[] = { 0xF3, 0x0F, 0x58, 0xC1, 0xC3 };
+    memcpy(code, addThreeCode, sizeof(addThreeCode));
+    memcpy(code + 0x10, loadCode, sizeof(loadCode));
+    memcpy(code + 0x20, addFloatsCode, sizeof(addFloatsCode));
+    addByte = code[3];
+
+    struct sigaction action = {};
+    action.sa_sigaction = OnTrap;
+    action.sa_flags = SA_SIGINFO;
+    sigaction(SIGTRAP, &action, nullptr);
+    action.sa_sigaction = OnFault;
+    sigaction(SIGSEGV, &action, nullptr);
+
+    AddThree addThree = (AddThree)code;
+    TestHits(addThree, (uintptr_t)code + 3);
+    TestRemoveRace(addThree, (uintptr_t)code + 3);
+    TestFaultingStep((Load)(code + 0x10), (uintptr_t)code + 0x10);
+    TestHitContext(addThree, (uintptr_t)code + 3, (AddFloats)(code + 0x20), (uintptr_t)code + 0x20);
+    Check(strayTraps == 0, "no trap outside a breakpoint or its step");
+    Benchmark(addThree, (uintptr_t)code + 3);
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+// BreakpointHitQueue: order, capacity and drop counting on one thread, then game threads
+// pushing while the render thread pops: every hit arrives whole and in order per thread,
+// and pushed plus dropped accounts for every attempt. Push and pop cost per hit.
+#include "breakpoints.h"
+#include <chrono>
+#include <cstdio>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Shaped like BreakpointHit. Every field is derived from the sequence number, so a torn
+// copy shows up.
+struct TestHit {
+    uint32_t address;
+    uint32_t threadId;
+    uint32_t registers[9];
+    uint32_t eflags;
+    int64_t time;
+};
+
+static TestHit MakeHit(uint32_t thread, uint64_t sequence) {
+    TestHit hit = {};
+    hit.address = 0x401000;
+    hit.threadId = thread;
+    for (uint32_t i = 0; i < 9; i++) hit.registers[i] = (uint32_t)sequence * (i + 1) ^ thread;
+    hit.eflags = (uint32_t)(sequence >> 32);
+    hit.time = (int64_t)sequence;
+    return hit;
+}
+
+static bool IsWhole(const TestHit& hit) {
+    uint64_t sequence = (uint64_t)hit.time;
+    bool whole = hit.address == 0x401000 && hit.eflags == (uint32_t)(sequence >> 32);
+    for (uint32_t i = 0; i < 9; i++) whole = whole && hit.registers[i] == ((uint32_t)sequence * (i + 1) ^ hit.threadId);
+    return whole;
+}
+
+static void TestSingleThread() {
+    static BreakpointHitQueue<TestHit, 8> queue;
+    TestHit hit;
+    Check(!queue.Pop(hit) && queue.Pending() == 0, "empty queue");
+    bool pushed = true;
+    for (uint64_t i = 0; i < 8; i++) pushed = pushed && queue.Push(MakeHit(0, i));
+    Check(pushed, "fills to capacity");
+    Check(!queue.Push(MakeHit(0, 8)) && queue.Dropped() == 1, "full queue drops and counts");
+    Check(queue.Pending() == 8 && queue.Pushed() == 8, "pending and pushed");
+
+    bool inOrder = true;
+    for (uint64_t i = 0; i < 8; i++) inOrder = inOrder && queue.Pop(hit) && hit.time == (int64_t)i && IsWhole(hit);
+    Check(inOrder, "pops in push order");
+    Check(!queue.Pop(hit), "drained");
+
+    // Wrapping around reuses the cells
+    for (uint64_t lap = 0; lap < 5; lap++) {
+        for (uint64_t i = 0; i < 5; i++) queue.Push(MakeHit(0, lap * 5 + i));
+        for (uint64_t i = 0; i < 5; i++) inOrder = inOrder && queue.Pop(hit) && hit.time == (int64_t)(lap * 5 + i);
+    }
+    Check(inOrder && queue.Pending() == 0, "order kept across laps");
+}
+
+// Game threads push as fast as they can; the render thread drains
+static void TestStress() {
+    static BreakpointHitQueue<TestHit, 4096> queue;
+    const uint32_t producers = 4;
+    std::atomic<bool> stop{ false };
+    std::vector<uint64_t> attempts(producers);
+    std::vector<std::thread> threads;
+    for (uint32_t p = 0; p < producers; p++) {
+        threads.emplace_back([&, p] {
+            uint64_t sequence = 0;
+            for (; !stop; sequence++) queue.Push(MakeHit(p, sequence));
+            attempts[p] = sequence;
+        });
+    }
+
+    std::vector<int64_t> last(producers, -1);
+    uint64_t popped = 0, torn = 0, reordered = 0;
+    auto drain = [&] {
+        TestHit hit;
+        while (queue.Pop(hit)) {
+            if (hit.threadId >= producers || !IsWhole(hit)) {
+                torn++;
+                continue;
+            }
+            if (hit.time <= last[hit.threadId]) reordered++;
+            last[hit.threadId] = hit.time;
+            popped++;
+        }
+    };
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+        drain();
+        std::this_thread::yield();
+    }
+    stop = true;
+    for (auto& thread : threads) thread.join();
+    drain();
+
+    uint64_t total = 0;
+    for (uint64_t count : attempts) total += count;
+    printf("stress: %llu pushed, %llu dropped, %llu popped\n", (unsigned long long)queue.Pushed(),
+        (unsigned long long)queue.Dropped(), (unsigned long long)popped);
+    Check(popped > 0, "hits got through");
+    Check(torn == 0, "no torn hits");
+    Check(reordered == 0, "each thread's hits in order");
+    Check(queue.Pushed() + queue.Dropped() == total, "every push attempt counted");
+    Check(popped == queue.Pushed() && queue.Pending() == 0, "every pushed hit popped");
+}
+
+static void Benchmark() {
+    static BreakpointHitQueue<TestHit, 4096> queue;
+    TestHit hit = MakeHit(0, 0);
+    const int rounds = 2000;
+    std::chrono::steady_clock::duration pushing{}, popping{};
+    for (int round = 0; round < rounds; round++) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < 4096; i++) queue.Push(hit);
+        auto pushed = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < 4096; i++) queue.Pop(hit);
+        popping += std::chrono::steady_clock::now() - pushed;
+        pushing += pushed - start;
+    }
+    double count = rounds * 4096.0;
+    printf("push: %.1f ns, pop: %.1f ns per hit\n", std::chrono::duration<double, std::nano>(pushing).count() / count,
+        std::chrono::duration<double, std::nano>(popping).count() / count);
+    Check(queue.Dropped() == 0, "no drops below capacity");
+}
+
+int main() {
+    TestSingleThread();
+    TestStress();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+// BreakpointTable: lookups on many threads never miss a stable entry or see a torn one while
+// writers keep adding and erasing others, the single-threaded API, and lookup cost per hit.
+#include "breakpoints.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Shaped like BreakpointInfo, with a string so a torn or freed entry shows up
+struct TestInfo {
+    uint8_t originalByte;
+    std::string callbackName;
+    bool active;
+};
+
+static void TestApi() {
+    BreakpointTable<TestInfo> table;
+    Check(!table.Contains(0x401000), "empty table");
+    table.Set(0x401000, { 0x55, "OnFirst", true });
+    table.Set(0x400000, { 0x8B, "OnSecond", true });
+    table.Set(0x401000, { 0x56, "OnFirst", false });
+
+    TestInfo info;
+    Check(table.Get(0x401000, info) && info.originalByte == 0x56 && !info.active, "set replaces an entry");
+    auto entries = table.Snapshot();
+    Check(entries.size() == 2 && entries[0].first == 0x400000 && entries[1].first == 0x401000, "snapshot in address order");
+
+    Check(table.Erase(0x401000) && !table.Contains(0x401000), "erase");
+    Check(!table.Erase(0x401000), "erase of a missing entry");
+    Check(table.WasRemoved(0x401000) && !table.WasRemoved(0x400000), "removed addresses remembered");
+
+    // Growing past the initial capacity keeps every entry reachable
+    for (uint32_t address = 0x500000; address < 0x500000 + 1000 * 0x10; address += 0x10) {
+        table.Set(address, { (uint8_t)address, "OnMany", true });
+    }
+    bool all = true;
+    for (uint32_t address = 0x500000; address < 0x500000 + 1000 * 0x10; address += 0x10) {
+        bool same = false;
+        table.Lookup(address, [&](const TestInfo& found) { same = found.originalByte == (uint8_t)address; });
+        all = all && same;
+    }
+    Check(all, "entries survive growth");
+
+    bool inside = false;
+    table.Exclusive([&] {
+        table.Erase(0x400000);
+        inside = !table.Contains(0x400000);
+    });
+    Check(inside, "writes inside Exclusive");
+    table.Clear();
+    Check(table.Snapshot().empty(), "clear");
+}
+
+// Readers probe 64 stable entries and a range writers keep changing
+static void TestStress() {
+    BreakpointTable<TestInfo> table;
+    for (uint32_t address = 0x401000; address < 0x401000 + 64 * 16; address += 16) {
+        table.Set(address, { 0x55, "OnBreakpoint", true });
+    }
+
+    std::atomic<bool> stop{ false };
+    std::atomic<uint64_t> lookups{ 0 }, writes{ 0 }, missing{ 0 }, torn{ 0 };
+    std::vector<std::thread> threads;
+    for (uint32_t r = 0; r < 6; r++) {
+        threads.emplace_back([&, r] {
+            uint64_t n = 0;
+            for (uint32_t x = r; !stop; n += 2) {
+                x = x * 1103515245 + 12345;
+                uint32_t address = 0x401000 + ((x >> 8) % 64) * 16;
+                bool found = table.Lookup(address, [&](const TestInfo& info) {
+                    if (info.originalByte != 0x55 || info.callbackName != "OnBreakpoint") torn++;
+                });
+                if (!found) missing++;
+                table.Lookup(0x500000 + ((x >> 4) % 256) * 4, [&](const TestInfo& info) {
+                    if (info.originalByte != 0x90 || info.callbackName != "OnChanging") torn++;
+                });
+                // Leave the writers some time on machines with few cores
+                if (n % 4096 == 0) std::this_thread::yield();
+            }
+            lookups += n;
+        });
+    }
+    for (uint32_t w = 0; w < 2; w++) {
+        threads.emplace_back([&, w] {
+            uint64_t n = 0;
+            for (uint32_t x = w * 77; !stop; n++) {
+                x = x * 1103515245 + 12345;
+                uint32_t address = 0x500000 + ((x >> 4) % 256) * 4;
+                if (x & 1) {
+                    table.Set(address, { 0x90, "OnChanging", true });
+                }
+                else {
+                    table.Erase(address);
+                }
+            }
+            writes += n;
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    stop = true;
+    for (auto& thread : threads) thread.join();
+
+    printf("stress: %llu lookups, %llu writes\n", (unsigned long long)lookups.load(), (unsigned long long)writes.load());
+    Check(lookups > 0 && writes > 0, "readers and writers both ran");
+    Check(missing == 0, "stable entries never missing");
+    Check(torn == 0, "no torn entries");
+    size_t stable = 0;
+    for (const auto& entry : table.Snapshot()) stable += entry.first < 0x500000;
+    Check(stable == 64, "stable entries intact");
+}
+
+static void Benchmark() {
+    BreakpointTable<TestInfo> table;
+    for (uint32_t address = 0x401000; address < 0x401000 + 256 * 0x30; address += 0x30) {
+        table.Set(address, { 0xCC, "OnBreakpoint", true });
+    }
+    const int count = 20000000;
+    uint64_t found = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < count; i++) {
+        uint8_t originalByte = 0;
+        found += table.Lookup(0x401000 + (i & 255) * 0x30, [&](const TestInfo& info) { originalByte = info.originalByte; });
+        found += originalByte == 0;
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+    printf("lookup: %.1f ns per hit, 256 breakpoints (%llu)\n", ns, (unsigned long long)found);
+    Check(found == (uint64_t)count, "every lookup found its entry");
+}
+
+int main() {
+    TestApi();
+    TestStress();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
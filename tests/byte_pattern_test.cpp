@@ -0,0 +1,236 @@
+// Byte patterns: what parses, which byte is picked as the anchor, forward and backward scans
+// with wildcards against a brute-force search, and matches in the scalar tail after the last
+// 16-byte block with the buffer ending on an inaccessible page. Then Memory.FindPattern's
+// scan against the Lua loop findSignature used before, on a synthetic multi-megabyte image.
+#include "byte_pattern.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <sys/mman.h>
+#include <lua.hpp>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void TestParse() {
+    BytePattern pattern;
+    Check(ParsePattern("53 42 ?? 4E ? 00", pattern), "pattern parses");
+    const uint8_t bytes[] = { 0x53, 0x42, 0, 0x4E, 0, 0 };
+    const uint8_t mask[] = { 0xFF, 0xFF, 0, 0xFF, 0, 0xFF };
+    Check(pattern.bytes.size() == 6 && !memcmp(pattern.bytes.data(), bytes, 6) && !memcmp(pattern.mask.data(), mask, 6),
+        "bytes and mask");
+    Check(ParsePattern("534e??4D", pattern) && pattern.bytes.size() == 4 && pattern.bytes[1] == 0x4E, "spaces are optional");
+
+    const char* malformed[] = { "5", "53 4", "GG", "53,42", "0x53", "53 -1", "53 4G" };
+    for (const char* text : malformed) {
+        if (ParsePattern(text, pattern)) {
+            printf("FAIL: \"%s\" should not parse\n", text);
+            failures++;
+        }
+    }
+    Check(!ParsePattern("", pattern), "empty pattern rejected");
+    Check(!ParsePattern("?? ? ??", pattern), "all-wildcard pattern rejected");
+    Check(!ParsePattern("   ", pattern), "blank pattern rejected");
+}
+
+static void TestAnchor() {
+    BytePattern pattern;
+    ParsePattern("00 FF 8B 53 00", pattern);
+    Check(pattern.anchor == 3, "rare byte chosen over common ones");
+    ParsePattern("00 ?? 8B FF", pattern);
+    Check(pattern.anchor == 2, "least common of the common bytes");
+    ParsePattern("?? 41 42", pattern);
+    Check(pattern.anchor == 1, "first of equally rare bytes, never a wildcard");
+    ParsePattern("00 00 ?? 00", pattern);
+    Check(pattern.anchor == 0, "all zero still anchors on a literal");
+}
+
+// Every position tried in turn
+static size_t Reference(const std::vector<uint8_t>& data, const BytePattern& pattern, bool backward) {
+    size_t length = pattern.bytes.size();
+    if (data.size() < length) return SIZE_MAX;
+    size_t found = SIZE_MAX;
+    for (size_t i = 0; i + length <= data.size(); i++) {
+        bool match = true;
+        for (size_t j = 0; j < length && match; j++) match = !((data[i + j] ^ pattern.bytes[j]) & pattern.mask[j]);
+        if (!match) continue;
+        if (!backward) return i;
+        found = i;
+    }
+    return found;
+}
+
+static void TestRandom() {
+    std::mt19937 random(11);
+    int mismatches = 0;
+    for (int round = 0; round < 3000; round++) {
+        // A small alphabet so matches, including overlapping ones, are common
+        std::vector<uint8_t> data(random() % 300);
+        for (auto& byte : data) byte = (uint8_t)(random() % 3);
+        std::string text;
+        size_t length = 1 + random() % 24;
+        for (size_t i = 0; i < length; i++) {
+            char hex[4];
+            snprintf(hex, sizeof(hex), "%02X ", (unsigned)(random() % 3));
+            text += random() % 4 == 0 ? "?? " : hex;
+        }
+        BytePattern pattern;
+        if (!ParsePattern(text.c_str(), pattern)) continue;
+        for (bool backward : { false, true }) {
+            if (ScanPattern(data.data(), data.size(), pattern, backward) != Reference(data, pattern, backward)) mismatches++;
+        }
+    }
+    Check(mismatches == 0, "forward and backward scans agree with a brute-force search");
+}
+
+static const size_t pageSize = 0x1000;
+
+// The buffer ends where a PROT_NONE page begins, so reading past it faults
+static void TestTail() {
+    uint8_t* pages = (uint8_t*)mmap(nullptr, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    mprotect(pages + pageSize, pageSize, PROT_NONE);
+    BytePattern pattern;
+    ParsePattern("53 ?? 44 4E 11 22 33 44 55 66 77 88 99 AA BB CC DD", pattern);
+    size_t length = pattern.bytes.size();
+    const uint8_t match[] = { 0x53, 0x42, 0x44, 0x4E, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xAA, 0xBB,
+        0xCC, 0xDD };
+
+    int wrong = 0;
+    for (size_t size = length; size <= 80; size++) {
+        uint8_t* data = pages + pageSize - size;
+        for (size_t at = 0; at + length <= size; at++) {
+            memset(data, 0x53, size);
+            memcpy(data + at, match, length);
+            if (ScanPattern(data, size, pattern, false) != at || ScanPattern(data, size, pattern, true) != at) {
+                printf("FAIL: match at %zu of %zu\n", at, size);
+                wrong++;
+            }
+        }
+        memset(data, 0x53, size);
+        if (ScanPattern(data, size, pattern, false) != SIZE_MAX || ScanPattern(data, size, pattern, true) != SIZE_MAX) wrong++;
+    }
+    Check(wrong == 0, "matches in every position up to the last byte, including the last 15");
+    Check(ScanPattern(pages + pageSize - 4, 4, pattern, false) == SIZE_MAX, "buffer shorter than the pattern");
+    munmap(pages, 2 * pageSize);
+}
+
+static const uint8_t* image = nullptr;
+static size_t imageSize = 0;
+static const uintptr_t imageBase = 0x10000000;
+
+// Memory.ReadMemory(address, 1) as the loader answers it
+static int lua_ReadMemory(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t size = (size_t)luaL_checkinteger(L, 2);
+    if (size == 1 && address >= imageBase && address - imageBase < imageSize) {
+        lua_pushinteger(L, image[address - imageBase]);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// findSignature from calendar_injerctor.lua before Memory.FindPattern
+static const char* luaFindSignature = R"(
+function findSignature(startAddress, signature, direction, maxBytes)
+    local signatureLength = #signature
+    local currentAddress = startAddress
+    local endAddress = startAddress + (direction * maxBytes)
+    while (direction == 1 and currentAddress < endAddress) or
+          (direction == -1 and currentAddress > endAddress) do
+        local match = true
+        for i = 1, signatureLength do
+            local checkAddr
+            if direction == 1 then
+                checkAddr = currentAddress + (i - 1)
+            else
+                checkAddr = currentAddress - signatureLength + i
+            end
+            local byteValue = Memory.ReadMemory(checkAddr, 1)
+            if byteValue ~= string.byte(signature, i) then
+                match = false
+                break
+            end
+        end
+        if match then
+            if direction == -1 then
+                return currentAddress - signatureLength + 1
+            end
+            return currentAddress
+        end
+        currentAddress = currentAddress + direction
+    end
+    return nil
+end
+)";
+
+static void Benchmark() {
+    // Game data: mostly zeroes and small values, with the signature near the far end
+    const size_t size = 8 * 1024 * 1024;
+    std::vector<uint8_t> data(size);
+    std::mt19937 random(3);
+    for (auto& byte : data) byte = random() % 4 == 0 ? (uint8_t)random() : 0;
+    const size_t at = size - 0x1234;
+    memcpy(&data[at], "SBDN", 4);
+    image = data.data();
+    imageSize = size;
+
+    BytePattern pattern;
+    ParsePattern("53 42 44 4E", pattern);
+    const int runs = 20;
+    size_t forward = 0, backward = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < runs; i++) {
+        forward = ScanPattern(data.data(), size, pattern, false);
+        backward = ScanPattern(data.data(), at + 0x100, pattern, true);
+    }
+    double native = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+    Check(forward == at && backward == at, "native scan finds the signature both ways");
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_ReadMemory);
+    lua_setfield(L, -2, "ReadMemory");
+    lua_setglobal(L, "Memory");
+    Check(luaL_dostring(L, luaFindSignature) == LUA_OK, "Lua loop loads");
+
+    uintptr_t found[2] = { 0, 0 };
+    start = std::chrono::steady_clock::now();
+    for (int direction = 0; direction < 2; direction++) {
+        lua_getglobal(L, "findSignature");
+        lua_pushinteger(L, (lua_Integer)(direction == 0 ? imageBase : imageBase + at + 0x100 - 1));
+        lua_pushstring(L, "SBDN");
+        lua_pushinteger(L, direction == 0 ? 1 : -1);
+        lua_pushinteger(L, (lua_Integer)size);
+        if (lua_pcall(L, 4, 1, 0) == LUA_OK) found[direction] = (uintptr_t)lua_tointeger(L, -1);
+        lua_pop(L, 1);
+    }
+    double loop = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    lua_close(L);
+    Check(found[0] == imageBase + at && found[1] == imageBase + at, "Lua loop finds the signature both ways");
+
+    // Both directions together scan size + at + 0x100 bytes in each
+    double scanned = (double)(size + at + 0x100);
+    printf("%zu MB image: FindPattern %.2f GB/s, Lua ReadMemory loop %.1f MB/s (%.0fx)\n", size >> 20,
+        scanned / native / 1e9, scanned / loop / 1e6, loop / native);
+}
+
+int main() {
+    TestParse();
+    TestAnchor();
+    TestRandom();
+    TestTail();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+// The detour hook stub run for real on i386: registers, flags and XMM state survive it,
+// writes the handler makes to the saved context come back out, and the fxsave area is
+// aligned. Then hits per second through the stub against an INT3 rearmed by single-step,
+// the way breakpoints work. Built freestanding, since a 32-bit C++ runtime is often not
+// installed: Linux syscalls stand in for libc.
+#include "hook_stub.h"
+
+extern "C" uint64_t __udivdi3(uint64_t a, uint64_t b) {
+    uint64_t quotient = 0, remainder = 0;
+    for (int i = 63; i >= 0; i--) {
+        remainder = (remainder << 1) | ((a >> i) & 1);
+        if (remainder >= b) {
+            remainder -= b;
+            quotient |= 1ull << i;
+        }
+    }
+    return quotient;
+}
+
+extern "C" uint64_t __umoddi3(uint64_t a, uint64_t b) {
+    return a - __udivdi3(a, b) * b;
+}
+
+extern "C" void* memcpy(void* dst, const void* src, size_t size) {
+    uint8_t* to = (uint8_t*)dst;
+    const uint8_t* from = (const uint8_t*)src;
+    while (size--) *to++ = *from++;
+    return dst;
+}
+
+static int Syscall(int number, int a = 0, int b = 0, int c = 0, int d = 0, int e = 0, int f = 0) {
+    int result;
+    __asm__ volatile("push %%ebp\n mov %7, %%ebp\n int $0x80\n pop %%ebp"
+        : "=a"(result) : "a"(number), "b"(a), "c"(b), "d"(c), "S"(d), "D"(e), "g"(f) : "memory");
+    return result;
+}
+
+static void Print(const char* text) {
+    int length = 0;
+    while (text[length]) length++;
+    Syscall(4, 1, (int)text, length);
+}
+
+static void PrintNumber(uint64_t value) {
+    char digits[24];
+    int i = 23;
+    digits[i] = 0;
+    do {
+        digits[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    Print(digits + i);
+}
+
+static uint64_t Nanoseconds() {
+    struct { int seconds, nanoseconds; } now;
+    Syscall(265, 1, (int)&now);  // clock_gettime(CLOCK_MONOTONIC)
+    return (uint64_t)now.seconds * 1000000000ull + now.nanoseconds;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        Print("FAIL: ");
+        Print(what);
+        Print("\n");
+        failures++;
+    }
+}
+
+// What DispatchHook sees, plus the trampoline slot the stub jumps through
+struct TestHook {
+    void* trampoline;
+    volatile uint64_t hits;
+    bool inspect;
+    uint32_t stackArgument, esi, eflags, fxsaveAlignment;
+    float xmm1;
+};
+
+extern "C" void __attribute__((cdecl)) Dispatch(TestHook* hook, HookContext* context, uint8_t* fxsave) {
+    hook->hits++;
+    if (!hook->inspect) return;
+    hook->stackArgument = *(uint32_t*)(context->esp + 4 + 4);
+    hook->esi = context->esi;
+    hook->eflags = context->eflags;
+    hook->fxsaveAlignment = (uint32_t)fxsave & 15;
+    memcpy(&hook->xmm1, fxsave + 160 + 16, 4);
+    // popad and fxrstor must bring these back out
+    context->ebx = 0;
+    context->edi = 0;
+    float lane = 7.5f;
+    memcpy(fxsave + 160 + 32, &lane, 4);
+    __asm__ volatile("xorps %%xmm0, %%xmm0\n xorps %%xmm1, %%xmm1\n xorps %%xmm2, %%xmm2\n xorps %%xmm7, %%xmm7"
+        ::: "xmm0", "xmm1", "xmm2", "xmm7");
+}
+
+// int target(int a, int b) { return a + b; } with a frame
+static const uint8_t targetCode[] = { 0x55, 0x89, 0xE5, 0x8B, 0x45, 0x08, 0x03, 0x45, 0x0C, 0x5D, 0xC3 };
+typedef int (__attribute__((cdecl)) *Target)(int, int);
+
+extern "C" { volatile uint32_t savedEbx, savedEdi; }
+
+static void TestStub(Target target, TestHook& hook) {
+    static float xmmIn[4] __attribute__((aligned(16))) = { 1.25f, 2, 3, 4 };
+    static float xmm1Out[4] __attribute__((aligned(16))), xmm2Out[4] __attribute__((aligned(16))),
+        xmm7Out[4] __attribute__((aligned(16)));
+    hook.inspect = true;
+    uint32_t esiOut;
+    int result;
+    __asm__ volatile("movaps %0, %%xmm1\n movaps %0, %%xmm7" :: "m"(xmmIn) : "xmm1", "xmm7");
+    __asm__ volatile("push %%ebx\n push %%edi\n mov $0x1234, %%esi\n mov $0x55, %%ebx\n mov $0x66, %%edi\n"
+        "stc\n push $5\n push $37\n call *%2\n add $8, %%esp\n"
+        "mov %%ebx, savedEbx\n mov %%edi, savedEdi\n pop %%edi\n pop %%ebx\n"
+        : "=a"(result), "=S"(esiOut) : "r"(target) : "ecx", "edx", "memory", "cc");
+    __asm__ volatile("movaps %%xmm1, %0\n movaps %%xmm2, %1\n movaps %%xmm7, %2"
+        : "=m"(xmm1Out), "=m"(xmm2Out), "=m"(xmm7Out));
+    hook.inspect = false;
+
+    Check(result == 42 && hook.hits == 1, "hooked function runs once through the stub");
+    Check(hook.stackArgument == 37, "stack arguments at esp + 4");
+    Check(hook.esi == 0x1234 && esiOut == 0x1234, "registers seen and kept");
+    Check((hook.eflags & 1) == 1, "flags seen");
+    Check(savedEbx == 0 && savedEdi == 0, "context writes come back out");
+    Check(hook.fxsaveAlignment == 0, "fxsave area aligned");
+    Check(hook.xmm1 == 1.25f, "xmm1 seen");
+    Check(xmm1Out[0] == 1.25f && xmm1Out[3] == 4 && xmm7Out[2] == 3, "xmm registers kept");
+    Check(xmm2Out[0] == 7.5f, "xmm writes come back out");
+}
+
+// The breakpoint path in miniature: the INT3 puts the original byte back and steps, the
+// single-step trap writes the INT3 again
+static uint8_t* trapTarget;
+static volatile bool stepping = false;
+static volatile uint64_t trapHits = 0;
+
+extern "C" void SignalReturn();
+__asm__(".text\nSignalReturn: mov $173, %eax\n int $0x80\n");
+
+static void OnTrap(int, void*, void* native) {
+    uint32_t* registers = (uint32_t*)((uint8_t*)native + 20);  // ucontext's sigcontext
+    const int eip = 14, eflags = 16;
+    if (!stepping) {
+        registers[eip] -= 1;
+        trapTarget[0] = targetCode[0];
+        trapHits++;
+        registers[eflags] |= 0x100;
+        stepping = true;
+    }
+    else {
+        trapTarget[0] = 0xCC;
+        registers[eflags] &= ~0x100u;
+        stepping = false;
+    }
+}
+
+extern "C" void TestMain() {
+    uint8_t* page = (uint8_t*)Syscall(192, 0, 4096, 7, 0x22, -1, 0);  // mmap2 RWX
+    uint8_t* target = page;
+    uint8_t* stub = page + 64;
+    uint8_t* trampoline = page + 128;
+    memcpy(target, targetCode, sizeof(targetCode));
+    Target call = (Target)target;
+
+    const int calls = 5000000;
+    uint64_t start = Nanoseconds();
+    int sum = 0;
+    for (int i = 0; i < calls; i++) sum += call(i, 1);
+    uint64_t plain = Nanoseconds() - start;
+
+    // A hand-made trampoline stands in for MinHook's: the 6 bytes of whole instructions
+    // under the jump, then a jump back
+    static TestHook hook;
+    hook.trampoline = trampoline;
+    memcpy(trampoline, target, 6);
+    trampoline[6] = 0xE9;
+    *(uint32_t*)(trampoline + 7) = (uint32_t)(target + 6) - (uint32_t)(trampoline + 11);
+    size_t size = EmitHookStub(stub, (uintptr_t)stub, (uintptr_t)&hook, (uintptr_t)&Dispatch, (uintptr_t)&hook.trampoline);
+    Check(size == hookStubSize, "stub size");
+    target[0] = 0xE9;
+    *(uint32_t*)(target + 1) = (uint32_t)stub - (uint32_t)(target + hookPatchSize);
+    target[5] = 0x90;
+    TestStub(call, hook);
+
+    start = Nanoseconds();
+    for (int i = 0; i < calls; i++) sum += call(i, 1);
+    uint64_t hooked = Nanoseconds() - start;
+    Check(hook.hits == 1 + (uint64_t)calls, "every call hits the hook");
+
+    memcpy(target, targetCode, sizeof(targetCode));
+    target[0] = 0xCC;
+    trapTarget = target;
+    struct { void* handler; uint32_t flags; void* restorer; uint32_t mask[2]; } action =
+        { (void*)OnTrap, 4 | 0x04000000, (void*)SignalReturn, { 0, 0 } };  // SA_SIGINFO | SA_RESTORER
+    Check(Syscall(174, 5, (int)&action, 0, 8) == 0, "SIGTRAP handler installed");
+    const int trapCalls = 200000;
+    start = Nanoseconds();
+    for (int i = 0; i < trapCalls; i++) sum += call(i, 1);
+    uint64_t trapped = Nanoseconds() - start;
+    Check(trapHits == (uint64_t)trapCalls, "every call hits the INT3");
+
+    Print("plain: ");
+    PrintNumber(plain / calls);
+    Print(" ns per call\nhook: ");
+    PrintNumber(hooked / calls);
+    Print(" ns per hit, ");
+    PrintNumber((uint64_t)calls * 1000000000ull / hooked);
+    Print(" hits/s\nINT3: ");
+    PrintNumber(trapped / trapCalls);
+    Print(" ns per hit, ");
+    PrintNumber((uint64_t)trapCalls * 1000000000ull / trapped);
+    Print(" hits/s\n");
+    Check(sum != 0, "calls return their results");
+    Print(failures ? "FAILED\n" : "ok\n");
+    Syscall(1, failures ? 1 : 0);  // exit
+}
+
+__asm__(".text\n.globl _start\n_start: and $-16, %esp\n call TestMain\n");
@@ -0,0 +1,212 @@
+// Memory.View: elements of each type read and written through Lua, views refused over
+// unreadable memory and rebased only onto readable memory, and writes refused over read-only
+// memory. Then a Lua loop summing a large array through a view against the same loop calling
+// Memory.ReadMemory per element.
+#include "memory_view.h"
+#include "block_read.h"
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+
+ProcMapsRegionSource regionSource;
+ProtectionCache protectionCache(regionSource);
+
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    return SignalGuardedCopy(dst, src, size);
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Memory.ReadMemory(address, size) as the loader answers it
+static int lua_ReadMemory(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t size = (size_t)luaL_checkinteger(L, 2);
+    uint64_t value = 0;
+    if ((size == 1 || size == 2 || size == 4 || size == 8) && ReadBlock(address, &value, size)) {
+        switch (size) {
+        case 1: lua_pushinteger(L, (uint8_t)value); break;
+        case 2: lua_pushinteger(L, (uint16_t)value); break;
+        case 4: lua_pushinteger(L, (uint32_t)value); break;
+        case 8: lua_pushinteger(L, (lua_Integer)value); break;
+        }
+        return 1;
+    }
+    lua_pushnil(L);
+    return 1;
+}
+
+static lua_State* NewState() {
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    RegisterMemoryView(L);
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_CreateView);
+    lua_setfield(L, -2, "View");
+    lua_pushcfunction(L, lua_ReadMemory);
+    lua_setfield(L, -2, "ReadMemory");
+    lua_setglobal(L, "Memory");
+    return L;
+}
+
+static void SetAddress(lua_State* L, const char* name, const void* address) {
+    lua_pushinteger(L, (lua_Integer)(uintptr_t)address);
+    lua_setglobal(L, name);
+}
+
+static bool Run(lua_State* L, const char* code) {
+    if (luaL_dostring(L, code) == LUA_OK) return true;
+    printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return false;
+}
+
+// Runs code that must return true
+static void CheckLua(lua_State* L, const char* code, const char* what) {
+    bool ok = luaL_dostring(L, code) == LUA_OK && lua_toboolean(L, -1);
+    if (!ok && lua_type(L, -1) == LUA_TSTRING) printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_settop(L, 0);
+    Check(ok, what);
+}
+
+static void TestTypes(lua_State* L) {
+    struct {
+        uint8_t u8[2];
+        int8_t i8[2];
+        uint16_t u16[2];
+        int16_t i16[2];
+        uint32_t u32[2];
+        int32_t i32[2];
+        float f32[2];
+        double f64[2];
+    } data = { { 1, 255 }, { 1, -128 }, { 2, 65535 }, { 2, -32768 }, { 3, 4000000000u }, { 3, -2000000000 },
+        { 0.5f, -1.25f }, { 0.25, 1e300 } };
+    SetAddress(L, "data", &data);
+    SetAddress(L, "u8", data.u8); SetAddress(L, "i8", data.i8); SetAddress(L, "u16", data.u16);
+    SetAddress(L, "i16", data.i16); SetAddress(L, "u32", data.u32); SetAddress(L, "i32", data.i32);
+    SetAddress(L, "f32", data.f32); SetAddress(L, "f64", data.f64);
+
+    CheckLua(L, R"(
+        return Memory.View(u8, "u8", 2)[1] == 255 and Memory.View(i8, "i8", 2)[1] == -128 and
+            Memory.View(u16, "word", 2)[1] == 65535 and Memory.View(i16, "i16", 2)[1] == -32768 and
+            Memory.View(u32, "dword", 2)[1] == 4000000000 and Memory.View(i32, "int", 2)[1] == -2000000000 and
+            Memory.View(f32, "float", 2)[1] == -1.25 and Memory.View(f64, "double", 2)[1] == 1e300 and
+            #Memory.View(f64, "f64", 2) == 2
+    )", "elements of every type");
+
+    CheckLua(L, R"(
+        local v = Memory.View(i16, "i16", 2)
+        v[0] = -5
+        v:Set(1, 70000)
+        local f = Memory.View(f32, "f32", 2)
+        f[1] = 3.5
+        return v[0] == -5 and v:Get(1) == 70000 - 65536 and f[1] == 3.5 and v:Address() == i16
+    )", "writes, wrapped to the element size");
+    Check(data.i16[0] == -5 && data.f32[1] == 3.5f && data.u16[1] == 65535, "writes land in memory, neighbours untouched");
+
+    CheckLua(L, "return not pcall(function() return Memory.View(u8, 'u8', 2)[2] end)", "index past the end");
+    CheckLua(L, "return not pcall(function() return Memory.View(u8, 'u8', 2)[-1] end)", "negative index");
+    CheckLua(L, "return not pcall(Memory.View, u8, 'u128')", "unknown type");
+    CheckLua(L, "return not pcall(Memory.View, u8, 'u8', 0)", "empty view");
+    CheckLua(L, "return not pcall(Memory.View, -8, 'u32', 0x7FFFFFFF)", "view wrapping the address space");
+}
+
+static void TestRanges(lua_State* L) {
+    // A writable page, a read-only page and an inaccessible one
+    uint8_t* pages = (uint8_t*)mmap(nullptr, 3 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    pages[pageSize] = 42;
+    mprotect(pages + pageSize, pageSize, PROT_READ);
+    mprotect(pages + 2 * pageSize, pageSize, PROT_NONE);
+    SetAddress(L, "writable", pages);
+    SetAddress(L, "readOnly", pages + pageSize);
+    SetAddress(L, "none", pages + 2 * pageSize);
+
+    uint64_t rejected = protectionCache.rejectedReads;
+    CheckLua(L, "return Memory.View(none, 'u8') == nil and Memory.View(0, 'u32') == nil", "no view over unreadable memory");
+    CheckLua(L, "return Memory.View(none - 4, 'u32', 2) == nil and Memory.View(none - 8, 'u32', 2) ~= nil",
+        "no view running into unreadable memory");
+    Check(protectionCache.rejectedReads == rejected + 3, "refusals counted as rejected reads");
+
+    CheckLua(L, R"(
+        local v = Memory.View(readOnly, "u8", 16)
+        return v[0] == 42 and not pcall(function() v[0] = 1 end)
+    )", "read-only view reads but refuses writes");
+    Check(pages[pageSize] == 42, "read-only memory untouched");
+
+    CheckLua(L, R"(
+        local v = Memory.View(writable, "u32", 4)
+        v[0] = 7
+        if v:Rebase(none) ~= nil or v:Address() ~= writable or v[0] ~= 7 then return false end
+        if v:Rebase(none - 8) ~= nil or v:Address() ~= writable then return false end
+        if v:Rebase(readOnly) ~= v or v:Address() ~= readOnly or pcall(function() v[0] = 1 end) then return false end
+        return v:Rebase(writable) == v and pcall(function() v[1] = 9 end) and v[1] == 9
+    )", "rebase onto unreadable memory refused, writability follows the new range");
+
+    // Freed and forgotten by the cache: neither a new view nor a rebase goes there
+    CheckLua(L, "view = Memory.View(writable, 'u8', 16) return view ~= nil", "view before freeing");
+    munmap(pages, 3 * pageSize);
+    protectionCache.Invalidate((uintptr_t)pages, 3 * pageSize);
+    CheckLua(L, "return Memory.View(writable, 'u8') == nil and view:Rebase(writable) == nil", "no view over freed memory");
+}
+
+static void Benchmark(lua_State* L) {
+    const size_t count = 1 << 20;
+    std::vector<int32_t> values(count);
+    long long expected = 0;
+    for (size_t i = 0; i < count; i++) {
+        values[i] = (int32_t)(i * 2654435761u % 1000);
+        expected += values[i];
+    }
+    SetAddress(L, "values", values.data());
+    lua_pushinteger(L, (lua_Integer)count);
+    lua_setglobal(L, "count");
+    Run(L, R"(
+        function SumView()
+            local v = Memory.View(values, "i32", count)
+            local sum = 0
+            for i = 0, count - 1 do sum = sum + v[i] end
+            return sum
+        end
+        function SumReadMemory()
+            local sum = 0
+            for i = 0, count - 1 do sum = sum + Memory.ReadMemory(values + i * 4, 4) end
+            return sum
+        end
+    )");
+
+    double seconds[2];
+    const char* functions[2] = { "SumView", "SumReadMemory" };
+    for (int i = 0; i < 2; i++) {
+        auto start = std::chrono::steady_clock::now();
+        lua_getglobal(L, functions[i]);
+        bool ok = lua_pcall(L, 0, 1, 0) == LUA_OK && lua_tointeger(L, -1) == expected;
+        lua_settop(L, 0);
+        seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Check(ok, "benchmark sums agree");
+    }
+    printf("%zu i32 elements from Lua: View %.1f ns each, ReadMemory %.1f ns each (%.1fx)\n", count,
+        seconds[0] / count * 1e9, seconds[1] / count * 1e9, seconds[1] / seconds[0]);
+}
+
+int main() {
+    lua_State* L = NewState();
+    TestTypes(L);
+    TestRanges(L);
+    Benchmark(L);
+    lua_close(L);
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,208 @@
+// Memory.FindAll's scan on a synthetic database.bin blob: every hit of several patterns at
+// once, overlapping hits, wildcards, the maxHits cap, and hits straddling the 1 MB pool chunk
+// boundaries, each checked against testing every pattern at every offset. Then one pass over
+// the blob against a ScanPattern loop per pattern.
+#include "multi_pattern.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+ScanStats scanStats;
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static MultiPattern Build(std::initializer_list<const char*> texts) {
+    MultiPattern multi;
+    for (const char* text : texts) {
+        BytePattern pattern;
+        Check(ParsePattern(text, pattern), text);
+        multi.patterns.push_back(pattern);
+    }
+    BuildMultiPattern(multi);
+    return multi;
+}
+
+static bool SameHits(std::vector<PatternHit> a, std::vector<PatternHit> b) {
+    auto order = [](const PatternHit& x, const PatternHit& y) {
+        return x.address != y.address ? x.address < y.address : x.pattern < y.pattern;
+    };
+    std::sort(a.begin(), a.end(), order);
+    std::sort(b.begin(), b.end(), order);
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (a[i].address != b[i].address || a[i].pattern != b[i].pattern) return false;
+    }
+    return true;
+}
+
+// Every pattern tried at every offset
+static std::vector<PatternHit> Reference(const std::vector<uint8_t>& data, const MultiPattern& multi) {
+    std::vector<PatternHit> hits;
+    for (size_t i = 0; i < data.size(); i++) {
+        for (size_t p = 0; p < multi.patterns.size(); p++) {
+            if (i + multi.patterns[p].bytes.size() <= data.size() && MatchPatternAt(data.data() + i, multi.patterns[p])) {
+                hits.push_back({ i, (int)p });
+            }
+        }
+    }
+    return hits;
+}
+
+static std::vector<PatternHit> Scan(const std::vector<uint8_t>& data, const MultiPattern& multi, size_t maxHits = SIZE_MAX) {
+    std::vector<PatternHit> hits;
+    ScanMultiPattern(data.data(), data.size(), 0, multi, hits, maxHits);
+    return hits;
+}
+
+// As FindAllInRange does it above parallelScanThreshold, without the pool
+static std::vector<PatternHit> ScanChunked(const std::vector<uint8_t>& data, const MultiPattern& multi, size_t maxHits) {
+    size_t longest = 0;
+    for (const auto& pattern : multi.patterns) longest = std::max(longest, pattern.bytes.size());
+    std::vector<ScanChunk> chunks = SplitScanChunks({ { 0, data.size() } }, longest - 1);
+    std::vector<std::vector<PatternHit>> chunkHits(chunks.size());
+    for (size_t i = 0; i < chunks.size(); i++) {
+        ScanMultiPattern(data.data() + chunks[i].start, chunks[i].end - chunks[i].start, chunks[i].start, multi,
+            chunkHits[i], maxHits);
+        TrimChunkHits(chunks[i], chunkHits[i]);
+    }
+    return MergeChunkHits(chunkHits, maxHits);
+}
+
+// database.bin in miniature: SBDN, then ITMS records with a name, and noise in between
+static std::vector<uint8_t> BuildDatabase(size_t size, std::vector<size_t>& records) {
+    std::mt19937 random(7);
+    std::vector<uint8_t> data(size);
+    for (auto& byte : data) byte = (uint8_t)random();
+    memcpy(&data[0], "SBDN", 4);
+    for (size_t at = 0x40; at + 0x40 < size; at += 0x1000 + random() % 0x3000) records.push_back(at);
+    // Records that straddle each chunk boundary by one to three bytes
+    for (size_t boundary = scanChunkSize; boundary + 0x40 < size; boundary += scanChunkSize) {
+        for (size_t back = 1; back <= 3; back++) records.push_back(boundary - back - 0x100 * back);
+        records.push_back(boundary - 2);
+    }
+    for (size_t at : records) {
+        memcpy(&data[at], "ITMS", 4);
+        memcpy(&data[at + 4 + 0x20], "Track", 5);
+    }
+    return data;
+}
+
+static void TestPatterns() {
+    std::vector<uint8_t> data = { 0xAA, 0xAA, 0xAA, 0xAA, 0x41, 0x42, 0x43, 0x44, 0x42, 0x43, 0x00, 0x49, 0x54, 0x4D, 0x53 };
+
+    // Overlapping hits of one pattern, and a key that is a suffix of another
+    MultiPattern overlap = Build({ "AA AA", "AA AA AA", "41 42 43", "42 43" });
+    std::vector<PatternHit> hits = Scan(data, overlap);
+    Check(SameHits(hits, Reference(data, overlap)), "overlapping hits");
+    Check(hits.size() == 3 + 2 + 1 + 2, "overlapping hit count");
+    bool ordered = true;
+    for (size_t i = 1; i < hits.size(); i++) ordered = ordered && hits[i - 1].address <= hits[i].address;
+    Check(ordered, "hits in address order");
+
+    // Wildcards on either side of the literal key, and a pattern with its key in the middle
+    MultiPattern wild = Build({ "49 ?? 4D 53", "?? 42 43 ??", "AA ? 41", "44 ?? ?? 00 49" });
+    Check(SameHits(Scan(data, wild), Reference(data, wild)), "wildcard patterns");
+    Check(Scan(data, wild).size() == 5, "wildcard hit count");
+
+    // A hit whose pattern runs past the end of the buffer isn't reported
+    MultiPattern past = Build({ "4D 53 ??" });
+    Check(Scan(data, past).empty(), "pattern running past the end");
+}
+
+static void TestDatabase() {
+    std::vector<size_t> records;
+    std::vector<uint8_t> data = BuildDatabase(3 * scanChunkSize + 0x5000, records);
+    MultiPattern multi = Build({ "53 42 44 4E", "49 54 4D 53", "49 54 4D 53 ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ??"
+        " ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? 54 72 61 63 6B" });
+    std::vector<PatternHit> reference = Reference(data, multi);
+    size_t itms = 0, named = 0;
+    for (const auto& hit : reference) {
+        itms += hit.pattern == 1;
+        named += hit.pattern == 2;
+    }
+    Check(itms >= records.size() && named == records.size(), "database blob has its records");
+
+    std::vector<PatternHit> hits = Scan(data, multi);
+    Check(SameHits(hits, reference), "every hit of every pattern in one pass");
+    Check(!hits.empty() && hits[0].address == 0 && hits[0].pattern == 0, "SBDN first");
+
+    // Too many start bytes to skip ahead on, so every byte goes through the automaton
+    MultiPattern many = Build({ "53 42 44 4E", "49 54 4D 53", "54 72 61 63 6B", "00 ?? 00", "A0 A1", "7F" });
+    Check(many.startBytes.size() > multiPatternSkipBytes, "no skipping with six start bytes");
+    Check(SameHits(Scan(data, many), Reference(data, many)), "every hit without skipping");
+
+    std::vector<PatternHit> chunked = ScanChunked(data, multi, SIZE_MAX);
+    Check(SameHits(chunked, reference), "hits across chunk boundaries found once");
+    bool straddles = false;
+    for (const auto& hit : chunked) {
+        size_t offset = hit.address % scanChunkSize;
+        straddles = straddles || (hit.pattern == 2 && offset + 41 > scanChunkSize);
+    }
+    Check(straddles, "a record crosses a chunk boundary");
+}
+
+static void TestMaxHits() {
+    std::vector<size_t> records;
+    std::vector<uint8_t> data = BuildDatabase(3 * scanChunkSize + 0x5000, records);
+    // The long pattern's key ends 40 bytes after it starts, so its hit on the first record comes
+    // out of the automaton after the ITMS tag planted 8 bytes further on
+    memcpy(&data[records[0] + 8], "ITMS", 4);
+    MultiPattern multi = Build({ "49 54 4D 53", "?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ??"
+        " ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? ?? 54 72 61 63 6B" });
+    std::vector<PatternHit> reference = Reference(data, multi);
+    std::stable_sort(reference.begin(), reference.end(),
+        [](const PatternHit& a, const PatternHit& b) { return a.address < b.address; });
+
+    for (size_t maxHits : { (size_t)1, (size_t)2, (size_t)7, reference.size() / 2, reference.size(), reference.size() + 5 }) {
+        std::vector<PatternHit> expected(reference.begin(), reference.begin() + std::min(maxHits, reference.size()));
+        char what[64];
+        snprintf(what, sizeof(what), "first %zu hits by address", maxHits);
+        Check(SameHits(Scan(data, multi, maxHits), expected), what);
+        snprintf(what, sizeof(what), "first %zu hits by address, chunked", maxHits);
+        Check(SameHits(ScanChunked(data, multi, maxHits), expected), what);
+    }
+}
+
+static void Benchmark() {
+    std::vector<size_t> records;
+    std::vector<uint8_t> data = BuildDatabase(32 * 1024 * 1024, records);
+    MultiPattern multi = Build({ "53 42 44 4E", "49 54 4D 53" });
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<PatternHit> hits = Scan(data, multi);
+    double onePass = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // What analyzeTrackDatabase did: restart a single-pattern scan after every hit, per pattern
+    start = std::chrono::steady_clock::now();
+    size_t loopHits = 0;
+    for (const auto& pattern : multi.patterns) {
+        for (size_t position = 0; position < data.size(); ) {
+            size_t offset = ScanPattern(data.data() + position, data.size() - position, pattern, false);
+            if (offset == SIZE_MAX) break;
+            loopHits++;
+            position += offset + 1;
+        }
+    }
+    double perPattern = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("32 MB, %zu hits: one pass %.2f GB/s, ScanPattern per pattern %.2f GB/s\n", hits.size(),
+        data.size() / onePass / 1e9, data.size() / perPattern / 1e9);
+    Check(hits.size() == loopHits, "benchmark hit counts agree");
+}
+
+int main() {
+    TestPatterns();
+    TestDatabase();
+    TestMaxHits();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,206 @@
+// PE parsing: a PE32 file written to disk and read back is parsed through its raw file
+// offsets, sections and exports alike, and again as the loader would map it. Forwarded
+// exports are skipped and damaged headers are rejected. A PE file given on the command line
+// is parsed too.
+#include "pe_image.h"
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+template<typename T>
+static void Put(std::vector<uint8_t>& file, size_t offset, const T& value) {
+    memcpy(file.data() + offset, &value, sizeof(T));
+}
+
+static void PutString(std::vector<uint8_t>& file, size_t offset, const char* text) {
+    memcpy(file.data() + offset, text, strlen(text) + 1);
+}
+
+constexpr uint32_t imageBase = 0x400000;
+constexpr size_t ntOffset = 0x80;
+constexpr size_t sectionTableOffset = ntOffset + 4 + sizeof(PeFileHeader) + sizeof(PeOptionalHeader32);
+
+// Three sections whose file offsets differ from their RVAs. .rdata holds the export
+// directory: Alpha and Beta point into .text, Forward is forwarded to another DLL.
+static std::vector<uint8_t> BuildImage() {
+    std::vector<uint8_t> file(0xA00);
+    Put(file, 0, peDosSignature);
+    Put(file, 0x3C, (int32_t)ntOffset);
+    Put(file, ntOffset, peNtSignature);
+
+    PeFileHeader header = {};
+    header.machine = 0x14C;
+    header.numberOfSections = 3;
+    header.timeDateStamp = 0x5F5E1234;
+    header.sizeOfOptionalHeader = sizeof(PeOptionalHeader32);
+    Put(file, ntOffset + 4, header);
+
+    PeOptionalHeader32 optional = {};
+    optional.magic = pe32Magic;
+    optional.imageBase = imageBase;
+    optional.sectionAlignment = 0x1000;
+    optional.fileAlignment = 0x200;
+    optional.sizeOfImage = 0x4000;
+    optional.sizeOfHeaders = 0x400;
+    optional.numberOfRvaAndSizes = 16;
+    optional.dataDirectory[peExportDirectoryIndex] = { 0x2000, 0x100 };
+    Put(file, ntOffset + 4 + sizeof(PeFileHeader), optional);
+
+    const PeSectionHeader sections[] = {
+        { ".text", 0x200, 0x1000, 0x200, 0x400, 0, 0, 0, 0, 0x60000020 },
+        { ".rdata", 0x180, 0x2000, 0x200, 0x600, 0, 0, 0, 0, 0x40000040 },
+        { ".data", 0x80, 0x3000, 0x200, 0x800, 0, 0, 0, 0, 0xC0000040 },
+    };
+    for (size_t i = 0; i < 3; i++) Put(file, sectionTableOffset + i * sizeof(PeSectionHeader), sections[i]);
+
+    // .rdata starts at file offset 0x600 for RVA 0x2000
+    auto at = [](uint32_t rva) { return (size_t)(rva - 0x2000 + 0x600); };
+    PeExportDirectory exports = {};
+    exports.numberOfFunctions = 3;
+    exports.numberOfNames = 3;
+    exports.addressOfFunctions = 0x2040;
+    exports.addressOfNames = 0x2050;
+    exports.addressOfNameOrdinals = 0x2060;
+    Put(file, at(0x2000), exports);
+    const uint32_t functions[] = { 0x1020, 0x1010, 0x2080 };
+    const uint32_t names[] = { 0x20A0, 0x20B0, 0x20C0 };
+    const uint16_t ordinals[] = { 1, 0, 2 };
+    for (size_t i = 0; i < 3; i++) {
+        Put(file, at(0x2040) + i * 4, functions[i]);
+        Put(file, at(0x2050) + i * 4, names[i]);
+        Put(file, at(0x2060) + i * 2, ordinals[i]);
+    }
+    PutString(file, at(0x2080), "OTHER.Function");
+    PutString(file, at(0x20A0), "Alpha");
+    PutString(file, at(0x20B0), "Beta");
+    PutString(file, at(0x20C0), "Forward");
+    return file;
+}
+
+static std::vector<uint8_t> ReadFile(const char* path) {
+    std::vector<uint8_t> data;
+    FILE* file = fopen(path, "rb");
+    if (!file) return data;
+    fseek(file, 0, SEEK_END);
+    data.resize((size_t)ftell(file));
+    fseek(file, 0, SEEK_SET);
+    if (fread(data.data(), 1, data.size(), file) != data.size()) data.clear();
+    fclose(file);
+    return data;
+}
+
+static void CheckExports(const ModuleInfo& module, const char* how) {
+    char what[96];
+    auto alpha = module.exports.find("Alpha");
+    auto beta = module.exports.find("Beta");
+    snprintf(what, sizeof(what), "exports by name (%s)", how);
+    Check(module.exports.size() == 2 && alpha != module.exports.end() && beta != module.exports.end() &&
+        alpha->second == imageBase + 0x1010 && beta->second == imageBase + 0x1020, what);
+    snprintf(what, sizeof(what), "forwarded export skipped (%s)", how);
+    Check(!module.exports.count("Forward"), what);
+}
+
+static void TestFromDisk() {
+    char path[] = "/tmp/pe_image_testXXXXXX";
+    int fd = mkstemp(path);
+    std::vector<uint8_t> built = BuildImage();
+    Check(fd >= 0 && write(fd, built.data(), built.size()) == (ssize_t)built.size(), "image written");
+    if (fd >= 0) close(fd);
+    std::vector<uint8_t> file = ReadFile(path);
+    unlink(path);
+    Check(file == built, "image read back");
+
+    ModuleInfo module;
+    module.base = imageBase;
+    Check(ParsePeSections(file.data(), file.size(), module), "sections parse");
+    Check(module.size == 0x4000 && module.timeDateStamp == 0x5F5E1234, "image size and timestamp");
+    Check(module.sections.size() == 3 && module.sections[0].name == ".text" && module.sections[1].name == ".rdata" &&
+        module.sections[2].name == ".data", "section names");
+    const SectionInfo& data = module.sections[2];
+    Check(data.start == imageBase + 0x3000 && data.size == 0x80 && data.rawOffset == 0x800 && data.rawSize == 0x200,
+        "section layout");
+    Check((data.characteristics & peSectionWritable) && !(module.sections[0].characteristics & peSectionWritable),
+        "section characteristics");
+
+    Check(ParsePeExports(file.data(), file.size(), false, module), "exports parse from raw offsets");
+    CheckExports(module, "on disk");
+
+    // Laid out at RVAs, as GetExport copies a loaded module
+    std::vector<uint8_t> mapped(module.size);
+    memcpy(mapped.data(), file.data(), 0x400);
+    for (const auto& section : module.sections) {
+        memcpy(mapped.data() + (section.start - imageBase), file.data() + section.rawOffset,
+            std::min<size_t>(section.rawSize, section.size));
+    }
+    ModuleInfo loaded;
+    loaded.base = imageBase;
+    Check(ParsePeSections(mapped.data(), mapped.size(), loaded) && loaded.sections.size() == 3, "mapped sections parse");
+    Check(ParsePeExports(mapped.data(), mapped.size(), true, loaded), "mapped exports parse");
+    CheckExports(loaded, "mapped");
+}
+
+static bool Parses(const std::vector<uint8_t>& file) {
+    ModuleInfo module;
+    module.base = imageBase;
+    return ParsePeSections(file.data(), file.size(), module);
+}
+
+static void TestDamaged() {
+    std::vector<uint8_t> file = BuildImage();
+    Check(!Parses(std::vector<uint8_t>(file.begin(), file.begin() + 0x100)), "truncated headers rejected");
+    Check(!Parses(std::vector<uint8_t>(file.begin(), file.begin() + sectionTableOffset + 50)), "truncated section table rejected");
+
+    std::vector<uint8_t> damaged = file;
+    damaged[0] = 'X';
+    Check(!Parses(damaged), "bad DOS signature rejected");
+    damaged = file;
+    Put(damaged, 0x3C, (int32_t)0x7FFFFFF0);
+    Check(!Parses(damaged), "NT headers past the end rejected");
+    damaged = file;
+    Put(damaged, 0x3C, (int32_t)-8);
+    Check(!Parses(damaged), "negative NT header offset rejected");
+    damaged = file;
+    Put(damaged, ntOffset + 4 + sizeof(PeFileHeader), (uint16_t)0x20B);
+    Check(!Parses(damaged), "PE32+ rejected");
+    damaged = file;
+    Put(damaged, ntOffset + 4 + 2, (uint16_t)0xFFFF);
+    Check(!Parses(damaged), "section count past the end rejected");
+
+    // Export tables pointing outside the image
+    damaged = file;
+    Put(damaged, 0x600 + 20, (uint32_t)0x40000000);  // numberOfFunctions
+    ModuleInfo module;
+    module.base = imageBase;
+    Check(ParsePeSections(damaged.data(), damaged.size(), module) &&
+        !ParsePeExports(damaged.data(), damaged.size(), false, module) && module.exports.empty(),
+        "oversized export table rejected");
+    damaged = file;
+    Put(damaged, 0x600 + 32, (uint32_t)0x9000);  // addressOfNames outside every section
+    module.exports.clear();
+    Check(ParsePeSections(damaged.data(), damaged.size(), module) &&
+        !ParsePeExports(damaged.data(), damaged.size(), false, module), "export names outside the image rejected");
+}
+
+int main(int argc, char** argv) {
+    TestFromDisk();
+    TestDamaged();
+    if (argc > 1) {
+        std::vector<uint8_t> file = ReadFile(argv[1]);
+        ModuleInfo module;
+        bool parsed = ParsePeSections(file.data(), file.size(), module);
+        if (parsed) ParsePeExports(file.data(), file.size(), false, module);
+        printf("%s: %s, %zu sections, %zu exports\n", argv[1], parsed ? "PE32" : "not parsed",
+            module.sections.size(), module.exports.size());
+    }
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
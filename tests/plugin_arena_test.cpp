@@ -0,0 +1,125 @@
+// PluginArena over mmap: size classes, freed blocks handed out again, page-granular and large
+// allocations on their own pages, empty chunks given back, ReleaseAll, and the stats along the
+// way. Then allocations per second against malloc.
+#include "plugin_arena.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    memcpy(dst, src, size);
+    return true;
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void TestSizeClasses() {
+    MmapChunkSource source;
+    PluginArena arena(source);
+
+    uint8_t* a = (uint8_t*)arena.Allocate(10, false);
+    uint8_t* b = (uint8_t*)arena.Allocate(16, false);
+    uint8_t* c = (uint8_t*)arena.Allocate(17, false);
+    Check(a && b && c, "small allocations");
+    Check(b == a + arenaMinBlock, "same class shares a chunk, bottom up");
+    Check(((uintptr_t)c & 31) == 0 && (c < a || c >= a + arenaChunkSize), "next class in its own chunk");
+    Check(arena.Stats().chunks == 2 && arena.Stats().reservedBytes == 2 * arenaChunkSize, "one chunk per class");
+    Check(arena.Stats().liveBytes == 10 + 16 + 17 && arena.Stats().blockBytes == 16 + 16 + 32 &&
+        arena.Stats().allocations == 3, "live and block bytes");
+
+    uint8_t* largest = (uint8_t*)arena.Allocate(arenaMinBlock << (arenaClassCount - 1), false);
+    Check(largest && arena.Stats().chunks == 3, "largest class still pooled");
+    uint8_t* large = (uint8_t*)arena.Allocate(100000, false);
+    Check(large && ((uintptr_t)large & (pageSize - 1)) == 0, "large allocation gets its own pages");
+    Check(arena.Stats().blockBytes == 16 + 16 + 32 + 32768 + 102400, "large allocation rounded to pages");
+
+    memset(a, 0xAB, 10);
+    Check(arena.Free((uintptr_t)a), "free");
+    Check(!arena.Free((uintptr_t)a), "double free refused");
+    Check(!arena.Free((uintptr_t)b + 4), "free inside a block refused");
+    Check(!arena.Free((uintptr_t)&source), "free of foreign memory refused");
+    uint8_t* again = (uint8_t*)arena.Allocate(12, false);
+    Check(again == a, "freed block handed out again");
+    bool zeroed = true;
+    for (int i = 0; i < 16; i++) zeroed = zeroed && again[i] == 0;
+    Check(zeroed, "reused block zeroed");
+    Check(arena.Stats().liveBytes == 12 + 16 + 17 + 32768 + 100000, "stats follow reuse");
+
+    Check(arena.Free((uintptr_t)large) && arena.Stats().chunks == 3 && source.released == 1, "large chunk given back");
+    Check(arena.Free((uintptr_t)c) && arena.Stats().chunks == 2, "empty chunk given back");
+    uint8_t* d = (uint8_t*)arena.Allocate(20, false);
+    Check(d && arena.Stats().chunks == 3, "class refilled after its chunk went back");
+}
+
+static void TestPages() {
+    MmapChunkSource source;
+    PluginArena arena(source);
+    uint8_t* small = (uint8_t*)arena.Allocate(64, true);
+    uint8_t* code = (uint8_t*)arena.Allocate(100, true, true);
+    uint8_t* next = (uint8_t*)arena.Allocate(100, true, true);
+    Check(((uintptr_t)code & (pageSize - 1)) == 0 && ((uintptr_t)next & (pageSize - 1)) == 0, "page-granular blocks start on a page");
+    Check(next != code && arena.Stats().blockBytes == 64 + 2 * pageSize, "page-granular blocks take whole pages");
+    Check(arena.SharesPage((uintptr_t)small + 8, 4), "sub-page blocks share pages");
+    Check(!arena.SharesPage((uintptr_t)code, pageSize), "page-granular blocks don't");
+    Check(arena.Allocate(64, false) != small + 64, "executable and data blocks kept apart");
+}
+
+static void TestReleaseAll() {
+    MmapChunkSource source;
+    {
+        PluginArena arena(source);
+        for (int i = 0; i < 1000; i++) arena.Allocate(16 + i % 300, i & 1);
+        arena.Allocate(1 << 20, false);
+        Check(arena.Stats().allocations == 1001, "allocations counted");
+        arena.ReleaseAll();
+        const ArenaStats& stats = arena.Stats();
+        Check(stats.allocations == 0 && stats.chunks == 0 && stats.liveBytes == 0 && stats.blockBytes == 0 &&
+            stats.reservedBytes == 0, "ReleaseAll clears the stats");
+        Check(source.released == source.reserved, "ReleaseAll gives every chunk back");
+        Check(arena.Allocate(32, false) != nullptr, "usable after ReleaseAll");
+    }
+    Check(source.released == source.reserved, "destructor gives every chunk back");
+}
+
+static void Benchmark() {
+    MmapChunkSource source;
+    PluginArena arena(source);
+    const int count = 200000;
+    std::vector<void*> blocks(count);
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < count; i++) blocks[i] = arena.Allocate(16 + (i % 8) * 24, false);
+        for (int i = 0; i < count; i++) arena.Free((uintptr_t)blocks[i]);
+    }
+    double arenaNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (5.0 * count);
+
+    start = std::chrono::steady_clock::now();
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < count; i++) blocks[i] = calloc(1, 16 + (i % 8) * 24);
+        for (int i = 0; i < count; i++) free(blocks[i]);
+    }
+    double mallocNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (5.0 * count);
+    printf("allocate + free: arena %.1f ns, calloc %.1f ns\n", arenaNs, mallocNs);
+    Check(arena.Stats().allocations == 0 && arena.Stats().chunks == 0, "benchmark leaves nothing behind");
+}
+
+int main() {
+    TestSizeClasses();
+    TestPages();
+    TestReleaseAll();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,196 @@
+// Memory.Chain over 32-bit pointers like the game's: resolving and reading through several
+// hops, null and unreadable hops, the cache revalidating on the root pointer and Invalidate.
+// Then reading through a four-hop chain from Lua, cached and not, against the same walk
+// written with Memory.ReadMemory.
+#include "pointer_chain.h"
+#include "block_read.h"
+#include <chrono>
+#include <cstdio>
+#include <sys/mman.h>
+
+ProcMapsRegionSource regionSource;
+ProtectionCache protectionCache(regionSource);
+
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    return SignalGuardedCopy(dst, src, size);
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Memory.ReadMemory(address, 4) as the loader answers it
+static int lua_ReadMemory(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t size = (size_t)luaL_checkinteger(L, 2);
+    uint32_t value = 0;
+    if (size <= sizeof(value) && ReadBlock(address, &value, size)) {
+        lua_pushinteger(L, value);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+// The game's heap: pointers are 32 bits, so it has to sit below 4 GB
+static uint8_t* heap = nullptr;
+static const size_t heapSize = 16 * pageSize;
+
+static uint32_t At(size_t offset) {
+    return (uint32_t)(uintptr_t)(heap + offset);
+}
+
+static void Put(size_t offset, uint32_t value) {
+    memcpy(heap + offset, &value, 4);
+}
+
+static bool Run(lua_State* L, const char* code) {
+    if (luaL_dostring(L, code) == LUA_OK) return true;
+    printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return false;
+}
+
+static void CheckLua(lua_State* L, const char* code, const char* what) {
+    bool ok = luaL_dostring(L, code) == LUA_OK && lua_toboolean(L, -1);
+    if (!ok && lua_type(L, -1) == LUA_TSTRING) printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_settop(L, 0);
+    Check(ok, what);
+}
+
+// static -> player (+0x10) -> stats (+0x24) -> health (+0x8)
+static void BuildChain() {
+    memset(heap, 0, heapSize - pageSize);
+    Put(0x000, At(0x1000));         // The static pointer
+    Put(0x1010, At(0x2000));        // player->stats
+    Put(0x2024, At(0x3000));        // stats->health block
+    Put(0x3008, 0x12345678);        // health
+    Put(0x4008, 0xCAFE);            // health in a second player's block
+    Put(0x1810, At(0x2800));
+    Put(0x2824, At(0x4000));
+}
+
+static void TestChain(lua_State* L) {
+    BuildChain();
+    lua_pushinteger(L, At(0));
+    lua_setglobal(L, "base");
+    lua_pushinteger(L, At(0));
+    lua_setglobal(L, "heap");
+
+    CheckLua(L, R"(
+        local chain = Memory.Chain(base, { 0x10, 0x24, 0x8 })
+        return chain:Resolve() == heap + 0x3008 and chain:Read() == 0x12345678 and chain:Read(2) == 0x5678 and
+            chain:Read(1) == 0x78 and not pcall(chain.Read, chain, 8)
+    )", "resolve and read through three hops");
+    CheckLua(L, "return Memory.Chain(base, {}):Resolve() == heap + 0x1000", "no offsets reads the root pointer");
+    CheckLua(L, "return Memory.Chain(base, { 0x10, -0x10 }):Resolve() == heap + 0x1FF0", "negative offsets");
+
+    Put(0x2024, 0);
+    CheckLua(L, "return Memory.Chain(base, { 0x10, 0x24, 0x8 }):Read() == nil", "null hop");
+    Put(0x2024, At(heapSize - pageSize));
+    CheckLua(L, "return Memory.Chain(base, { 0x10, 0x24, 0x8 }):Read() == nil", "hop onto an inaccessible page");
+    CheckLua(L, "return Memory.Chain(base, { 0x10, 0x24, 0x8, 0 }):Resolve() == nil", "hop through an inaccessible page");
+    CheckLua(L, "return Memory.Chain(8, { 0 }):Resolve() == nil", "unreadable base");
+    Put(0x2024, At(0x3000));
+
+    CheckLua(L, R"(
+        cached = Memory.Chain(base, { 0x10, 0x24, 0x8 }, true)
+        return cached:Read() == 0x12345678
+    )", "cached chain");
+    // A deeper hop changing goes unnoticed while the root stays the same...
+    Put(0x2024, At(0x4000));
+    CheckLua(L, "return cached:Read() == 0x12345678", "cache kept while the root is unchanged");
+    // ...until the chain is invalidated
+    CheckLua(L, "cached:Invalidate() return cached:Read() == 0xCAFE", "invalidate walks again");
+    // A new root is noticed on its own
+    Put(0x2024, At(0x3000));
+    Put(0x000, At(0x1800));
+    CheckLua(L, "return cached:Read() == 0xCAFE and cached:Resolve() == heap + 0x4008", "new root walks again");
+    Put(0x000, 0);
+    CheckLua(L, "return cached:Resolve() == nil", "null root");
+    Put(0x000, At(0x1000));
+    CheckLua(L, "return cached:Read() == 0x12345678", "root back");
+}
+
+static void Benchmark(lua_State* L) {
+    // static -> a -> b -> c -> value
+    BuildChain();
+    Put(0x3008, At(0x5000));
+    Put(0x5004, 77);
+    Run(L, R"(
+        offsets = { 0x10, 0x24, 0x8, 0x4 }
+        function WalkInLua()
+            local address = Memory.ReadMemory(base, 4)
+            for i = 1, #offsets - 1 do
+                if not address or address == 0 then return nil end
+                address = Memory.ReadMemory(address + offsets[i], 4)
+            end
+            if not address or address == 0 then return nil end
+            return Memory.ReadMemory(address + offsets[#offsets], 4)
+        end
+        local chain = Memory.Chain(base, offsets)
+        local cached = Memory.Chain(base, offsets, true)
+        function ReadChain() return chain:Read() end
+        function ReadCached() return cached:Read() end
+        function Repeat(f, n)
+            local sum = 0
+            for i = 1, n do sum = sum + f() end
+            return sum
+        end
+    )");
+
+    const int reads = 200000;
+    const char* functions[] = { "ReadCached", "ReadChain", "WalkInLua" };
+    double seconds[3];
+    for (int i = 0; i < 3; i++) {
+        auto start = std::chrono::steady_clock::now();
+        lua_getglobal(L, "Repeat");
+        lua_getglobal(L, functions[i]);
+        lua_pushinteger(L, reads);
+        bool ok = lua_pcall(L, 2, 1, 0) == LUA_OK && lua_tointeger(L, -1) == 77LL * reads;
+        lua_settop(L, 0);
+        seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Check(ok, "benchmark reads agree");
+    }
+    printf("Four-hop chain read from Lua: cached Chain %.0f ns, Chain %.0f ns, Lua walk with ReadMemory %.0f ns (%.1fx, %.1fx)\n",
+        seconds[0] / reads * 1e9, seconds[1] / reads * 1e9, seconds[2] / reads * 1e9, seconds[2] / seconds[0],
+        seconds[2] / seconds[1]);
+}
+
+int main() {
+#ifdef MAP_32BIT
+    heap = (uint8_t*)mmap(nullptr, heapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+#endif
+    if (!heap || heap == MAP_FAILED || (uintptr_t)heap + heapSize > 0x100000000ULL) {
+        printf("no memory below 4 GB, skipped\n");
+        return 0;
+    }
+    mprotect(heap + heapSize - pageSize, pageSize, PROT_NONE);
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    RegisterPointerChain(L);
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_CreateChain);
+    lua_setfield(L, -2, "Chain");
+    lua_pushcfunction(L, lua_ReadMemory);
+    lua_setfield(L, -2, "ReadMemory");
+    lua_setglobal(L, "Memory");
+
+    TestChain(L);
+    Benchmark(L);
+    lua_close(L);
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,179 @@
+// Pointer index: which values count as pointers, the segmented radix sort against
+// std::stable_sort, a build over several chunks against collecting and sorting in one go, and
+// a chunk that faults. Then building the index over a 50 MB heap on the pool, against the
+// same collection followed by std::sort.
+#include "pointer_index.h"
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+ScanStats scanStats;
+// Data in this range reads as if it had been freed mid-build
+static AddressRange poisoned = { 0, 0 };
+
+bool GuardedCollectPointers(const uintptr_t* data, size_t count, const std::vector<AddressRange>* mapped,
+    std::vector<PointerRef>* refs) {
+    uintptr_t start = (uintptr_t)data, end = (uintptr_t)(data + count);
+    if (start < poisoned.end && poisoned.start < end) return false;
+    CollectPointers(data, count, *mapped, *refs);
+    return true;
+}
+
+ScanThreadPool& GetScanThreadPool() {
+    static ScanThreadPool* pool = new ScanThreadPool(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    return *pool;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static bool ByTarget(const PointerRef& a, const PointerRef& b) {
+    return a.target < b.target;
+}
+
+static bool SameRefs(const std::vector<PointerRef>& a, const std::vector<PointerRef>& b) {
+    return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+        [](const PointerRef& x, const PointerRef& y) { return x.target == y.target && x.source == y.source; });
+}
+
+static void TestCollect() {
+    const std::vector<AddressRange> mapped = { { 0x1000, 0x2000 }, { 0x5000, 0x6000 }, { 0x9000, 0x9010 } };
+    const uintptr_t values[] = { 0xFFF, 0x1000, 0x1FFF, 0x2000, 0x4FFF, 0x5000, 0x5FFF, 0x6000, 0, UINTPTR_MAX,
+        0x9008, 0x1800, 0x900F, 0x9010 };
+    const bool expected[] = { false, true, true, false, false, true, true, false, false, false, true, true, true, false };
+    std::vector<PointerRef> refs;
+    CollectPointers(values, sizeof(values) / sizeof(values[0]), mapped, refs);
+
+    std::vector<PointerRef> wanted;
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        if (expected[i]) wanted.push_back({ values[i], (uintptr_t)&values[i] });
+    }
+    Check(SameRefs(refs, wanted), "pointers into mapped ranges only, ends exclusive");
+
+    refs.clear();
+    CollectPointers(values, sizeof(values) / sizeof(values[0]), {}, refs);
+    Check(refs.empty(), "nothing mapped, nothing collected");
+}
+
+static void TestRadixSort() {
+    std::mt19937_64 random(5);
+    for (int round = 0; round < 40; round++) {
+        size_t count = random() % 20000;
+        // Narrow targets share their high bytes, so those passes are skipped
+        bool narrow = round % 2 == 0;
+        std::vector<PointerRef> refs(count);
+        for (size_t i = 0; i < count; i++) {
+            uintptr_t target = narrow ? 0x7F3A00000000ULL + (random() % 50000) * 8 : (uintptr_t)random();
+            refs[i] = { target, 0x10000 + i * 8 };
+        }
+        std::vector<size_t> bounds = { 0 };
+        while (bounds.back() < count) bounds.push_back(std::min(count, bounds.back() + 1 + random() % 3000));
+        if (bounds.size() == 1) bounds.push_back(0);
+
+        std::vector<PointerRef> expected = refs;
+        std::stable_sort(expected.begin(), expected.end(), ByTarget);
+        std::vector<PointerRef> serial = refs;
+        RadixSortRefs(serial, bounds, false);
+        RadixSortRefs(refs, bounds, true);
+        if (!SameRefs(serial, expected) || !SameRefs(refs, expected)) {
+            printf("FAIL: radix sort round %d of %zu refs in %zu segments\n", round, count, bounds.size() - 1);
+            failures++;
+        }
+    }
+}
+
+// A heap where about a third of the words point into it or into a few other ranges
+static std::vector<uintptr_t> BuildHeap(size_t words, std::vector<AddressRange>& mapped) {
+    std::vector<uintptr_t> heap(words);
+    uintptr_t start = (uintptr_t)heap.data(), end = (uintptr_t)(heap.data() + words);
+    mapped = { { 0x10000, 0x400000 }, { start, end }, { end + 0x100000, end + 0x900000 } };
+    std::sort(mapped.begin(), mapped.end(), [](const AddressRange& a, const AddressRange& b) { return a.start < b.start; });
+    std::mt19937_64 random(9);
+    for (auto& word : heap) {
+        switch (random() % 6) {
+        case 0: word = start + (random() % words) * sizeof(uintptr_t); break;
+        case 1: word = 0x10000 + random() % 0x3F0000; break;
+        default: word = random() % 5000; break;
+        }
+    }
+    // Many refs to one target
+    for (size_t i = 0; i < words; i += 97) heap[i] = start + 64;
+    return heap;
+}
+
+static void TestBuild() {
+    std::vector<AddressRange> mapped;
+    std::vector<uintptr_t> heap = BuildHeap(3 * scanChunkSize / sizeof(uintptr_t) + 1000, mapped);
+    uintptr_t start = (uintptr_t)heap.data(), end = (uintptr_t)(heap.data() + heap.size());
+
+    std::vector<PointerRef> expected;
+    CollectPointers(heap.data(), heap.size(), mapped, expected);
+    std::stable_sort(expected.begin(), expected.end(), ByTarget);
+
+    // Two runs, the first ending unaligned
+    std::vector<AddressRange> runs = { { start, start + 0x12345 }, { start + 0x12345, end } };
+    std::vector<PointerRef> refs;
+    std::vector<AddressRange> faulted;
+    for (bool parallel : { false, true }) {
+        BuildPointerRefs(runs, mapped, parallel, refs, faulted);
+        std::vector<PointerRef> aligned;
+        for (const auto& ref : expected) {
+            // The word straddling the end of the first run belongs to neither
+            if (ref.source + sizeof(uintptr_t) <= start + 0x12345 || ref.source >= start + 0x12348) aligned.push_back(ref);
+        }
+        Check(SameRefs(refs, aligned) && faulted.empty(), parallel ? "pool build matches one sort" : "build matches one sort");
+    }
+
+    // The second chunk of the second run faults: its refs are left out and it is reported
+    poisoned = { start + 0x12345 + scanChunkSize + 8, start + 0x12345 + scanChunkSize + 16 };
+    BuildPointerRefs(runs, mapped, true, refs, faulted);
+    poisoned = { 0, 0 };
+    uintptr_t chunkStart = start + 0x12345 + scanChunkSize, chunkEnd = chunkStart + scanChunkSize;
+    bool excluded = std::none_of(refs.begin(), refs.end(),
+        [&](const PointerRef& ref) { return ref.source >= chunkStart && ref.source < chunkEnd; });
+    Check(faulted.size() == 1 && faulted[0].start == chunkStart && faulted[0].end == chunkEnd && excluded,
+        "faulted chunk reported and left out");
+    Check(std::is_sorted(refs.begin(), refs.end(), ByTarget) && !refs.empty(), "the rest still sorted");
+}
+
+static void Benchmark() {
+    std::vector<AddressRange> mapped;
+    std::vector<uintptr_t> heap = BuildHeap(50 * 1024 * 1024 / sizeof(uintptr_t), mapped);
+    std::vector<AddressRange> runs = { { (uintptr_t)heap.data(), (uintptr_t)(heap.data() + heap.size()) } };
+
+    std::vector<PointerRef> refs;
+    std::vector<AddressRange> faulted;
+    auto start = std::chrono::steady_clock::now();
+    BuildPointerRefs(runs, mapped, true, refs, faulted);
+    double pool = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    BuildPointerRefs(runs, mapped, false, refs, faulted);
+    double serial = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<PointerRef> sorted;
+    start = std::chrono::steady_clock::now();
+    CollectPointers(heap.data(), heap.size(), mapped, sorted);
+    std::sort(sorted.begin(), sorted.end(),
+        [](const PointerRef& a, const PointerRef& b) { return a.target != b.target ? a.target < b.target : a.source < b.source; });
+    double stdSort = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    printf("50 MB, %zu refs, %zu pool threads: pool %.0f ms, one thread %.0f ms, collect + std::sort %.0f ms\n",
+        refs.size(), GetScanThreadPool().ThreadCount(), pool * 1e3, serial * 1e3, stdSort * 1e3);
+    Check(SameRefs(refs, sorted), "benchmark index matches std::sort");
+}
+
+int main() {
+    TestCollect();
+    TestRadixSort();
+    TestBuild();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,127 @@
+// ProtectionCache: negative entries expire and stay bounded, invalidation works against
+// /proc/self/maps, and a benchmark of cached lookups against querying the maps file.
+#include "page_protection.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    memcpy(dst, src, size);
+    return true;
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Everything below 1 MB is one readable region, everything else fails to query
+struct FakeSource : RegionSource {
+    uint64_t now = 1000;
+    uint32_t queries = 0;
+
+    bool Query(uintptr_t address, uintptr_t& start, uintptr_t& end, uint32_t& protect) override {
+        queries++;
+        if (address >= 0x100000) return false;
+        start = 0;
+        end = 0x100000;
+        protect = 1;
+        return true;
+    }
+    bool IsReadable(uint32_t protect) const override { return protect != 0; }
+    bool IsWritable(uint32_t protect) const override { return protect != 0; }
+    uint64_t Now() const override { return now; }
+};
+
+static void TestNegativeEntries() {
+    FakeSource source;
+    ProtectionCache cache(source);
+
+    Check(cache.IsReadable(0x1000, 4), "readable region");
+    Check(cache.IsReadable(0x2000, 4) && source.queries == 1, "positive entry cached");
+    Check(!cache.IsReadable(0x2000, SIZE_MAX) && !cache.IsWritable(0x2000, SIZE_MAX), "wrapping range rejected");
+
+    Check(!cache.IsReadable(0x200000, 4), "unqueryable page");
+    Check(!cache.IsReadable(0x200000, 4) && source.queries == 2, "negative entry cached");
+    source.now += negativeEntryTtl;
+    Check(!cache.IsReadable(0x200000, 4) && source.queries == 3, "negative entry expired");
+
+    // Probing far more bad pages than the cap keeps the cache bounded
+    for (uintptr_t i = 0; i < maxNegativeEntries * 8; i++) {
+        cache.IsReadable(0x10000000 + i * pageSize, 1);
+        if (i % 1000 == 0) source.now += negativeEntryTtl;
+    }
+    Check(cache.NegativeEntries() <= maxNegativeEntries, "negative entries capped");
+    Check(cache.Size() <= maxNegativeEntries + 1, "cache size capped");
+    Check(cache.IsReadable(0x3000, 4), "positive entry survives the sweep");
+
+    // Without time passing every negative entry is live, so the cap drops them all
+    FakeSource frozen;
+    ProtectionCache frozenCache(frozen);
+    frozenCache.IsReadable(0x1000, 1);
+    for (uintptr_t i = 0; i <= maxNegativeEntries; i++) frozenCache.IsReadable(0x10000000 + i * pageSize, 1);
+    Check(frozenCache.NegativeEntries() <= maxNegativeEntries / 2, "live negative entries dropped over the cap");
+    uint32_t before = frozen.queries;
+    frozenCache.IsReadable(0x1000, 1);
+    Check(frozen.queries == before, "positive entry kept when live negatives are dropped");
+}
+
+static void TestProcMaps() {
+    ProcMapsRegionSource source;
+    ProtectionCache cache(source);
+    uint8_t* page = (uint8_t*)mmap(nullptr, 2 * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Check(cache.IsWritable((uintptr_t)page, 2 * pageSize), "mapped pages writable");
+
+    mprotect(page + pageSize, pageSize, PROT_NONE);
+    cache.Invalidate((uintptr_t)page + pageSize, pageSize);
+    Check(cache.IsReadable((uintptr_t)page, pageSize), "first page still readable");
+    Check(!cache.IsReadable((uintptr_t)page + pageSize, 1), "protected page seen after invalidation");
+
+    munmap(page, 2 * pageSize);
+    cache.Invalidate((uintptr_t)page, 2 * pageSize);
+    Check(!cache.IsReadable((uintptr_t)page, 1), "unmapped gap not readable");
+}
+
+static void Benchmark() {
+    using Clock = std::chrono::steady_clock;
+    ProcMapsRegionSource source;
+    ProtectionCache cache(source);
+    static uint8_t data[64 * pageSize];
+    uintptr_t base = (uintptr_t)data;
+
+    const int queries = 2000;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < queries; i++) {
+        uintptr_t regionStart, regionEnd;
+        uint32_t protect;
+        source.Query(base + (i % 64) * pageSize, regionStart, regionEnd, protect);
+    }
+    double uncached = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / queries;
+
+    const int lookups = 2000000;
+    size_t readable = 0;
+    start = Clock::now();
+    for (int i = 0; i < lookups; i++) readable += cache.IsReadable(base + (i % 64) * pageSize, 8);
+    double cached = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / lookups;
+
+    Check(readable == (size_t)lookups, "benchmark lookups readable");
+    printf("maps query %.0f ns, cached lookup %.1f ns (%.0fx), hits %u misses %u\n",
+        uncached, cached, uncached / cached, cache.hits.load(), cache.misses.load());
+}
+
+int main() {
+    TestNegativeEntries();
+    TestProcMaps();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,97 @@
+// ScanThreadPool: every chunk runs once, cancellation and nested batches, and scan
+// throughput in GB/s for each pool size.
+#include "scan_thread_pool.h"
+#include <cstdio>
+#include <cstring>
+
+ScanStats scanStats;
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void TestRun(ScanThreadPool& pool) {
+    const size_t count = 1000;
+    std::vector<std::atomic<int>> runs(count);
+    pool.Run(count, [&](size_t i) { runs[i]++; });
+    bool once = true;
+    for (auto& run : runs) once = once && run == 1;
+    Check(once, "every task runs exactly once");
+
+    // A task that submits its own batch must not deadlock the pool
+    std::atomic<size_t> inner{ 0 };
+    pool.Run(8, [&](size_t) { pool.Run(16, [&](size_t) { inner++; }); });
+    Check(inner == 8 * 16, "nested batches");
+
+    std::atomic<bool> cancel{ true };
+    std::atomic<size_t> ran{ 0 };
+    pool.Run(count, [&](size_t) {
+        ran++;
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }, &cancel);
+    Check(ran < count, "cancelled batch skips its remaining tasks");
+}
+
+// Counts occurrences of an 8-byte needle, the inner loop of a plain signature scan
+static size_t CountNeedle(const uint8_t* data, size_t size, uint64_t needle) {
+    size_t found = 0;
+    for (size_t i = 0; i + 8 <= size; i++) {
+        if (data[i] != (uint8_t)needle) continue;
+        uint64_t value;
+        memcpy(&value, data + i, 8);
+        found += value == needle;
+    }
+    return found;
+}
+
+static void Benchmark() {
+    using Clock = std::chrono::steady_clock;
+    const size_t size = 256u << 20;
+    const size_t chunkSize = 1u << 20;  // As the loader splits large scans
+    std::vector<uint8_t> data(size);
+    uint32_t seed = 1;
+    for (auto& byte : data) {
+        seed = seed * 1103515245 + 12345;
+        byte = (uint8_t)(seed >> 24);
+    }
+    const uint64_t needle = 0x1122334455667788ull;
+    for (size_t offset = 12345; offset + 8 <= size; offset += 3 * chunkSize + 77) {
+        memcpy(&data[offset], &needle, 8);
+    }
+    size_t expected = CountNeedle(data.data(), size, needle);
+
+    size_t hardware = std::thread::hardware_concurrency() ? std::thread::hardware_concurrency() : 1;
+    printf("hardware threads: %zu\n", hardware);
+    for (size_t threads = 1; threads <= std::max<size_t>(hardware, 4); threads *= 2) {
+        ScanThreadPool* pool = new ScanThreadPool(threads);  // Workers are detached; never destroyed
+        size_t chunks = size / chunkSize;
+        std::vector<size_t> found(chunks);
+        double best = 1e30;
+        for (int round = 0; round < 3; round++) {
+            Clock::time_point start = Clock::now();
+            pool->Run(chunks, [&](size_t i) {
+                // Chunks overlap by 7 bytes so a needle across a boundary is still seen once
+                size_t length = std::min(chunkSize + 7, size - i * chunkSize);
+                found[i] = CountNeedle(&data[i * chunkSize], length, needle);
+            });
+            best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+        }
+        size_t total = 0;
+        for (size_t n : found) total += n;
+        Check(total == expected, "parallel scan finds every needle");
+        printf("%zu threads: %.2f GB/s\n", threads, size / best / 1e9);
+    }
+}
+
+int main() {
+    ScanThreadPool* pool = new ScanThreadPool(3);
+    TestRun(*pool);
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,185 @@
+// Signature cache: lines written and read back, truncated and corrupt lines rejected, a
+// cache file reloaded by a new session and missed when the module's fingerprint changes,
+// and which changes to a module file change its fingerprint.
+#include "signature_cache.h"
+#include <cstdio>
+#include <unistd.h>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static const std::string key = "game.exe\t.text\t53 42 ?? 4E";
+static const SignatureCacheEntry entry = { { 0x5F5E1234, 0x01A2B000, 0xFEDCBA9876543210ULL }, 0x0012ABCD };
+
+static bool Same(const SignatureCacheEntry& a, const SignatureCacheEntry& b) {
+    return a.fingerprint == b.fingerprint && a.rva == b.rva;
+}
+
+static void TestLines() {
+    std::string line = FormatCacheLine(key, entry);
+    Check(line == "game.exe\t.text\t5F5E1234\t01A2B000\tFEDCBA9876543210\t0012ABCD\t53 42 ?? 4E", "line layout");
+    std::string parsedKey;
+    SignatureCacheEntry parsed = {};
+    Check(ParseCacheLine(line, parsedKey, parsed) && parsedKey == key && Same(parsed, entry), "round trip");
+
+    SignatureCacheEntry zero = {};
+    Check(ParseCacheLine(FormatCacheLine(key, zero), parsedKey, parsed) && Same(parsed, zero), "round trip of zeroes");
+
+    // Cut anywhere before the pattern starts
+    size_t patternAt = line.rfind('\t') + 1;
+    int accepted = 0;
+    for (size_t length = 0; length <= patternAt; length++) {
+        if (ParseCacheLine(line.substr(0, length), parsedKey, parsed)) accepted++;
+    }
+    Check(accepted == 0, "truncated lines rejected");
+
+    const char* corrupt[] = {
+        "game.exe\t.text\t5F5E12G4\t01A2B000\tFEDCBA9876543210\t0012ABCD\t53 42",   // Not hex
+        "game.exe\t.text\t\t01A2B000\tFEDCBA9876543210\t0012ABCD\t53 42",           // Empty number
+        "game.exe\t.text\t5F5E1234\t-1\tFEDCBA9876543210\t0012ABCD\t53 42",          // Negative
+        "game.exe\t.text\t5F5E1234\t01A2B000\tFEDCBA9876543210\t10012ABCD\t53 42",  // RVA too wide
+        "game.exe\t.text\t5F5E1234\t01A2B000\t1FEDCBA9876543210\t0012ABCD\t53 42",  // Hash too wide
+        "game.exe\t.text\t 5F5E1234\t01A2B000\tFEDCBA9876543210\t0012ABCD\t53 42",  // Leading space
+        "game.exe\t.text\t5F5E1234\t01A2B000\tFEDCBA9876543210\t0012ABCD\t53 42\textra",
+        "\t.text\t5F5E1234\t01A2B000\tFEDCBA9876543210\t0012ABCD\t53 42",           // No module
+        "game.exe\t.text\t5F5E1234\t01A2B000\tFEDCBA9876543210\t0012ABCD\t",        // No pattern
+        "",
+    };
+    for (const char* text : corrupt) {
+        if (ParseCacheLine(text, parsedKey, parsed)) {
+            printf("FAIL: corrupt line accepted: %s\n", text);
+            failures++;
+        }
+    }
+}
+
+static std::string TempPath() {
+    char path[] = "/tmp/signature_cache_testXXXXXX";
+    int fd = mkstemp(path);
+    if (fd >= 0) close(fd);
+    return path;
+}
+
+static void TestFile() {
+    std::string path = TempPath();
+    const std::string other = "game.exe\t.rdata\t49 54 4D 53";
+    {
+        SignatureCache cache(path);
+        cache.Store(key, entry);
+        cache.Store(other, { entry.fingerprint, 0x400 });
+    }
+    // A corrupt line among them is skipped
+    {
+        std::ofstream file(path, std::ios::app);
+        file << "game.exe\t.text\tnonsense\n";
+    }
+
+    SignatureCache cache(path);
+    uintptr_t rva = 0;
+    Check(cache.Lookup(key, entry.fingerprint, rva) && rva == entry.rva, "entry found by the next session");
+    Check(cache.Lookup(other, entry.fingerprint, rva) && rva == 0x400, "second entry found");
+    ModuleFingerprint rebuilt = entry.fingerprint;
+    rebuilt.textHash ^= 1;
+    Check(!cache.Lookup(key, rebuilt, rva), "changed .text misses");
+    ModuleFingerprint relinked = entry.fingerprint;
+    relinked.timeDateStamp++;
+    Check(!cache.Lookup(key, relinked, rva), "changed timestamp misses");
+    Check(!cache.Lookup("game.exe\t.text\t00 11", entry.fingerprint, rva), "unknown pattern misses");
+
+    // Storing the new fingerprint replaces the old entry
+    cache.Store(key, { rebuilt, 0x2000 });
+    SignatureCache reloaded(path);
+    Check(reloaded.Lookup(key, rebuilt, rva) && rva == 0x2000 && !reloaded.Lookup(key, entry.fingerprint, rva),
+        "entry replaced for the new fingerprint");
+    unlink(path.c_str());
+
+    SignatureCache missing("/nonexistent/dir/sigcache.txt");
+    Check(!missing.Lookup(key, entry.fingerprint, rva), "missing file is an empty cache");
+}
+
+template<typename T>
+static void Put(std::vector<uint8_t>& file, size_t offset, const T& value) {
+    memcpy(file.data() + offset, &value, sizeof(T));
+}
+
+// A PE32 with .text at file offset 0x200 and .data at 0x400
+static std::vector<uint8_t> BuildImage() {
+    std::vector<uint8_t> file(0x600, 0xCC);
+    memset(file.data(), 0, 0x200);
+    Put(file, 0, peDosSignature);
+    Put(file, 0x3C, (int32_t)0x80);
+    Put(file, 0x80, peNtSignature);
+    PeFileHeader header = {};
+    header.machine = 0x14C;
+    header.numberOfSections = 2;
+    header.timeDateStamp = 0x5F5E1234;
+    header.sizeOfOptionalHeader = sizeof(PeOptionalHeader32);
+    Put(file, 0x84, header);
+    PeOptionalHeader32 optional = {};
+    optional.magic = pe32Magic;
+    optional.sizeOfImage = 0x3000;
+    Put(file, 0x84 + sizeof(PeFileHeader), optional);
+    const PeSectionHeader sections[] = {
+        { ".text", 0x200, 0x1000, 0x200, 0x200, 0, 0, 0, 0, 0x60000020 },
+        { ".data", 0x200, 0x2000, 0x200, 0x400, 0, 0, 0, 0, 0xC0000040 },
+    };
+    size_t table = 0x84 + sizeof(PeFileHeader) + sizeof(PeOptionalHeader32);
+    Put(file, table, sections[0]);
+    Put(file, table + sizeof(PeSectionHeader), sections[1]);
+    return file;
+}
+
+static void TestFingerprint() {
+    std::vector<uint8_t> file = BuildImage();
+    ModuleFingerprint original;
+    Check(ComputeFingerprint(file, original), "fingerprint computed");
+    Check(original.timeDateStamp == 0x5F5E1234 && original.imageSize == 0x3000 &&
+        original.textHash == HashBytes(file.data() + 0x200, 0x200), "fingerprint fields");
+
+    ModuleFingerprint changed;
+    std::vector<uint8_t> patched = file;
+    patched[0x450] ^= 1;
+    Check(ComputeFingerprint(patched, changed) && changed == original, ".data changes keep the fingerprint");
+    patched = file;
+    patched[0x3FF] ^= 1;
+    Check(ComputeFingerprint(patched, changed) && !(changed == original), ".text changes change it");
+    patched = file;
+    Put(patched, 0x84 + 4, (uint32_t)0x5F5E1235);
+    Check(ComputeFingerprint(patched, changed) && !(changed == original), "relinking changes it");
+
+    std::vector<uint8_t> garbage(0x600, 0x90);
+    Check(!ComputeFingerprint(garbage, changed), "not a PE file");
+    std::vector<uint8_t> truncated(file.begin(), file.begin() + 0x300);
+    Check(ComputeFingerprint(truncated, changed) && changed.textHash == 0, ".text past the end isn't hashed");
+
+    // Read from disk once per session
+    std::string path = TempPath();
+    {
+        std::ofstream out(path, std::ios::binary);
+        out.write((const char*)file.data(), file.size());
+    }
+    SignatureCache cache(path + ".cache");
+    ModuleFingerprint fromDisk;
+    Check(cache.GetFingerprint(path, fromDisk) && fromDisk == original, "fingerprint of a module file");
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write((const char*)patched.data(), patched.size());
+    }
+    Check(cache.GetFingerprint(path, fromDisk) && fromDisk == original, "fingerprint kept for the session");
+    Check(!cache.GetFingerprint(path + ".missing", fromDisk), "missing module file");
+    unlink(path.c_str());
+}
+
+int main() {
+    TestLines();
+    TestFile();
+    TestFingerprint();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
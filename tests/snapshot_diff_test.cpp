@@ -0,0 +1,214 @@
+// Snapshot diffs: changed and unchanged runs against a byte-by-byte reference, runs that merge
+// across 16-byte blocks, and float comparisons at the smallest possible step, with NaN, signed
+// zero and unaligned snapshots. Then both diffs over a multi-megabyte snapshot against the
+// plain loops.
+#include "snapshot_diff.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <utility>
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+typedef std::vector<std::pair<size_t, size_t>> Runs;
+
+static Runs Bytes(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, bool wantEqual) {
+    Runs runs;
+    DiffBytes(a.data(), b.data(), a.size(), wantEqual, [&](size_t offset, size_t length) { runs.push_back({ offset, length }); });
+    return runs;
+}
+
+static Runs ReferenceBytes(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, bool wantEqual) {
+    Runs runs;
+    for (size_t i = 0; i < a.size();) {
+        if ((a[i] == b[i]) != wantEqual) {
+            i++;
+            continue;
+        }
+        size_t start = i;
+        while (i < a.size() && (a[i] == b[i]) == wantEqual) i++;
+        runs.push_back({ start, i - start });
+    }
+    return runs;
+}
+
+static void TestBytes() {
+    std::mt19937 random(21);
+    int mismatches = 0;
+    for (int round = 0; round < 2000; round++) {
+        std::vector<uint8_t> a(random() % 200);
+        for (auto& byte : a) byte = (uint8_t)random();
+        std::vector<uint8_t> b = a;
+        // Sparse, dense or clustered changes
+        unsigned odds = 1 + random() % 40;
+        for (auto& byte : b) {
+            if (random() % odds == 0) byte ^= 1 + random() % 255;
+        }
+        for (bool wantEqual : { false, true }) {
+            if (Bytes(a, b, wantEqual) != ReferenceBytes(a, b, wantEqual)) mismatches++;
+        }
+    }
+    Check(mismatches == 0, "changed and unchanged runs agree with a byte-by-byte search");
+
+    std::vector<uint8_t> a(64, 0), b(64, 0);
+    for (size_t i = 10; i < 50; i++) b[i] = 1;
+    Check(Bytes(a, b, false) == Runs{ { 10, 40 } }, "a run across three blocks is one run");
+    Check(Bytes(a, b, true) == Runs({ { 0, 10 }, { 50, 14 } }), "unchanged around it");
+    b[15] = 0;
+    Check(Bytes(a, b, false) == Runs({ { 10, 5 }, { 16, 34 } }), "one unchanged byte splits it");
+    b[15] = 1;
+    b[63] = 1;
+    Check(Bytes(a, b, false) == Runs({ { 10, 40 }, { 63, 1 } }), "run in the last byte");
+    Check(Bytes(a, a, false).empty() && Bytes(a, a, true) == Runs{ { 0, 64 } }, "identical snapshots");
+}
+
+static std::vector<uint8_t> Floats(const std::vector<float>& values, size_t shift) {
+    std::vector<uint8_t> bytes(shift + values.size() * 4);
+    memcpy(bytes.data() + shift, values.data(), values.size() * 4);
+    return bytes;
+}
+
+static Runs FloatRuns(uintptr_t address, const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, bool decreased) {
+    Runs runs;
+    DiffFloats(address, a.data(), b.data(), a.size(), decreased, [&](size_t offset, size_t length) { runs.push_back({ offset, length }); });
+    return runs;
+}
+
+static void TestFloats() {
+    const float nan = std::nanf("");
+    const float inf = INFINITY;
+    // One value per case, several blocks long so both the SSE2 and the scalar path see them
+    std::vector<float> before, after;
+    std::vector<int> expected;  // 1 increased, -1 decreased, 0 neither
+    auto add = [&](float x, float y, int direction) {
+        before.push_back(x);
+        after.push_back(y);
+        expected.push_back(direction);
+    };
+    for (int repeat = 0; repeat < 3; repeat++) {
+        add(1.0f, std::nextafterf(1.0f, 2.0f), 1);        // Smallest step up
+        add(1.0f, std::nextafterf(1.0f, 0.0f), -1);       // Smallest step down
+        add(0.0f, 1e-45f, 1);                             // Up to the smallest denormal
+        add(0.0f, -0.0f, 0);                              // Signed zeroes are equal
+        add(-0.0f, 0.0f, 0);
+        add(5.0f, 5.0f, 0);
+        add(nan, 1.0f, 0);                                // NaN is neither
+        add(1.0f, nan, 0);
+        add(nan, nan, 0);
+        add(-inf, -3e38f, 1);
+        add(inf, 3e38f, -1);
+        add(100.0f, 100.0f + 1e-6f, 0);                   // Below float resolution, so unchanged...
+        add(1e7f, 1e7f + 1.0f, 1);                        // ...but this is exactly representable
+        add(2.0f, 3.0f, 1);
+        add(3.0f, 2.0f, -1);
+    }
+
+    int mismatches = 0;
+    for (size_t shift = 0; shift < 4; shift++) {
+        // The snapshot starts shift bytes before the first aligned float
+        uintptr_t address = 0x10000 - shift;
+        std::vector<uint8_t> a = Floats(before, shift), b = Floats(after, shift);
+        for (bool decreased : { false, true }) {
+            Runs wanted;
+            for (size_t i = 0; i < expected.size(); i++) {
+                if (expected[i] != (decreased ? -1 : 1)) continue;
+                size_t offset = shift + i * 4;
+                if (!wanted.empty() && wanted.back().first + wanted.back().second == offset) wanted.back().second += 4;
+                else wanted.push_back({ offset, 4 });
+            }
+            if (FloatRuns(address, a, b, decreased) != wanted) {
+                printf("FAIL: float diff, %s, snapshot %zu bytes before alignment\n", decreased ? "decreased" : "increased", shift);
+                mismatches++;
+            }
+        }
+    }
+    Check(mismatches == 0, "smallest steps count, NaN and signed zero never do");
+
+    // A trailing partial float is ignored, a run ending on the last whole one is closed there
+    std::vector<uint8_t> a = Floats({ 1, 1, 1, 1, 1 }, 0), b = Floats({ 1, 1, 1, 1, 2 }, 0);
+    a.resize(a.size() + 3);
+    b.resize(b.size() + 3, 0xFF);
+    Check(FloatRuns(0x20000, a, b, false) == Runs{ { 16, 4 } }, "run closed at the last whole float");
+    // At an odd address the aligned floats start 3 bytes in and straddle the values
+    Runs odd = FloatRuns(0x20001, a, b, false);
+    Check(!odd.empty() && std::all_of(odd.begin(), odd.end(), [](const std::pair<size_t, size_t>& run) { return run.first % 4 == 3; }),
+        "only aligned floats compared");
+}
+
+static void Benchmark() {
+    const size_t size = 32 * 1024 * 1024;
+    std::vector<uint8_t> a(size), b;
+    std::mt19937 random(4);
+    for (size_t i = 0; i < size; i += 4) {
+        float value = (float)(random() % 1000);
+        memcpy(&a[i], &value, 4);
+    }
+    b = a;
+    // A few thousand changes, as between two frames of a game
+    for (int i = 0; i < 4000; i++) {
+        size_t at = (random() % (size / 4)) * 4;
+        float value;
+        memcpy(&value, &b[at], 4);
+        value += random() % 2 ? 1.0f : -1.0f;
+        memcpy(&b[at], &value, 4);
+    }
+
+    const int runs = 5;
+    size_t changed = 0, increased = 0, plainChanged = 0, plainIncreased = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        changed = 0;
+        DiffBytes(a.data(), b.data(), size, false, [&](size_t, size_t) { changed++; });
+    }
+    double bytes = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+
+    start = std::chrono::steady_clock::now();
+    for (int run = 0; run < runs; run++) {
+        increased = 0;
+        DiffFloats(0x10000, a.data(), b.data(), size, false, [&](size_t, size_t) { increased++; });
+    }
+    double floats = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() / runs;
+
+    // The loops Memory.Diff replaced
+    start = std::chrono::steady_clock::now();
+    bool open = false;
+    for (size_t i = 0; i < size; i++) {
+        bool differs = a[i] != b[i];
+        if (differs && !open) plainChanged++;
+        open = differs;
+    }
+    double plainBytes = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    start = std::chrono::steady_clock::now();
+    open = false;
+    for (size_t i = 0; i < size; i += 4) {
+        float x, y;
+        memcpy(&x, &a[i], 4);
+        memcpy(&y, &b[i], 4);
+        if (y > x && !open) plainIncreased++;
+        open = y > x;
+    }
+    double plainFloats = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Check(changed == plainChanged && increased == plainIncreased && changed > 3000, "benchmark diffs agree");
+    printf("%zu MB, %zu changed runs: DiffBytes %.2f GB/s (loop %.2f GB/s), DiffFloats %.2f GB/s (loop %.2f GB/s)\n",
+        size >> 20, changed, size / bytes / 1e9, size / plainBytes / 1e9, size / floats / 1e9, size / plainFloats / 1e9);
+}
+
+int main() {
+    TestBytes();
+    TestFloats();
+    Benchmark();
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
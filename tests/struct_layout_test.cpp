@@ -0,0 +1,246 @@
+// Memory.DefineStruct: fields, arrays and mirrors read and written through Lua, gaps and
+// fields left out of a write untouched, unreadable structs and malformed definitions. Then
+// reading and writing a twelve-field struct from Lua with layout:Read and layout:Write against
+// one Memory.ReadMemory or Memory.WriteMemory call per field.
+#include "struct_layout.h"
+#include <chrono>
+#include <cstdio>
+#include <sys/mman.h>
+
+ProcMapsRegionSource regionSource;
+ProtectionCache protectionCache(regionSource);
+
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    return SignalGuardedCopy(dst, src, size);
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+// The loader's protector: pages the cache knows to be writable aren't touched
+struct CachedProtector : MprotectProtector {
+    bool Unprotect(uintptr_t page, size_t size, uint32_t& oldProtect) override {
+        if (protectionCache.IsWritable(page, size)) {
+            oldProtect = 0;
+            return true;
+        }
+        return MprotectProtector::Unprotect(page, size, oldProtect);
+    }
+};
+
+static CachedProtector protector;
+
+bool SubmitWrites(lua_State*, WriteBatch& batch) {
+    return batch.Apply(protector);
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Memory.ReadMemory and Memory.WriteMemory as the loader answers them outside a transaction
+static int lua_ReadMemory(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    size_t size = (size_t)luaL_checkinteger(L, 2);
+    uint64_t value = 0;
+    if (size <= sizeof(value) && ReadBlock(address, &value, size)) {
+        lua_pushinteger(L, (lua_Integer)value);
+    }
+    else {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+static int lua_WriteMemory(lua_State* L) {
+    uintptr_t address = (uintptr_t)luaL_checkinteger(L, 1);
+    uint64_t value = (uint64_t)luaL_checkinteger(L, 2);
+    size_t size = (size_t)luaL_checkinteger(L, 3);
+    luaL_argcheck(L, size <= sizeof(value), 3, "size too large");
+    bool written = protectionCache.IsWritable(address, size) && GuardedCopy((void*)address, &value, size);
+    lua_pushboolean(L, written);
+    return 1;
+}
+
+static bool Run(lua_State* L, const char* code) {
+    if (luaL_dostring(L, code) == LUA_OK) return true;
+    printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_pop(L, 1);
+    return false;
+}
+
+static void CheckLua(lua_State* L, const char* code, const char* what) {
+    bool ok = luaL_dostring(L, code) == LUA_OK && lua_toboolean(L, -1);
+    if (!ok && lua_type(L, -1) == LUA_TSTRING) printf("Lua: %s\n", lua_tostring(L, -1));
+    lua_settop(L, 0);
+    Check(ok, what);
+}
+
+struct Player {
+    int32_t health;         // 0x00
+    int32_t mana;           // 0x04
+    int32_t maxHealth;      // 0x08, mirrored at 0x90
+    uint8_t gap1[4];
+    float position[3];      // 0x10
+    uint8_t gap2[0x24];
+    uint8_t level;          // 0x40, more than structReadGap after position
+    uint8_t gap3[0x3F];
+    uint16_t id;            // 0x80
+    uint8_t gap4[0xE];
+    int32_t maxHealthCopy;  // 0x90
+};
+
+static void TestStruct(lua_State* L) {
+    Player player;
+    memset(&player, 0xEE, sizeof(player));
+    player.health = 100;
+    player.mana = -5;
+    player.maxHealth = 150;
+    player.position[0] = 1.5f;
+    player.position[1] = -2.0f;
+    player.position[2] = 1e6f;
+    player.level = 42;
+    player.id = 0xBEEF;
+    player.maxHealthCopy = 150;
+    lua_pushinteger(L, (lua_Integer)(uintptr_t)&player);
+    lua_setglobal(L, "player");
+
+    Run(L, R"(
+        Player = Memory.DefineStruct("Player", {
+            { name = "health", offset = 0x00, type = "i32" },
+            { name = "mana", offset = 0x04, type = "int" },
+            { name = "maxHealth", offset = 0x08, type = "i32", mirrors = { 0x90 } },
+            { name = "position", offset = 0x10, type = "float", count = 3 },
+            { name = "level", offset = 0x40, type = "u8" },
+            { name = "id", offset = 0x80, type = "u16" },
+        })
+    )");
+    CheckLua(L, R"(
+        local p = Player:Read(player)
+        return p.health == 100 and p.mana == -5 and p.maxHealth == 150 and p.position[1] == 1.5 and
+            p.position[2] == -2 and p.position[3] == 1e6 and #p.position == 3 and p.level == 42 and p.id == 0xBEEF and
+            Player:Size() == 0x94 and tostring(Player) == 'struct Player (6 fields)'
+    )", "fields and arrays read");
+    CheckLua(L, R"(
+        local p = Player:Read(player)
+        local position = p.position
+        return Player:Read(player, p) == p and p.position == position
+    )", "into reuses the table and its arrays");
+
+    CheckLua(L, R"(
+        return Player:Write(player, { health = 90, mana = 7, maxHealth = 200, position = { 3, 4, 5 }, level = 43, id = 1 })
+    )", "full write");
+    bool gapsKept = true;
+    for (size_t i = 0; i < sizeof(player.gap1); i++) gapsKept = gapsKept && player.gap1[i] == 0xEE;
+    for (size_t i = 0; i < sizeof(player.gap2); i++) gapsKept = gapsKept && player.gap2[i] == 0xEE;
+    for (size_t i = 0; i < sizeof(player.gap4); i++) gapsKept = gapsKept && player.gap4[i] == 0xEE;
+    Check(player.health == 90 && player.mana == 7 && player.maxHealth == 200 && player.position[1] == 4.0f &&
+        player.level == 43 && player.id == 1, "full write lands");
+    Check(player.maxHealthCopy == 200, "mirror written");
+    Check(gapsKept, "bytes between fields untouched");
+
+    // The game changes fields between our read and a partial write
+    CheckLua(L, "last = Player:Read(player) return last ~= nil", "read before a partial write");
+    player.mana = 55;
+    player.position[2] = 9.0f;
+    player.id = 77;
+    CheckLua(L, "return Player:Write(player, { health = 1, maxHealth = 300 })", "partial write");
+    Check(player.health == 1 && player.maxHealth == 300 && player.maxHealthCopy == 300, "partial write lands, with its mirror");
+    Check(player.mana == 55 && player.position[2] == 9.0f && player.id == 77, "fields left out keep the game's values");
+
+    CheckLua(L, "return Player:Read(0) == nil and Player:Read(8) == nil", "unreadable struct");
+    CheckLua(L, "return not pcall(Memory.DefineStruct, 'Empty', {})", "no fields");
+    CheckLua(L, "return not pcall(Memory.DefineStruct, 'Bad', { { name = 'x', offset = 0, type = 'i128' } })", "unknown type");
+    CheckLua(L, "return not pcall(Memory.DefineStruct, 'Bad', { { name = 'x', offset = -4, type = 'i32' } })", "negative offset");
+    CheckLua(L, "return not pcall(Memory.DefineStruct, 'Bad', { { name = 'x', offset = 0, type = 'i32', count = 0 } })", "empty array");
+    CheckLua(L, "return not pcall(Memory.DefineStruct, 'Bad', { { offset = 0, type = 'i32' } })", "unnamed field");
+}
+
+static void Benchmark(lua_State* L) {
+    int32_t fields[12];
+    for (int i = 0; i < 12; i++) fields[i] = i + 1;
+    lua_pushinteger(L, (lua_Integer)(uintptr_t)fields);
+    lua_setglobal(L, "fields");
+    Run(L, R"(
+        local definition = {}
+        names = {}
+        for i = 1, 12 do
+            names[i] = "field" .. i
+            definition[i] = { name = names[i], offset = (i - 1) * 4, type = "i32" }
+        end
+        Fields = Memory.DefineStruct("Fields", definition)
+
+        function ReadStruct(n)
+            local sum, into = 0, nil
+            for _ = 1, n do
+                into = Fields:Read(fields, into)
+                sum = sum + into.field12
+            end
+            return sum
+        end
+        function ReadPerField(n)
+            local sum, into = 0, {}
+            for _ = 1, n do
+                for i = 1, 12 do into[names[i]] = Memory.ReadMemory(fields + (i - 1) * 4, 4) end
+                sum = sum + into.field12
+            end
+            return sum
+        end
+        function WriteStruct(n)
+            local values = {}
+            for i = 1, 12 do values[names[i]] = i end
+            for _ = 1, n do Fields:Write(fields, values) end
+            return n * 12
+        end
+        function WritePerField(n)
+            for _ = 1, n do
+                for i = 1, 12 do Memory.WriteMemory(fields + (i - 1) * 4, i, 4) end
+            end
+            return n * 12
+        end
+    )");
+
+    const int structs = 50000;
+    const char* functions[] = { "ReadStruct", "ReadPerField", "WriteStruct", "WritePerField" };
+    double seconds[4];
+    for (int i = 0; i < 4; i++) {
+        auto start = std::chrono::steady_clock::now();
+        lua_getglobal(L, functions[i]);
+        lua_pushinteger(L, structs);
+        bool ok = lua_pcall(L, 1, 1, 0) == LUA_OK && lua_tointeger(L, -1) == 12LL * structs;
+        lua_settop(L, 0);
+        seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        Check(ok && fields[11] == 12, "benchmark results agree");
+    }
+    printf("Twelve i32 fields from Lua, per struct: Read %.2f us vs ReadMemory per field %.2f us (%.1fx), "
+        "Write %.2f us vs WriteMemory per field %.2f us (%.1fx)\n",
+        seconds[0] / structs * 1e6, seconds[1] / structs * 1e6, seconds[1] / seconds[0],
+        seconds[2] / structs * 1e6, seconds[3] / structs * 1e6, seconds[3] / seconds[2]);
+}
+
+int main() {
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    RegisterMemoryStruct(L);
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_DefineStruct);
+    lua_setfield(L, -2, "DefineStruct");
+    lua_pushcfunction(L, lua_ReadMemory);
+    lua_setfield(L, -2, "ReadMemory");
+    lua_pushcfunction(L, lua_WriteMemory);
+    lua_setfield(L, -2, "WriteMemory");
+    lua_setglobal(L, "Memory");
+
+    TestStruct(L);
+    Benchmark(L);
+    lua_close(L);
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,67 @@
+// ParseTrackDatabase on a synthetic database.bin image: records at uneven spacing, a name
+// longer than the field, an empty-name terminator and a stray ITMS tag after it.
+#include "track_database.h"
+#include <cstdio>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static size_t PutRecord(std::vector<uint8_t>& image, size_t at, const std::string& name) {
+    memcpy(&image[at], "ITMS", 4);
+    memcpy(&image[at + 4 + trackNameOffset], name.data(), name.size());
+    return at + 4;
+}
+
+int main() {
+    std::vector<uint8_t> image(64 * 1024, 0);
+    memcpy(&image[0], "SBDN", 4);
+    const uintptr_t base = 0x20000000;
+
+    std::vector<std::string> names;
+    std::vector<uintptr_t> addresses;
+    size_t at = 0x40;
+    for (int i = 0; i < 20; i++) {
+        names.push_back("Track " + std::to_string(i + 1));
+        addresses.push_back(base + PutRecord(image, at, names.back()));
+        at += 0x180 + (i * 37) % 0x90;  // Uneven record sizes
+    }
+    std::string longName(40, 'L');
+    addresses.push_back(base + PutRecord(image, at, longName));
+    names.push_back(longName.substr(0, trackNameLength));
+    at += 0x200;
+    PutRecord(image, at, "");         // Ends the list
+    PutRecord(image, at + 0x200, "After the end");
+
+    std::vector<TrackRecord> tracks;
+    ParseTrackDatabase(image.data(), image.size(), base, tracks);
+    Check(tracks.size() == names.size(), "every track up to the terminator");
+    for (size_t i = 0; i < tracks.size() && i < names.size(); i++) {
+        if (tracks[i].name != names[i] || tracks[i].address != addresses[i]) {
+            printf("FAIL: record %zu is \"%s\" at 0x%zx\n", i, tracks[i].name.c_str(), (size_t)tracks[i].address);
+            failures++;
+        }
+    }
+    Check(!tracks.empty() && tracks.back().name.size() == trackNameLength, "long name cut to the field");
+
+    // A name running into the end of the image is cut there
+    std::vector<uint8_t> truncated(image.begin(), image.begin() + (addresses[0] - base) + trackNameOffset + 3);
+    std::vector<TrackRecord> cut;
+    ParseTrackDatabase(truncated.data(), truncated.size(), base, cut);
+    Check(cut.size() == 1 && cut[0].name == "Tra", "name cut at the end of the image");
+
+    // No records, and a tag too close to the end for its name
+    std::vector<uint8_t> empty(0x30, 0);
+    memcpy(&empty[0], "SBDN", 4);
+    memcpy(&empty[0x10], "ITMS", 4);
+    std::vector<TrackRecord> none;
+    Check(ParseTrackDatabase(empty.data(), empty.size(), base, none) == 0, "tag without room for a name");
+
+    printf("%zu tracks\n%s\n", tracks.size(), failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
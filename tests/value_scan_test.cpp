@@ -0,0 +1,301 @@
+// Value scans over a synthetic heap: exact, range and unknown first scans, narrowing with
+// changed, unchanged, increased and decreased, each against a plain map of candidates. Also
+// the switch between bitmap and varint candidate storage, values straddling the pool's block
+// boundaries, a region freed between scans, and the 256 MB cap on unknown scans.
+#include "value_scan.h"
+#include <cstdio>
+#include <map>
+#include <random>
+#include <sys/uio.h>
+#include <unistd.h>
+
+ScanStats scanStats;
+ProcMapsRegionSource regionSource;
+ProtectionCache protectionCache(regionSource);
+static std::vector<AddressRange> writableRegions;
+
+// Reads through the kernel, so memory unmapped under the scan fails instead of faulting
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    iovec local = { dst, size }, remote = { const_cast<void*>(src), size };
+    return process_vm_readv(getpid(), &local, 1, &remote, 1, 0) == (ssize_t)size;
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+ScanThreadPool& GetScanThreadPool() {
+    static ScanThreadPool* pool = new ScanThreadPool(2);
+    return *pool;
+}
+
+std::vector<AddressRange> CommittedRegions(bool) {
+    return writableRegions;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// Every candidate of the scan with its value at the last scan
+template<typename T>
+static std::map<uintptr_t, T> Candidates(const ValueScan& scan) {
+    std::map<uintptr_t, T> found;
+    for (const auto& block : scan.blocks) {
+        ForEachCandidate(block, [&](size_t slot, size_t n) {
+            T value;
+            memcpy(&value, block.values.data() + n * sizeof(T), sizeof(T));
+            found[block.base + slot * scanSlotStride] = value;
+        });
+    }
+    return found;
+}
+
+// What the scan should hold: every aligned slot whose value fits, then narrowed one by one
+template<typename T>
+struct Model {
+    std::map<uintptr_t, T> candidates;
+
+    void First(uintptr_t start, uintptr_t end, const ScanCondition& condition) {
+        candidates.clear();
+        for (uintptr_t address = start; address + sizeof(T) <= end; address += scanSlotStride) {
+            T value;
+            memcpy(&value, (const void*)address, sizeof(T));
+            if (MatchesCondition(condition, value, value)) candidates[address] = value;
+        }
+    }
+
+    void Next(const ScanCondition& condition) {
+        for (auto it = candidates.begin(); it != candidates.end(); ) {
+            T value;
+            memcpy(&value, (const void*)it->first, sizeof(T));
+            if (MatchesCondition(condition, value, it->second)) {
+                it->second = value;
+                ++it;
+            }
+            else {
+                it = candidates.erase(it);
+            }
+        }
+    }
+};
+
+template<typename T>
+static bool SameCandidates(const ValueScan& scan, const Model<T>& model) {
+    std::map<uintptr_t, T> found = Candidates<T>(scan);
+    return found.size() == model.candidates.size() && CountCandidates(scan) == found.size() &&
+        std::equal(found.begin(), found.end(), model.candidates.begin(), [](const auto& a, const auto& b) {
+            return a.first == b.first && !memcmp(&a.second, &b.second, sizeof(T));
+        });
+}
+
+static bool AnyDense(const ValueScan& scan) {
+    for (const auto& block : scan.blocks) {
+        if (block.dense) return true;
+    }
+    return false;
+}
+
+static ScanCondition Condition(ScanCompare compare, double low = 0, double high = 0) {
+    ScanCondition condition;
+    condition.compare = compare;
+    condition.low = low;
+    condition.high = compare == ScanCompare::Range ? high : low;
+    return condition;
+}
+
+// The heap: several pool blocks of small random integers, so exact values repeat
+static const size_t heapSize = 5 * scanChunkSize + 0x3000;
+static uint8_t* heap = nullptr;
+
+static void FillHeap(uint32_t seed) {
+    std::mt19937 random(seed);
+    for (size_t i = 0; i < heapSize; i += 4) {
+        int32_t value = (int32_t)(random() % 5000);
+        memcpy(heap + i, &value, 4);
+    }
+}
+
+template<typename T>
+static void Put(size_t offset, T value) {
+    memcpy(heap + offset, &value, sizeof(T));
+}
+
+static void TestExact() {
+    FillHeap(1);
+    // Planted values: clustered, sparse, either side of a block boundary, and the last slot
+    const int32_t target = 123456789;
+    std::vector<size_t> planted = { 0, 4, 8, 12, 16, 0x1000, scanChunkSize - 4, scanChunkSize, 3 * scanChunkSize + 8,
+        heapSize - 4 };
+    for (size_t offset : planted) Put(offset, target);
+    Put(101, target);  // Unaligned, not a slot
+
+    ValueScan scan;
+    std::string error;
+    Model<int32_t> model;
+    ScanCondition exact = Condition(ScanCompare::Exact, target);
+    Check(RunValueScan(scan, exact, true, error), "exact first scan");
+    model.First((uintptr_t)heap, (uintptr_t)heap + heapSize, exact);
+    Check(model.candidates.size() == planted.size() && SameCandidates(scan, model), "exact finds every planted slot");
+    Check(scan.blocks.size() == 4, "blocks without candidates are dropped");
+
+    // Two of them change
+    Put(0x1000, target + 5);
+    Put(heapSize - 4, 7);
+    model.Next(Condition(ScanCompare::Unchanged));
+    Check(RunValueScan(scan, Condition(ScanCompare::Unchanged), false, error) && SameCandidates(scan, model) &&
+        CountCandidates(scan) == planted.size() - 2, "unchanged drops the two that moved");
+    Check(RunValueScan(scan, Condition(ScanCompare::Exact, 7), false, error) && CountCandidates(scan) == 0,
+        "changed values are gone for good");
+}
+
+static void TestRange() {
+    std::mt19937 random(2);
+    for (size_t i = 0; i < heapSize; i += 4) Put(i, (float)(random() % 100000) / 7.0f);
+    ValueScan scan;
+    scan.type = ScanValueType::F32;
+    std::string error;
+    Model<float> model;
+    ScanCondition range = Condition(ScanCompare::Range, 1000.5, 1010.25);
+    Check(RunValueScan(scan, range, true, error), "range first scan");
+    model.First((uintptr_t)heap, (uintptr_t)heap + heapSize, range);
+    Check(!model.candidates.empty() && SameCandidates(scan, model), "range matches the model");
+
+    // Half go up, a quarter go down, the rest stay
+    size_t i = 0;
+    for (const auto& candidate : model.candidates) {
+        float value = candidate.second + (i % 4 == 0 ? -1.0f : i % 2 == 0 ? 0.0f : 2.5f);
+        memcpy((void*)candidate.first, &value, sizeof(value));
+        i++;
+    }
+    Model<float> increased = model, decreased = model, changed = model;
+    increased.Next(Condition(ScanCompare::Increased));
+    decreased.Next(Condition(ScanCompare::Decreased));
+    changed.Next(Condition(ScanCompare::Changed));
+    Check(increased.candidates.size() == model.candidates.size() / 2 &&
+        changed.candidates.size() == increased.candidates.size() + decreased.candidates.size(), "model split");
+
+    ValueScan up = scan, down = scan, moved = scan;
+    Check(RunValueScan(up, Condition(ScanCompare::Increased), false, error) && SameCandidates(up, increased), "increased");
+    Check(RunValueScan(down, Condition(ScanCompare::Decreased), false, error) && SameCandidates(down, decreased), "decreased");
+    Check(RunValueScan(moved, Condition(ScanCompare::Changed), false, error) && SameCandidates(moved, changed), "changed");
+    // Values are those of the last scan, so nothing changed since
+    Check(RunValueScan(moved, Condition(ScanCompare::Changed), false, error) && CountCandidates(moved) == 0,
+        "changed compares against the last scan");
+}
+
+static void TestUnknown() {
+    FillHeap(3);
+    // Blocks split the range a megabyte from its start; a double straddling that boundary is
+    // still a candidate, once
+    uintptr_t start = (uintptr_t)heap + 0x1000;
+    uintptr_t end = start + scanChunkSize + 0x4000;
+    Put(0x1000 + scanChunkSize - 4, 1.5);
+    ValueScan scan;
+    scan.type = ScanValueType::F64;
+    scan.ranges.push_back({ start, end });
+    std::string error;
+    Model<double> model;
+    Check(RunValueScan(scan, Condition(ScanCompare::Unknown), true, error), "unknown first scan");
+    model.First(start, end, Condition(ScanCompare::Unknown));
+    Check(CountCandidates(scan) == (end - start - 8) / 4 + 1 && SameCandidates(scan, model), "every slot is a candidate");
+    Check(scan.blocks.size() == 2 && scan.blocks[0].dense && scan.blocks[1].dense, "all slots kept as bitmaps");
+    Check(Candidates<double>(scan)[start + scanChunkSize - 4] == 1.5, "value across the block boundary");
+
+    // Nothing moved: unchanged keeps everything
+    Check(RunValueScan(scan, Condition(ScanCompare::Unchanged), false, error) && SameCandidates(scan, model),
+        "unchanged keeps every slot");
+
+    // Touch a sparse few: changed narrows to the slots overlapping them, stored as gaps
+    for (size_t offset = 0x1000; offset < 0x1000 + scanChunkSize + 0x4000; offset += 0x2340) {
+        Put(offset, (int32_t)-1);
+    }
+    model.Next(Condition(ScanCompare::Changed));
+    Check(RunValueScan(scan, Condition(ScanCompare::Changed), false, error) && SameCandidates(scan, model),
+        "changed narrows the unknown scan");
+    Check(!model.candidates.empty() && !AnyDense(scan), "few candidates kept as varint gaps");
+}
+
+static void TestEncoding() {
+    // 1024 slots: the bitmap is 128 bytes, so 127 one-byte gaps stay varints and 128 don't
+    CandidateBlock block;
+    block.slots = 1024;
+    std::vector<uint32_t> found;
+    for (uint32_t slot = 0; slot < 127; slot++) found.push_back(slot * 8);
+    StoreCandidates(block, found);
+    Check(!block.dense && block.deltas.size() == 127 && block.count == 127, "127 candidates as gaps");
+    found.push_back(127 * 8);
+    StoreCandidates(block, found);
+    Check(block.dense && block.deltas.empty() && block.bits.size() == 32 && block.count == 128, "128 candidates as a bitmap");
+
+    // Gaps of one to four varint bytes, and slot 0
+    CandidateBlock wide;
+    wide.slots = 1 << 22;
+    std::vector<uint32_t> spread = { 0, 1, 200, 20000, 3000000, 3000001, (1 << 22) - 1 };
+    StoreCandidates(wide, spread);
+    Check(!wide.dense && wide.deltas.size() == 1 + 1 + 2 + 3 + 4 + 1 + 3, "multi-byte gaps");
+
+    for (CandidateBlock* b : { &block, &wide }) {
+        const std::vector<uint32_t>& expected = b == &block ? found : spread;
+        std::vector<uint32_t> slots;
+        ForEachCandidate(*b, [&](size_t slot, size_t n) { if (n == slots.size()) slots.push_back((uint32_t)slot); });
+        Check(slots == expected, b->dense ? "bitmap decodes in slot order" : "gaps decode in slot order");
+    }
+
+    StoreCandidates(block, {});
+    Check(!block.dense && block.count == 0 && block.deltas.empty(), "no candidates");
+}
+
+static void TestFreed() {
+    FillHeap(4);
+    Put(0x100, (int32_t)777777);
+    Put(2 * scanChunkSize + 0x100, (int32_t)777777);
+    ValueScan scan;
+    std::string error;
+    Check(RunValueScan(scan, Condition(ScanCompare::Exact, 777777), true, error) && CountCandidates(scan) == 2,
+        "two candidates before the free");
+    munmap(heap + 2 * scanChunkSize, scanChunkSize);
+    Check(RunValueScan(scan, Condition(ScanCompare::Unchanged), false, error) && CountCandidates(scan) == 1 &&
+        Candidates<int32_t>(scan).count((uintptr_t)heap + 0x100), "freed block loses its candidates");
+    mmap(heap + 2 * scanChunkSize, scanChunkSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+}
+
+static void TestCap() {
+    // Never touched: the cap is checked before any memory is read
+    std::vector<AddressRange> saved = writableRegions;
+    writableRegions = { { 0x40000000, 0x40000000 + (300u << 20) } };
+    ValueScan scan;
+    std::string error;
+    Check(!RunValueScan(scan, Condition(ScanCompare::Unknown), true, error) && !scan.started && scan.blocks.empty(),
+        "unknown scan over 300 MB refused");
+    Check(error.find("MB of values") != std::string::npos, "refusal says why");
+
+    // With a range inside the cap it runs
+    writableRegions = saved;
+    scan.ranges.push_back({ (uintptr_t)heap, (uintptr_t)heap + 0x10000 });
+    error.clear();
+    Check(RunValueScan(scan, Condition(ScanCompare::Unknown), true, error) && scan.started && error.empty(),
+        "unknown scan with a range");
+
+    writableRegions = saved;
+}
+
+int main() {
+    heap = (uint8_t*)mmap(nullptr, heapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    writableRegions = { { (uintptr_t)heap, (uintptr_t)heap + heapSize } };
+    TestExact();
+    TestRange();
+    TestUnknown();
+    TestEncoding();
+    TestFreed();
+    TestCap();
+    munmap(heap, heapSize);
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
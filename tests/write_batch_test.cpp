@@ -0,0 +1,78 @@
+// WriteBatch against the mprotect backend: writes that span read-only pages land, each
+// page is unprotected once and gets its old protection back.
+#include "page_protection.h"
+#include <cstdio>
+#include <cstring>
+
+bool GuardedCopy(void* dst, const void* src, size_t size) {
+    memcpy(dst, src, size);
+    return true;
+}
+
+bool GuardedFill(void* dst, uint8_t value, size_t size) {
+    memset(dst, value, size);
+    return true;
+}
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static uint32_t ProtectionOf(uintptr_t address) {
+    uintptr_t start, end;
+    uint32_t protect = 0;
+    ProcMapsRegionSource().Query(address, start, end, protect);
+    return protect;
+}
+
+int main() {
+    const size_t pages = 4;
+    uint8_t* base = (uint8_t*)mmap(nullptr, pages * pageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    Check(base != MAP_FAILED, "mmap");
+    memset(base, 0x11, pages * pageSize);
+    // Pages 1 and 2 read-only, page 3 read+exec, page 0 stays writable
+    mprotect(base + pageSize, 2 * pageSize, PROT_READ);
+    mprotect(base + 3 * pageSize, pageSize, PROT_READ | PROT_EXEC);
+
+    WriteBatch batch;
+    const char text[] = "crosses a page boundary";
+    uintptr_t straddle = (uintptr_t)base + 2 * pageSize - 8;
+    batch.Add(straddle, text, sizeof(text));
+    batch.AddFill((uintptr_t)base + 16, 0xAB, 32);
+    batch.AddFill((uintptr_t)base + 3 * pageSize + 100, 0xCD, 8);
+    uint32_t value = 0xDEADBEEF;
+    batch.Add((uintptr_t)base + pageSize + 4, &value, sizeof(value));
+    batch.Add((uintptr_t)base + pageSize + 4, &value, 2);  // Later writes win in order
+
+    MprotectProtector protector;
+    Check(batch.Apply(protector), "apply");
+    Check(memcmp((void*)straddle, text, sizeof(text)) == 0, "straddling write");
+    Check(base[16] == 0xAB && base[47] == 0xAB && base[48] == 0x11, "fill on writable page");
+    Check(base[3 * pageSize + 100] == 0xCD && base[3 * pageSize + 108] == 0x11, "fill on exec page");
+    uint32_t read;
+    memcpy(&read, base + pageSize + 4, 4);
+    Check(read == 0xDEADBEEF, "dword write");
+    Check(protector.unprotectCalls == 3, "one unprotect per read-only page");
+    Check(ProtectionOf((uintptr_t)base) == (PROT_READ | PROT_WRITE), "page 0 untouched");
+    Check(ProtectionOf((uintptr_t)base + pageSize) == PROT_READ, "page 1 restored");
+    Check(ProtectionOf((uintptr_t)base + 2 * pageSize) == PROT_READ, "page 2 restored");
+    Check(ProtectionOf((uintptr_t)base + 3 * pageSize) == (PROT_READ | PROT_EXEC), "page 3 restored");
+
+    // An unmapped page fails the batch without touching the others
+    munmap(base + 2 * pageSize, pageSize);
+    WriteBatch partial;
+    partial.AddFill((uintptr_t)base + 2 * pageSize + 1, 0xEE, 4);
+    partial.AddFill((uintptr_t)base + pageSize + 100, 0xEE, 4);
+    MprotectProtector second;
+    Check(!partial.Apply(second), "unmapped page reported");
+    Check(base[pageSize + 100] == 0xEE, "mapped page still written");
+    Check(ProtectionOf((uintptr_t)base + pageSize) == PROT_READ, "page 1 restored again");
+
+    printf("%s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+// Parsing of the database.bin track records, on a copy of the image so it also builds on
+// Linux. Finding and copying the live database stays in main.cpp.
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "byte_pattern.h"
+
+constexpr size_t trackSearchBack = 500000;     // How far before the anchor SBDN may start
+constexpr size_t trackDatabaseSpan = 5000000;  // ITMS tags are looked for this far after SBDN
+constexpr size_t trackNameOffset = 0x20;
+constexpr size_t trackNameLength = 31;
+
+struct TrackRecord {
+    std::string name;
+    uintptr_t address;  // Just after the ITMS tag
+};
+
+// Walks the ITMS records of a database image that starts with its SBDN signature and is
+// mapped at base. Stops at the first record with an empty name, which ends the track list.
+inline size_t ParseTrackDatabase(const uint8_t* data, size_t size, uintptr_t base, std::vector<TrackRecord>& tracks) {
+    BytePattern itms;
+    ParsePattern("49 54 4D 53", itms);
+    size_t limit = std::min(size, trackDatabaseSpan + itms.bytes.size() - 1);
+
+    for (size_t position = 4; position < limit; ) {
+        size_t offset = ScanPattern(data + position, limit - position, itms, false);
+        if (offset == SIZE_MAX) break;
+        position += offset;
+
+        size_t nameAt = position + itms.bytes.size() + trackNameOffset;
+        if (nameAt >= size) break;
+        size_t length = strnlen((const char*)data + nameAt, std::min(trackNameLength, size - nameAt));
+        if (length == 0) break;
+
+        tracks.push_back({ std::string((const char*)data + nameAt, length), base + position + itms.bytes.size() });
+        position += itms.bytes.size();
+    }
+    return tracks.size();
+}
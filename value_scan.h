@@ -0,0 +1,345 @@
+#pragma once
+
+// Value scanning, kept free of Windows headers so it also builds on Linux. A first scan over
+// writable memory is followed by narrowing scans, like a cheat table. Memory is split into
+// blocks that are scanned independently on the pool. Each block keeps its candidates either
+// as a bitmap over its 4-byte aligned slots or, when fewer, as varint gaps between slot
+// numbers, plus the value each candidate had at the last scan.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <emmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#include "page_protection.h"
+#include "scan_thread_pool.h"
+
+// Supplied by main.cpp, or by the test harness
+extern ProtectionCache protectionCache;
+ScanThreadPool& GetScanThreadPool();
+std::vector<AddressRange> CommittedRegions(bool writableOnly);
+
+enum class ScanValueType { I32, F32, F64 };
+enum class ScanCompare { Exact, Range, Unknown, Changed, Unchanged, Increased, Decreased };
+
+constexpr size_t scanSlotStride = 4;
+// An "unknown" first scan keeps a value for every slot, i.e. a copy of the memory it covers.
+// Scans that would need more than this are refused up front.
+constexpr size_t maxValueScanBytes = 256 * 1024 * 1024;
+
+struct ScanCondition {
+    ScanCompare compare;
+    double low = 0;  // The value for Exact
+    double high = 0;
+};
+
+struct CandidateBlock {
+    uintptr_t base = 0;     // Address of slot 0
+    size_t slots = 0;
+    size_t count = 0;
+    bool dense = false;     // bits holds one bit per slot; otherwise deltas holds the gaps
+    std::vector<uint32_t> bits;
+    std::vector<uint8_t> deltas;
+    std::vector<uint8_t> values;    // Value of each candidate at the last scan, in slot order
+};
+
+struct ValueScan {
+    ScanValueType type = ScanValueType::I32;
+    std::vector<AddressRange> ranges;  // Empty means all writable memory
+    std::vector<CandidateBlock> blocks;
+    bool started = false;
+    double seconds = 0;
+};
+
+inline unsigned LowestSetBit(uint32_t value) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(value);
+#endif
+}
+
+inline size_t ScanValueSize(ScanValueType type) {
+    return type == ScanValueType::F64 ? 8 : 4;
+}
+
+// Calls visit(slot, n) for the n-th candidate of the block, in slot order
+template<typename Visit>
+void ForEachCandidate(const CandidateBlock& block, Visit visit) {
+    size_t n = 0;
+    if (block.dense) {
+        for (size_t word = 0; word < block.bits.size(); word++) {
+            for (uint32_t bits = block.bits[word]; bits; bits &= bits - 1) {
+                visit(word * 32 + LowestSetBit(bits), n++);
+            }
+        }
+        return;
+    }
+    size_t slot = 0;
+    for (size_t i = 0; i < block.deltas.size(); ) {
+        size_t gap = 0;
+        for (unsigned shift = 0; ; shift += 7) {
+            uint8_t b = block.deltas[i++];
+            gap |= (size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) break;
+        }
+        slot += gap;
+        visit(slot, n++);
+    }
+}
+
+// Replaces the block's candidates with found (ascending slots), picking the smaller encoding
+inline void StoreCandidates(CandidateBlock& block, const std::vector<uint32_t>& found) {
+    block.count = found.size();
+    block.bits.clear();
+    block.deltas.clear();
+    size_t bitmapBytes = (block.slots + 31) / 32 * sizeof(uint32_t);
+
+    size_t previous = 0;
+    block.dense = false;
+    for (uint32_t slot : found) {
+        size_t gap = slot - previous;
+        previous = slot;
+        while (gap >= 0x80) {
+            block.deltas.push_back((uint8_t)(gap | 0x80));
+            gap >>= 7;
+        }
+        block.deltas.push_back((uint8_t)gap);
+        if (block.deltas.size() >= bitmapBytes) {
+            block.dense = true;
+            break;
+        }
+    }
+
+    if (block.dense) {
+        std::vector<uint8_t>().swap(block.deltas);
+        block.bits.assign((block.slots + 31) / 32, 0);
+        for (uint32_t slot : found) block.bits[slot / 32] |= 1u << (slot % 32);
+    }
+    else {
+        block.deltas.shrink_to_fit();
+    }
+    block.values.shrink_to_fit();
+}
+
+template<typename T>
+bool MatchesCondition(const ScanCondition& condition, T value, T previous) {
+    switch (condition.compare) {
+    case ScanCompare::Exact: return value == (T)condition.low;
+    case ScanCompare::Range: return value >= (T)condition.low && value <= (T)condition.high;
+    case ScanCompare::Unknown: return true;
+    case ScanCompare::Changed: return memcmp(&value, &previous, sizeof(T)) != 0;
+    case ScanCompare::Unchanged: return memcmp(&value, &previous, sizeof(T)) == 0;
+    case ScanCompare::Increased: return value > previous;
+    case ScanCompare::Decreased: return value < previous;
+    }
+    return false;
+}
+
+// Bit i is set when 4-byte slot i of the 16 bytes at p equals the exact value, so the first
+// scan steps over four slots with one compare
+template<typename T>
+unsigned ExactPrefilter(const uint8_t* p, const ScanCondition& condition) {
+    if (std::is_same<T, int32_t>::value) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        return (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, _mm_set1_epi32((int32_t)condition.low))));
+    }
+    if (std::is_same<T, float>::value) {
+        return (unsigned)_mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps((const float*)p), _mm_set1_ps((float)condition.low)));
+    }
+    return 0xF;
+}
+
+// data holds the block's memory from block.base on, with room for a whole value at every slot
+template<typename T>
+void FirstScanBlock(const uint8_t* data, CandidateBlock& block, const ScanCondition& condition, std::vector<uint32_t>& found) {
+    found.clear();
+    block.values.clear();
+    if (condition.compare == ScanCompare::Unknown) {
+        found.reserve(block.slots);
+        block.values.reserve(block.slots * sizeof(T));
+    }
+    size_t slot = 0;
+    if (condition.compare == ScanCompare::Exact && sizeof(T) == scanSlotStride) {
+        for (; slot + 4 <= block.slots; slot += 4) {
+            unsigned mask = ExactPrefilter<T>(data + slot * scanSlotStride, condition);
+            for (; mask; mask &= mask - 1) {
+                size_t candidate = slot + LowestSetBit(mask);
+                T value;
+                memcpy(&value, data + candidate * scanSlotStride, sizeof(T));
+                found.push_back((uint32_t)candidate);
+                block.values.insert(block.values.end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(T));
+            }
+        }
+    }
+    for (; slot < block.slots; slot++) {
+        T value;
+        memcpy(&value, data + slot * scanSlotStride, sizeof(T));
+        if (!MatchesCondition(condition, value, value)) continue;
+        found.push_back((uint32_t)slot);
+        block.values.insert(block.values.end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(T));
+    }
+    StoreCandidates(block, found);
+}
+
+// data holds the block's memory from slot first on
+template<typename T>
+void NextScanBlock(const uint8_t* data, size_t first, CandidateBlock& block, const ScanCondition& condition,
+    std::vector<uint32_t>& found, std::vector<uint8_t>& values) {
+    found.clear();
+    values.clear();
+    ForEachCandidate(block, [&](size_t slot, size_t n) {
+        T value, previous;
+        memcpy(&value, data + (slot - first) * scanSlotStride, sizeof(T));
+        memcpy(&previous, block.values.data() + n * sizeof(T), sizeof(T));
+        if (!MatchesCondition(condition, value, previous)) return;
+        found.push_back((uint32_t)slot);
+        values.insert(values.end(), (const uint8_t*)&value, (const uint8_t*)&value + sizeof(T));
+    });
+    block.values.swap(values);
+    StoreCandidates(block, found);
+}
+
+inline size_t FirstCandidateSlot(const CandidateBlock& block) {
+    size_t first = SIZE_MAX;
+    ForEachCandidate(block, [&](size_t slot, size_t) { if (first == SIZE_MAX) first = slot; });
+    return first;
+}
+
+// Frees everything a block holds, for blocks whose memory is gone or that ran out of memory
+inline void DropCandidates(CandidateBlock& block) {
+    block.count = 0;
+    block.dense = false;
+    std::vector<uint32_t>().swap(block.bits);
+    std::vector<uint8_t>().swap(block.deltas);
+    std::vector<uint8_t>().swap(block.values);
+}
+
+// Scratch reused by each pool thread across blocks
+inline thread_local std::vector<uint8_t> scanBlockBuffer;
+inline thread_local std::vector<uint32_t> scanFoundSlots;
+inline thread_local std::vector<uint8_t> scanFoundValues;
+
+template<typename T>
+void ScanBlock(CandidateBlock& block, const ScanCondition& condition, bool first) {
+    size_t firstSlot = 0, lastSlot = block.slots;
+    if (!first) {
+        if (block.count == 0) return;
+        firstSlot = FirstCandidateSlot(block);
+        ForEachCandidate(block, [&](size_t slot, size_t) { lastSlot = slot + 1; });
+    }
+
+    // One guarded copy per block, so a region freed since the last scan just loses its candidates
+    size_t bytes = (lastSlot - firstSlot - 1) * scanSlotStride + sizeof(T);
+    scanBlockBuffer.resize(bytes);
+    if (!GuardedCopy(scanBlockBuffer.data(), (const void*)(block.base + firstSlot * scanSlotStride), bytes)) {
+        protectionCache.Invalidate(block.base + firstSlot * scanSlotStride, bytes);
+        DropCandidates(block);
+        return;
+    }
+
+    if (first) {
+        FirstScanBlock<T>(scanBlockBuffer.data(), block, condition, scanFoundSlots);
+    }
+    else {
+        NextScanBlock<T>(scanBlockBuffer.data(), firstSlot, block, condition, scanFoundSlots, scanFoundValues);
+    }
+}
+
+// False with error set if the scan was refused or ran out of memory; the scan is then reset
+inline bool RunValueScan(ValueScan& scan, const ScanCondition& condition, bool first, std::string& error) {
+    auto started = std::chrono::steady_clock::now();
+    size_t valueSize = ScanValueSize(scan.type);
+
+    if (first) {
+        std::vector<AddressRange> runs;
+        if (scan.ranges.empty()) {
+            runs = CommittedRegions(true);
+        }
+        else {
+            std::vector<AddressRange> writable = CommittedRegions(true);
+            for (const auto& range : scan.ranges) {
+                for (const auto& region : writable) {
+                    uintptr_t start = std::max(range.start, region.start), end = std::min(range.end, region.end);
+                    if (start < end) runs.push_back({ start, end });
+                }
+            }
+        }
+
+        scan.blocks.clear();
+        for (const auto& chunk : SplitScanChunks(runs, valueSize - scanSlotStride)) {
+            CandidateBlock block;
+            block.base = (chunk.start + scanSlotStride - 1) & ~(uintptr_t)(scanSlotStride - 1);
+            // Every slot that starts in the owned part and whose value fits before end
+            if (block.base + valueSize > chunk.end || block.base >= chunk.ownedEnd) continue;
+            size_t owned = (chunk.ownedEnd - block.base + scanSlotStride - 1) / scanSlotStride;
+            size_t fits = (chunk.end - block.base - valueSize) / scanSlotStride + 1;
+            block.slots = std::min(owned, fits);
+            scan.blocks.push_back(std::move(block));
+        }
+
+        if (condition.compare == ScanCompare::Unknown) {
+            size_t needed = 0;
+            for (const auto& block : scan.blocks) needed += block.slots * valueSize + block.slots / 8;
+            if (needed > maxValueScanBytes) {
+                error = "unknown scan would keep " + std::to_string(needed >> 20) + " MB of values; give it a range";
+                scan.blocks.clear();
+                scan.started = false;
+                return false;
+            }
+        }
+    }
+
+    // An allocation failure on a pool thread would otherwise terminate the game
+    std::atomic<bool> outOfMemory{ false };
+    auto scanBlock = [&](size_t i) {
+        try {
+            switch (scan.type) {
+            case ScanValueType::I32: ScanBlock<int32_t>(scan.blocks[i], condition, first); break;
+            case ScanValueType::F32: ScanBlock<float>(scan.blocks[i], condition, first); break;
+            case ScanValueType::F64: ScanBlock<double>(scan.blocks[i], condition, first); break;
+            }
+        }
+        catch (const std::bad_alloc&) {
+            DropCandidates(scan.blocks[i]);
+            std::vector<uint8_t>().swap(scanBlockBuffer);
+            std::vector<uint32_t>().swap(scanFoundSlots);
+            std::vector<uint8_t>().swap(scanFoundValues);
+            outOfMemory = true;
+        }
+    };
+    if (scan.blocks.size() > 1) {
+        GetScanThreadPool().Run(scan.blocks.size(), scanBlock);
+    }
+    else if (!scan.blocks.empty()) {
+        scanBlock(0);
+    }
+
+    if (outOfMemory) {
+        error = "out of memory";
+        std::vector<CandidateBlock>().swap(scan.blocks);
+        scan.started = false;
+        return false;
+    }
+
+    // Blocks without candidates can never gain any again
+    scan.blocks.erase(std::remove_if(scan.blocks.begin(), scan.blocks.end(),
+        [](const CandidateBlock& block) { return block.count == 0; }), scan.blocks.end());
+    scan.started = true;
+    scan.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+    return true;
+}
+
+inline size_t CountCandidates(const ValueScan& scan) {
+    size_t count = 0;
+    for (const auto& block : scan.blocks) count += block.count;
+    return count;
+}